@@ -1,91 +1,639 @@
 #include "App.h"
+#include <limits.h>
 
 
 
 static T_ADC_state adc_state;
 static T_ADC_res   adc_res;
 
-signed short   smpls[MEAS_RES_ARR_SZ][TST_SMPLS_ARR_SZ];
-unsigned int   arr_pos;
+static T_meas_window  meas_acc;      // Окно измерений в котором накапливается статистика
+static T_meas_window  meas_win[2];   // Завершенные окна. Пока задача обрабатывает одно, накопление идет в другое
+static unsigned int   meas_win_indx; // Индекс последнего завершенного окна
+static unsigned int   meas_win_cycles = MEAS_WIN_CYCLES_DEF; // Заданное количество периодов генератора в окне
+static unsigned int   meas_last_cycle; // Номер периода генератора предыдущего кадра
 
 
+// Буфер кадров результатов ADC заполняемый каналами DMA.
+// Для каждого ADC свой массив кадров, в кадре результаты регистров RA и RB
+static unsigned short adc_dma_buf[ADC_DMA_CH_NUM][ADC_DMA_FRAMES][2];
+
+typedef struct
+{
+  T_3ph_pwm     pwm;    // Компараторы действующие в нижней точке кадра, т.е. во время выборки токов
+  unsigned int  cycle;  // Номер периода генератора отсчета по которому рассчитаны компараторы
+  unsigned int  phase;  // Фаза генератора этого отсчета
+  unsigned int  valid;  // Признак что значения записаны задачей Motor_ISR_task и еще не обработаны
+  unsigned int  bad;    // Флаги ADC_SMPL_BAD_A/B отсчетов токов взятых вне интервала открытого нижнего ключа
+} T_ADC_pwm_smpl;
+
+// Последовательность коммутации слота B у ADC0..ADC2.
+// adc_seq_ch  - номер канала преобразуемого в кадре
+// adc_seq_sc1 - значения SC1B записываемые DMA после переноса кадра, т.е. элемент fi настраивает кадр fi+1
+static unsigned char  adc_seq_ch[ADC_SEQ_CH_NUM][ADC_DMA_FRAMES];
+static unsigned int   adc_seq_sc1[ADC_SEQ_CH_NUM][ADC_DMA_FRAMES];
+
+// Каналы фазных токов ADC0..ADC2
+static const unsigned char adc_curr_ch[MEAS_CURR_NUM] = { SIG_II_W_CHANNEL, SIG_II_V_CHANNEL, SIG_II_U_CHANNEL };
+
+// Значения PWM записанные задачей Motor_ISR_task для каждого кадра
+static T_ADC_pwm_smpl adc_pwm_ring[ADC_DMA_FRAMES];
+
+static const unsigned int meas_harm_orders[MEAS_HARM_NUM] = MEAS_HARM_ORDERS;
+
 /*-------------------------------------------------------------------------------------------------------------
-  Обработчик прерывания PDB (Программируемой задержки синхронизирующей PWM и ADC)
-  Принимает результаты ADC
+  Подготовка окна измерений к накоплению статистики
 -------------------------------------------------------------------------------------------------------------*/
-static void PDB0_isr(pointer user_isr_ptr)
+static void ADC_meas_window_reset(T_meas_window *w)
 {
-  Led_control(LED2, 1);
-  PDB0_SC &= ~(BIT(7) + BIT(6));
-  PDB0_CH0S = 0;
-  PDB0_CH1S = 0;
-  PDB0_CH2S = 0;
-  PDB0_CH3S = 0;
-  PDB0_SC |= BIT(7);
+  unsigned int n;
+  unsigned int k;
 
-  adc_res.smpl_ii_w    = ADC0_RA;
-  adc_res.smpl_v_bus   = ADC0_RB;
-  adc_res.smpl_ii_v    = ADC1_RA;
-  adc_res.smpl_temper  = ADC1_RB;
-  adc_res.smpl_ii_u    = ADC2_RA;
-  adc_res.smpl_v_u     = ADC2_RB;
-  adc_res.smpl_15v     = ADC3_RA;
-  adc_res.smpl_5v      = ADC3_RB;
-  
-  // Фильтруем токи от постоянной составляющей
-  adc_res.ii_w = adc_res.smpl_ii_w - (adc_res.ii_w_offs >> 12);
-  adc_res.ii_w_offs += adc_res.ii_w;       
+  w->info.smpl_cnt = 0;
+  w->info.cycles   = 0;
+  w->info.sync     = 0;
+  for (n = 0; n < MEAS_RES_ARR_SZ; n++)
+  {
+    w->stat[n].maxv  = INT_MIN;
+    w->stat[n].minv  = INT_MAX;
+    w->stat[n].averv = 0;
+    w->stat[n].rmsv  = 0;
+    w->stat[n].cnt   = 0;
+  }
+  for (n = 0; n < MEAS_HARM_PH_NUM; n++)
+  {
+    for (k = 0; k < MEAS_HARM_NUM; k++)
+    {
+      w->harm_re[n][k] = 0;
+      w->harm_im[n][k] = 0;
+    }
+  }
+  w->pwr_p   = 0;
+  w->pwr_q   = 0;
+  w->pwr_cnt = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Добавление отсчета в статистику канала
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_meas_add_smpl(T_meas_stat *st, int v)
+{
+  if ( v > st->maxv ) st->maxv = v;
+  if ( v < st->minv ) st->minv = v;
+  st->averv += v;
+  st->rmsv  += v * v;
+  st->cnt++;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Накопление гармонических составляющих фазных токов
+  phase - фаза генератора к которой относится кадр
+
+  Это одна точка ДПФ на частоте каждой гармоники, то же что вычисляет фильтр Герцеля,
+  но опорный сигнал берется из фазы генератора. Поэтому бины следуют за частотой и при разгоне,
+  и нет накопления погрешности рекурсии, которое у фильтра Герцеля при f/fs порядка 1e-4 недопустимо велико
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_meas_add_harm(unsigned int phase)
+{
+  unsigned int k;
+  int          s;
+  int          c;
+
+  for (k = 0; k < MEAS_HARM_NUM; k++)
+  {
+    Gen_get_sin_cos_q15(phase * meas_harm_orders[k], &s, &c);
+    // Произведение 13-и битного отсчета на Q15 помещается в 32 бита, накопление в 64 бита
+    meas_acc.harm_re[0][k] += adc_res.ii_w * c;
+    meas_acc.harm_im[0][k] += adc_res.ii_w * s;
+    meas_acc.harm_re[1][k] += adc_res.ii_v * c;
+    meas_acc.harm_im[1][k] += adc_res.ii_v * s;
+    meas_acc.harm_re[2][k] += adc_res.ii_u * c;
+    meas_acc.harm_im[2][k] += adc_res.ii_u * s;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Накопление мгновенной мощности на выходе инвертора
+  ps - значения PWM кадра
+
+  Напряжения плеч берутся относительно средней точки шины, поскольку сумма фазных токов равна нулю
+  синфазная составляющая в мощность не входит.
+  Реактивная мощность по линейным напряжениям: q = (u_wv*i_u + u_vu*i_w + u_uw*i_v)/sqrt(3), деление выполняет задача измерений
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_meas_add_power(T_ADC_pwm_smpl *ps)
+{
+  int uw = PWM_MODULO / 2 - ps->pwm.pwm_a;
+  int uv = PWM_MODULO / 2 - ps->pwm.pwm_b;
+  int uu = PWM_MODULO / 2 - ps->pwm.pwm_c;
+  int p;
+  int q;
+
+  // Произведение напряжения в тактах (не более 11 бит) на 13-и битный ток помещается в 32 бита, умножение на v_bus в 64 бита
+  p = uw * adc_res.ii_w + uv * adc_res.ii_v + uu * adc_res.ii_u;
+  q = (uw - uv) * adc_res.ii_u + (uv - uu) * adc_res.ii_w + (uu - uw) * adc_res.ii_v;
+  meas_acc.pwr_p += (long long)p * adc_res.v_bus;
+  meas_acc.pwr_q += (long long)q * adc_res.v_bus;
+  meas_acc.pwr_cnt++;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Передать завершенное окно задаче измерений и начать новое
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_meas_window_close(void)
+{
+  unsigned int n;
 
-  adc_res.ii_v = adc_res.smpl_ii_v - (adc_res.ii_v_offs >> 12);
-  adc_res.ii_v_offs += adc_res.ii_v;       
+  for (n = 0; n < MEAS_CURR_NUM; n++)
+  {
+    meas_acc.info.bad_smpls[n] = meas_acc.info.smpl_cnt - meas_acc.stat[n].cnt;
+  }
+  meas_win_indx ^= 1;
+  meas_win[meas_win_indx] = meas_acc;
+  ADC_meas_window_reset(&meas_acc);
+  MC_set_events(MEAS_WIN_READY);
+}
 
-  adc_res.ii_u = adc_res.smpl_ii_u - (adc_res.ii_u_offs >> 12);
-  adc_res.ii_u_offs += adc_res.ii_u;       
+/*-------------------------------------------------------------------------------------------------------------
+  Синхронизация окна измерений с периодом генератора
+  Вызывается до добавления отсчетов кадра в статистику.
+
+  Пока генератор работает окно открывается и закрывается на переходе фазы через 0 и содержит meas_win_cycles целых периодов,
+  поэтому RMS, среднее и пики не зависят от соотношения частоты вращения и длительности окна.
+  Несинхронизированный остаток окна при старте генератора отбрасывается.
+  Если генератор остановлен, то окно закрывается по числу отсчетов MEAS_WIN_SMPLS
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_meas_window_sync(T_ADC_pwm_smpl *ps)
+{
+  if ( ps->valid == 0 )
+  {
+    // Кадр без отсчета генератора, окно далее не может быть синхронным
+    meas_acc.info.sync = 0;
+    return;
+  }
+
+  if ( ps->cycle != meas_last_cycle )
+  {
+    meas_last_cycle = ps->cycle;
+    if ( meas_acc.info.sync )
+    {
+      meas_acc.info.cycles++;
+      if ( meas_acc.info.cycles >= meas_win_cycles )
+      {
+        ADC_meas_window_close();
+        meas_acc.info.sync = 1;
+      }
+    }
+    else
+    {
+      ADC_meas_window_reset(&meas_acc);
+      meas_acc.info.sync = 1;
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить отсчет фазного тока ADCn из кадра fi
+  b_is_curr - в слоте B кадра повторное преобразование тока
+  bad       - флаги недостоверных отсчетов кадра
+  Возвращает 1 если отсчет получен, 0 если оба отсчета недостоверны и *smpl не изменен
+-------------------------------------------------------------------------------------------------------------*/
+static unsigned int ADC_frame_curr(unsigned int n, unsigned int fi, int b_is_curr, unsigned int bad, unsigned short *smpl)
+{
+  int a_ok = (bad & ADC_SMPL_BAD_A(n)) == 0;
+  int b_ok = b_is_curr && ((bad & ADC_SMPL_BAD_B(n)) == 0);
+
+  if ( a_ok && b_ok )
+  {
+    *smpl = (adc_dma_buf[n][fi][0] + adc_dma_buf[n][fi][1] + 1) >> 1;
+  }
+  else if ( a_ok )
+  {
+    *smpl = adc_dma_buf[n][fi][0];
+  }
+  else if ( b_ok )
+  {
+    *smpl = adc_dma_buf[n][fi][1];
+  }
+  else
+  {
+    return 0;
+  }
+  return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка одного кадра результатов ADC
+  Фильтрация сигналов и накопление статистики окна измерений
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_process_frame(unsigned int fi)
+{
+  int          slow = (fi == ADC_SEQ_SLOW_FRAME);
+  unsigned int bad  = 0;
+  unsigned int ok;
+
+  if ( adc_pwm_ring[fi].valid ) bad = adc_pwm_ring[fi].bad;
+
+  // Если слот B занят повторным преобразованием тока, то берем среднее достоверных отсчетов.
+  // Если достоверных отсчетов нет, то прежнее значение тока сохраняется, но в статистику не попадает
+  ok  = ADC_frame_curr(0, fi, adc_seq_ch[0][fi] == adc_curr_ch[0], bad, &adc_res.smpl_ii_w) << 0;
+  ok |= ADC_frame_curr(1, fi, adc_seq_ch[1][fi] == adc_curr_ch[1], bad, &adc_res.smpl_ii_v) << 1;
+  ok |= ADC_frame_curr(2, fi, adc_seq_ch[2][fi] == adc_curr_ch[2], bad, &adc_res.smpl_ii_u) << 2;
+
+  adc_res.smpl_v_bus = adc_dma_buf[0][fi][1];
+  if ( adc_seq_ch[1][fi] == SIG_TEMPER_CHANNEL ) adc_res.smpl_temper = adc_dma_buf[1][fi][1];
+  if ( adc_seq_ch[2][fi] == SIG_V_U_CHANNEL    ) adc_res.smpl_v_u    = adc_dma_buf[2][fi][1];
+
+  // ADC3 не имеет входов фазных токов и преобразует каждый период, но результаты берутся только в медленном кадре
+  if ( slow )
+  {
+    adc_res.smpl_15v   = adc_dma_buf[3][fi][0];
+    adc_res.smpl_5v    = adc_dma_buf[3][fi][1];
+  }
+
+  // Вычитаем из токов смещение нуля датчиков
+  ADC_curr_offs_update(&adc_res, adc_pwm_ring[fi].valid);
+  adc_res.ii_w = adc_res.smpl_ii_w - ((adc_res.ii_w_offs + (1 << (ADC_OFFS_Q - 1))) >> ADC_OFFS_Q);
+  adc_res.ii_v = adc_res.smpl_ii_v - ((adc_res.ii_v_offs + (1 << (ADC_OFFS_Q - 1))) >> ADC_OFFS_Q);
+  adc_res.ii_u = adc_res.smpl_ii_u - ((adc_res.ii_u_offs + (1 << (ADC_OFFS_Q - 1))) >> ADC_OFFS_Q);
 
   // Фильтруем напряжения с помощью бегущего среднего на 16 отсчетов
-  adc_res.v_bus_acc -= adc_res.v_bus_arr[adc_res.aai]; 
+  adc_res.v_bus_acc -= adc_res.v_bus_arr[adc_res.aai];
   adc_res.v_bus_arr[adc_res.aai] = adc_res.smpl_v_bus;
   adc_res.v_bus_acc += adc_res.v_bus_arr[adc_res.aai];
   adc_res.aai++;
   if ( adc_res.aai >= FILTR_AVER_SZ ) adc_res.aai = 0;
   adc_res.v_bus = adc_res.v_bus_acc/FILTR_AVER_SZ;
 
- 
 
-  // Запись отсчетов в тестовый массив
-  if ( arr_pos < TST_SMPLS_ARR_SZ )
+
+  ADC_meas_window_sync(&adc_pwm_ring[fi]);
+
+  // Статистика накапливается по каждому отсчету, задаче измерений передаются только результаты завершенного окна
+  if ( ok & BIT(0) ) ADC_meas_add_smpl(&meas_acc.stat[0],  adc_res.ii_w);
+  if ( ok & BIT(1) ) ADC_meas_add_smpl(&meas_acc.stat[1],  adc_res.ii_v);
+  if ( ok & BIT(2) ) ADC_meas_add_smpl(&meas_acc.stat[2],  adc_res.ii_u);
+  ADC_meas_add_smpl(&meas_acc.stat[3],  adc_res.v_bus);
+  if ( slow )
   {
-/*
-    smpls[0][arr_pos] = adc_res.smpl_ii_w   ;
-    smpls[1][arr_pos] = adc_res.smpl_v_bus  ;
-    smpls[2][arr_pos] = adc_res.smpl_ii_v   ;
-    smpls[3][arr_pos] = adc_res.smpl_temper ; 
-    smpls[4][arr_pos] = adc_res.smpl_ii_u   ; 
-    smpls[5][arr_pos] = adc_res.smpl_v_u    ; 
-    smpls[6][arr_pos] = adc_res.smpl_15v    ; 
-    smpls[7][arr_pos] = adc_res.smpl_5v     ;
-*/ 
-    smpls[0][arr_pos] = adc_res.ii_w        ;
-    smpls[1][arr_pos] = adc_res.ii_v        ;
-    smpls[2][arr_pos] = adc_res.ii_u        ;
-    smpls[3][arr_pos] = adc_res.v_bus       ; 
-    smpls[4][arr_pos] = adc_res.smpl_temper ; 
-    smpls[5][arr_pos] = adc_res.smpl_15v    ; 
-    smpls[6][arr_pos] = adc_res.smpl_5v     ; 
-    smpls[7][arr_pos] = adc_res.smpl_ii_u   ;
-
-    arr_pos++;
-    if ( arr_pos == (TST_SMPLS_ARR_SZ/2) )
+    ADC_meas_add_smpl(&meas_acc.stat[4],  adc_res.smpl_temper);
+    ADC_meas_add_smpl(&meas_acc.stat[5],  adc_res.smpl_15v);
+    ADC_meas_add_smpl(&meas_acc.stat[6],  adc_res.smpl_5v);
+  }
+  ADC_meas_add_smpl(&meas_acc.stat[7],  adc_res.smpl_ii_u);
+  ADC_meas_add_smpl(&meas_acc.stat[8],  adc_pwm_ring[fi].pwm.pwm_a);
+  ADC_meas_add_smpl(&meas_acc.stat[9],  adc_pwm_ring[fi].pwm.pwm_b);
+  ADC_meas_add_smpl(&meas_acc.stat[10], adc_pwm_ring[fi].pwm.pwm_c);
+  if ( adc_pwm_ring[fi].valid )
+  {
+    ADC_meas_add_harm(adc_pwm_ring[fi].phase);
+    ADC_meas_add_power(&adc_pwm_ring[fi]);
+    adc_pwm_ring[fi].valid = 0;
+  }
+  meas_acc.info.smpl_cnt++;
+
+  Stream_sample(&adc_res, &adc_pwm_ring[fi].pwm);
+
+  if ( meas_acc.info.sync )
+  {
+    // Защита от слишком длинного окна на очень низкой частоте
+    if ( meas_acc.info.smpl_cnt >= MEAS_WIN_MAX_SMPLS ) ADC_meas_window_close();
+  }
+  else
+  {
+    if ( meas_acc.info.smpl_cnt >= MEAS_WIN_SMPLS ) ADC_meas_window_close();
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработчик прерывания DMA по заполнению половины или всего буфера кадров ADC
+  Вызывается раз в ADC_DMA_HALF_FRAMES периодов PWM вместо прерывания PDB в каждом периоде
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_DMA_isr(pointer user_isr_ptr)
+{
+  unsigned int fi;
+  unsigned int fend;
+
+  TRACE_ISR_ENTER(TRACE_ISR_ADC_DMA);
+  Led_control(LED2, 1);
+  DMA_CINT = ADC_DMA_LAST_CH; // Сбрасываем флаг прерывания канала
+
+  // После прерывания по половине буфера счетчик последнего канала указывает на вторую половину
+  if ( DMA_BASE_PTR->TCD[ADC_DMA_LAST_CH].CITER_ELINKNO <= ADC_DMA_HALF_FRAMES )
+  {
+    fi = 0;
+  }
+  else
+  {
+    fi = ADC_DMA_HALF_FRAMES;
+  }
+  fend = fi + ADC_DMA_HALF_FRAMES;
+
+  for (; fi < fend; fi++)
+  {
+    ADC_process_frame(fi);
+  }
+  Led_control(LED2, 0);
+  TRACE_ISR_LEAVE(TRACE_ISR_ADC_DMA);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить номер кадра буфера DMA в который будут записаны результаты ближайшего запуска PDB
+-------------------------------------------------------------------------------------------------------------*/
+unsigned int ADC_get_frame_indx(void)
+{
+  unsigned int citer;
+
+  citer = DMA_BASE_PTR->TCD[ADC_DMA_FIRST_CH].CITER_ELINKYES & 0x1FF;
+  return (ADC_DMA_FRAMES - citer) % ADC_DMA_FRAMES;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Проверка что интервал [t0, t1) после запуска PDB не задевает переключений ключей
+  e - моменты переключений после запуска PDB по возрастанию. До запуска переключения были в моменты -e[k]
+-------------------------------------------------------------------------------------------------------------*/
+static int ADC_is_quiet(int t0, int t1, int *e)
+{
+  int k;
+
+  if ( t0 < ADC_SETTLE_TICKS - e[0] ) return 0; // Не успокоились после последнего переключения перед нижней точкой
+  for (k = 0; k < 3; k++)
+  {
+    if ( (e[k] < t1) && (e[k] + ADC_SETTLE_TICKS > t0) ) return 0;
+  }
+  return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Расчет задержек PDB для ближайшего кадра по коэффициентам заполнения PWM которые будут действовать в этом кадре
+  Вызывается из задачи Motor_ISR_task каждый период до записи новых значений компараторов,
+  до запуска PDB в этом периоде остается не менее половины периода PWM.
+  Компараторы и отсчет генератора по которому они рассчитаны сохраняются для обработки кадра
+  cycle - номер периода генератора к которому относится отсчет
+  phase - фаза генератора отсчета
+
+  Для тока каждой фазы выбирается самый широкий интервал без переключений в пределах открытого нижнего ключа этой фазы,
+  выборка слота A ставится в его середину, слот B сразу после преобразования A.
+  Если повторный отсчет тока в слоте B выходит за интервал или интервала нет вовсе, то отсчет помечается флагом для кадра.
+  Напряжения в слоте B переносятся за последнее переключение если попадают на фронт.
+-------------------------------------------------------------------------------------------------------------*/
+void ADC_set_sampling(T_3ph_pwm *pwm_3ph_ptr, unsigned int cycle, unsigned int phase)
+{
+  int          cv[3];
+  int          e[3];
+  int          tA[3];
+  int          tB[3];
+  int          c, t, start, end, best, best_len;
+  int          idly;
+  unsigned int n, k;
+  unsigned int fi;
+  unsigned int bad = 0;
+
+  fi = ADC_get_frame_indx();
+
+  cv[0] = pwm_3ph_ptr->pwm_a; // ADC0 - ii_w
+  cv[1] = pwm_3ph_ptr->pwm_b; // ADC1 - ii_v
+  cv[2] = pwm_3ph_ptr->pwm_c; // ADC2 - ii_u
+
+  // Сортируем моменты переключений
+  for (n = 0; n < 3; n++) e[n] = cv[n];
+  for (n = 0; n < 2; n++)
+  {
+    for (k = n + 1; k < 3; k++)
+    {
+      if ( e[k] < e[n] ) { t = e[n]; e[n] = e[k]; e[k] = t; }
+    }
+  }
+
+  idly = 2 * ADC_CONV_TICKS; // ADC3 работает с фиксированными задержками
+  for (n = 0; n < MEAS_CURR_NUM; n++)
+  {
+    c        = cv[n];
+    best     = 0;
+    best_len = -1;
+    start    = ADC_SETTLE_TICKS - e[0];
+    if ( start < 0 ) start = 0;
+    for (k = 0; k < 3; k++)
+    {
+      end = e[k];
+      if ( end > c ) end = c;
+      if ( end - start > best_len )
+      {
+        best     = start;
+        best_len = end - start;
+      }
+      if ( e[k] >= c ) break;
+      start = e[k] + ADC_SETTLE_TICKS;
+    }
+
+    if ( best_len >= ADC_ACQ_TICKS )
     {
-      MC_set_events(SMPL_ARR1_FULL);
+      tA[n] = best + (best_len - ADC_ACQ_TICKS) / 2;
     }
-    else if ( arr_pos == TST_SMPLS_ARR_SZ )
+    else
     {
-      MC_set_events(SMPL_ARR2_FULL);
-      arr_pos = 0;
+      tA[n] = 0;
+      bad |= ADC_SMPL_BAD_A(n);
+    }
+
+    tB[n] = tA[n] + ADC_CONV_TICKS;
+    if ( adc_seq_ch[n][fi] == adc_curr_ch[n] )
+    {
+      // Повторный отсчет тока должен попасть в интервал открытого нижнего ключа
+      if ( (tB[n] + ADC_ACQ_TICKS > c) || (ADC_is_quiet(tB[n], tB[n] + ADC_ACQ_TICKS, e) == 0) ) bad |= ADC_SMPL_BAD_B(n);
+    }
+    else
+    {
+      if ( ADC_is_quiet(tB[n], tB[n] + ADC_ACQ_TICKS, e) == 0 )
+      {
+        t = e[2] + ADC_SETTLE_TICKS;
+        if ( t > tB[n] ) tB[n] = t;
+      }
+    }
+    if ( tB[n] + ADC_CONV_TICKS > idly ) idly = tB[n] + ADC_CONV_TICKS;
+  }
+
+  PDB0_CH0DLY0 = tA[0];
+  PDB0_CH0DLY1 = tB[0];
+  PDB0_CH1DLY0 = tA[1];
+  PDB0_CH1DLY1 = tB[1];
+  PDB0_CH2DLY0 = tA[2];
+  PDB0_CH2DLY1 = tB[2];
+  PDB0_IDLY    = idly + ADC_DMA_MARGIN;
+  PDB0_SC     |= BIT(0); // LDOK. Регистры задержек загружаются сразу, до нижней точки счетчика PWM остается около половины периода
+
+  adc_pwm_ring[fi].pwm   = *pwm_3ph_ptr;
+  adc_pwm_ring[fi].cycle = cycle;
+  adc_pwm_ring[fi].phase = phase;
+  adc_pwm_ring[fi].bad   = bad;
+  adc_pwm_ring[fi].valid = 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Установить количество периодов генератора в окне измерений
+  Новое значение применяется начиная с текущего окна
+-------------------------------------------------------------------------------------------------------------*/
+void ADC_set_meas_win_cycles(unsigned int n)
+{
+  if ( n < 1 ) n = 1;
+  if ( n > MEAS_WIN_MAX_CYCLES ) n = MEAS_WIN_MAX_CYCLES;
+  meas_win_cycles = n;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить количество периодов генератора в окне измерений
+-------------------------------------------------------------------------------------------------------------*/
+unsigned int ADC_get_meas_win_cycles(void)
+{
+  return meas_win_cycles;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Построение многоскоростной последовательности коммутации слота B у ADC0..ADC2
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_seq_build(void)
+{
+  unsigned int fi;
+  unsigned int n;
+
+  for (fi = 0; fi < ADC_DMA_FRAMES; fi++)
+  {
+    adc_seq_ch[0][fi] = SIG_V_BUS_CHANNEL;
+    adc_seq_ch[1][fi] = (fi == ADC_SEQ_SLOW_FRAME)   ? SIG_TEMPER_CHANNEL : SIG_II_V_CHANNEL;
+    adc_seq_ch[2][fi] = (fi == ADC_SEQ_V_U_FRAME)    ? SIG_V_U_CHANNEL    : SIG_II_U_CHANNEL;
+  }
+  for (n = 0; n < ADC_SEQ_CH_NUM; n++)
+  {
+    for (fi = 0; fi < ADC_DMA_FRAMES; fi++)
+    {
+      adc_seq_sc1[n][fi] = 0
+                           + LSHIFT(0, 6) // AIEN. 1 Conversion complete interrupt enabled.
+                           + LSHIFT(0, 5) // DIFF. 1 Differential conversions and input channels are selected.
+                           + LSHIFT(adc_seq_ch[n][(fi + 1) % ADC_DMA_FRAMES], 0) // ADCH. Input channel select.
+      ;
     }
   }
-  Led_control(LED2, 0);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Настройка связи канала DMA со следующим в цепочке
+  link_ch - канал запускаемый после переноса кадра. Если меньше 0, то канал последний в цепочке и генерирует прерывания
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_DMA_set_link(int ch, int link_ch)
+{
+  if ( link_ch >= 0 )
+  {
+    // После каждого кадра запускаем следующий канал цепочки.
+    // На последней итерации главного цикла связь по малому циклу не работает, поэтому дублируем ее связью по главному циклу
+    DMA_BASE_PTR->TCD[ch].CITER_ELINKYES = 0
+                                           + LSHIFT(1, 15)       // ELINK.  1 The channel-to-channel linking is enabled.
+                                           + LSHIFT(link_ch, 9)  // LINKCH. Link Channel Number
+                                           + LSHIFT(ADC_DMA_FRAMES, 0) // CITER. Current Major Iteration Count
+    ;
+    DMA_BASE_PTR->TCD[ch].BITER_ELINKYES = DMA_BASE_PTR->TCD[ch].CITER_ELINKYES;
+    DMA_BASE_PTR->TCD[ch].CSR = 0
+                                + LSHIFT(link_ch, 8) // MAJORLINKCH. Link Channel Number
+                                + LSHIFT(1, 5)       // MAJORELINK.  1 The channel-to-channel linking is enabled.
+                                + LSHIFT(0, 3)       // DREQ.        0 The channel's ERQ bit is not affected.
+                                + LSHIFT(0, 2)       // INTHALF.
+                                + LSHIFT(0, 1)       // INTMAJOR.
+    ;
+  }
+  else
+  {
+    DMA_BASE_PTR->TCD[ch].CITER_ELINKNO = ADC_DMA_FRAMES;
+    DMA_BASE_PTR->TCD[ch].BITER_ELINKNO = ADC_DMA_FRAMES;
+    DMA_BASE_PTR->TCD[ch].CSR = 0
+                                + LSHIFT(0, 5)       // MAJORELINK.  0 The channel-to-channel linking is disabled.
+                                + LSHIFT(0, 3)       // DREQ.        0 The channel's ERQ bit is not affected.
+                                + LSHIFT(1, 2)       // INTHALF.     1 The half-point interrupt is enabled.
+                                + LSHIFT(1, 1)       // INTMAJOR.    1 The end-of-major loop interrupt is enabled.
+    ;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Настройка канала DMA записывающего в SC1B одного ADC канал для следующего кадра
+  ch      - номер канала DMA
+  ADC     - модуль ADC
+  src     - последовательность значений SC1B
+  link_ch - канал запускаемый после записи. Если меньше 0, то канал последний в цепочке и генерирует прерывания
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_DMA_config_seq_channel(int ch, ADC_MemMapPtr ADC, unsigned int *src, int link_ch)
+{
+  DMA_BASE_PTR->TCD[ch].SADDR = (uint32_t)src;
+  DMA_BASE_PTR->TCD[ch].SOFF  = 4;
+  DMA_BASE_PTR->TCD[ch].ATTR  = 0
+                                + LSHIFT(0, 11) // SMOD.  0 Source address modulo feature is disabled
+                                + LSHIFT(2,  8) // SSIZE. 010 32-bit
+                                + LSHIFT(0,  3) // DMOD.  0 Source address modulo feature is disabled
+                                + LSHIFT(2,  0) // DSIZE. 010 32-bit
+  ;
+  DMA_BASE_PTR->TCD[ch].NBYTES_MLNO = 4;
+  DMA_BASE_PTR->TCD[ch].SLAST       = (uint32_t)(-(ADC_DMA_FRAMES * 4)); // По завершении главного цикла возвращаемся на начало последовательности
+  DMA_BASE_PTR->TCD[ch].DADDR       = (uint32_t)&ADC->SC1[1];
+  DMA_BASE_PTR->TCD[ch].DOFF        = 0;
+  DMA_BASE_PTR->TCD[ch].DLAST_SGA   = 0;
+  ADC_DMA_set_link(ch, link_ch);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Настройка канала DMA переносящего результаты RA и RB одного ADC в буфер кадров
+  ch      - номер канала DMA
+  ADC     - модуль ADC
+  dst     - начало массива кадров этого ADC
+  link_ch - канал запускаемый после переноса кадра. Если меньше 0, то канал последний в цепочке и генерирует прерывания
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_DMA_config_channel(int ch, ADC_MemMapPtr ADC, unsigned short *dst, int link_ch)
+{
+  DMA_BASE_PTR->TCD[ch].SADDR = (uint32_t)&ADC->R[0];
+  DMA_BASE_PTR->TCD[ch].SOFF  = 4;  // Регистры RA и RB расположены через 4 байта
+  DMA_BASE_PTR->TCD[ch].ATTR  = 0
+                                + LSHIFT(3, 11) // SMOD.  Адрес источника меняется по модулю 8 байт, т.е. после RB снова RA
+                                + LSHIFT(1,  8) // SSIZE. 001 16-bit
+                                + LSHIFT(0,  3) // DMOD.  0 Source address modulo feature is disabled
+                                + LSHIFT(1,  0) // DSIZE. 001 16-bit
+  ;
+  DMA_BASE_PTR->TCD[ch].NBYTES_MLNO = 4; // За один запрос переносим RA и RB
+  DMA_BASE_PTR->TCD[ch].SLAST       = 0;
+  DMA_BASE_PTR->TCD[ch].DADDR       = (uint32_t)dst;
+  DMA_BASE_PTR->TCD[ch].DOFF        = 2;
+  DMA_BASE_PTR->TCD[ch].DLAST_SGA   = (uint32_t)(-(ADC_DMA_FRAMES * 4)); // По завершении главного цикла возвращаемся на начало буфера
+  ADC_DMA_set_link(ch, link_ch);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Конфигурирование DMA для сбора результатов ADC
+
+  По запросу PDB канал ADC_DMA_FIRST_CH переносит результаты ADC0, и по цепочке запускает каналы ADC1, ADC2, ADC3.
+  Далее каналы ADC_SEQ_FIRST_CH.. записывают в SC1B у ADC0..ADC2 каналы следующего кадра последовательности.
+  Запись выполняется сразу после завершения преобразований, до следующего запуска PDB остается почти весь период PWM.
+  Последний канал генерирует прерывания по заполнению половины и всего буфера.
+-------------------------------------------------------------------------------------------------------------*/
+static void ADC_DMA_configure(void)
+{
+  SIM_SCGC6 |= BIT(1);  // Тактирование DMAMUX0
+  SIM_SCGC7 |= BIT(1);  // Тактирование DMA
+
+  DMAMUX0_CHCFG(ADC_DMA_FIRST_CH) = 0;
+
+  ADC_DMA_config_channel(ADC_DMA_FIRST_CH + 0, ADC0_BASE_PTR, &adc_dma_buf[0][0][0], ADC_DMA_FIRST_CH + 1);
+  ADC_DMA_config_channel(ADC_DMA_FIRST_CH + 1, ADC1_BASE_PTR, &adc_dma_buf[1][0][0], ADC_DMA_FIRST_CH + 2);
+  ADC_DMA_config_channel(ADC_DMA_FIRST_CH + 2, ADC2_BASE_PTR, &adc_dma_buf[2][0][0], ADC_DMA_FIRST_CH + 3);
+  ADC_DMA_config_channel(ADC_DMA_FIRST_CH + 3, ADC3_BASE_PTR, &adc_dma_buf[3][0][0], ADC_SEQ_FIRST_CH);
+
+  ADC_DMA_config_seq_channel(ADC_SEQ_FIRST_CH + 0, ADC0_BASE_PTR, &adc_seq_sc1[0][0], ADC_SEQ_FIRST_CH + 1);
+  ADC_DMA_config_seq_channel(ADC_SEQ_FIRST_CH + 1, ADC1_BASE_PTR, &adc_seq_sc1[1][0], ADC_SEQ_FIRST_CH + 2);
+  ADC_DMA_config_seq_channel(ADC_SEQ_FIRST_CH + 2, ADC2_BASE_PTR, &adc_seq_sc1[2][0], -1);
+
+  _int_install_isr(ADC_DMA_INT, ADC_DMA_isr, 0);
+  // Разрешить прерывание только после установки вектора! Иначе можем уйти в непрерывный вызов ISR по дефолтному вектору
+  _bsp_int_init(ADC_DMA_INT, ADC_DMA_ISR_PRIO, 0, TRUE);
+
+  DMAMUX0_CHCFG(ADC_DMA_FIRST_CH) = 0
+                                    + LSHIFT(1, 7)                  // ENBL.   1 DMA channel is enabled
+                                    + LSHIFT(0, 6)                  // TRIG.   0 Triggering is disabled.
+                                    + LSHIFT(ADC_DMA_PDB_SOURCE, 0) // SOURCE. DMA Channel Source (slot)
+  ;
+  DMA_SERQ = ADC_DMA_FIRST_CH; // Разрешаем аппаратные запросы только первому каналу, остальные запускаются по цепочке
 }
 
 
@@ -321,28 +869,32 @@ void PDB_configure_ADC_triggers(void)
 
 
   // Первый претриггер канала работает без задержки, второй с задержкой на время преобразования ADC
+  // У ADC0..ADC2 оба претриггера работают через задержки, которые каждый период пересчитывает ADC_set_sampling
   PDB0_CH0C1 = 0
-               + LSHIFT(2, 8) // Установка битов подключения претриггеров к задержкам. 0-й претригер в байпасе, 1-й претрегер после задержки
+               + LSHIFT(3, 8) // Установка битов подключения претриггеров к задержкам. 0-й и 1-й претригеры после задержки
                + LSHIFT(3, 0) // Установка битов разрешения выходов претриггеров
   ;
   PDB0_CH1C1 = 0
-               + LSHIFT(2, 8) // Установка битов подключения претриггеров к задержкам
+               + LSHIFT(3, 8) // Установка битов подключения претриггеров к задержкам
                + LSHIFT(3, 0) // Установка битов разрешения выходов претриггеров
   ;
   PDB0_CH2C1 = 0
-               + LSHIFT(2, 8) // Установка битов подключения претриггеров к задержкам
+               + LSHIFT(3, 8) // Установка битов подключения претриггеров к задержкам
                + LSHIFT(3, 0) // Установка битов разрешения выходов претриггеров
   ;
   PDB0_CH3C1 = 0
                + LSHIFT(2, 8) // Установка битов подключения претриггеров к задержкам
                + LSHIFT(3, 0) // Установка битов разрешения выходов претриггеров
   ;
-  PDB0_CH0DLY1 = 138; // 2.3 мкс в тактах системной шины  
-  PDB0_CH1DLY1 = 138; // 2.3 мкс в тактах системной шины  
-  PDB0_CH2DLY1 = 138; // 2.3 мкс в тактах системной шины  
-  PDB0_CH3DLY1 = 138; // 2.3 мкс в тактах системной шины  
-
-  PDB0_IDLY    = 138 + 138; // Время после которого произойдет прерывание PDB0 и можно будет забрать результаты ADC
+  PDB0_CH0DLY0 = 0;
+  PDB0_CH1DLY0 = 0;
+  PDB0_CH2DLY0 = 0;
+  PDB0_CH0DLY1 = ADC_CONV_TICKS; // 2.3 мкс в тактах системной шины  
+  PDB0_CH1DLY1 = ADC_CONV_TICKS; // 2.3 мкс в тактах системной шины  
+  PDB0_CH2DLY1 = ADC_CONV_TICKS; // 2.3 мкс в тактах системной шины  
+  PDB0_CH3DLY1 = ADC_CONV_TICKS; // 2.3 мкс в тактах системной шины  
+
+  PDB0_IDLY    = 2 * ADC_CONV_TICKS + ADC_DMA_MARGIN; // Время после которого PDB0 выдаст запрос DMA и можно будет забрать результаты ADC
 /*
   // Первый претриггер канала работает без задержки, второй с задержкой на время преобразования ADC
   PDB0_CH0C1 = 0
@@ -378,16 +930,13 @@ void PDB_configure_ADC_triggers(void)
 */
 
 
-  _int_install_isr(INT_PDB0, PDB0_isr, 0);
-  // Разрешить прерывание только после установки вектора! Иначе можем уйти в непрерывный вызов ISR по дефолтному вектору
-  _bsp_int_init(INT_PDB0, PDB0_ISR_PRIO, 0, TRUE);
-
+  ADC_DMA_configure();
 
   PDB0_SC = 0
             + LSHIFT(0,   18) // LDMOD.     00 The internal registers are loaded with the values from their buffers immediately after 1 is written to LDOK.
             + LSHIFT(0,   17) // PDBEIE.    0 PDB sequence error interrupt disabled.
             + LSHIFT(0,   16) // SWTRIG.    Software Trigger
-            + LSHIFT(0,   15) // DMAEN.     0 DMA disabled
+            + LSHIFT(1,   15) // DMAEN.     1 DMA enabled. Флаг PDBIF вместо прерывания выдает запрос DMA
             + LSHIFT(0,   12) // PRESCALER. 000 Counting uses the peripheral clock divided by multiplication factor selected by MULT.
             + LSHIFT(0x8,  8) // TRGSEL.    1000 FTM0 Init and Ext Trigger Outputs
             + LSHIFT(1,    7) // PDBEN.     1 PDB enabled
@@ -410,12 +959,15 @@ void PDB_set_delays(int delay1, int delay2)
   PDB0_CH2S = 0;
   PDB0_CH3S = 0;
 
+  PDB0_CH0DLY0 = 0;
+  PDB0_CH1DLY0 = 0;
+  PDB0_CH2DLY0 = 0;
   PDB0_CH0DLY1 = delay1;  
   PDB0_CH1DLY1 = delay1;  
   PDB0_CH2DLY1 = delay1;  
   PDB0_CH3DLY1 = delay1;  
 
-  PDB0_IDLY    = delay1 + delay2; // Время после которого произойдет прерывание PDB0 и можно будет забрать результаты ADC
+  PDB0_IDLY    = delay1 + delay2 + ADC_DMA_MARGIN; // Время после которого PDB0 выдаст запрос DMA и можно будет забрать результаты ADC
 
   PDB0_SC |= BIT(7) + BIT(0);
 }
@@ -478,6 +1030,8 @@ signed short ADC_get_sample(ADC_MemMapPtr ADC, INT32U channel, INT32U diff, INT3
 -------------------------------------------------------------------------------------------------------------*/
 void ADCs_prepare(void)
 {
+  ADC_meas_window_reset(&meas_acc);
+  ADC_curr_offs_reset(&adc_res);
   ADC_switch_on_all();
   adc_state.adc0_cal_res = ADC_calibrating(ADC0_BASE_PTR);
   adc_state.adc1_cal_res = ADC_calibrating(ADC1_BASE_PTR);
@@ -488,14 +1042,16 @@ void ADCs_prepare(void)
   ADC_init(ADC2_BASE_PTR);
   ADC_init(ADC3_BASE_PTR);
 
+  // Слот B настраивается на первый кадр последовательности, далее его переключает DMA
+  ADC_seq_build();
   ADC_set_channel(ADC0_BASE_PTR, SIG_II_W_CHANNEL     ,0,0);
-  ADC_set_channel(ADC0_BASE_PTR, SIG_V_BUS_CHANNEL    ,0,1);
+  ADC_set_channel(ADC0_BASE_PTR, adc_seq_ch[0][0]     ,0,1);
                                                       
   ADC_set_channel(ADC1_BASE_PTR, SIG_II_V_CHANNEL     ,0,0);
-  ADC_set_channel(ADC1_BASE_PTR, SIG_TEMPER_CHANNEL   ,0,1);
+  ADC_set_channel(ADC1_BASE_PTR, adc_seq_ch[1][0]     ,0,1);
                                                       
   ADC_set_channel(ADC2_BASE_PTR, SIG_II_U_CHANNEL     ,0,0);
-  ADC_set_channel(ADC2_BASE_PTR, SIG_V_U_CHANNEL      ,0,1);
+  ADC_set_channel(ADC2_BASE_PTR, adc_seq_ch[2][0]     ,0,1);
                                                       
   ADC_set_channel(ADC3_BASE_PTR, SIG_15V_MEAS_CHANNEL ,0,0);
   ADC_set_channel(ADC3_BASE_PTR, SIG_5V_MEAS_CHANNEL  ,0,1);
@@ -517,44 +1073,32 @@ T_ADC_state *ADC_get_state(void)
 }
 
 /*-------------------------------------------------------------------------------------------------------------
-  Получить массив отсчетов  
+  Получить отфильтрованное значение напряжения шины в отсчетах ADC
 -------------------------------------------------------------------------------------------------------------*/
-void ADC_get_arr_smp(unsigned int indx, signed short *arr)
+int ADC_get_v_bus(void)
 {
-  INT32U i;
-
-  for (i=0;i<MEAS_RES_ARR_SZ;i++)
-  {
-    arr[i]  = smpls[i][indx]; 
-  }
+  return adc_res.v_bus;
 }
-/*-------------------------------------------------------------------------------------------------------------
 
--------------------------------------------------------------------------------------------------------------*/
-void ADC_reset_smpl_arr_pos(void)
-{
-  arr_pos = 0;
-}
 /*-------------------------------------------------------------------------------------------------------------
-
+  Получить смещения нуля датчиков тока в отсчетах ADC
+  Возвращает количество выполненных калибровок смещения
 -------------------------------------------------------------------------------------------------------------*/
-int ADC_is_smpl_arr_ready(void)
+unsigned int ADC_get_curr_offs(float *offs_w, float *offs_v, float *offs_u)
 {
-  if ( arr_pos == TST_SMPLS_ARR_SZ)
-    return 1;
-  else
-    return 0;
+  *offs_w = (float)adc_res.ii_w_offs / (float)(1 << ADC_OFFS_Q);
+  *offs_v = (float)adc_res.ii_v_offs / (float)(1 << ADC_OFFS_Q);
+  *offs_u = (float)adc_res.ii_u_offs / (float)(1 << ADC_OFFS_Q);
+  return adc_res.cal_done;
 }
-/*-------------------------------------------------------------------------------------------------------------
 
+/*-------------------------------------------------------------------------------------------------------------
+  Получить копию статистики последнего завершенного окна измерений
+  Вызывается по событию MEAS_WIN_READY. Следующее окно записывается в другой буфер, поэтому блокировки не нужны
 -------------------------------------------------------------------------------------------------------------*/
-void ADC_get_smpl_arr(signed short **ptr)
+void ADC_get_meas_window(T_meas_window *w)
 {
-  int i;
-  for (i=0;i<MEAS_RES_ARR_SZ;i++)
-  {
-    ptr[i] = &smpls[i][0]; 
-  }
+  *w = meas_win[meas_win_indx];
 }
 
 /*-------------------------------------------------------------------------------------------------------------
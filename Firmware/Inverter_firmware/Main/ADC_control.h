@@ -16,8 +16,70 @@
 #define SIG_5V_MEAS_CHANNEL   5 // ADC3 5a (после тюнинга на плате ver. 1.0)
 
 
-#define TST_SMPLS_ARR_SZ  (800*2) //  Общее время выборки всех сэмплов 50 мс
-
+// Пересчет между вольтами и отсчетами ADC для делителя напряжения шины (r1 = 2200, r2 = 300000)
+#define VBUS_VOLT_PER_SMPL        (3.3 * (2200.0 + 300000.0) * 0.964 / (2200.0 * 4096.0))
+#define VBUS_VOLTS_TO_SMPL(v)     ((int)((v) / VBUS_VOLT_PER_SMPL))
+
+#define MEAS_RES_ARR_SZ   11  // Количество каналов статистических измерений
+#define MEAS_WIN_SMPLS    800 // Количество отсчетов в окне статистических измерений при остановленном генераторе. Время окна 50 мс
+
+// Окна измерений при вращении двигателя синхронизируются с периодом генератора и содержат целое число периодов
+#define MEAS_WIN_CYCLES_DEF   2     // Количество периодов в окне по умолчанию
+#define MEAS_WIN_MAX_CYCLES   16    // Максимальное количество периодов в окне
+#define MEAS_WIN_MAX_SMPLS    64000 // Окно закрывается принудительно если за это количество отсчетов (4 с) не набралось заданное число периодов
+
+// Гармонический анализ фазных токов (каналы статистики 0..2) в синхронизированных окнах.
+// Для каждой гармоники накапливаются суммы произведений тока на cos и sin кратной фазы генератора.
+// Затраты в каждом периоде PWM постоянны: MEAS_HARM_NUM выборок из таблицы и 2*MEAS_HARM_PH_NUM*MEAS_HARM_NUM умножений с накоплением
+#define MEAS_HARM_PH_NUM      3              // Количество анализируемых фазных токов
+#define MEAS_HARM_NUM         4              // Количество анализируемых гармоник
+#define MEAS_HARM_ORDERS      { 1, 3, 5, 7 } // Номера гармоник. Первой должна быть основная
+
+// Мощность на выходе инвертора.
+// Напряжение плеча фазы относительно средней точки шины v_bus*(PWM_MODULO/2 - CnV)/PWM_MODULO по компараторам действовавшим в момент выборки тока.
+// Падение на мертвом времени и ключах не учитывается
+#define MEAS_PWR_SIGN         1   // 1 - положительный ток датчика направлен из инвертора в двигатель, -1 - наоборот
+#define MEAS_ENERGY_SIGNATURE 0x454E5247 // Признак достоверности счетчиков энергии в неинициализируемой памяти
+
+// Сбор результатов ADC через DMA
+#define ADC_DMA_CH_NUM       4                    // Количество каналов DMA переносящих результаты, по одному на каждый ADC
+#define ADC_DMA_FIRST_CH     0                    // Канал DMA запускаемый от PDB0 (ADC0)
+#define ADC_SEQ_CH_NUM       3                    // Количество каналов DMA записывающих последовательность коммутации SC1B у ADC0..ADC2
+#define ADC_SEQ_FIRST_CH     (ADC_DMA_FIRST_CH + ADC_DMA_CH_NUM)
+#define ADC_DMA_LAST_CH      (ADC_SEQ_FIRST_CH + ADC_SEQ_CH_NUM - 1) // Последний канал в цепочке, генерирует прерывания
+#define ADC_DMA_INT          INT_DMA6_DMA22       // Вектор прерывания канала ADC_DMA_LAST_CH
+#define ADC_DMA_PDB_SOURCE   48                   // Номер источника запроса PDB в DMAMUX0
+#define ADC_DMA_FRAMES       32                   // Количество кадров в буфере DMA. Кадр - результаты всех ADC за один период PWM
+#define ADC_DMA_HALF_FRAMES  (ADC_DMA_FRAMES/2)   // Прерывание DMA происходит через каждые 16 периодов PWM (1 мс)
+#define ADC_DMA_MARGIN       12                   // Запас в тактах шины после завершения второго преобразования до запроса DMA
+
+// Многоскоростная последовательность преобразований.
+// Период последовательности равен ADC_DMA_FRAMES кадрам. Медленные сигналы преобразуются в слоте B в отдельных кадрах,
+// в остальных кадрах слот B занят повторным преобразованием фазного тока того же ADC.
+// Слот B у ADC0 всегда преобразует напряжение шины (16 кГц, регулятор VBUS_GOV и фильтр на 16 отсчетов рассчитаны на эту частоту),
+// поэтому ii_w преобразуется один раз в каждом кадре. ii_v и ii_u преобразуются дважды во всех кадрах кроме своего медленного
+#define ADC_SEQ_SLOW_FRAME   0                    // Кадр преобразования температуры (ADC1 B), 15V и 5V (ADC3). Частота 500 Гц
+#define ADC_SEQ_V_U_FRAME    16                   // Кадр преобразования фазного напряжения (ADC2 B). Частота 500 Гц
+
+// Адаптивный выбор момента выборки по коэффициентам заполнения PWM.
+// Такты шины и такты счетчика PWM совпадают (60 МГц). Время отсчитывается от запуска PDB в нижней точке счетчика PWM,
+// нижний ключ фазы с компаратором CnV открыт в интервале (-CnV, CnV)
+#define ADC_CONV_TICKS       138  // Время преобразования ADC (2.3 мкс)
+#define ADC_ACQ_TICKS        30   // Время выборки-хранения в начале преобразования (0.5 мкс)
+#define ADC_SETTLE_TICKS     60   // Время успокоения сигналов после переключения любого ключа (1 мкс)
+#define ADC_SMPL_BAD_A(n)    BIT(n)       // Флаг кадра: отсчет тока в слоте A у ADCn взят вне интервала открытого нижнего ключа
+#define ADC_SMPL_BAD_B(n)    (BIT(n) << 4)// Флаг кадра: то же для повторного отсчета тока в слоте B
+#define MEAS_CURR_NUM        3    // Количество фазных токов (каналы статистики 0..2, ADC0..ADC2)
+
+
+// Смещение нуля датчиков фазных токов.
+// Измеряется при выключенном PWM после затухания тока и замораживается на время работы генератора.
+// В простое после калибровки медленно отслеживается дрейф
+#define ADC_OFFS_Q              16   // Смещение хранится в формате Q16
+#define ADC_OFFS_NOMINAL        2048 // Смещение до первой калибровки (середина шкалы)
+#define ADC_OFFS_SETTLE_FRAMES  800  // Количество кадров (50 мс) после остановки PWM на затухание тока перед калибровкой
+#define ADC_OFFS_CAL_SHIFT      10   // Калибровка усреднением 2^10 отсчетов (64 мс)
+#define ADC_OFFS_DRIFT_SHIFT    6    // Постоянная времени слежения за дрейфом в простое 2^6 блоков калибровки (4 с)
 
 #define ADC_AVER_4   1
 #define ADC_AVER_8   2
@@ -44,10 +106,52 @@ typedef struct
 {
   int    maxv;
   int    minv;
-  int    averv;
-  int long long    rmsv;
+  int    averv;          // При накоплении в окне - сумма отсчетов
+  int long long    rmsv; // При накоплении в окне - сумма квадратов отсчетов
+  unsigned int     cnt;  // Количество отсчетов канала в окне. Медленные каналы имеют меньше отсчетов чем окно
 } T_meas_stat;
 
+typedef struct
+{
+  unsigned int  smpl_cnt;                  // Количество отсчетов в окне
+  unsigned int  cycles;                    // Количество целых периодов генератора в окне
+  unsigned int  sync;                      // 1 - окно начинается и заканчивается на переходе фазы генератора через 0
+  unsigned int  bad_smpls[MEAS_CURR_NUM];  // Количество кадров без достоверного отсчета фазного тока. Такие кадры не входят в статистику
+} T_meas_win_info;
+
+typedef struct
+{
+  T_meas_win_info info;
+  T_meas_stat     stat[MEAS_RES_ARR_SZ];   // Статистика по каналам
+  long long       harm_re[MEAS_HARM_PH_NUM][MEAS_HARM_NUM]; // Сумма произведений тока на cos гармоники фазы генератора (Q15)
+  long long       harm_im[MEAS_HARM_PH_NUM][MEAS_HARM_NUM]; // Сумма произведений тока на sin гармоники фазы генератора (Q15)
+  long long       pwr_p;    // Сумма v_bus * sum((PWM_MODULO/2 - CnV) * i) по фазам. Отсчеты ADC * такты PWM
+  long long       pwr_q;    // Сумма v_bus * sum(линейное напряжение * ток третьей фазы) для реактивной мощности
+  unsigned int    pwr_cnt;  // Количество кадров при включенном PWM вошедших в суммы мощности
+} T_meas_window;
+
+typedef struct
+{
+  int    valid;                                   // 1 - результаты получены по синхронизированному окну
+  float  freq;                                    // Частота основной гармоники по длительности окна (Гц)
+  float  rms[MEAS_HARM_PH_NUM][MEAS_HARM_NUM];    // Действующие значения гармоник тока (А)
+  float  imbalance;                               // Небаланс основной гармоники фазных токов (%). Максимальное отклонение от среднего к среднему
+} T_meas_harm;
+
+typedef struct
+{
+  int    valid;            // 1 - в последнем окне PWM был включен
+  float  p;                // Активная мощность (Вт). Отрицательная при рекуперации
+  float  q;                // Реактивная мощность (ВАр)
+  float  s;                // Полная мощность (ВА)
+  float  pf;               // Коэффициент мощности P/S
+  float  kwh_motor;        // Накопленная энергия в режиме двигателя (кВт*ч)
+  float  kwh_regen;        // Накопленная энергия рекуперации (кВт*ч)
+  float  trip_kwh_motor;   // Энергия в режиме двигателя за текущую или последнюю поездку (кВт*ч)
+  float  trip_kwh_regen;   // Энергия рекуперации за текущую или последнюю поездку (кВт*ч)
+  unsigned int trips;      // Количество поездок с момента сброса счетчиков
+} T_meas_power;
+
 
 typedef struct
 {
@@ -57,6 +161,16 @@ typedef struct
   float  frms;
 } T_meas_results;
 
+// Результаты измерений публикуемые задачей измерений по завершении каждого окна.
+// Читатели получают согласованную копию по номеру версии без мьютекса и без запрета переключения задач
+typedef struct
+{
+  T_meas_results  res[MEAS_RES_ARR_SZ];
+  T_meas_win_info info;   // Параметры окна по которому получены результаты
+  T_meas_harm     harm;   // Результаты гармонического анализа фазных токов
+  T_meas_power    power;  // Мощность и энергия на выходе инвертора
+} T_meas_snapshot;
+
 #define  FILTR_AVER_SZ  16
 
 typedef struct
@@ -70,9 +184,17 @@ typedef struct
   unsigned short smpl_15v    ; // Текущий отсчет сигнала
   unsigned short smpl_5v     ; // Текущий отсчет сигнала
 
-  int ii_w_offs; // Накопленное смещение
-  int ii_v_offs; // Накопленное смещение
-  int ii_u_offs; // Накопленное смещение
+  int ii_w_offs; // Смещение нуля в формате Q16
+  int ii_v_offs; // Смещение нуля в формате Q16
+  int ii_u_offs; // Смещение нуля в формате Q16
+
+  int ii_w_cal;  // Сумма отсчетов для калибровки смещения
+  int ii_v_cal;  // Сумма отсчетов для калибровки смещения
+  int ii_u_cal;  // Сумма отсчетов для калибровки смещения
+
+  unsigned int idle_frames; // Количество кадров подряд при выключенном PWM, до калибровки включительно
+  unsigned int cal_smpls;   // Количество отсчетов накопленных в блоке калибровки
+  unsigned int cal_done;    // Количество выполненных калибровок смещения
 
   int ii_w; // Отфильтрованный от постоянной составляющей сигнал  ii_w
   int ii_v; // Отфильтрованный от постоянной составляющей сигнал  ii_v
@@ -113,11 +235,25 @@ void PDB_activate_ADC_triggers(void);
 void PDB_deactivate_ADC_triggers(void);
 void PDB_set_delays(int delay1, int delay2);
 
-//void ADC_reset_smpl_arr_pos(void);
-int  ADC_is_smpl_arr_ready(void);
-void ADC_get_arr_smp(unsigned int indx, signed short *arr);
-void ADC_get_smpl_arr(signed short **ptr);
+void ADC_get_meas_window(T_meas_window *w);
 T_ADC_state *ADC_get_state(void);
-
+unsigned int ADC_get_frame_indx(void);
+void ADC_set_sampling(T_3ph_pwm *pwm_3ph_ptr, unsigned int cycle, unsigned int phase);
+int  ADC_get_v_bus(void);
+unsigned int ADC_get_curr_offs(float *offs_w, float *offs_v, float *offs_u);
+
+// Калибровка смещений датчиков тока, ADC_offs.c
+void ADC_curr_offs_reset(T_ADC_res *r);
+void ADC_curr_offs_update(T_ADC_res *r, int running);
+void ADC_set_meas_win_cycles(unsigned int n);
+unsigned int ADC_get_meas_win_cycles(void);
+
+unsigned int Get_meas_snapshot(T_meas_snapshot *snap);
+unsigned int Meas_get_version(void);
+_mqx_uint    Meas_wait_next(unsigned int *ver, _mqx_uint ticks);
 void Get_copy_meas_results(T_meas_results * mres);
+void Get_meas_win_info(T_meas_win_info *wi);
+void Get_copy_meas_harm(T_meas_harm *harm);
+void Get_copy_meas_power(T_meas_power *pwr);
+void Meas_reset_energy(void);
 #endif
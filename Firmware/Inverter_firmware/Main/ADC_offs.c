@@ -0,0 +1,78 @@
+#ifdef ADC_OFFS_HOST_BUILD
+  #include "offs_host.h"
+#else
+  #include "App.h"
+#endif
+
+// Калибровка смещений нуля датчиков фазных токов. Вызывается обработкой кадров ADC (ADC_control.c).
+// Модуль не обращается к регистрам, поэтому собирается также для Linux и проверяется на синтетических
+// отсчетах (Firmware/Linux_tools/offs_test)
+
+/*-------------------------------------------------------------------------------------------------------------
+  Установка начальных значений смещений датчиков тока
+-------------------------------------------------------------------------------------------------------------*/
+void ADC_curr_offs_reset(T_ADC_res *r)
+{
+  r->ii_w_offs   = ADC_OFFS_NOMINAL << ADC_OFFS_Q;
+  r->ii_v_offs   = ADC_OFFS_NOMINAL << ADC_OFFS_Q;
+  r->ii_u_offs   = ADC_OFFS_NOMINAL << ADC_OFFS_Q;
+  r->idle_frames = 0;
+  r->cal_smpls   = 0;
+  r->cal_done    = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обновление смещений датчиков тока
+  r       - результаты ADC с отсчетами токов текущего кадра
+  running - 1 если в этом кадре работает генератор (PWM включен)
+
+  При работе PWM смещения не меняются, поэтому низкочастотная составляющая тока не подавляется.
+  После остановки PWM и затухания тока смещения измеряются усреднением, затем до следующего старта
+  отслеживается медленный дрейф
+-------------------------------------------------------------------------------------------------------------*/
+void ADC_curr_offs_update(T_ADC_res *r, int running)
+{
+  if ( running )
+  {
+    r->idle_frames = 0;
+    r->cal_smpls   = 0;
+    return;
+  }
+
+  if ( r->idle_frames < ADC_OFFS_SETTLE_FRAMES )
+  {
+    r->idle_frames++;
+    return;
+  }
+
+  // Калибровка и слежение за дрейфом по средним блоков из 2^ADC_OFFS_CAL_SHIFT отсчетов.
+  // Среднее блока сохраняет дробную часть, поэтому целые отсчеты не смещают результат
+  if ( r->cal_smpls == 0 )
+  {
+    r->ii_w_cal = 0;
+    r->ii_v_cal = 0;
+    r->ii_u_cal = 0;
+  }
+  r->ii_w_cal += r->smpl_ii_w;
+  r->ii_v_cal += r->smpl_ii_v;
+  r->ii_u_cal += r->smpl_ii_u;
+  r->cal_smpls++;
+  if ( r->cal_smpls < (1u << ADC_OFFS_CAL_SHIFT) ) return;
+  r->cal_smpls = 0;
+
+  if ( r->idle_frames == ADC_OFFS_SETTLE_FRAMES )
+  {
+    // Первый блок после остановки - калибровка
+    r->ii_w_offs = r->ii_w_cal << (ADC_OFFS_Q - ADC_OFFS_CAL_SHIFT);
+    r->ii_v_offs = r->ii_v_cal << (ADC_OFFS_Q - ADC_OFFS_CAL_SHIFT);
+    r->ii_u_offs = r->ii_u_cal << (ADC_OFFS_Q - ADC_OFFS_CAL_SHIFT);
+    r->cal_done++;
+    r->idle_frames++;
+    return;
+  }
+
+  // Слежение за дрейфом. Среднее блока в Q16 помещается в 28 бит
+  r->ii_w_offs += ((r->ii_w_cal << (ADC_OFFS_Q - ADC_OFFS_CAL_SHIFT)) - r->ii_w_offs) >> ADC_OFFS_DRIFT_SHIFT;
+  r->ii_v_offs += ((r->ii_v_cal << (ADC_OFFS_Q - ADC_OFFS_CAL_SHIFT)) - r->ii_v_offs) >> ADC_OFFS_DRIFT_SHIFT;
+  r->ii_u_offs += ((r->ii_u_cal << (ADC_OFFS_Q - ADC_OFFS_CAL_SHIFT)) - r->ii_u_offs) >> ADC_OFFS_DRIFT_SHIFT;
+}
@@ -12,10 +12,14 @@
 #include "Pins_control.h"
 #include "Motor_control.h"
 #include "Temperature_control.h"
+#include "Load_control.h"
+#include "Trace_control.h"
 #include "ADC_control.h"
+#include "Stream_control.h"
 #include "LCD_control.h"
 #include "SIN_COS_generator.h"
 #include "MonitorVT100.h"
+#include "UART_control.h"
 #include "Tests.h"
 #include "CAN_control.h"
 #include "app_IDs.h"
@@ -41,11 +45,15 @@
 #define LCD_ID_PRIO      11
 
 #define ETM0_ISR_PRIO  3  // Приоритет процедуры прерывания узла ШИМ модуляции
-#define PDB0_ISR_PRIO  3  // Приоритет процедуры прерывания узла программируемой задержки для считывания результатов АЦП
+#define ADC_DMA_ISR_PRIO 3  // Приоритет процедуры прерывания DMA по заполнению буфера результатов АЦП
 #define CAN_ISR_PRIO   3  // Приоритет процедуры прерывания от контроллера CAN шины
+#define SYNC_START_ISR_PRIO 2  // Приоритет прерывания таймера PIT включающего PWM при синхронном старте
+#define UART_ISR_PRIO  4  // Приоритет прерываний DMA передатчика и ошибок приемника порта монитора
+#define LCD_ISR_PRIO   5  // Приоритет прерывания SPI2 передачи на индикатор
+#define TEMP_ISR_PRIO  5  // Приоритет прерываний PIT1 и I2C0 чтения температуры IGBT
+#define LOAD_ISR_PRIO  2  // Приоритет прерывания PIT2 выборок загрузки процессора. Выше остальных, чтобы видеть их время
 
 
-#define MEAS_RES_ARR_SZ 11
 #define MEAS_RES_LOG_SZ 1000 // 50 сек
 
 extern void Delay_m8(int cnt); // Задержка на (cnt+1)*8 тактов . Передача нуля недопускается
@@ -57,8 +65,6 @@ extern void Delay_m8(int cnt); // Задержка на (cnt+1)*8 тактов .
   #define  DELAY_30us Delay_m8(30*15-1)
 
 
-void    Lock_meas_mutex(void);
-void    Unlock_meas_mutex(void);
 //INT32U  Reset_rms_log(void);
 //INT32U  Get_rms_log_pos(void);
 //void    Get_rms_log_arr(float **ptr);
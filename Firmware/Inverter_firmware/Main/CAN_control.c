@@ -1,59 +1,237 @@
 #include "App.h"
+#include <stddef.h>
 
 LWEVENT_STRUCT can_event;
 
 
 
-const T_can_rx_config rx_mboxes[RX_MBOX_CNT] =
+// Таблица фильтров Rx FIFO. При совпадении с несколькими фильтрами кадр принимается по фильтру с меньшим номером.
+// Неиспользуемые элементы таблицы заполняются копией первого фильтра
+const T_can_rx_filter rx_filters[] =
 {
-  { CAN_RX_MB1, INVERT_REQ, 0xFFF00000 },
-  { CAN_RX_MB2, INVERT_REQ, 0xFFF00000 },
-  { CAN_RX_MB3, INVERT_REQ, 0xFFF00000 },
-  { CAN_RX_MB4, INVERT_REQ, 0xFFF00000 },
-  { CAN_RX_MB5, INVERT_REQ, 0xFFF00000 },
-  { CAN_RX_MB6, INVERT_REQ, 0xFFF00000 },
-  { CAN_RX_MB7, INVERT_REQ, 0xFFF00000 },
-  { CAN_RX_MB8, INVERT_REQ, 0xFFF00000 },
+  { INVERT_REQ, 0x1FFFFFFF, 1 }, // Команды инвертору
+  { INVERT_SYNC,0x1FFFFFFF, 1 }, // Синхронизация общей шкалы времени
+  { INVERT_REQ, 0x1FF00000, 1 }, // Остальные пакеты группы инверторов, только в лог
 };
 
-INT32U       rx_log_head;
-INT32U       rx_log_tail;
-T_can_rx     rx_log[CAN_RX_LOG_SZ];
-LWSEM_STRUCT can_log_sem;
+static T_can_rx_stat    can_rx_stat;
+static T_can_estop_stat can_estop_stat;
+
+// Очередь принятых кадров. Заполняется прерыванием CAN_isr, выбирается задачей CAN_Rx_Task
+static T_can_rx         can_rx_q[CAN_RX_Q_SZ];
+static volatile INT32U  can_rx_q_head;
+static volatile INT32U  can_rx_q_tail;
+
+// Очереди передачи по приоритетам. Доступ при запрещенных прерываниях
+static volatile CAN_MemMapPtr can_tx_ptr;
+static T_can_tx         can_tx_q[CAN_TX_PRIO_NUM][CAN_TX_Q_SZ];
+static INT32U           can_tx_q_head[CAN_TX_PRIO_NUM];
+static INT32U           can_tx_q_tail[CAN_TX_PRIO_NUM];
+static INT32U           can_tx_busy;     // Маска майлбоксов пула занятых передачей
+static INT32U           can_tx_mb_id[CAN_TX_MB_NUM]; // Приоритет и идентификатор кадра в каждом майлбоксе пула
+static T_can_tx_stat    can_tx_stat;
+
+
+// Ошибки шины. Счетчики изменяются в CAN_err_isr и в задаче приема при запрещенных прерываниях
+static T_can_err_stat   can_err_stat;
+static T_can_err_hist   can_err_hist[CAN_ERR_HIST_SZ]; // История по секундам
+static INT32U           can_err_hist_head;             // Позиция следующей записи истории
+static INT32U           can_err_hist_cnt;
+static volatile INT32U  can_boff_pending;              // Зафиксирован Bus Off, ожидается восстановление
+
+// Кадры синхронизации. Фиксируются в CAN_isr, момент приема пересчитывается из таймера FlexCAN в такты ядра
+static T_can_sync       can_sync[CAN_SYNC_HIST_SZ];
+static INT32U           can_sync_head;
+static INT32U           can_bit_cycles;                // Тактов ядра в битовом интервале
+static T_can_sync_stat  can_sync_stat;
+
+
+static void CAN_read_rx_fifo(volatile CAN_MemMapPtr CAN, T_can_rx *rx);
+static void CAN_tx_dispatch(volatile CAN_MemMapPtr CAN);
+
+// Лог принятых кадров. Кольцо с одним писателем (CAN_isr) и одним читателем (CAN_pop_log_rec) без блокировок.
+// Индексы только увеличиваются, позиция в массиве - младшие биты индекса
+static T_can_rx         can_log[CAN_RX_LOG_SZ];
+static volatile INT32U  can_log_head;  // Изменяет только писатель
+static volatile INT32U  can_log_tail;  // Изменяет только читатель
+
+static INT32U           can_time;      // Таймер FlexCAN расширенный до 32 бит. Изменяется при запрещенных прерываниях
 
 
+/*-------------------------------------------------------------------------------------------------------------
+  Аварийная остановка непосредственно из прерывания приема
+  t0 - значение счетчика тактов ядра при входе в прерывание
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_fast_emergency_stop(volatile CAN_MemMapPtr CAN, T_can_rx *rx, INT32U t0)
+{
+  INT32U cycles;
+  INT32U bits;
+
+  // Прерывание синхронного старта (PIT0) имеет более высокий приоритет и не должно включить PWM до отмены старта
+  _int_disable();
+  PWM_stop(); // Выходы PWM переводятся в безопасное состояние сразу
+  cycles = DWT_CYCCNT - t0;
+  bits   = (CAN->TIMER - rx->stamp) & 0xFFFF;
+
+  MC_emergency_stop_motor();
+  _int_enable();
+
+  can_estop_stat.cnt++;
+  can_estop_stat.last_cycles = cycles;
+  can_estop_stat.last_bits   = bits;
+  if ( cycles > can_estop_stat.max_cycles ) can_estop_stat.max_cycles = cycles;
+  if ( bits   > can_estop_stat.max_bits   ) can_estop_stat.max_bits   = bits;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обновить расширение таймера FlexCAN до 32 бит и вернуть его текущее значение.
+  Вызывается при запрещенных прерываниях не реже чем раз в период переполнения таймера
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U CAN_time_update(volatile CAN_MemMapPtr CAN)
+{
+  can_time += ((CAN->TIMER & 0xFFFF) - can_time) & 0xFFFF;
+  return can_time;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Записать кадр в лог. Вызывается только из CAN_isr
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_log_push(T_can_rx *rx)
+{
+  INT32U head = can_log_head;
+
+  if ( (head - can_log_tail) >= CAN_RX_LOG_SZ )
+  {
+    can_rx_stat.log_drops++;
+    return;
+  }
+  can_log[head & (CAN_RX_LOG_SZ - 1)] = *rx;
+  __DMB(); // Запись должна быть завершена раньше продвижения индекса
+  can_log_head = head + 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Фиксация момента приема кадра синхронизации.
+  Отметка времени кадра одинакова на всех узлах шины, поэтому время прошедшее от нее по таймеру FlexCAN
+  вычитается из текущего значения счетчика тактов ядра. Погрешность не превышает битового интервала
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_sync_capture(volatile CAN_MemMapPtr CAN, T_can_rx *rx)
+{
+  INT32U     now  = DWT_CYCCNT;
+  INT32U     bits = (CAN->TIMER - rx->stamp) & 0xFFFF;
+  T_can_sync *s   = &can_sync[can_sync_head];
+  INT32U     t;
+
+  t = now - bits * can_bit_cycles;
+  if ( can_sync_stat.cnt != 0 ) can_sync_stat.period = t - can_sync[(can_sync_head + CAN_SYNC_HIST_SZ - 1) % CAN_SYNC_HIST_SZ].t;
+  s->t     = t;
+  s->seq   = rx->data[0];
+  s->valid = 1;
+  can_sync_head = (can_sync_head + 1) % CAN_SYNC_HIST_SZ;
+
+  can_sync_stat.cnt++;
+  can_sync_stat.seq       = rx->data[0];
+  can_sync_stat.last_bits = bits;
+  if ( bits > can_sync_stat.max_bits ) can_sync_stat.max_bits = bits;
+}
+
 /*-------------------------------------------------------------------------------------------------------------
   Обслуживание прерываний CAN шины при отправке и получении данных
+
+  Все кадры находящиеся в Rx FIFO выбираются в очередь задачи приема в порядке поступления.
+  Команды требующие немедленной реакции выполняются здесь же, остальные обрабатывает задача CAN_Rx_Task
 -------------------------------------------------------------------------------------------------------------*/
 void CAN_isr(pointer ptr)
 {
+  INT32U                   t0 = DWT_CYCCNT;
   volatile CAN_MemMapPtr   CAN;
   INT32U                   reg;
+  INT32U                   batch;
+  INT32U                   next;
+  T_can_rx                *rx;
 
+  TRACE_ISR_ENTER(TRACE_ISR_CAN);
   CAN = (CAN_MemMapPtr)ptr;
 
-  reg = CAN->IFLAG1; // Получить флаги прерываний (всего в работе 16-ть младших флагов).
-                     // Если не разрешен FIFO то каждый флаг отмечает прерывание от соответствующего буфера.
-                     // Снимаються флаги записью 1
-                     // Каждый флаг может отмечать, как прерывание по приему так и по передаче.
+  reg = CAN->IFLAG1 & CAN->IMASK1; // Получить флаги разрешенных прерываний.
+                                   // Флаги 5..7 относятся к Rx FIFO, остальные к буферам передачи.
+                                   // Снимаються флаги записью 1
   if ( reg )
   {
-    _lwevent_set(&can_event, reg); // Создать для каждого флага событие
-    CAN->IFLAG1 = reg;             // Сбрасываем флаги, но только те о которых мы сообщили
+    if ( reg & CAN_FIFO_WARN ) can_rx_stat.warnings++;
+    if ( reg & CAN_FIFO_OVF  ) can_rx_stat.overflows++;
+    if ( reg & CAN_FIFO_AVAIL )
+    {
+      batch = 0;
+      while ( CAN->IFLAG1 & CAN_FIFO_AVAIL )
+      {
+        // Кадр читается в свободный элемент очереди, при переполнении очереди он будет перезаписан следующим
+        rx = &can_rx_q[can_rx_q_head];
+        CAN_read_rx_fifo(CAN, rx);
+        CAN_log_push(rx);
+        batch++;
+
+        if ( (rx->canid == INVERT_REQ) && (rx->len > 0) && (rx->data[0] == EMERGENCY_STOP_MOVING) )
+        {
+          CAN_fast_emergency_stop(CAN, rx, t0);
+        }
+        else if ( (rx->canid == INVERT_SYNC) && (rx->len > 0) )
+        {
+          CAN_sync_capture(CAN, rx);
+        }
+
+        next = can_rx_q_head + 1;
+        if ( next >= CAN_RX_Q_SZ ) next = 0;
+        if ( next == can_rx_q_tail ) can_rx_stat.q_overflows++;
+        else can_rx_q_head = next;
+      }
+      can_rx_stat.frames += batch;
+      can_rx_stat.batches++;
+      if ( batch > can_rx_stat.max_batch ) can_rx_stat.max_batch = batch;
+    }
+    _lwevent_set(&can_event, (reg & CAN_FIFO_AVAIL) ? (reg | CAN_LOG_EVENT) : reg); // Создать для каждого флага событие и уведомить о записи в лог
+    CAN->IFLAG1 = reg & ~CAN_FIFO_AVAIL; // Сбрасываем флаги о которых мы сообщили. Флаг наличия кадра снят при чтении FIFO
+    if ( reg & CAN_TX_MB_MASK )
+    {
+      // Освободившиеся майлбоксы сразу занимаем пакетами из очередей
+      can_tx_busy &= ~(reg & CAN_TX_MB_MASK);
+      CAN_tx_dispatch(CAN);
+    }
   }
+  TRACE_ISR_LEAVE(TRACE_ISR_CAN);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Подсчет ошибок по флагам регистра ESR1. Флаги ошибок BIT1ERR..STFERR сбрасываются чтением ESR1,
+  поэтому каждое чтение регистра должно сопровождаться подсчетом
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_err_count(INT32U esr)
+{
+  if ( esr & BIT(15) ) can_err_stat.bit1_errs++;  // BIT1ERR
+  if ( esr & BIT(14) ) can_err_stat.bit0_errs++;  // BIT0ERR
+  if ( esr & BIT(13) ) can_err_stat.ack_errs++;   // ACKERR
+  if ( esr & BIT(12) ) can_err_stat.crc_errs++;   // CRCERR
+  if ( esr & BIT(11) ) can_err_stat.form_errs++;  // FRMERR
+  if ( esr & BIT(10) ) can_err_stat.stuff_errs++; // STFERR
 }
+
 /*-------------------------------------------------------------------------------------------------------------
   Обслуживание прерываний CAN шины в результате ошибок м других событий
+  Восстановление после Bus Off выполняет задача приема в CAN_err_poll
 -------------------------------------------------------------------------------------------------------------*/
 void CAN_err_isr(pointer ptr)
 {
   volatile CAN_MemMapPtr   CAN;
+  INT32U                   esr;
   INT32U                   reg;
 
   CAN = (CAN_MemMapPtr)ptr;
 
-  // Получить флаги ошибок и сбросить их
-  reg = CAN->ESR1 & (
+  esr = CAN->ESR1;
+  CAN_err_count(esr);
+
+  // Получить флаги прерываний и сбросить их
+  reg = esr & (
                      BIT(17)   // TWRNINT. 1 The Tx error counter transitioned from less than 96 to greater than or equal to 96.
                      + BIT(16) // RWRNINT. 1 The Rx error counter transitioned from less than 96 to greater than or equal to 96.
                      + BIT(2)  // BOFFINT. ‘Bus Off’ Interrupt
@@ -62,114 +240,15 @@ void CAN_err_isr(pointer ptr)
                      );
   if ( reg  )
   {
-    CAN->ESR1 = reg; // Сбрасываем флаги
-  }
-}
-
-/*-------------------------------------------------------------------------------------------------------------
- 
--------------------------------------------------------------------------------------------------------------*/
-int Solve_can_timings(INT32U clk, INT32U bitrate, T_can_ctrl *ctrl)
-{
-  INT32U TQ_x_Prescaler = clk / bitrate;
-  INT32U TQ;
-  INT32U lowest_diff;
-  INT32U diff;
-  INT32U best_TQ;
-  INT32U actual_freq;
-
-
-  ctrl->pseg1    = 0;
-  ctrl->pseg2    = 0;
-  ctrl->propseg  = 0;
-  ctrl->rjw      = 0;
-  ctrl->presdiv  = 0;
-
-
-  // If BSP_CANPE_CLOCK is defined, then we will calculate the CAN bit timing parameters
-  // using the method outlined in AN1798, section 4.1. A maximum time for PROP_SEG will be used,
-  // the remaining TQ will be split equally between PSEG1 and PSEG2, provided PSEG2 >=2. RJW is
-  // set to the minimum of 4 or PSEG1.
-
-
-  if ( TQ_x_Prescaler < (CAN_MIN_TQ - 1) )
-  {
-    // We will be off by more than 12.5%
-    return MQX_ERROR;
-  }
-
-  // First, find the best TQ and pre-scaler to use for the desired frequency. If any exact matches
-  // is found, we use the match that gives us the lowest pre-scaler and highest TQ, otherwise we pick
-  // the TQ and prescaler that generates the closest frequency to the desired frequency.
-
-  lowest_diff = bitrate;
-  best_TQ = 0;
-  for (TQ = CAN_MAX_TQ; TQ >= CAN_MIN_TQ; TQ--)
-  {
-    ctrl->presdiv = TQ_x_Prescaler / TQ;
-    if ( ctrl->presdiv <= 256 )
+    if ( reg & BIT(17) ) can_err_stat.tx_warns++;
+    if ( reg & BIT(16) ) can_err_stat.rx_warns++;
+    if ( reg & BIT(2) )
     {
-      if ( TQ_x_Prescaler == TQ * ctrl->presdiv )
-      {
-        best_TQ = TQ;
-        break;
-      }
-      actual_freq = (clk / ctrl->presdiv) / TQ;
-
-      if ( actual_freq > bitrate )
-      {
-        diff = actual_freq - bitrate;
-      }
-      else
-      {
-        diff = bitrate - actual_freq;
-      }
-
-      if ( diff < lowest_diff )
-      {
-        lowest_diff = diff;
-        best_TQ = TQ;
-      }
+      can_err_stat.bus_offs++;
+      can_boff_pending = 1;
     }
+    CAN->ESR1 = reg; // Сбрасываем флаги
   }
-  if ( (best_TQ >= CAN_MIN_TQ) && (ctrl->presdiv <= 256) )
-  {
-    ctrl->pseg2 = (best_TQ - CAN_MAX_PROPSEG) / 2;
-    if ( ctrl->pseg2 < CAN_MIN_PSEG2 ) ctrl->pseg2 = CAN_MIN_PSEG2;
-
-    if ( best_TQ == CAN_MIN_TQ )
-    {
-      ctrl->pseg1 = 1;
-    }
-    else
-    {
-      ctrl->pseg1 = ctrl->pseg2;
-    }
-
-    ctrl->propseg = best_TQ - ctrl->pseg1 - ctrl->pseg2 - 1;
-
-    if ( ctrl->pseg1 < CAN_MAX_RJW  )
-    {
-      ctrl->rjw = ctrl->pseg1;
-    }
-    else
-    {
-      ctrl->rjw = CAN_MAX_RJW;
-    }
-
-    ctrl->propseg -= 1;
-    ctrl->rjw     -= 1;
-    ctrl->pseg1   -= 1;
-    ctrl->pseg2   -= 1;
-    ctrl->presdiv -= 1;
-  }
-  else
-  {
-    return MQX_ERROR;
-  }
-
-  return MQX_OK;
-
 }
 
 /*-------------------------------------------------------------------------------------------------------------
@@ -187,7 +266,11 @@ int CAN_init(CAN_MemMapPtr ptr, INT32U bitrate)
 
 
   _lwevent_create(&can_event, 0);
-  _lwsem_create(&can_log_sem, 1);
+  can_tx_ptr = ptr;
+
+  // Счетчик тактов ядра для измерения задержки аварийной остановки
+  DEMCR    |= BIT(24); // TRCENA. Разрешение блоков DWT и ITM
+  DWT_CTRL |= BIT(0);  // CYCCNTENA
 
   if ( ptr == CAN0_BASE_PTR )
   {
@@ -248,7 +331,9 @@ int CAN_init(CAN_MemMapPtr ptr, INT32U bitrate)
   while ((CAN->MCR & BIT(24)) == 0)   // Ожидаем установки FRZACK
   {}
 
+  // Расчет параметров битового интервала для частоты тактирования clk и скорости bitrate (CAN_protocol.c)
   Solve_can_timings(clk, bitrate, &ctrl);
+  can_bit_cycles = (ctrl.presdiv + 1) * (4 + ctrl.propseg + ctrl.pseg1 + ctrl.pseg2) * (BSP_SYSTEM_CLOCK / clk);
 
   CAN->CTRL1 = 0
                + LSHIFT(ctrl.presdiv, 24) // PRESDIV. Prescaler Division Factor
@@ -262,7 +347,7 @@ int CAN_init(CAN_MemMapPtr ptr, INT32U bitrate)
                + LSHIFT(1,            11) // TWRNMSK. Tx Warning Interrupt Mask. 1 Tx Warning Interrupt enabled
                + LSHIFT(1,            10) // RWRNMSK. Rx Warning Interrupt Mask. 1 Rx Warning Interrupt enabled
                + LSHIFT(0,             7) // SMP    . CAN Bit Sampling. 0 Just one sample is used to determine the bit value
-               + LSHIFT(0,             6) // BOFFREC. Bus Off Recovery. 1 Automatic recovering from Bus Off state disabled
+               + LSHIFT(1,             6) // BOFFREC. Bus Off Recovery. 1 Automatic recovering from Bus Off state disabled. Восстановление выполняет CAN_err_poll
                + LSHIFT(0,             5) // TSYN   . Timer Sync. 1 Timer Sync feature enabled
                + LSHIFT(0,             4) // LBUF   . Lowest Buffer Transmitted First. 1 Lowest number buffer is transmitted first.
                + LSHIFT(0,             3) // LOM    . Listen-Only Mode. 1 FlexCAN module operates in Listen-Only Mode.
@@ -286,13 +371,44 @@ int CAN_init(CAN_MemMapPtr ptr, INT32U bitrate)
     CAN->MB[i].WORD0 = 0; //
     CAN->MB[i].WORD1 = 0; //
   }
-  //CAN->RXIMR[CAN_RX_MB1] = 0xFF000000;
+
+  // RFEN и IRMQ записываются только в режиме Freeze, поэтому устанавливаем их до выхода из него
+  CAN->MCR |= 0
+              + BIT(29) // RFEN   . Rx FIFO Enable
+              + BIT(16) // IRMQ   . Individual Rx Masking and Queue Enable
+              + BIT(13) // LPRIOEN. Local Priority Enable. Поле PRIO майлбокса участвует в выборе пакета для передачи
+  ;
+
+  // Заполняем таблицу фильтров Rx FIFO и индивидуальные маски фильтров.
+  // Формат A: бит 31 - RTR, бит 30 - IDE, биты 29..1 - расширенный идентификатор или биты 29..19 - стандартный
+  {
+    volatile INT32U *flt = &CAN->MB[CAN_RX_FILTER_MB].CS;
+    const T_can_rx_filter *f;
+
+    for (i = 0; i < CAN_RX_FIFO_FILTERS; i++)
+    {
+      f = &rx_filters[i < sizeof(rx_filters) / sizeof(rx_filters[0]) ? i : 0];
+      if ( f->ext )
+      {
+        flt[i]         = BIT(30) + ((f->canid & 0x1FFFFFFF) << 1);
+        CAN->RXIMR[i]  = BIT(31) + BIT(30) + ((f->canid_mask & 0x1FFFFFFF) << 1);
+      }
+      else
+      {
+        flt[i]         = (f->canid & 0x7FF) << 19;
+        CAN->RXIMR[i]  = BIT(31) + BIT(30) + ((f->canid_mask & 0x7FF) << 19);
+      }
+    }
+    CAN->RXFGMASK = 0xFFFFFFFF;
+  }
+  CAN->IFLAG1 = CAN_FIFO_AVAIL + CAN_FIFO_WARN + CAN_FIFO_OVF;
+  CAN->IMASK1 = CAN_FIFO_AVAIL + CAN_FIFO_WARN + CAN_FIFO_OVF;
 
   // Выходим из режима Freeze
   CAN->MCR = 0
              + LSHIFT(0,  31) // MDIS   . Module Disable. 1 Disable the FlexCAN module.
              + LSHIFT(0,  30) // FRZ    . Freeze Enable. 1 Enabled to enter Freeze Mode
-             + LSHIFT(0,  29) // RFEN   . Rx FIFO Enable. 1 Rx FIFO enabled
+             + LSHIFT(1,  29) // RFEN   . Rx FIFO Enable. 1 Rx FIFO enabled
              + LSHIFT(0,  28) // HALT   . Halt FlexCAN. 1 Enters Freeze Mode if the FRZ bit is asserted.
              + LSHIFT(0,  26) // WAKMSK . Wake Up Interrupt Mask. 1 Wake Up Interrupt is enabled.
              + LSHIFT(0,  25) // SOFTRST. Soft Reset. 1 Resets the registers affected by soft reset.
@@ -300,11 +416,11 @@ int CAN_init(CAN_MemMapPtr ptr, INT32U bitrate)
              + LSHIFT(0,  22) // SLFWAK . Self Wake Up. 1 FlexCAN Self Wake Up feature is enabled.
              + LSHIFT(1,  21) // WRNEN  . Warning Interrupt Enable. 1 TWRNINT and RWRNINT bits are set when the respective error counter transitions from less than 96 to greater than or equal to 96.
              + LSHIFT(1,  17) // SRXDIS . Self Reception Disable. 1 Self reception disabled
-             + LSHIFT(1,  16) // IRMQ   . Individual Rx Masking and Queue Enable. 1 Individual Rx masking and queue feature are enabled.
-             + LSHIFT(0,  13) // LPRIOEN. Local Priority Enable. 1 Local Priority enabled
+             + LSHIFT(1,  16) // IRMQ   . Individual Rx Masking and Queue Enable. 1 Individual Rx masking and queue feature are enabled. Фильтры FIFO 0..7 маскируются RXIMR0..7
+             + LSHIFT(1,  13) // LPRIOEN. Local Priority Enable. 1 Local Priority enabled
              + LSHIFT(0,  12) // AEN    . Abort Enable. 0 Abort disabled.  !!!Не выставлять 1, поскольку процедуры инициализации MB расчитаны на режим 0
              + LSHIFT(0,   8) // IDAM   . ID Acceptance Mode. 00 Format A: One full ID (standard and extended) per ID Filter Table element.
-             + LSHIFT(16,  0) // MAXMB  . Number of the Last Message Buffer.
+             + LSHIFT(15,  0) // MAXMB  . Number of the Last Message Buffer.
   ;
 
   return MQX_OK;
@@ -312,52 +428,6 @@ int CAN_init(CAN_MemMapPtr ptr, INT32U bitrate)
 
 
 
-/*-------------------------------------------------------------------------------------------------------------
-  Установка буффера на прием и инициация приема
-  n    - номер буфера
-  id   - идентификатор CAN пакета
-  mask - фильтр-маска принимаемого идентификатора
-  ext  - если расширенный формат то 1, иначе 0
-  rtr  - если 1 то будет отправлен пакет вида Remote Request Frame 
--------------------------------------------------------------------------------------------------------------*/
-void CAN_set_rx_mbox(volatile CAN_MemMapPtr CAN, INT8U n, INT32U id, INT32U mask, INT8U ext, INT8U rtr)
-{
-  // Переходим в Freeze режим поскольку маску фильтра можно изменить только в этом режиме
-  CAN->MCR |= 0
-              + BIT(30) // FRZ    . Freeze Enable. 1 Enabled to enter Freeze Mode
-              + BIT(28) // HALT   . Halt FlexCAN. 1 Enters Freeze Mode if the FRZ bit is asserted.
-  ;
-  while ((CAN->MCR & BIT(24)) == 0)   // Ожидаем установки FRZACK
-  {}
-
-  // Сбросим флаг прерывания
-  CAN->IFLAG1  |= (1 << n);
-
-  // Инициализируем mailbox на передачу
-  CAN->MB[n].CS = 0
-                  + LSHIFT(0x0,     24) // CODE. 0b0000:INACTIVE- MB is not active.
-                  + LSHIFT(1,       22) // SRR.  Substitute Remote Request. (должен быть 1 в расширенном формате)
-                  + LSHIFT(ext,     21) // IDE.  ID Extended Bit.           1 = расширенный формат
-                  + LSHIFT(rtr,     20) // RTR.  Remote Transmission Request. 1 - это mailbox с Remote Request Frame
-                  + LSHIFT(0,       16) // DLC.  Длина данных
-  ;
-  CAN->MB[n].ID    = id;
-  CAN->MB[n].WORD0 = 0;
-  CAN->MB[n].WORD1 = 0;
-  CAN->RXIMR[n] = mask; // Установим маску
-
-
-  CAN->IMASK1  |= (1 << n); // Разрешаем прерывания после приема
-
-  // Обозначаем готовность к приему
-  CAN->MB[n].CS |= BIT(26); // 0b0100: EMPTY - MB is active and empty.
-
-  CAN->MCR &= ~(BIT(30) + BIT(28)); // Выходим из режиме Freeze
-  while (CAN->MCR & BIT(24))        // Ожидаем сброса FRZACK
-  {}
-
-}
-
 /*-------------------------------------------------------------------------------------------------------------
   Установка буффера на отправку и инициация отправки
   n    - номер буфера
@@ -369,8 +439,8 @@ void CAN_set_rx_mbox(volatile CAN_MemMapPtr CAN, INT8U n, INT32U id, INT32U mask
 -------------------------------------------------------------------------------------------------------------*/
 void CAN_set_tx_mbox(volatile CAN_MemMapPtr CAN, INT8U n, INT32U id, INT8U *data, INT8U len, INT8U ext, INT8U rtr)
 {
-  // Сбросим флаг прерывания
-  CAN->IFLAG1  |= (1 << n);
+  // Сбросим флаг прерывания. Только запись, чтение-модификация-запись сняла бы флаг Rx FIFO и удалила бы кадр
+  CAN->IFLAG1  = (1 << n);
   // Инициализируем mailbox на передачу
   CAN->MB[n].CS = 0
                   + LSHIFT(0x8,     24) // CODE. 0b1000:MB is not active
@@ -389,6 +459,135 @@ void CAN_set_tx_mbox(volatile CAN_MemMapPtr CAN, INT8U n, INT32U id, INT8U *data
   CAN->MB[n].CS |= BIT(26); // 0b1100: DATA - MB is a Tx Data Frame (MB RTR must be 0)
 }
 
+/*-------------------------------------------------------------------------------------------------------------
+  Проверка есть ли в майлбоксах пула кадр с тем же приоритетом и идентификатором
+  Такие кадры FlexCAN передает начиная с майлбокса с меньшим номером, а не в порядке загрузки
+-------------------------------------------------------------------------------------------------------------*/
+static int CAN_tx_id_in_flight(INT32U prio_id)
+{
+  INT32U n;
+
+  for (n = 0; n < CAN_TX_MB_NUM; n++)
+  {
+    if ( (can_tx_busy & (1UL << (CAN_TX_MB_FIRST + n))) && (can_tx_mb_id[n] == prio_id) ) return 1;
+  }
+  return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Загрузка пакетов из очередей передачи в свободные майлбоксы пула
+  Вызывается при запрещенных прерываниях или из прерывания CAN_isr.
+  Телеметрия и блочная передача не занимают последние CAN_TX_MB_RESERVED свободных майлбоксов.
+  Пакет из очереди не загружается пока передается предыдущий пакет с тем же идентификатором,
+  так сохраняется порядок очереди (например сегментов ответа).
+  Кадры блочной передачи загружаются только когда очереди пусты
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_tx_dispatch(volatile CAN_MemMapPtr CAN)
+{
+  INT32U    n;
+  INT32U    p;
+  INT32U    busy_cnt;
+  INT32U    pending;
+  T_can_tx *tx;
+  T_can_tx  bulk_tx;
+
+  busy_cnt = 0;
+  for (n = 0; n < CAN_TX_MB_NUM; n++)
+  {
+    if ( can_tx_busy & (1UL << (CAN_TX_MB_FIRST + n)) ) busy_cnt++;
+  }
+
+  for (n = 0; n < CAN_TX_MB_NUM; n++)
+  {
+    if ( can_tx_busy & (1UL << (CAN_TX_MB_FIRST + n)) ) continue;
+
+    pending = 0;
+    for (p = 0; p < CAN_TX_PRIO_NUM; p++)
+    {
+      if ( can_tx_q_head[p] == can_tx_q_tail[p] ) continue;
+      pending = 1;
+      if ( (p != CAN_TX_PRIO_ANS) && (busy_cnt >= CAN_TX_MB_NUM - CAN_TX_MB_RESERVED) ) continue;
+      if ( CAN_tx_id_in_flight(LSHIFT(p, 29) | can_tx_q[p][can_tx_q_tail[p]].canid) ) continue;
+      break;
+    }
+    if ( p < CAN_TX_PRIO_NUM )
+    {
+      tx = &can_tx_q[p][can_tx_q_tail[p]];
+      if ( ++can_tx_q_tail[p] >= CAN_TX_Q_SZ ) can_tx_q_tail[p] = 0;
+    }
+    else
+    {
+      // Очереди пусты, майлбокс занимаем кадром блочной передачи
+      if ( pending ) return;
+      if ( busy_cnt >= CAN_TX_MB_NUM - CAN_TX_MB_RESERVED ) return;
+      if ( CAN_bulk_frame(&bulk_tx) == 0 ) return;
+      tx = &bulk_tx;
+      p  = CAN_TX_PRIO_BULK;
+    }
+    can_tx_mb_id[n] = LSHIFT(p, 29) | tx->canid;
+    CAN_set_tx_mbox(CAN, CAN_TX_MB_FIRST + n, can_tx_mb_id[n], tx->data, tx->len, tx->ext, 0);
+    can_tx_busy |= (1UL << (CAN_TX_MB_FIRST + n));
+    busy_cnt++;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Поставить пакет в очередь передачи
+  prio - CAN_TX_PRIO_ANS или CAN_TX_PRIO_TELEM
+  Возвращает MQX_ERROR если очередь переполнена
+-------------------------------------------------------------------------------------------------------------*/
+_mqx_uint CAN_send(INT32U prio, INT32U id, INT8U *data, INT8U len, INT8U ext)
+{
+  INT32U    next;
+  INT32U    q_len;
+  T_can_tx *tx;
+
+  if ( prio >= CAN_TX_PRIO_NUM ) return MQX_ERROR;
+
+  _int_disable();
+  next = can_tx_q_head[prio] + 1;
+  if ( next >= CAN_TX_Q_SZ ) next = 0;
+  if ( next == can_tx_q_tail[prio] )
+  {
+    can_tx_stat.drops[prio]++;
+    _int_enable();
+    return MQX_ERROR;
+  }
+  tx = &can_tx_q[prio][can_tx_q_head[prio]];
+  tx->canid = id;
+  tx->len   = len;
+  tx->ext   = ext;
+  memcpy(tx->data, data, 8);
+  can_tx_q_head[prio] = next;
+
+  can_tx_stat.queued[prio]++;
+  q_len = (can_tx_q_head[prio] + CAN_TX_Q_SZ - can_tx_q_tail[prio]) % CAN_TX_Q_SZ;
+  if ( q_len > can_tx_stat.max_q[prio] ) can_tx_stat.max_q[prio] = q_len;
+
+  CAN_tx_dispatch(can_tx_ptr);
+  _int_enable();
+  return MQX_OK;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить статистику очередей передачи
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_get_tx_stat(T_can_tx_stat *st)
+{
+  _int_disable();
+  *st = can_tx_stat;
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Занять свободные майлбоксы кадрами блочной передачи
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_tx_kick(void)
+{
+  _int_disable();
+  CAN_tx_dispatch(can_tx_ptr);
+  _int_enable();
+}
 
 /*-------------------------------------------------------------------------------------------------------------
   Выборка данных из mailbox-а с принятым пакетом
@@ -406,6 +605,7 @@ void CAN_read_rx_mbox(volatile CAN_MemMapPtr CAN, INT8U n, T_can_rx *rx)
   rx->ext  = (cs >> 21) & 1;
   rx->rtr  = (cs >> 20) & 1;
   rx->code = (cs >> 24) & 0x0F;
+  rx->stamp = cs & 0xFFFF;
   rx->canid  = CAN->MB[n].ID;
   w = CAN->MB[n].WORD0;
   rx->data[0] = (w >> 24) & 0xFF;
@@ -422,91 +622,258 @@ void CAN_read_rx_mbox(volatile CAN_MemMapPtr CAN, INT8U n, T_can_rx *rx)
 }
 
 /*-------------------------------------------------------------------------------------------------------------
+  Выборка очередного пакета из Rx FIFO
+  Вызывается только при установленном флаге CAN_FIFO_AVAIL
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_read_rx_fifo(volatile CAN_MemMapPtr CAN, T_can_rx *rx)
+{
+  CAN_read_rx_mbox(CAN, CAN_RX_FIFO_MB, rx);
+  rx->hit = CAN->RXFIR & 0x1FF; // IDHIT. Номер сработавшего фильтра, действителен до снятия флага
+  rx->time = CAN_time_update(CAN);
+  rx->time -= (rx->time - rx->stamp) & 0xFFFF; // Отметка кадра отстает от текущего значения таймера
+  if ( rx->ext ) rx->canid &= 0x1FFFFFFF;
+  CAN->IFLAG1 = CAN_FIFO_AVAIL; // Удаляем кадр из FIFO, на выход перемещается следующий
+}
 
+/*-------------------------------------------------------------------------------------------------------------
+  Получить статистику приема
 -------------------------------------------------------------------------------------------------------------*/
-void CAN_Tx_Task(uint_32 parameter)
+void CAN_get_rx_stat(T_can_rx_stat *st)
 {
-  volatile CAN_MemMapPtr   CAN = (CAN_MemMapPtr)parameter;
+  *st = can_rx_stat;
+}
 
-  INT8U databl[8] =
-  {
-    0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00
-  };
+/*-------------------------------------------------------------------------------------------------------------
+  Получить статистику аварийных остановок выполненных в прерывании
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_get_estop_stat(T_can_estop_stat *st)
+{
+  _int_disable();
+  *st = can_estop_stat;
+  _int_enable();
+}
 
-  // Периодическая отправка тестового сообщения
-  while (1)
+/*-------------------------------------------------------------------------------------------------------------
+  Ожидание записи в лог
+-------------------------------------------------------------------------------------------------------------*/
+_mqx_uint CAN_wait_log_rec(_mqx_uint ticks)
+{
+  if ( _lwevent_wait_ticks(&can_event, CAN_LOG_EVENT, FALSE, ticks) == MQX_OK )
   {
-/*
-    CAN_set_tx_mbox(CAN, CAN_TX_MB1, PDISPLx_REQ, databl, 3, 1, 0);
-    databl[1]++;
-    if ( databl[1] > 15 )
-    {
-      databl[1] = 0;
-    }
-*/
-    _time_delay(1000);
+    _lwevent_clear(&can_event, CAN_LOG_EVENT);
+    return MQX_OK;
   }
-
+  return MQX_ERROR;
 }
 
-
 /*-------------------------------------------------------------------------------------------------------------
+  Изъять из лога самую старую запись. Вызывается только одной задачей
+-------------------------------------------------------------------------------------------------------------*/
+_mqx_uint CAN_pop_log_rec(T_can_rx  *rx)
+{
+  INT32U tail = can_log_tail;
+
+  if ( tail == can_log_head ) return MQX_ERROR;
+  __DMB(); // Запись читается после индекса
+  *rx = can_log[tail & (CAN_RX_LOG_SZ - 1)];
+  __DMB(); // Запись должна быть прочитана раньше освобождения места
+  can_log_tail = tail + 1;
+  return MQX_OK;
+}
 
+/*-------------------------------------------------------------------------------------------------------------
+  Скопировать непрочитанные записи лога без изъятия, от старых к новым. Возвращает количество записей
+  Записи освобожденные читателем во время копирования могли быть перезаписаны прерыванием и отбрасываются
 -------------------------------------------------------------------------------------------------------------*/
-_mqx_uint CAN_wait_log_rec(_mqx_uint ticks)
+INT32U CAN_copy_log(T_can_rx *dst, INT32U max)
 {
-  if ( _lwevent_wait_ticks(&can_event, 0x80000000, FALSE, ticks) == MQX_OK )
+  INT32U tail = can_log_tail;
+  INT32U n    = can_log_head - tail;
+  INT32U skip;
+  INT32U i;
+
+  if ( n > max ) n = max;
+  __DMB();
+  for (i = 0; i < n; i++)
   {
-    _lwevent_clear(&can_event, 0x80000000);
-    return MQX_OK;
+    dst[i] = can_log[(tail + i) & (CAN_RX_LOG_SZ - 1)];
   }
-  return MQX_ERROR;
+  __DMB();
+  skip = can_log_tail - tail;
+  if ( skip >= n ) return 0;
+  if ( skip > 0 ) memmove(dst, dst + skip, (n - skip) * sizeof(T_can_rx));
+  return n - skip;
 }
 
 /*-------------------------------------------------------------------------------------------------------------
+  Контроль состояния шины. Вызывается задачей приема не реже чем раз в CAN_RX_POLL_TICKS
 
+  Обновляет счетчики ошибок, время в состояниях Error Passive и Bus Off и историю счетчиков по секундам.
+  После Bus Off через выдержку hold_ms снимается BOFFREC, контроллер ждет 128 последовательностей из 11
+  рецессивных битов и возвращается на шину, после чего BOFFREC снова устанавливается.
+  Каждое восстановление удваивает выдержку, так что узел с неисправным кабелем не забивает шину ошибками
 -------------------------------------------------------------------------------------------------------------*/
-_mqx_uint CAN_pop_log_rec(T_can_rx  *rx)
+static void CAN_err_poll(volatile CAN_MemMapPtr CAN)
 {
-  _lwsem_wait(&can_log_sem);
-  if ( rx_log_head != rx_log_tail )
+  static MQX_TICK_STRUCT t_last;
+  static INT32U          init;
+  static INT32U          recovering;
+  static INT32U          hold_cnt_ms;  // Время с начала выдержки
+  static INT32U          stable_ms;    // Время работы без Bus Off
+  static INT32U          sec_ms;
+  static T_can_err_hist  sec;          // Накопление текущей секунды истории
+  MQX_TICK_STRUCT        t;
+  boolean                ovfl;
+  INT32U                 dt;
+  INT32U                 esr;
+  INT32U                 ecr;
+  INT32U                 flt;
+  INT32U                 n;
+  INT8U                  peak;
+
+  _time_get_ticks(&t);
+  if ( init == 0 )
+  {
+    t_last = t;
+    init   = 1;
+    can_err_stat.hold_ms = CAN_BOFF_HOLD_MIN_MS;
+    return;
+  }
+  dt     = _time_diff_milliseconds(&t, &t_last, &ovfl);
+  t_last = t;
+
+  _int_disable();
+  esr = CAN->ESR1;
+  CAN_err_count(esr);
+  ecr = CAN->ECR;
+  flt = (esr >> 4) & 0x03;   // FLTCONF
+  if ( flt > CAN_FLT_BUS_OFF ) flt = CAN_FLT_BUS_OFF;
+
+  can_err_stat.fltconf = flt;
+  can_err_stat.tec     = ecr & 0xFF;         // TXERRCNT
+  can_err_stat.rec     = (ecr >> 8) & 0xFF;  // RXERRCNT
+  if ( can_err_stat.tec > can_err_stat.tec_max ) can_err_stat.tec_max = can_err_stat.tec;
+  if ( can_err_stat.rec > can_err_stat.rec_max ) can_err_stat.rec_max = can_err_stat.rec;
+  if ( flt == CAN_FLT_PASSIVE ) can_err_stat.passive_ms += dt;
+  if ( flt == CAN_FLT_BUS_OFF ) can_err_stat.bus_off_ms += dt;
+
+  // Восстановление после Bus Off
+  if ( can_boff_pending )
   {
-    *rx = rx_log[rx_log_tail];
-    rx_log_tail++;
-    if ( rx_log_tail >= CAN_RX_LOG_SZ )
+    if ( recovering == 0 )
     {
-      rx_log_tail = 0; 
+      hold_cnt_ms += dt;
+      if ( hold_cnt_ms >= can_err_stat.hold_ms )
+      {
+        CAN->CTRL1 &= ~BIT(6); // BOFFREC = 0. Запуск восстановления
+        recovering = 1;
+        can_err_stat.recoveries++;
+        can_err_stat.hold_ms *= 2;
+        if ( can_err_stat.hold_ms > CAN_BOFF_HOLD_MAX_MS ) can_err_stat.hold_ms = CAN_BOFF_HOLD_MAX_MS;
+      }
+    }
+    else if ( flt != CAN_FLT_BUS_OFF )
+    {
+      CAN->CTRL1 |= BIT(6);  // BOFFREC = 1. Следующий Bus Off снова будет ждать выдержку
+      recovering       = 0;
+      hold_cnt_ms      = 0;
+      stable_ms        = 0;
+      can_boff_pending = 0;
     }
-    _lwsem_post(&can_log_sem);
-    return MQX_OK;
   }
-  _lwsem_post(&can_log_sem);
-  return MQX_ERROR;
+  else if ( stable_ms < CAN_BOFF_STABLE_MS )
+  {
+    stable_ms += dt;
+    if ( stable_ms >= CAN_BOFF_STABLE_MS ) can_err_stat.hold_ms = CAN_BOFF_HOLD_MIN_MS;
+  }
+
+  // История по секундам
+  if ( can_err_stat.tec > sec.tec     ) sec.tec     = can_err_stat.tec;
+  if ( can_err_stat.rec > sec.rec     ) sec.rec     = can_err_stat.rec;
+  if ( flt              > sec.fltconf ) sec.fltconf = flt;
+  sec_ms += dt;
+  if ( sec_ms >= 1000 )
+  {
+    sec_ms = (sec_ms >= 2000) ? 0 : sec_ms - 1000;
+    can_err_hist[can_err_hist_head] = sec;
+    if ( ++can_err_hist_head >= CAN_ERR_HIST_SZ ) can_err_hist_head = 0;
+    if ( can_err_hist_cnt < CAN_ERR_HIST_SZ ) can_err_hist_cnt++;
+    memset(&sec, 0, sizeof(sec));
+
+    peak = 0;
+    for (n = 0; n < can_err_hist_cnt; n++)
+    {
+      if ( can_err_hist[n].tec > peak ) peak = can_err_hist[n].tec;
+      if ( can_err_hist[n].rec > peak ) peak = can_err_hist[n].rec;
+    }
+    can_err_stat.peak_1m = peak;
+  }
+  _int_enable();
 }
+
 /*-------------------------------------------------------------------------------------------------------------
+  Получить статистику ошибок шины
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_get_err_stat(T_can_err_stat *st)
+{
+  _int_disable();
+  *st = can_err_stat;
+  _int_enable();
+}
 
+/*-------------------------------------------------------------------------------------------------------------
+  Получить историю счетчиков ошибок, не более n последних секунд, начиная с последней
+  Возвращает количество записей
 -------------------------------------------------------------------------------------------------------------*/
-static _mqx_uint CAN_push_log_rec(T_can_rx  *rx)
+INT32U CAN_get_err_hist(T_can_err_hist *h, INT32U n)
 {
-  _lwsem_wait(&can_log_sem);
-  rx_log[rx_log_head] = *rx;
-  rx_log_head++;
-  if ( rx_log_head >= CAN_RX_LOG_SZ )
+  INT32U i;
+  INT32U k;
+
+  _int_disable();
+  if ( n > can_err_hist_cnt ) n = can_err_hist_cnt;
+  k = can_err_hist_head;
+  for (i = 0; i < n; i++)
   {
-    rx_log_head = 0;
+    k = (k == 0) ? CAN_ERR_HIST_SZ - 1 : k - 1;
+    h[i] = can_err_hist[k];
   }
-  if ( rx_log_head == rx_log_tail )
+  _int_enable();
+  return n;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить момент приема кадра синхронизации с номером seq в тактах ядра DWT_CYCCNT
+  Используются только кадры принятые не ранее CAN_SYNC_MAX_AGE_MS назад
+-------------------------------------------------------------------------------------------------------------*/
+_mqx_uint CAN_get_sync(INT8U seq, INT32U *t)
+{
+  _mqx_uint res = MQX_ERROR;
+  INT32U    i;
+
+  _int_disable();
+  for (i = 0; i < CAN_SYNC_HIST_SZ; i++)
   {
-    rx_log_tail++;  
-    if ( rx_log_tail >= CAN_RX_LOG_SZ )
+    if ( can_sync[i].valid && (can_sync[i].seq == seq) &&
+         ((DWT_CYCCNT - can_sync[i].t) < CAN_SYNC_MAX_AGE_MS * (BSP_SYSTEM_CLOCK / 1000)) )
     {
-      rx_log_tail = 0; 
+      *t  = can_sync[i].t;
+      res = MQX_OK;
+      break;
     }
   }
-  _lwsem_post(&can_log_sem);
+  _int_enable();
+  return res;
+}
 
-  _lwevent_set(&can_event, 0x80000000); // Уведомить о записи в лог
-  return 0;
+/*-------------------------------------------------------------------------------------------------------------
+
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_get_sync_stat(T_can_sync_stat *st)
+{
+  _int_disable();
+  *st = can_sync_stat;
+  _int_enable();
 }
 
 /*-------------------------------------------------------------------------------------------------------------
@@ -515,85 +882,29 @@ static _mqx_uint CAN_push_log_rec(T_can_rx  *rx)
 void CAN_Rx_Task(uint_32 parameter)
 {
   volatile CAN_MemMapPtr   CAN = (CAN_MemMapPtr)parameter;
-  _mqx_uint events;
   T_can_rx  rx;
-  T_MC_CBL     *mc_pcbl;
-
-
-  INT32U    n;
-  INT32U    events_mask = 0;
-
-  mc_pcbl = MC_get_pcbl();
-
-  rx_log_head=0;
-  rx_log_tail=0;
-  // Инициализация всех майлбоксов предназначенных для приема сообщений
-  for (n = 0; n < RX_MBOX_CNT; n++)
-  {
-    CAN_set_rx_mbox(CAN, rx_mboxes[n].mb_num, rx_mboxes[n].canid, rx_mboxes[n].canid_mask, 1, 0);
-    events_mask |= (1 << rx_mboxes[n].mb_num);
-  }
 
   while (1)
   {
 
-    if ( _lwevent_wait_ticks(&can_event, events_mask, FALSE, 0) == MQX_OK )
+    CAN_bulk_poll();
+    CAN_err_poll(CAN);
+    _int_disable();
+    CAN_time_update(CAN); // Расширение таймера не должно пропустить его переполнение
+    _int_enable();
+
+    if ( _lwevent_wait_ticks(&can_event, CAN_FIFO_AVAIL, FALSE, CAN_RX_POLL_TICKS) == MQX_OK )
     {
-      events = _lwevent_get_signalled();
-      _lwevent_clear(&can_event, events);
+      _lwevent_clear(&can_event, CAN_FIFO_AVAIL);
 
-      for (n = 0; n < RX_MBOX_CNT; n++)
+      // Выбираем все кадры из очереди в порядке приема
+      while ( can_rx_q_tail != can_rx_q_head )
       {
-        if ( events & (1 << rx_mboxes[n].mb_num) )
-        {
-          CAN_read_rx_mbox(CAN, rx_mboxes[n].mb_num, &rx);
- 
-          CAN_push_log_rec(&rx);
-
-          // Парсинг полученного пакета 
-          
-          if ( rx.canid == INVERT_REQ )
-          {
-            switch (rx.data[0])
-            {
-            case START_MOVING:
-              
-              if ( rx.data[1] == MOVING_UP )
-              {
-                 mc_pcbl->up_move_freq    = rx.data[2];
-                 mc_pcbl->up_acceler_time = rx.data[3];
-                 MC_set_events(MOTOR_START_UP);
-              }
-              else if ( rx.data[1] == MOVING_DOWN )
-              {
-                mc_pcbl->down_move_freq    = rx.data[2];    
-                mc_pcbl->down_acceler_time = rx.data[3];    
-                MC_set_events(MOTOR_START_DOWN);
-              }
-
-              //MC_start_motor_moving(rx.data[1], rx.data[2], rx.data[3]);
-              break;
-            case STOP_MOVING:
-              if ( mc_pcbl->direction == MOVING_DOWN )
-              {
-                mc_pcbl->down_deceler_time = rx.data[1];
-              }
-              else
-              {
-                mc_pcbl->up_deceler_time = rx.data[1];
-              }
-
-              MC_set_events(MOTOR_STOP);
-
-              //MC_stop_motor_moving(rx.data[1]);
-              break;
-
-            case EMERGENCY_STOP_MOVING:
-              MC_emergency_stop_motor();
-              break;
-            }
-          }
-        }
+        rx = can_rx_q[can_rx_q_tail];
+        if ( can_rx_q_tail + 1 >= CAN_RX_Q_SZ ) can_rx_q_tail = 0;
+        else can_rx_q_tail++;
+        // Парсинг полученного пакета
+        CAN_process_rx(&rx);
       }
     }
   }
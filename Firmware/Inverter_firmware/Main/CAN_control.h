@@ -13,23 +13,104 @@
   #define CAN_MIN_PSEG2 2
 
 
-  // Майлбоксы на чтение
-  #define CAN_RX_MB1     0
-  #define CAN_RX_MB2     1
-  #define CAN_RX_MB3     2
-  #define CAN_RX_MB4     3
-  #define CAN_RX_MB5     4
-  #define CAN_RX_MB6     5
-  #define CAN_RX_MB7     6
-  #define CAN_RX_MB8     7
-  // Всего майлбоксов на чтение
-  #define RX_MBOX_CNT    8
+  // Прием через Rx FIFO. При RFFN = 0 выход FIFO находится в MB0, память FIFO занимает MB0..MB5,
+  // таблица из 8 фильтров формата A занимает MB6..MB7. Свободные буферы начинаются с MB8
+  #define CAN_RX_FIFO_FILTERS  8
+  #define CAN_RX_FIFO_MB       0
+  #define CAN_RX_FILTER_MB     6
 
-  // Майлбоксы на передачу
-  #define CAN_TX_MB1     8
+  // Очередь принятых кадров от прерывания к задаче приема
+  #define CAN_RX_Q_SZ          32
 
-  // Количество сообщений в логе приемника
-  #define CAN_RX_LOG_SZ  128
+  // Флаги Rx FIFO в IFLAG1
+  #define CAN_FIFO_AVAIL       BIT(5) // В FIFO есть кадр. Запись 1 удаляет кадр из FIFO
+  #define CAN_FIFO_WARN        BIT(6) // В FIFO 5 кадров
+  #define CAN_FIFO_OVF         BIT(7) // Кадр потерян из-за переполнения FIFO
+
+  // Майлбоксы на передачу. Пакеты из очередей передачи распределяются по свободным майлбоксам пула
+  #define CAN_TX_MB_FIRST     8
+  #define CAN_TX_MB_NUM       8                                   // MB8..MB15
+  #define CAN_TX_MB_MASK      (((1UL << CAN_TX_MB_NUM) - 1) << CAN_TX_MB_FIRST)
+  #define CAN_TX_MB_RESERVED  2   // Количество майлбоксов которые не занимаются телеметрией и всегда свободны для ответов
+
+  // Приоритеты очередей передачи. Меньшее значение - более высокий приоритет.
+  // Приоритет записывается также в поле PRIO майлбокса для локального арбитража (LPRIOEN).
+  // Пакеты одной очереди с одинаковым идентификатором передаются в порядке постановки в очередь:
+  // в майлбоксах пула одновременно находится не более одного такого пакета.
+  // Кадры блочной передачи этого порядка не имеют, получатель собирает блок по номерам кадров
+  #define CAN_TX_PRIO_ANS     0   // Ответы на команды
+  #define CAN_TX_PRIO_TELEM   1   // Периодическая телеметрия
+  #define CAN_TX_PRIO_NUM     2
+  #define CAN_TX_PRIO_BULK    2   // Кадры блочной передачи. Очереди не имеют, формируются при освобождении майлбоксов
+  #define CAN_TX_Q_SZ         16  // Размер очереди каждого приоритета
+
+  // Телеметрия на INVERT_ONBUS_MSG
+  #define CAN_TELEM_PERIOD_DEF  10  // Период по умолчанию в единицах 10 мс
+  #define CAN_TELEM_MUX_NUM     4   // Количество мультиплексированных пакетов в цикле телеметрии
+  #define CAN_TELEM_TEMP_INVALID 0x8000 // Температура не достоверна. Достоверные значения ограничены +-32767
+
+  // Восстановление после Bus Off. Автоматическое восстановление контроллера запрещено (BOFFREC = 1),
+  // восстановление запускает задача приема после выдержки, которая удваивается при повторных отключениях
+  #define CAN_BOFF_HOLD_MIN_MS  100   // Начальная выдержка перед восстановлением
+  #define CAN_BOFF_HOLD_MAX_MS  5000  // Максимальная выдержка
+  #define CAN_BOFF_STABLE_MS    10000 // Время работы без Bus Off после которого выдержка возвращается к начальной
+  #define CAN_ERR_HIST_SZ       60    // Глубина истории счетчиков ошибок в секундах
+
+  // Состояние узла по полю FLTCONF регистра ESR1
+  #define CAN_FLT_ACTIVE        0     // Error Active
+  #define CAN_FLT_PASSIVE       1     // Error Passive
+  #define CAN_FLT_BUS_OFF       2     // Bus Off
+
+  // Блочная передача данных на INVERT_BULK (BULK_OPEN, BULK_ACK, BULK_ABORT)
+  #define BULK_BLOCK_FRAMES   16  // Кадров в блоке. В каждом кадре 7 байт данных блока
+  #define BULK_BLOCK_BYTES    (BULK_BLOCK_FRAMES * 7)
+  #define BULK_BLOCK_DATA     (BULK_BLOCK_BYTES - 4) // Байт данных объекта в блоке, последние 4 байта блока - CRC32
+  #define BULK_WIN_MAX        8   // Максимальное количество блоков в окне подтверждения
+  #define BULK_ACK_TIMEOUT_MS 500 // Время ожидания подтверждения окна после которого окно передается повторно
+  #define BULK_MAX_RETRIES    3   // Количество повторов окна без подтверждения до прекращения передачи
+  #define CAN_RX_POLL_TICKS   4   // Период проверки таймаутов задачей приема
+
+  #define BULK_OBJ_TEST       0   // Тестовая последовательность заданной длины: байт i равен (i ^ (i >> 8)) & 0xFF
+  #define BULK_OBJ_MEAS       1   // Снимок результатов измерений T_meas_snapshot
+  #define BULK_OBJ_CAN_LOG    2   // Непрочитанные записи лога приемника CAN, T_can_rx от старых к новым
+
+  #define BULK_OK             0   // Коды результата BULK_OPEN
+  #define BULK_ERR_OBJ        1   // Нет такого объекта
+  #define BULK_ERR_EMPTY      2   // Объект пуст
+  #define BULK_ERR_SIZE       3   // Длина тестовой последовательности больше BULK_TEST_SIZE_MAX
+  #define BULK_TEST_SIZE_MAX  0x1000000 // Наибольшая длина тестовой последовательности, 16 Мбайт
+
+  // Словарь параметров (OD_READ, OD_WRITE, OD_BATCH_READ, OD_BATCH_WRITE)
+  #define OD_TYPE_U32         0   // Типы значений параметров. Значение всегда передается 4-я байтами, старший байт первым
+  #define OD_TYPE_I32         1
+  #define OD_TYPE_FLOAT       2   // IEEE 754 одинарной точности
+
+  #define OD_RO               0   // Только чтение
+  #define OD_RW               1   // Чтение и запись
+
+  #define OD_SRC_CBL          0   // Параметр находится в управляющей структуре двигателя T_MC_CBL
+  #define OD_SRC_TELEM        1   // Период телеметрии
+
+  #define OD_OK               0   // Коды результата операции
+  #define OD_ERR_INDEX        1   // Нет параметра с таким индексом
+  #define OD_ERR_ACCESS       2   // Параметр только для чтения
+  #define OD_ERR_TYPE         3   // Тип значения не совпадает с типом параметра
+  #define OD_ERR_RANGE        4   // Значение вне допустимого диапазона
+  #define OD_ERR_SEQ          5   // Нарушена последовательность сегментов пакетной записи
+  #define OD_ERR_SIZE         6   // Недопустимое количество параметров в пакете
+
+  #define OD_SEG_LAST         0x80 // Признак последнего сегмента в номере сегмента
+  #define OD_BATCH_MAX        16   // Максимальное количество параметров в пакетной записи
+
+  // Общая шкала времени группы инверторов по кадрам INVERT_SYNC (команда SYNC_START)
+  #define CAN_SYNC_HIST_SZ    4    // Количество запоминаемых последних кадров синхронизации
+  #define CAN_SYNC_MAX_AGE_MS 1000 // Кадр синхронизации старше этого времени не используется для назначения старта
+
+  // Лог приемника. Заполняется прерыванием CAN_isr, читается без блокировок. При заполнении новые кадры отбрасываются.
+  // Отметки времени - таймер FlexCAN расширенный до 32 бит. Расширение обновляется прерыванием приема и задачей приема
+  // раз в CAN_RX_POLL_TICKS, что чаще переполнения 16-и битного таймера (65 мс при 1 Мбит/с)
+  #define CAN_RX_LOG_SZ  128       // Количество записей. Степень двойки
+  #define CAN_LOG_EVENT  BIT(31)   // Событие can_event о записи в лог
 
 
 
@@ -52,23 +133,150 @@ typedef struct
   INT8U  ext;     //Формат идентификатора(расширенный = 1, стандартный = 0)
   INT8U  rtr;     //Признак  Remote Request Frame
   INT8U  code;
+  INT16U hit;     //Номер фильтра Rx FIFO по которому принят пакет
+  INT16U stamp;   //Отметка времени приема. Таймер FlexCAN в битовых интервалах, фиксируется в начале поля идентификатора
+  INT32U time;    //Отметка времени приема расширенная до 32 бит (битовые интервалы)
 }
 T_can_rx;
 
 typedef struct
 {
-  INT8U  mb_num;
-  INT32U canid;
-  INT32U canid_mask;
+  INT32U canid;   // Идентификатор CAN пакета
+  INT8U  data[8]; // Данные
+  INT8U  len;     // Длина данных
+  INT8U  ext;     // Формат идентификатора(расширенный = 1, стандартный = 0)
+}
+T_can_tx;
+
+typedef struct
+{
+  INT32U queued[CAN_TX_PRIO_NUM];  // Поставлено в очередь пакетов
+  INT32U drops[CAN_TX_PRIO_NUM];   // Отброшено пакетов из-за переполнения очереди
+  INT32U max_q[CAN_TX_PRIO_NUM];   // Максимальная длина очереди
+} T_can_tx_stat;
 
-} T_can_rx_config;
+typedef struct
+{
+  INT32U canid;      // Идентификатор
+  INT32U canid_mask; // Маска сравниваемых битов идентификатора
+  INT8U  ext;        // Формат идентификатора(расширенный = 1, стандартный = 0)
 
+} T_can_rx_filter;
 
-int  CAN_init(CAN_MemMapPtr ptr, INT32U bitrate);
-void CAN_Tx_Task(uint_32 parameter);
-void CAN_Rx_Task(uint_32 parameter);
+typedef struct
+{
+  INT32U frames;     // Принято кадров
+  INT32U batches;    // Количество прерываний по приему. За одно прерывание выбираются все кадры находящиеся в FIFO
+  INT32U max_batch;  // Максимальное количество кадров выбранных за одно прерывание
+  INT32U warnings;   // Количество заполнений FIFO до 5 кадров
+  INT32U overflows;  // Количество кадров потерянных из-за переполнения FIFO
+  INT32U q_overflows;// Количество кадров потерянных из-за переполнения очереди задачи приема
+  INT32U log_drops;  // Количество кадров не записанных в лог из-за его заполнения
+} T_can_rx_stat;
+
+typedef struct
+{
+  INT32U cnt;          // Количество аварийных остановок выполненных в прерывании
+  INT32U last_cycles;  // Время от входа в прерывание до перевода выходов PWM в безопасное состояние (такты ядра)
+  INT32U max_cycles;
+  INT32U last_bits;    // Время от начала кадра на шине до перевода выходов PWM в безопасное состояние (битовые интервалы).
+  INT32U max_bits;     // Включает длительность самого кадра
+} T_can_estop_stat;
+
+typedef struct
+{
+  INT32U bit0_errs;   // Ошибки бита: передан доминантный, принят рецессивный
+  INT32U bit1_errs;   // Ошибки бита: передан рецессивный, принят доминантный
+  INT32U ack_errs;    // Нет подтверждения переданного кадра
+  INT32U crc_errs;    // Ошибки CRC
+  INT32U form_errs;   // Ошибки формата кадра
+  INT32U stuff_errs;  // Ошибки вставки битов
+  INT32U tx_warns;    // Переходы счетчика ошибок передачи через 96
+  INT32U rx_warns;    // Переходы счетчика ошибок приема через 96
+  INT32U bus_offs;    // Переходы в Bus Off
+  INT32U recoveries;  // Запущено восстановлений после Bus Off
+  INT32U passive_ms;  // Время в состоянии Error Passive (мс)
+  INT32U bus_off_ms;  // Время в состоянии Bus Off (мс)
+  INT32U hold_ms;     // Выдержка перед следующим восстановлением (мс)
+  INT8U  fltconf;     // Текущее состояние CAN_FLT_*
+  INT8U  tec;         // Текущий счетчик ошибок передачи
+  INT8U  rec;         // Текущий счетчик ошибок приема
+  INT8U  tec_max;     // Максимальные значения счетчиков с момента включения
+  INT8U  rec_max;
+  INT8U  peak_1m;     // Максимальный из счетчиков TEC и REC за последнюю минуту
+} T_can_err_stat;
+
+typedef struct
+{
+  INT8U  tec;         // Максимальный счетчик ошибок передачи за секунду
+  INT8U  rec;         // Максимальный счетчик ошибок приема за секунду
+  INT8U  fltconf;     // Худшее состояние за секунду CAN_FLT_*
+} T_can_err_hist;
+
+typedef struct
+{
+  INT32U t;           // Момент начала кадра на шине в тактах ядра DWT_CYCCNT
+  INT8U  seq;         // Номер кадра синхронизации
+  INT8U  valid;
+} T_can_sync;
+
+typedef struct
+{
+  INT32U cnt;         // Принято кадров синхронизации
+  INT32U seq;         // Номер последнего кадра
+  INT32U period;      // Интервал между двумя последними кадрами (такты ядра)
+  INT32U last_bits;   // Время от начала кадра синхронизации до его обработки в прерывании (битовые интервалы)
+  INT32U max_bits;
+} T_can_sync_stat;
+
+typedef struct
+{
+  INT32U sessions;    // Начато передач
+  INT32U completed;   // Завершено передач
+  INT32U aborted;     // Прервано командой BULK_ABORT или по исчерпанию повторов
+  INT32U windows;     // Подтверждено окон
+  INT32U blocks;      // Передано блоков, включая повторные
+  INT32U retx_blocks; // Блоков передано повторно по запросу или таймауту
+  INT32U timeouts;    // Таймаутов ожидания подтверждения
+} T_can_bulk_stat;
+
+typedef struct
+{
+  INT8U  index;  // Индекс параметра
+  INT8U  type;   // Тип значения OD_TYPE_*
+  INT8U  access; // OD_RO или OD_RW
+  INT8U  src;    // Размещение параметра OD_SRC_*
+  INT16U offs;   // Смещение параметра в T_MC_CBL для OD_SRC_CBL
+  float  min;    // Допустимый диапазон при записи
+  float  max;
+} T_od_entry;
+
+
+// Аппаратная часть драйвера, CAN_control.c. В сборке для Linux реализуется портом на SocketCAN
+int       CAN_init(CAN_MemMapPtr ptr, INT32U bitrate);
+void      CAN_Rx_Task(uint_32 parameter);
 
 _mqx_uint CAN_wait_log_rec(_mqx_uint ticks);
 _mqx_uint CAN_pop_log_rec(T_can_rx  *rx);
+INT32U    CAN_copy_log(T_can_rx *dst, INT32U max);
+void      CAN_get_rx_stat(T_can_rx_stat *st);
+void      CAN_get_estop_stat(T_can_estop_stat *st);
+_mqx_uint CAN_send(INT32U prio, INT32U id, INT8U *data, INT8U len, INT8U ext);
+void      CAN_tx_kick(void);
+void      CAN_get_tx_stat(T_can_tx_stat *st);
+void      CAN_get_err_stat(T_can_err_stat *st);
+INT32U    CAN_get_err_hist(T_can_err_hist *h, INT32U n);
+_mqx_uint CAN_get_sync(INT8U seq, INT32U *t);
+void      CAN_get_sync_stat(T_can_sync_stat *st);
+
+// Протокольная часть, CAN_protocol.c. К регистрам контроллера не обращается
+int       Solve_can_timings(INT32U clk, INT32U bitrate, T_can_ctrl *ctrl);
+void      CAN_Tx_Task(uint_32 parameter);
+void      CAN_process_rx(T_can_rx *rx);
+void      CAN_set_telem_period(INT32U period);
+INT32U    CAN_get_telem_period(void);
+void      CAN_bulk_poll(void);
+int       CAN_bulk_frame(T_can_tx *tx);
+void      CAN_get_bulk_stat(T_can_bulk_stat *st);
 
 #endif
@@ -0,0 +1,1113 @@
+#ifdef CAN_HOST_BUILD
+  #include "CAN_host.h"
+#else
+  #include "App.h"
+#endif
+#include <stddef.h>
+
+// Протокольная часть драйвера CAN: команды INVERT_REQ, словарь параметров, блочная передача и телеметрия.
+// К регистрам контроллера не обращается. Кадры передаются через CAN_send и CAN_tx_kick,
+// поэтому модуль собирается также для Linux с портом на SocketCAN (Firmware/Linux_tools/can_host)
+
+static INT32U           can_telem_period = CAN_TELEM_PERIOD_DEF;
+
+// Блочная передача. Состояние изменяется при запрещенных прерываниях.
+// Кадры формирует CAN_bulk_frame по запросу драйвера при освобождении майлбоксов
+#define BULK_IDLE      0
+#define BULK_SENDING   1  // Передаются блоки окна отмеченные в pend
+#define BULK_WAIT_ACK  2  // Окно передано, ожидается BULK_ACK
+#define BULK_NO_BLOCK  BULK_WIN_MAX
+
+static struct
+{
+  INT32U state;
+  INT32U obj;
+  INT32U size;        // Длина объекта в байтах
+  INT32U blocks;      // Количество блоков объекта
+  INT32U win;         // Номер текущего окна
+  INT32U win_first;   // Номер первого блока текущего окна
+  INT32U win_sz;      // Заданное количество блоков в окне
+  INT32U win_blocks;  // Количество блоков в текущем окне
+  INT32U pend;        // Маска блоков окна ожидающих передачи
+  INT32U blk;         // Номер в окне блока подготовленного в buf, BULK_NO_BLOCK - блок не подготовлен
+  INT32U frame;       // Номер следующего кадра подготовленного блока
+  INT32U retries;     // Повторы окна по таймауту
+  INT32U wait_gen;    // Счетчик переходов в ожидание подтверждения
+  INT8U  buf[BULK_BLOCK_BYTES];
+} can_bulk;
+static T_can_bulk_stat can_bulk_stat;
+
+// Копия объекта фиксируется при открытии передачи
+static union
+{
+  T_meas_snapshot ms;
+  T_can_rx        log[CAN_RX_LOG_SZ];
+} can_bulk_src;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Расчет параметров битового интервала для частоты тактирования clk и скорости bitrate
+-------------------------------------------------------------------------------------------------------------*/
+int Solve_can_timings(INT32U clk, INT32U bitrate, T_can_ctrl *ctrl)
+{
+  INT32U TQ_x_Prescaler = clk / bitrate;
+  INT32U TQ;
+  INT32U lowest_diff;
+  INT32U diff;
+  INT32U best_TQ;
+  INT32U actual_freq;
+
+
+  ctrl->pseg1    = 0;
+  ctrl->pseg2    = 0;
+  ctrl->propseg  = 0;
+  ctrl->rjw      = 0;
+  ctrl->presdiv  = 0;
+
+
+  // If BSP_CANPE_CLOCK is defined, then we will calculate the CAN bit timing parameters
+  // using the method outlined in AN1798, section 4.1. A maximum time for PROP_SEG will be used,
+  // the remaining TQ will be split equally between PSEG1 and PSEG2, provided PSEG2 >=2. RJW is
+  // set to the minimum of 4 or PSEG1.
+
+
+  if ( TQ_x_Prescaler < (CAN_MIN_TQ - 1) )
+  {
+    // We will be off by more than 12.5%
+    return MQX_ERROR;
+  }
+
+  // First, find the best TQ and pre-scaler to use for the desired frequency. If any exact matches
+  // is found, we use the match that gives us the lowest pre-scaler and highest TQ, otherwise we pick
+  // the TQ and prescaler that generates the closest frequency to the desired frequency.
+
+  lowest_diff = bitrate;
+  best_TQ = 0;
+  for (TQ = CAN_MAX_TQ; TQ >= CAN_MIN_TQ; TQ--)
+  {
+    ctrl->presdiv = TQ_x_Prescaler / TQ;
+    if ( ctrl->presdiv <= 256 )
+    {
+      if ( TQ_x_Prescaler == TQ * ctrl->presdiv )
+      {
+        best_TQ = TQ;
+        break;
+      }
+      actual_freq = (clk / ctrl->presdiv) / TQ;
+
+      if ( actual_freq > bitrate )
+      {
+        diff = actual_freq - bitrate;
+      }
+      else
+      {
+        diff = bitrate - actual_freq;
+      }
+
+      if ( diff < lowest_diff )
+      {
+        lowest_diff = diff;
+        best_TQ = TQ;
+      }
+    }
+  }
+  if ( (best_TQ >= CAN_MIN_TQ) && (ctrl->presdiv <= 256) )
+  {
+    ctrl->pseg2 = (best_TQ - CAN_MAX_PROPSEG) / 2;
+    if ( ctrl->pseg2 < CAN_MIN_PSEG2 ) ctrl->pseg2 = CAN_MIN_PSEG2;
+
+    if ( best_TQ == CAN_MIN_TQ )
+    {
+      ctrl->pseg1 = 1;
+    }
+    else
+    {
+      ctrl->pseg1 = ctrl->pseg2;
+    }
+
+    ctrl->propseg = best_TQ - ctrl->pseg1 - ctrl->pseg2 - 1;
+
+    if ( ctrl->pseg1 < CAN_MAX_RJW  )
+    {
+      ctrl->rjw = ctrl->pseg1;
+    }
+    else
+    {
+      ctrl->rjw = CAN_MAX_RJW;
+    }
+
+    ctrl->propseg -= 1;
+    ctrl->rjw     -= 1;
+    ctrl->pseg1   -= 1;
+    ctrl->pseg2   -= 1;
+    ctrl->presdiv -= 1;
+  }
+  else
+  {
+    return MQX_ERROR;
+  }
+
+  return MQX_OK;
+
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Установить период телеметрии в единицах 10 мс. 0 - телеметрия выключена
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_set_telem_period(INT32U period)
+{
+  can_telem_period = period;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить период телеметрии в единицах 10 мс
+-------------------------------------------------------------------------------------------------------------*/
+INT32U CAN_get_telem_period(void)
+{
+  return can_telem_period;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Ограничение значения размером байта
+-------------------------------------------------------------------------------------------------------------*/
+static INT8U CAN_sat_byte(float v)
+{
+  if ( v < 0 ) return 0;
+  if ( v > 255 ) return 255;
+  return (INT8U)v;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Записать в буфер 16-и битное значение старшим байтом первым с ограничением диапазона
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_put_be16(INT8U *buf, float v, int is_signed)
+{
+  INT32S iv;
+
+  if ( is_signed )
+  {
+    if ( v >  32767 ) v =  32767;
+    if ( v < -32767 ) v = -32767;
+  }
+  else
+  {
+    if ( v > 65535 ) v = 65535;
+    if ( v < 0     ) v = 0;
+  }
+  iv = (INT32S)v;
+  buf[0] = (iv >> 8) & 0xFF;
+  buf[1] = iv & 0xFF;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Формирование пакета телеметрии с номером mux
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_telem_frame(INT32U mux, INT32U cycle, T_meas_snapshot *ms, INT8U *buf)
+{
+  T_MC_CBL          *mc_pcbl = MC_get_pcbl();
+  T_can_rx_stat      rs;
+  T_can_estop_stat   es;
+  T_can_tx_stat      ts;
+  T_can_err_stat     ers;
+  INT8U              st;
+  float              temp;
+
+  memset(buf, 0, 8);
+  buf[0] = (mux & 0x0F) | ((cycle & 0x0F) << 4);
+
+  switch (mux)
+  {
+  case 0:
+    st = mc_pcbl->action & 0x03;
+    if ( mc_pcbl->direction == MOVING_DOWN ) st |= BIT(2);
+    if ( PWM_state() )                      st |= BIT(3);
+    if ( mc_pcbl->motor_drv_fail )          st |= BIT(4);
+    if ( Pin_PWM_OE_state() == 0 )          st |= BIT(5);
+    buf[1] = st;
+    CAN_put_be16(&buf[2], (float)((mc_pcbl->ll_mot_freq * 100) >> 32), 0);
+    CAN_put_be16(&buf[4], ms->res[3].favr * 10.0, 0);
+    if ( TempCtrl_get_IGBT_temperature(&temp) == MQX_OK ) CAN_put_be16(&buf[6], temp * 10.0, 1);
+    else CAN_put_be16(&buf[6], CAN_TELEM_TEMP_INVALID, 0);
+    break;
+
+  case 1:
+    CAN_put_be16(&buf[1], ms->res[0].frms * 100.0, 0);
+    CAN_put_be16(&buf[3], ms->res[1].frms * 100.0, 0);
+    CAN_put_be16(&buf[5], ms->res[2].frms * 100.0, 0);
+    buf[7] = ms->info.sync ? 1 : 0;
+    break;
+
+  case 2:
+    CAN_get_rx_stat(&rs);
+    CAN_get_estop_stat(&es);
+    CAN_get_tx_stat(&ts);
+    CAN_put_be16(&buf[1], mc_pcbl->fail_cnt, 0);
+    CAN_put_be16(&buf[3], es.cnt, 0);
+    CAN_put_be16(&buf[5], rs.overflows + rs.q_overflows, 0);
+    buf[7] = CAN_sat_byte(ts.drops[CAN_TX_PRIO_TELEM]);
+    break;
+
+  case 3:
+    CAN_get_err_stat(&ers);
+    buf[1] = CAN_sat_byte(ers.bus_offs);
+    CAN_put_be16(&buf[2], ers.passive_ms / 1000, 0);
+    buf[4] = ers.tec;
+    buf[5] = ers.rec;
+    buf[6] = ers.peak_1m;
+    buf[7] = ers.fltconf & 0x03;
+    break;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Задача периодической передачи телеметрии на INVERT_ONBUS_MSG
+  Пакеты телеметрии имеют низший приоритет и не задерживают ответы на команды
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_Tx_Task(uint_32 parameter)
+{
+  T_meas_snapshot  ms;
+  INT8U            buf[8];
+  INT32U           mux;
+  INT32U           cycle = 0;
+  INT32U           period;
+
+  while (1)
+  {
+    period = can_telem_period;
+    if ( period == 0 )
+    {
+      _time_delay(100);
+      continue;
+    }
+
+    Get_meas_snapshot(&ms);
+    for (mux = 0; mux < CAN_TELEM_MUX_NUM; mux++)
+    {
+      CAN_telem_frame(mux, cycle, &ms, buf);
+      CAN_send(CAN_TX_PRIO_TELEM, INVERT_ONBUS_MSG, buf, 8, 1);
+    }
+    cycle++;
+    _time_delay(period * 10);
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отправить ответ с результатами гармонического анализа тока фазы ph
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_send_harmonics(INT8U ph)
+{
+  T_meas_harm  harm;
+  INT8U        ans[8];
+  INT32U       v;
+  INT32U       k;
+
+  memset(ans, 0, sizeof(ans));
+  ans[0] = GET_HARMONICS;
+  ans[1] = ph;
+
+  Get_copy_meas_harm(&harm);
+  if ( (ph >= MEAS_HARM_PH_NUM) || (harm.valid == 0) )
+  {
+    ans[1] |= 0x80;
+  }
+  else
+  {
+    v = (INT32U)(harm.rms[ph][0] * 100.0);
+    if ( v > 0xFFFF ) v = 0xFFFF;
+    ans[2] = (v >> 8) & 0xFF;
+    ans[3] = v & 0xFF;
+    for (k = 1; k < MEAS_HARM_NUM; k++)
+    {
+      if ( harm.rms[ph][0] > 0 ) ans[3 + k] = CAN_sat_byte(harm.rms[ph][k] * 1000.0 / harm.rms[ph][0]);
+    }
+    ans[7] = CAN_sat_byte(harm.imbalance * 10.0);
+  }
+  CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Записать в буфер со старшего байта значение длиной len байт с ограничением диапазона
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_put_sat_be(INT8U *buf, INT32U len, float v, int is_signed)
+{
+  float  lim = (float)(1UL << (len * 8 - (is_signed ? 1 : 0))) - 1;
+  INT32S iv;
+  INT32U n;
+
+  if ( v > lim ) v = lim;
+  if ( v < (is_signed ? -lim : 0) ) v = is_signed ? -lim : 0;
+  iv = (INT32S)v;
+  for (n = 0; n < len; n++)
+  {
+    buf[n] = (iv >> ((len - 1 - n) * 8)) & 0xFF;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отправить ответ с мощностью или счетчиками энергии, page - номер страницы ответа
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_send_power(INT8U page)
+{
+  T_meas_power pwr;
+  INT8U        ans[8];
+
+  memset(ans, 0, sizeof(ans));
+  ans[0] = GET_POWER;
+  ans[1] = page;
+
+  Get_copy_meas_power(&pwr);
+  switch (page)
+  {
+  case 0:
+    if ( pwr.valid == 0 ) ans[1] |= 0x80;
+    CAN_put_sat_be(&ans[2], 2, pwr.p / 10.0, 1);
+    CAN_put_sat_be(&ans[4], 2, pwr.q / 10.0, 0);
+    CAN_put_sat_be(&ans[6], 2, pwr.pf * 1000.0, 1);
+    break;
+  case 1:
+    CAN_put_sat_be(&ans[2], 3, pwr.kwh_motor * 10.0, 0);
+    CAN_put_sat_be(&ans[5], 3, pwr.kwh_regen * 10.0, 0);
+    break;
+  case 2:
+    CAN_put_sat_be(&ans[2], 3, pwr.trip_kwh_motor * 1000.0, 0);
+    CAN_put_sat_be(&ans[5], 3, pwr.trip_kwh_regen * 1000.0, 0);
+    break;
+  default:
+    ans[1] |= 0x80;
+    break;
+  }
+  CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+}
+
+#define OD_CBL(idx, type, acc, fld, min, max) { idx, type, acc, OD_SRC_CBL, offsetof(T_MC_CBL, fld), min, max }
+
+// Словарь параметров доступных по CAN. Диапазоны записи совпадают с проверками в меню теста двигателя
+static const T_od_entry od_table[] =
+{
+  OD_CBL(0x00, OD_TYPE_FLOAT, OD_RW, up_accel_pwm_scale,   0, 1),
+  OD_CBL(0x01, OD_TYPE_FLOAT, OD_RW, up_pwm_scale,         0, 1),
+  OD_CBL(0x02, OD_TYPE_FLOAT, OD_RW, up_decel_pwm_scale,   0, 1),
+  OD_CBL(0x03, OD_TYPE_I32,   OD_RW, up_move_freq,         1, 100),
+  OD_CBL(0x04, OD_TYPE_I32,   OD_RW, up_acceler_time,      0, 9999),
+  OD_CBL(0x05, OD_TYPE_I32,   OD_RW, up_deceler_time,      0, 9999),
+  OD_CBL(0x06, OD_TYPE_FLOAT, OD_RW, down_accel_pwm_scale, 0, 1),
+  OD_CBL(0x07, OD_TYPE_FLOAT, OD_RW, down_pwm_scale,       0, 1),
+  OD_CBL(0x08, OD_TYPE_FLOAT, OD_RW, down_decel_pwm_scale, 0, 1),
+  OD_CBL(0x09, OD_TYPE_I32,   OD_RW, down_move_freq,       1, 100),
+  OD_CBL(0x0A, OD_TYPE_I32,   OD_RW, down_acceler_time,    0, 9999),
+  OD_CBL(0x0B, OD_TYPE_I32,   OD_RW, down_deceler_time,    0, 9999),
+
+  OD_CBL(0x20, OD_TYPE_U32,   OD_RO, action,               0, 0),
+  OD_CBL(0x21, OD_TYPE_U32,   OD_RO, direction,            0, 0),
+  OD_CBL(0x22, OD_TYPE_U32,   OD_RO, mot_freq,             0, 0),
+  OD_CBL(0x23, OD_TYPE_FLOAT, OD_RO, pwm_scale,            0, 0),
+  OD_CBL(0x24, OD_TYPE_I32,   OD_RO, motor_drv_fail,       0, 0),
+  OD_CBL(0x25, OD_TYPE_I32,   OD_RO, fail_cnt,             0, 0),
+  OD_CBL(0x26, OD_TYPE_U32,   OD_RO, gov_k,                0, 0),
+  OD_CBL(0x27, OD_TYPE_U32,   OD_RO, stop_rep.cnt,         0, 0),
+  OD_CBL(0x28, OD_TYPE_U32,   OD_RO, stop_rep.start_freq,  0, 0),
+  OD_CBL(0x29, OD_TYPE_U32,   OD_RO, stop_rep.end_freq,    0, 0),
+  OD_CBL(0x2A, OD_TYPE_U32,   OD_RO, stop_rep.plan_time_ms,0, 0),
+  OD_CBL(0x2B, OD_TYPE_U32,   OD_RO, stop_rep.time_ms,     0, 0),
+  OD_CBL(0x2C, OD_TYPE_U32,   OD_RO, stop_rep.gov_time_ms, 0, 0),
+  OD_CBL(0x2D, OD_TYPE_FLOAT, OD_RO, stop_rep.decel,       0, 0),
+  OD_CBL(0x2E, OD_TYPE_FLOAT, OD_RO, stop_rep.vbus_max,    0, 0),
+
+  { 0x40, OD_TYPE_U32, OD_RW, OD_SRC_TELEM, 0, 0, 255 },
+};
+
+// Состояние приема пакетной записи
+static struct
+{
+  INT32U           cnt;                       // Принято сегментов
+  const T_od_entry *ent[OD_BATCH_MAX];
+  INT32U           val[OD_BATCH_MAX];
+} od_batch;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Найти параметр словаря по индексу. Возвращает NULL если параметра нет
+-------------------------------------------------------------------------------------------------------------*/
+static const T_od_entry* OD_find(INT8U index)
+{
+  INT32U n;
+
+  for (n = 0; n < sizeof(od_table) / sizeof(od_table[0]); n++)
+  {
+    if ( od_table[n].index == index ) return &od_table[n];
+  }
+  return NULL;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Прочитать значение параметра в виде 32-х битного слова
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U OD_get(const T_od_entry *ent)
+{
+  INT32U v;
+
+  if ( ent->src == OD_SRC_TELEM ) return CAN_get_telem_period();
+
+  _int_disable();
+  memcpy(&v, (INT8U *)MC_get_pcbl() + ent->offs, sizeof(v));
+  _int_enable();
+  return v;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Проверить возможность записи значения v типа type в параметр
+-------------------------------------------------------------------------------------------------------------*/
+static INT8U OD_check(const T_od_entry *ent, INT8U type, INT32U v)
+{
+  float f;
+
+  if ( ent == NULL ) return OD_ERR_INDEX;
+  if ( ent->access != OD_RW ) return OD_ERR_ACCESS;
+  if ( ent->type != type ) return OD_ERR_TYPE;
+
+  switch (type)
+  {
+  case OD_TYPE_U32:
+    f = (float)v;
+    break;
+  case OD_TYPE_I32:
+    f = (float)(INT32S)v;
+    break;
+  default:
+    memcpy(&f, &v, sizeof(f));
+    break;
+  }
+  // Сравнение записано так чтобы NaN не проходил проверку
+  if ( !((f >= ent->min) && (f <= ent->max)) ) return OD_ERR_RANGE;
+  return OD_OK;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Записать проверенное значение в параметр. Для OD_SRC_CBL вызывать с запрещенными прерываниями
+-------------------------------------------------------------------------------------------------------------*/
+static void OD_put(const T_od_entry *ent, INT32U v)
+{
+  if ( ent->src == OD_SRC_TELEM )
+  {
+    CAN_set_telem_period(v);
+    return;
+  }
+  memcpy((INT8U *)MC_get_pcbl() + ent->offs, &v, sizeof(v));
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Записать значение со старшего байта
+-------------------------------------------------------------------------------------------------------------*/
+static void OD_put_be32(INT8U *buf, INT32U v)
+{
+  buf[0] = (v >> 24) & 0xFF;
+  buf[1] = (v >> 16) & 0xFF;
+  buf[2] = (v >>  8) & 0xFF;
+  buf[3] = v & 0xFF;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Прочитать значение со старшего байта
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U OD_get_be32(INT8U *buf)
+{
+  return ((INT32U)buf[0] << 24) | ((INT32U)buf[1] << 16) | ((INT32U)buf[2] << 8) | buf[3];
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка команд OD_READ и OD_WRITE
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_od_access(T_can_rx *rx)
+{
+  const T_od_entry *ent = OD_find(rx->data[1]);
+  INT8U             ans[8];
+  INT8U             res = OD_OK;
+  INT32U            v;
+
+  memset(ans, 0, sizeof(ans));
+  ans[0] = rx->data[0];
+  ans[1] = rx->data[1];
+
+  if ( rx->data[0] == OD_WRITE )
+  {
+    v   = OD_get_be32(&rx->data[4]);
+    res = OD_check(ent, rx->data[2], v);
+    if ( res == OD_OK )
+    {
+      _int_disable();
+      OD_put(ent, v);
+      _int_enable();
+    }
+  }
+  else if ( ent == NULL )
+  {
+    res = OD_ERR_INDEX;
+  }
+
+  if ( ent != NULL )
+  {
+    ans[2] = ent->type;
+    OD_put_be32(&ans[4], OD_get(ent));
+  }
+  ans[3] = res;
+  CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка команды OD_BATCH_READ. Каждый параметр передается отдельным сегментом
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_od_batch_read(T_can_rx *rx)
+{
+  const T_od_entry *ent;
+  INT8U             ans[8];
+  INT32U            num = rx->data[1];
+  INT32U            n;
+
+  if ( num == 0 )
+  {
+    // Пустой запрос. Отвечаем одним последним сегментом с ошибкой, чтобы запросчик не ждал ответа
+    memset(ans, 0, sizeof(ans));
+    ans[0] = OD_BATCH_READ;
+    ans[1] = OD_SEG_LAST;
+    ans[3] = OD_ERR_SIZE << 4;
+    CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+    return;
+  }
+  if ( num > 6 ) num = 6;
+  for (n = 0; n < num; n++)
+  {
+    ent = OD_find(rx->data[2 + n]);
+    memset(ans, 0, sizeof(ans));
+    ans[0] = OD_BATCH_READ;
+    ans[1] = n;
+    if ( n == num - 1 ) ans[1] |= OD_SEG_LAST;
+    ans[2] = rx->data[2 + n];
+    if ( ent == NULL )
+    {
+      ans[3] = OD_ERR_INDEX << 4;
+    }
+    else
+    {
+      ans[3] = ent->type;
+      OD_put_be32(&ans[4], OD_get(ent));
+    }
+    CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка сегмента команды OD_BATCH_WRITE.
+  Сегменты накапливаются, после последнего сегмента все значения проверяются и записываются
+  в одной критической секции, так что задача двигателя не увидит частично измененный набор параметров
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_od_batch_write(T_can_rx *rx)
+{
+  INT8U  ans[8];
+  INT8U  res = OD_OK;
+  INT8U  bad = 0;
+  INT32U seg = rx->data[1] & ~OD_SEG_LAST;
+  INT32U n;
+
+  if ( seg == 0 ) od_batch.cnt = 0; // Сегмент 0 всегда начинает новый пакет
+
+  if ( seg != od_batch.cnt )
+  {
+    res = OD_ERR_SEQ;
+    bad = rx->data[2];
+  }
+  else if ( od_batch.cnt >= OD_BATCH_MAX )
+  {
+    res = OD_ERR_SIZE;
+    bad = rx->data[2];
+  }
+  else
+  {
+    od_batch.ent[od_batch.cnt] = OD_find(rx->data[2]);
+    od_batch.val[od_batch.cnt] = OD_get_be32(&rx->data[4]);
+    res = OD_check(od_batch.ent[od_batch.cnt], rx->data[3], od_batch.val[od_batch.cnt]);
+    bad = rx->data[2];
+    od_batch.cnt++;
+    if ( res == OD_OK )
+    {
+      if ( (rx->data[1] & OD_SEG_LAST) == 0 ) return; // Ждем следующих сегментов
+      _int_disable();
+      for (n = 0; n < od_batch.cnt; n++)
+      {
+        OD_put(od_batch.ent[n], od_batch.val[n]);
+      }
+      _int_enable();
+      bad = 0;
+    }
+  }
+
+  memset(ans, 0, sizeof(ans));
+  ans[0] = OD_BATCH_WRITE;
+  ans[1] = od_batch.cnt;
+  ans[2] = res;
+  ans[3] = bad;
+  CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+  od_batch.cnt = OD_BATCH_MAX + 1; // До следующего сегмента 0 пакет не принимается
+}
+
+// CRC32 (полином 0x04C11DB7 отраженный) по тетрадам
+static const INT32U crc32_nibble_tbl[16] =
+{
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/*-------------------------------------------------------------------------------------------------------------
+  Вычисление CRC32 с начальным значением и финальным XOR 0xFFFFFFFF
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U CAN_crc32(INT8U *buf, INT32U len)
+{
+  INT32U crc = 0xFFFFFFFFUL;
+
+  while ( len-- )
+  {
+    crc = crc32_nibble_tbl[(crc ^ *buf) & 0x0F] ^ (crc >> 4);
+    crc = crc32_nibble_tbl[(crc ^ (*buf >> 4)) & 0x0F] ^ (crc >> 4);
+    buf++;
+  }
+  return crc ^ 0xFFFFFFFFUL;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Подготовить в can_bulk.buf блок n окна: данные объекта, дополненные нулями, и CRC32
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_bulk_stage_block(INT32U n)
+{
+  INT32U offs = (can_bulk.win_first + n) * BULK_BLOCK_DATA;
+  INT32U len  = can_bulk.size - offs;
+  INT32U crc;
+  INT32U i;
+
+  if ( len > BULK_BLOCK_DATA ) len = BULK_BLOCK_DATA;
+  if ( can_bulk.obj == BULK_OBJ_TEST )
+  {
+    for (i = 0; i < len; i++)
+    {
+      can_bulk.buf[i] = ((offs + i) ^ ((offs + i) >> 8)) & 0xFF;
+    }
+  }
+  else
+  {
+    memcpy(can_bulk.buf, (INT8U *)&can_bulk_src + offs, len);
+  }
+  memset(&can_bulk.buf[len], 0, BULK_BLOCK_DATA - len);
+
+  crc = CAN_crc32(can_bulk.buf, BULK_BLOCK_DATA);
+  can_bulk.buf[BULK_BLOCK_DATA + 0] = (crc >> 24) & 0xFF;
+  can_bulk.buf[BULK_BLOCK_DATA + 1] = (crc >> 16) & 0xFF;
+  can_bulk.buf[BULK_BLOCK_DATA + 2] = (crc >>  8) & 0xFF;
+  can_bulk.buf[BULK_BLOCK_DATA + 3] = crc & 0xFF;
+
+  can_bulk.blk   = n;
+  can_bulk.frame = 0;
+  can_bulk_stat.blocks++;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Сформировать очередной кадр блочной передачи. Вызывается из CAN_tx_dispatch
+  Возвращает 0 если передавать нечего
+-------------------------------------------------------------------------------------------------------------*/
+int CAN_bulk_frame(T_can_tx *tx)
+{
+  INT32U n;
+
+  if ( can_bulk.state != BULK_SENDING ) return 0;
+
+  if ( can_bulk.blk == BULK_NO_BLOCK )
+  {
+    for (n = 0; n < can_bulk.win_blocks; n++)
+    {
+      if ( can_bulk.pend & (1UL << n) ) break;
+    }
+    if ( n >= can_bulk.win_blocks ) return 0;
+    can_bulk.pend &= ~(1UL << n);
+    CAN_bulk_stage_block(n);
+  }
+
+  tx->canid   = INVERT_BULK;
+  tx->len     = 8;
+  tx->ext     = 1;
+  tx->data[0] = ((can_bulk.win & 1) << 7) | (can_bulk.blk << 4) | can_bulk.frame;
+  memcpy(&tx->data[1], &can_bulk.buf[can_bulk.frame * 7], 7);
+
+  if ( ++can_bulk.frame >= BULK_BLOCK_FRAMES )
+  {
+    can_bulk.blk = BULK_NO_BLOCK;
+    if ( can_bulk.pend == 0 )
+    {
+      can_bulk.state = BULK_WAIT_ACK;
+      can_bulk.wait_gen++;
+    }
+  }
+  return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Начать передачу блоков окна отмеченных в mask. Вызывается при запрещенных прерываниях
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_bulk_send_window(INT32U mask)
+{
+  can_bulk.pend  = mask;
+  can_bulk.blk   = BULK_NO_BLOCK;
+  can_bulk.state = BULK_SENDING;
+  CAN_tx_kick();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Перейти к окну начинающемуся с блока can_bulk.win_first. Вызывается при запрещенных прерываниях
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_bulk_next_window(void)
+{
+  can_bulk.win_blocks = can_bulk.blocks - can_bulk.win_first;
+  if ( can_bulk.win_blocks > can_bulk.win_sz ) can_bulk.win_blocks = can_bulk.win_sz;
+  can_bulk.retries = 0;
+  CAN_bulk_send_window((1UL << can_bulk.win_blocks) - 1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка команды BULK_OPEN
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_bulk_open(T_can_rx *rx)
+{
+  INT8U  ans[8];
+  INT8U  res  = BULK_OK;
+  INT32U size = 0;
+  INT32U win  = rx->data[6];
+
+  // Текущая передача прекращается до изменения копии объекта
+  _int_disable();
+  if ( can_bulk.state != BULK_IDLE ) can_bulk_stat.aborted++;
+  can_bulk.state = BULK_IDLE;
+  _int_enable();
+
+  if ( (win == 0) || (win > BULK_WIN_MAX) ) win = BULK_WIN_MAX;
+
+  switch (rx->data[1])
+  {
+  case BULK_OBJ_TEST:
+    size = ((INT32U)rx->data[2] << 24) | ((INT32U)rx->data[3] << 16) | ((INT32U)rx->data[4] << 8) | rx->data[5];
+    if ( size > BULK_TEST_SIZE_MAX ) res = BULK_ERR_SIZE; // Иначе переполнение при расчете количества блоков
+    break;
+  case BULK_OBJ_MEAS:
+    Get_meas_snapshot(&can_bulk_src.ms);
+    size = sizeof(can_bulk_src.ms);
+    break;
+  case BULK_OBJ_CAN_LOG:
+    size = CAN_copy_log(can_bulk_src.log, CAN_RX_LOG_SZ) * sizeof(T_can_rx);
+    break;
+  default:
+    res = BULK_ERR_OBJ;
+    break;
+  }
+  if ( (res == BULK_OK) && (size == 0) ) res = BULK_ERR_EMPTY;
+
+  memset(ans, 0, sizeof(ans));
+  ans[0] = BULK_OPEN;
+  ans[1] = rx->data[1];
+  ans[2] = res;
+  ans[3] = win;
+  ans[4] = (size >> 24) & 0xFF;
+  ans[5] = (size >> 16) & 0xFF;
+  ans[6] = (size >>  8) & 0xFF;
+  ans[7] = size & 0xFF;
+  CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+
+  if ( res != BULK_OK ) return;
+
+  _int_disable();
+  can_bulk.obj       = rx->data[1];
+  can_bulk.size      = size;
+  can_bulk.blocks    = (size + BULK_BLOCK_DATA - 1) / BULK_BLOCK_DATA;
+  can_bulk.win       = 0;
+  can_bulk.win_first = 0;
+  can_bulk.win_sz    = win;
+  can_bulk_stat.sessions++;
+  CAN_bulk_next_window();
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка команды BULK_ACK. Подтверждение следующего окна означает что подтверждение ожидаемого окна потеряно,
+  а клиент принял его целиком и ждет следующее. Остальные подтверждения игнорируются
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_bulk_ack(T_can_rx *rx)
+{
+  INT32U mask;
+  INT32U n;
+
+  _int_disable();
+  if ( (can_bulk.state == BULK_WAIT_ACK) &&
+       ((rx->data[1] == (can_bulk.win & 0xFF)) || (rx->data[1] == ((can_bulk.win + 1) & 0xFF))) )
+  {
+    mask = 0;
+    if ( rx->data[1] == (can_bulk.win & 0xFF) ) mask = rx->data[2] & ((1UL << can_bulk.win_blocks) - 1);
+    if ( mask != 0 )
+    {
+      // Повторяем только блоки с ошибками
+      for (n = 0; n < can_bulk.win_blocks; n++)
+      {
+        if ( mask & (1UL << n) ) can_bulk_stat.retx_blocks++;
+      }
+      CAN_bulk_send_window(mask);
+    }
+    else
+    {
+      can_bulk_stat.windows++;
+      can_bulk.win_first += can_bulk.win_blocks;
+      can_bulk.win++;
+      if ( can_bulk.win_first >= can_bulk.blocks )
+      {
+        can_bulk.state = BULK_IDLE;
+        can_bulk_stat.completed++;
+      }
+      else
+      {
+        CAN_bulk_next_window();
+      }
+    }
+  }
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка команды BULK_ABORT
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_bulk_abort(void)
+{
+  _int_disable();
+  if ( can_bulk.state != BULK_IDLE ) can_bulk_stat.aborted++;
+  can_bulk.state = BULK_IDLE;
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Проверка таймаута подтверждения окна. Вызывается задачей приема не реже чем раз в CAN_RX_POLL_TICKS
+  Окно без подтверждения передается целиком повторно, после BULK_MAX_RETRIES повторов передача прекращается
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_bulk_poll(void)
+{
+  static MQX_TICK_STRUCT t0;
+  static INT32U          t0_gen;
+  static INT32U          t0_valid;
+  MQX_TICK_STRUCT        t;
+  boolean                ovfl;
+
+  if ( can_bulk.state != BULK_WAIT_ACK )
+  {
+    t0_valid = 0;
+    return;
+  }
+  if ( (t0_valid == 0) || (t0_gen != can_bulk.wait_gen) )
+  {
+    // Начало ожидания отсчитываем от первой проверки после перехода в ожидание
+    _time_get_ticks(&t0);
+    t0_gen   = can_bulk.wait_gen;
+    t0_valid = 1;
+    return;
+  }
+  _time_get_ticks(&t);
+  if ( _time_diff_milliseconds(&t, &t0, &ovfl) < BULK_ACK_TIMEOUT_MS ) return;
+
+  t0_valid = 0;
+  _int_disable();
+  if ( (can_bulk.state == BULK_WAIT_ACK) && (t0_gen == can_bulk.wait_gen) )
+  {
+    can_bulk_stat.timeouts++;
+    if ( ++can_bulk.retries > BULK_MAX_RETRIES )
+    {
+      can_bulk.state = BULK_IDLE;
+      can_bulk_stat.aborted++;
+    }
+    else
+    {
+      can_bulk_stat.retx_blocks += can_bulk.win_blocks;
+      CAN_bulk_send_window((1UL << can_bulk.win_blocks) - 1);
+    }
+  }
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить статистику блочной передачи
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_get_bulk_stat(T_can_bulk_stat *st)
+{
+  _int_disable();
+  *st = can_bulk_stat;
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Назначить старт двигателя в момент общей шкалы времени, отсчитываемый от кадра синхронизации INVERT_SYNC
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_sync_start(T_can_rx *rx)
+{
+  INT8U  ans[8];
+  INT32U t_sync;
+  INT32U delay_us;
+  INT32S remain_us = 0;
+  INT8U  res;
+
+  delay_us = ((INT32U)rx->data[5] << 16) | ((INT32U)rx->data[6] << 8) | rx->data[7];
+  if ( CAN_get_sync(rx->data[4], &t_sync) != MQX_OK )
+  {
+    res = SYNC_START_ERR_SYNC;
+  }
+  else
+  {
+    res = MC_sync_start_request(rx->data[1], rx->data[2], rx->data[3], t_sync, delay_us, &remain_us);
+  }
+
+  memset(ans, 0, sizeof(ans));
+  ans[0] = SYNC_START;
+  ans[1] = res;
+  OD_put_be32(&ans[4], (INT32U)remain_us);
+  CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отправить загрузку процессора и использование стеков. Каждая задача передается отдельным сегментом.
+  Отчет около 400 байт не помещается на стек задачи приема, поэтому статический.
+  Вызывается только задачей приема CAN
+-------------------------------------------------------------------------------------------------------------*/
+static void CAN_send_task_load(void)
+{
+  static T_load_report rep;
+  T_load_task   *pt;
+  INT8U          ans[8];
+  INT32U         seg = 0;
+  INT32U         last;
+  INT32U         i;
+
+  Load_get_report(&rep);
+
+  // Номер последней передаваемой задачи, задача простоя не передается
+  last = 0;
+  for (i = 0; i < rep.n; i++)
+  {
+    if ( rep.task[i].idle == 0 ) last = i + 1;
+  }
+
+  memset(ans, 0, sizeof(ans));
+  ans[0] = GET_TASK_LOAD;
+  ans[1] = (last == 0) ? OD_SEG_LAST : 0;
+  CAN_put_sat_be(&ans[2], 2, rep.isr_load, 0);
+  CAN_put_sat_be(&ans[4], 2, rep.idle_load, 0);
+  CAN_put_sat_be(&ans[6], 2, rep.isr_stack_used, 0);
+  CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+
+  for (i = 0; i < last; i++)
+  {
+    pt = &rep.task[i];
+    if ( pt->idle ) continue;
+    memset(ans, 0, sizeof(ans));
+    ans[0] = GET_TASK_LOAD;
+    ans[1] = ++seg & 0x7F;
+    if ( i == last - 1 ) ans[1] |= OD_SEG_LAST;
+    ans[2] = pt->tmpl_idx;
+    CAN_put_sat_be(&ans[3], 2, pt->load, 0);
+    CAN_put_sat_be(&ans[5], 2, pt->stack_used, 0);
+    if ( pt->stack_size != 0 ) ans[7] = CAN_sat_byte(pt->stack_used * 100.0 / pt->stack_size);
+    CAN_send(CAN_TX_PRIO_ANS, INVERT_ANS, ans, 8, 1);
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Выполнение команды принятой на INVERT_REQ. Вызывается задачей приема для каждого принятого кадра
+-------------------------------------------------------------------------------------------------------------*/
+void CAN_process_rx(T_can_rx *rx)
+{
+  T_MC_CBL     *mc_pcbl = MC_get_pcbl();
+
+  if ( rx->canid != INVERT_REQ ) return;
+
+  switch (rx->data[0])
+  {
+  case START_MOVING:
+
+    if ( rx->data[1] == MOVING_UP )
+    {
+       mc_pcbl->up_move_freq    = rx->data[2];
+       mc_pcbl->up_acceler_time = rx->data[3];
+       MC_set_events(MOTOR_START_UP);
+    }
+    else if ( rx->data[1] == MOVING_DOWN )
+    {
+      mc_pcbl->down_move_freq    = rx->data[2];
+      mc_pcbl->down_acceler_time = rx->data[3];
+      MC_set_events(MOTOR_START_DOWN);
+    }
+
+    //MC_start_motor_moving(rx->data[1], rx->data[2], rx->data[3]);
+    break;
+  case STOP_MOVING:
+    if ( mc_pcbl->direction == MOVING_DOWN )
+    {
+      mc_pcbl->down_deceler_time = rx->data[1];
+    }
+    else
+    {
+      mc_pcbl->up_deceler_time = rx->data[1];
+    }
+
+    MC_set_events(MOTOR_STOP);
+
+    //MC_stop_motor_moving(rx->data[1]);
+    break;
+
+  case EMERGENCY_STOP_MOVING:
+    // Выполнено в прерывании CAN_isr
+    break;
+
+  case GET_HARMONICS:
+    CAN_send_harmonics(rx->data[1]);
+    break;
+
+  case GET_POWER:
+    CAN_send_power(rx->data[1]);
+    break;
+
+  case RESET_ENERGY:
+    Meas_reset_energy();
+    break;
+
+  case SET_TELEMETRY:
+    CAN_set_telem_period(rx->data[1]);
+    break;
+
+  case OD_READ:
+  case OD_WRITE:
+    CAN_od_access(rx);
+    break;
+
+  case OD_BATCH_READ:
+    CAN_od_batch_read(rx);
+    break;
+
+  case OD_BATCH_WRITE:
+    CAN_od_batch_write(rx);
+    break;
+
+  case BULK_OPEN:
+    CAN_bulk_open(rx);
+    break;
+
+  case BULK_ACK:
+    CAN_bulk_ack(rx);
+    break;
+
+  case BULK_ABORT:
+    CAN_bulk_abort();
+    break;
+
+  case SYNC_START:
+    CAN_sync_start(rx);
+    break;
+
+  case GET_TASK_LOAD:
+    CAN_send_task_load();
+    break;
+  }
+}
@@ -3,131 +3,310 @@
 #include <fio.h>
 #include "App.h"
 
+#define LCD_SPI_IDLE   0  // Передача не идет, RS можно переключать
+#define LCD_SPI_RUN    1  // Идет передача серии байт одного типа
+#define LCD_SPI_DRAIN  2  // Последний байт серии в FIFO, ожидается EOQF
+
+// Очередь байт на передачу. Пишет только задача индикатора, читает прерывание SPI2 или задача при запрещенных прерываниях.
+// Индексы только увеличиваются, позиция в массиве - младшие биты индекса
+static INT16U           lcd_q[LCD_Q_SZ];
+static volatile INT32U  lcd_head;
+static volatile INT32U  lcd_tail;
+static volatile INT32U  lcd_state;
+static INT32U           lcd_spi_ready;
+
+static char             lcd_fb[LCD_ROWS][LCD_COLS];     // Теневой буфер кадра
+static char             lcd_shown[LCD_ROWS][LCD_COLS];  // Что уже передано индикатору
+static INT32U           lcd_shown_valid;                // 0 - содержимое индикатора неизвестно, перерисовать все
 
 /*-------------------------------------------------------------------------------------------------------------
-  Запись команды
+  Перенос байт из очереди в FIFO SPI2
+  Серия байт с одинаковым RS завершается флагом EOQ, после него модуль останавливается до сброса EOQF.
+  Вызывается из прерывания или при запрещенных прерываниях
 -------------------------------------------------------------------------------------------------------------*/
-void LCD_wr_cmd(int cmd)
+static void LCD_spi_feed(void)
 {
-  int i;
-  LCD_SCB(0);
-  DELAY_1us;
-  LCD_RS(0);
-  DELAY_1us;
-  for (i=0;i<8;i++)
+  INT32U head = lcd_head;
+  INT32U tail = lcd_tail;
+  INT32U e;
+  INT32U eoq;
+
+  if ( SPI2_SR & BIT(28) )
   {
-    if ( (cmd & 0x80)!=0 )
-      LCD_SI(1);
-    else
-      LCD_SI(0);
-    cmd <<=1;
-    DELAY_1us;
-    LCD_SCL(0);
-    DELAY_1us;
-    LCD_SCL(1);
-    DELAY_1us;
-    LCD_SCL(0);
-    DELAY_1us;
+    // Серия передана. Сброс EOQF снова запускает модуль
+    SPI2_SR   = BIT(28);
+    lcd_state = LCD_SPI_IDLE;
+  }
+
+  if ( lcd_state != LCD_SPI_DRAIN )
+  {
+    __DMB(); // Элементы очереди читаются после индекса
+    while ( (tail != head) && (SPI2_SR & BIT(25)) )
+    {
+      e = lcd_q[tail & (LCD_Q_SZ - 1)];
+      if ( lcd_state == LCD_SPI_IDLE )
+      {
+        LCD_RS((e & LCD_Q_RS) != 0);
+        lcd_state = LCD_SPI_RUN;
+      }
+      tail++;
+      eoq = (tail == head) || ((lcd_q[tail & (LCD_Q_SZ - 1)] ^ e) & LCD_Q_RS);
+
+      SPI2_PUSHR = 0
+                   + LSHIFT(0, 28)            // CTAS. Параметры из CTAR0
+                   + LSHIFT(eoq, 27)          // EOQ. Последний байт серии
+                   + LSHIFT(LCD_SPI_PCS, 16)  // PCS. Выбор индикатора
+                   + (e & 0xFF)               // TXDATA
+      ;
+      SPI2_SR = BIT(25); // TFFF
+      if ( eoq )
+      {
+        lcd_state = LCD_SPI_DRAIN;
+        break;
+      }
+    }
+    lcd_tail = tail;
   }
-  LCD_SCB(1);
-  LCD_SI(0);
-  DELAY_30us;
+
+  // Прерывание по свободному месту в FIFO нужно только пока есть что в него положить
+  if ( (lcd_state != LCD_SPI_DRAIN) && (tail != head) ) SPI2_RSER |= BIT(25);
+  else SPI2_RSER &= ~BIT(25);
 }
 
 /*-------------------------------------------------------------------------------------------------------------
-  Запись команды
+  Прерывание SPI2: свободное место в FIFO передатчика или конец серии
 -------------------------------------------------------------------------------------------------------------*/
-void LCD_wr_data(int data)
+static void LCD_spi_isr(pointer user_isr_ptr)
+{
+  LCD_spi_feed();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Запустить передачу накопленных в очереди байт
+-------------------------------------------------------------------------------------------------------------*/
+static void LCD_spi_start(void)
 {
-  int i;
-  LCD_SCB(0);
-  DELAY_1us;
-  LCD_RS(1);
-  DELAY_1us;
-  for (i=0;i<8;i++)
+  _int_disable();
+  LCD_spi_feed();
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Поместить байт в очередь передачи. Бит LCD_Q_RS в e - признак данных
+-------------------------------------------------------------------------------------------------------------*/
+static void LCD_put(INT32U e)
+{
+  INT32U head = lcd_head;
+
+  while ( (head - lcd_tail) >= LCD_Q_SZ )
   {
-    if ( (data & 0x80)!=0 )
-      LCD_SI(1);
-    else
-      LCD_SI(0);
-    data <<=1;
-    DELAY_1us;
-    LCD_SCL(0);
-    DELAY_1us;
-    LCD_SCL(1);
-    DELAY_1us;
-    LCD_SCL(0);
-    DELAY_1us;
+    LCD_spi_start();
+    _time_delay_ticks(1);
   }
-  LCD_SCB(1);
-  LCD_RS(0);
-  LCD_SI(0);
-  DELAY_1us;
+  lcd_q[head & (LCD_Q_SZ - 1)] = e;
+  __DMB(); // Запись должна быть завершена раньше публикации индекса
+  lcd_head = head + 1;
 }
 
 /*-------------------------------------------------------------------------------------------------------------
-  Вывести символ в заданную позицию
+  Настройка SPI2 на передачу индикатору
+-------------------------------------------------------------------------------------------------------------*/
+static void LCD_spi_init(void)
+{
+  SIM_SCGC3 |= BIT(12); // Тактирование SPI2. Выводы PTD12, PTD13, PTD15 настраиваются по таблице выводов BSP
+
+  SPI2_MCR = 0
+             + LSHIFT(1, 31)            // MSTR. Master mode
+             + LSHIFT(LCD_SPI_PCS, 16)  // PCSIS. Неактивный уровень PCS1 высокий
+             + LSHIFT(1, 12)            // DIS_RXF. Принятые данные не используются
+             + LSHIFT(1, 11)            // CLR_TXF. Очистить FIFO передатчика
+             + LSHIFT(1, 10)            // CLR_RXF. Очистить FIFO приемника
+             + LSHIFT(1, 0)             // HALT. Остановлен на время настройки
+  ;
+  // Частота шины 60 МГц
+  SPI2_CTAR0 = 0
+               + LSHIFT(7, 27)  // FMSZ. Кадр 8 бит
+               + LSHIFT(0, 26)  // CPOL. SCK в покое низкий
+               + LSHIFT(0, 25)  // CPHA. Данные захватываются индикатором по переднему фронту SCK
+               + LSHIFT(0, 24)  // LSBFE. Старшим битом вперед
+               + LSHIFT(2, 22)  // PCSSCK. Предделитель 5
+               + LSHIFT(0, 20)  // PASC. Предделитель 1
+               + LSHIFT(0, 18)  // PDT. Предделитель 1
+               + LSHIFT(0, 16)  // PBR. Предделитель 2
+               + LSHIFT(8, 12)  // CSSCK. 512. От PCS до SCK 5*512/60 МГц = 42.7 мкс, больше времени выполнения команды ST7032 (26.3 мкс)
+               + LSHIFT(5, 8)   // ASC. 64. От последнего SCK до снятия PCS 1.07 мкс
+               + LSHIFT(5, 4)   // DT. 64. Пауза между кадрами 1.07 мкс
+               + LSHIFT(5, 0)   // BR. 32. SCK = 60 МГц / (2 * 32) = 937.5 кГц
+  ;
+  SPI2_SR   = SPI2_SR;   // Сбросить все флаги
+  SPI2_RSER = 0
+              + LSHIFT(1, 28)  // EOQF_RE. Прерывание по концу серии
+  ;
+
+  _int_install_isr(LCD_SPI_INT, LCD_spi_isr, 0);
+  _bsp_int_init(LCD_SPI_INT, LCD_ISR_PRIO, 0, TRUE);
+
+  lcd_head  = 0;
+  lcd_tail  = 0;
+  lcd_state = LCD_SPI_IDLE;
+  SPI2_MCR &= ~BIT(0);   // HALT. Запуск
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Дождаться окончания передачи всех байт из очереди
+-------------------------------------------------------------------------------------------------------------*/
+void LCD_flush(void)
+{
+  INT32U n;
+
+  LCD_spi_start();
+  for (n = 0; n < LCD_FLUSH_TICKS; n++)
+  {
+    if ( (lcd_tail == lcd_head) && (lcd_state == LCD_SPI_IDLE) ) return;
+    _time_delay_ticks(1);
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Запись команды
+-------------------------------------------------------------------------------------------------------------*/
+void LCD_wr_cmd(int cmd)
+{
+  lcd_shown_valid = 0;
+  LCD_put(cmd & 0xFF);
+  LCD_spi_start();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Запись данных
+-------------------------------------------------------------------------------------------------------------*/
+void LCD_wr_data(int data)
+{
+  lcd_shown_valid = 0;
+  LCD_put(LCD_Q_RS | (data & 0xFF));
+  LCD_spi_start();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Вывести строку в заданную позицию буфера кадра. Часть строки за краем индикатора отбрасывается
 -------------------------------------------------------------------------------------------------------------*/
 void LCD_print_str(char *str, int x, int y)
 {
-  LCD_set_pos(x,y);
-  while (*str)
+  if ( (y < 0) || (y >= LCD_ROWS) || (x < 0) ) return;
+  while ( *str && (x < LCD_COLS) )
   {
-    LCD_wr_data(*str++);
+    lcd_fb[y][x++] = *str++;
   }
 }
 
 /*-------------------------------------------------------------------------------------------------------------
-  Вывести символ в заданную позицию
+  Вывести символ в заданную позицию буфера кадра
 -------------------------------------------------------------------------------------------------------------*/
 void LCD_print_char(char ch, int x, int y)
 {
-  LCD_set_pos(x,y);
-  LCD_wr_data(ch);
+  if ( (y < 0) || (y >= LCD_ROWS) || (x < 0) || (x >= LCD_COLS) ) return;
+  lcd_fb[y][x] = ch;
 }
 
 /*-------------------------------------------------------------------------------------------------------------
-  Установить текущую позицию вывода
+  Заполнить строку буфера кадра пробелами
 -------------------------------------------------------------------------------------------------------------*/
-void LCD_set_pos(int x, int y)
+void LCD_clear_row(int row)
 {
-  unsigned char addr;
-  addr = y*0x40+x;
-  LCD_wr_cmd(addr + 0x80);     
+  memset(lcd_fb[row & 1], ' ', LCD_COLS);
 }
 
 /*-------------------------------------------------------------------------------------------------------------
- 
+  Символ буфера кадра отличается от показанного
 -------------------------------------------------------------------------------------------------------------*/
-void LCD_clear_row(int row)
+static INT32U LCD_changed(INT32U x, INT32U y)
+{
+  return (lcd_shown_valid == 0) || (lcd_fb[y][x] != lcd_shown[y][x]);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Передать индикатору изменения буфера кадра
+  Каждый участок изменений передается командой установки позиции и байтами данных.
+  Функция не ждет окончания передачи
+-------------------------------------------------------------------------------------------------------------*/
+void LCD_refresh(void)
 {
-  int i;
-  LCD_set_pos(0, row & 1);
-  for (i=0;i<16;i++)
+  INT32U x;
+  INT32U y;
+  INT32U i;
+  INT32U end;
+  INT32U gap;
+
+  for (y = 0; y < LCD_ROWS; y++)
   {
-    LCD_wr_data(0x20);
+    x = 0;
+    while ( x < LCD_COLS )
+    {
+      if ( !LCD_changed(x, y) )
+      {
+        x++;
+        continue;
+      }
+
+      // Участок продолжается через короткие промежутки без изменений
+      end = x + 1;
+      gap = 0;
+      for (i = end; i < LCD_COLS; i++)
+      {
+        if ( LCD_changed(i, y) )
+        {
+          end = i + 1;
+          gap = 0;
+        }
+        else if ( ++gap > LCD_GAP_MERGE ) break;
+      }
+
+      LCD_put(0x80 + y * 0x40 + x);  // Установка адреса DDRAM
+      for (; x < end; x++)
+      {
+        LCD_put(LCD_Q_RS | (INT8U)lcd_fb[y][x]);
+        lcd_shown[y][x] = lcd_fb[y][x];
+      }
+    }
   }
+  lcd_shown_valid = 1;
+  LCD_spi_start();
 }
+
 /*-------------------------------------------------------------------------------------------------------------
 
 -------------------------------------------------------------------------------------------------------------*/
 void LCD_init(void)
 {
+  if ( lcd_spi_ready == 0 )
+  {
+    LCD_spi_init();
+    lcd_spi_ready = 1;
+  }
+  LCD_flush();
+
   LCD_RST(0);
   _time_delay_ticks(1);
   LCD_RST(1);
   _time_delay_ticks(8);
-  LCD_wr_cmd(0x30);     //wake up
+  LCD_put(0x30);     //wake up
+  LCD_flush();
   _time_delay_ticks(1);
-  LCD_wr_cmd(0x30);     //wake up
-  LCD_wr_cmd(0x30);     //wake up
-  LCD_wr_cmd(0x39);     //function set. 8-bit bus mode, 2-line display mode is set, display font is normal (5x8 dot), extension instruction be selected
-  LCD_wr_cmd(0x14);     //internal osc frequency. bias will be 1/5 , Frame frequency ( Hz ) = 183
-  LCD_wr_cmd(0x56);     //power control. ICON display off, booster circuit is turn on.
-  LCD_wr_cmd(0x6D);     //internal follower circuit is turn on, 
-  LCD_wr_cmd(0x70);     //contrast
-  LCD_wr_cmd(0x0C);     //display on
-  LCD_wr_cmd(0x06);     //entry mode
-  LCD_wr_cmd(0x01);     //clear
+  LCD_put(0x30);     //wake up
+  LCD_put(0x30);     //wake up
+  LCD_put(0x39);     //function set. 8-bit bus mode, 2-line display mode is set, display font is normal (5x8 dot), extension instruction be selected
+  LCD_put(0x14);     //internal osc frequency. bias will be 1/5 , Frame frequency ( Hz ) = 183
+  LCD_put(0x56);     //power control. ICON display off, booster circuit is turn on.
+  LCD_put(0x6D);     //internal follower circuit is turn on,
+  LCD_put(0x70);     //contrast
+  LCD_put(0x0C);     //display on
+  LCD_put(0x06);     //entry mode
+  LCD_put(0x01);     //clear
+  LCD_flush();
   _time_delay_ticks(2);
+
+  // После очистки индикатор показывает пробелы
+  memset(lcd_fb, ' ', sizeof(lcd_fb));
+  memset(lcd_shown, ' ', sizeof(lcd_shown));
+  lcd_shown_valid = 1;
 }
@@ -1,13 +1,33 @@
 #ifndef __LCD_CONTROL
   #define __LCD_CONTROL
 
+// Индикатор 2x16 с контроллером ST7032 на SPI2 (PTD12 - SCK, PTD13 - SOUT, PTD15 - PCS1), RS и RST - выводы GPIO.
+//
+// Вывод идет через теневой буфер кадра: LCD_print_str, LCD_print_char и LCD_clear_row только меняют буфер,
+// а LCD_refresh передает индикатору лишь символы отличающиеся от уже показанных.
+// Байты передаются из очереди в FIFO SPI2 в прерывании. Паузу на выполнение каждой команды и записи индикатором
+// выдерживает сам SPI задержкой от выбора кристалла до первого такта, поэтому задача не ждет передачи.
+// RS переключается в прерывании только после полной передачи серии байт одного типа (флаг EOQF).
+
+#define LCD_COLS          16
+#define LCD_ROWS          2
+#define LCD_Q_SZ          64        // Очередь байт на передачу. Степень двойки, не меньше полной перерисовки кадра
+#define LCD_Q_RS          BIT(8)    // Признак байта данных (RS=1) в элементе очереди
+#define LCD_GAP_MERGE     1         // Неизмененные символы между изменениями передаются повторно если их не больше этого
+                                    // количества, так дешевле чем новая команда установки позиции
+#define LCD_FLUSH_TICKS   20        // Наибольшее ожидание окончания передачи очереди
+
+#define LCD_SPI_INT       INT_SPI2
+#define LCD_SPI_PCS       BIT(1)    // Индикатор подключен к PCS1
+
 void LCD_init(void);
 void LCD_wr_data(int data);
 void LCD_wr_cmd(int cmd);
+void LCD_flush(void);
 void LCD_print_char(char ch, int x, int y);
-void LCD_set_pos(int x, int y);
 void LCD_print_str(char *str, int x, int y);
 void LCD_clear_row(int row);
+void LCD_refresh(void);
 
 
 #endif
@@ -0,0 +1,206 @@
+#include <mqx.h>
+#include <bsp.h>
+#include "mqx_inc.h"
+#include "App.h"
+
+// Счетчики выборок. Изменяются только в прерывании PIT2
+static _task_id         load_tid[LOAD_MAX_TASKS];        // Задачи в порядке первого появления
+static volatile INT32U  load_n;
+static INT16U           load_cnt[LOAD_SLOTS][LOAD_MAX_TASKS];
+static INT16U           load_isr[LOAD_SLOTS];
+static INT16U           load_other[LOAD_SLOTS];
+static INT16U           load_total[LOAD_SLOTS];
+static INT32U           load_slot;
+
+// Трассировка смены задач через ITM (Trace_control.h)
+static INT8U            load_trace_id[LOAD_MAX_TASKS];   // Номер задачи в канале TRACE_CH_TASK
+static INT32U           load_idle_i = LOAD_MAX_TASKS;    // Индекс задачи простоя в таблице
+static INT32U           load_last_id;                    // Последний переданный номер задачи
+
+
+/*-------------------------------------------------------------------------------------------------------------
+  Доля cnt от total в 0.1 %
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U Load_permille(INT32U cnt, INT32U total)
+{
+  if ( total == 0 ) return 0;
+  return (cnt * 1000 + total / 2) / total;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Номер задачи для канала трассировки TRACE_CH_TASK. Определяется один раз при первом появлении задачи
+-------------------------------------------------------------------------------------------------------------*/
+static INT8U Load_trace_id(_task_id tid, INT32U i)
+{
+  TASK_TEMPLATE_STRUCT_PTR tmpl = _task_get_template_ptr(tid);
+
+  if ( tmpl == NULL ) return TRACE_TASK_MQX;
+  if ( (tmpl->TASK_NAME != NULL) && (strcmp(tmpl->TASK_NAME, MQX_IDLE_TASK_NAME) == 0) )
+  {
+    load_idle_i = i;
+    return TRACE_TASK_IDLE;
+  }
+  if ( tmpl->TASK_TEMPLATE_INDEX >= TRACE_TASK_OTHER ) return TRACE_TASK_MQX; // Системные задачи MQX
+  return (INT8U)tmpl->TASK_TEMPLATE_INDEX;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Прерывание PIT2. Выборка текущего контекста
+-------------------------------------------------------------------------------------------------------------*/
+static void Load_pit_isr(pointer user_isr_ptr)
+{
+  INT32U   slot = load_slot;
+  INT32U   n    = load_n;
+  INT32U   i;
+  INT32U   id;
+  _task_id tid;
+
+  PIT_TFLG2 = BIT(0);
+
+  if ( _int_get_isr_depth() > 1 )
+  {
+    load_isr[slot]++;
+  }
+  else
+  {
+    tid = _task_get_id(); // Задача прерванная этим прерыванием
+    for (i = 0; i < n; i++)
+    {
+      if ( load_tid[i] == tid ) break;
+    }
+    if ( (i == n) && (n < LOAD_MAX_TASKS) )
+    {
+      load_tid[n]      = tid;
+      load_trace_id[n] = Load_trace_id(tid, n);
+      load_n           = n + 1;
+    }
+    if ( i < LOAD_MAX_TASKS )
+    {
+      load_cnt[slot][i]++;
+      id = load_trace_id[i];
+    }
+    else
+    {
+      load_other[slot]++;
+      id = TRACE_TASK_OTHER;
+    }
+    if ( id != load_last_id )
+    {
+      TRACE_TASK(id);
+      load_last_id = id;
+    }
+  }
+
+  if ( ++load_total[slot] >= LOAD_SLOT_SMPLS )
+  {
+    // Счетчики закончившегося интервала в канал трассировки
+    TRACE_COUNTER(TRACE_CNT_ISR_LOAD, Load_permille(load_isr[slot], load_total[slot]));
+    if ( load_idle_i < LOAD_MAX_TASKS )
+    {
+      TRACE_COUNTER(TRACE_CNT_IDLE_LOAD, Load_permille(load_cnt[slot][load_idle_i], load_total[slot]));
+    }
+    TRACE_COUNTER(TRACE_CNT_DROPS, trace_drops);
+
+    // Переход к следующему интервалу окна. Самый старый интервал очищается
+    slot = (slot + 1) % LOAD_SLOTS;
+    for (i = 0; i < LOAD_MAX_TASKS; i++) load_cnt[slot][i] = 0;
+    load_isr[slot]   = 0;
+    load_other[slot] = 0;
+    load_total[slot] = 0;
+    load_slot        = slot;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Наибольшее использование стека от limit до base, байт.
+  MQX заполняет стеки значением MQX_STACK_MONITOR_VALUE (MQX_MONITOR_STACK), стек растет вниз,
+  поэтому ищется первое измененное слово от нижней границы
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U Load_stack_used(_mqx_uint_ptr limit, _mqx_uint_ptr base)
+{
+  _mqx_uint_ptr p = limit;
+
+  while ( (p < base) && (*p == MQX_STACK_MONITOR_VALUE) ) p++;
+  return (INT32U)((uchar_ptr)base - (uchar_ptr)p);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Запуск выборок загрузки процессора
+-------------------------------------------------------------------------------------------------------------*/
+void Load_init(void)
+{
+  SIM_SCGC6 |= BIT(23); // Тактирование PIT
+  PIT_MCR    = 0;       // MDIS = 0. Модуль включен
+
+  PIT_TCTRL2 = 0;
+  PIT_TFLG2  = BIT(0);
+  _int_install_isr(LOAD_PIT_INT, Load_pit_isr, NULL);
+  _bsp_int_init(LOAD_PIT_INT, LOAD_ISR_PRIO, 0, TRUE);
+
+  PIT_LDVAL2 = LOAD_PERIOD_US * (BSP_BUS_CLOCK / 1000000) - 1; // PIT считает такты шины
+  PIT_TCTRL2 = BIT(1) + BIT(0); // TIE, TEN
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить загрузку процессора за окно и использование стеков
+-------------------------------------------------------------------------------------------------------------*/
+void Load_get_report(T_load_report *rep)
+{
+  INT32U                   isr   = 0;
+  INT32U                   other = 0;
+  INT32U                   total = 0;
+  INT32U                   i;
+  INT32U                   s;
+  _mqx_uint                prio;
+  KERNEL_DATA_STRUCT_PTR   kd;
+  TD_STRUCT_PTR            td;
+  _mqx_uint_ptr            base;
+  TASK_TEMPLATE_STRUCT_PTR tmpl;
+  T_load_task             *pt;
+
+  memset(rep, 0, sizeof(T_load_report));
+
+  _int_disable();
+  rep->n = load_n;
+  for (i = 0; i < rep->n; i++) rep->task[i].tid = load_tid[i];
+  for (s = 0; s < LOAD_SLOTS; s++)
+  {
+    for (i = 0; i < rep->n; i++) rep->task[i].load += load_cnt[s][i]; // Пока число отсчетов, ниже переводится в 0.1 %
+    isr   += load_isr[s];
+    other += load_other[s];
+    total += load_total[s];
+  }
+  _int_enable();
+
+  rep->window_ms  = total * LOAD_PERIOD_US / 1000;
+  rep->isr_load   = Load_permille(isr, total);
+  rep->other_load = Load_permille(other, total);
+
+  // Границы стека прерываний как в _klog_get_interrupt_stack_usage. Ядро собрано без MQX_KERNEL_LOGGING
+  _GET_KERNEL_DATA(kd);
+  base = (_mqx_uint_ptr)kd->INTERRUPT_STACK_PTR;
+  rep->isr_stack_size = kd->INIT.INTERRUPT_STACK_SIZE;
+  rep->isr_stack_used = Load_stack_used((_mqx_uint_ptr)((uchar_ptr)base - kd->INIT.INTERRUPT_STACK_SIZE + PSP_MEMORY_ALIGNMENT + 1), base);
+
+  for (i = 0; i < rep->n; i++)
+  {
+    pt       = &rep->task[i];
+    pt->load = Load_permille(pt->load, total);
+    pt->name = "?";
+    tmpl     = _task_get_template_ptr(pt->tid);
+    if ( tmpl != NULL )
+    {
+      pt->tmpl_idx = tmpl->TASK_TEMPLATE_INDEX;
+      if ( tmpl->TASK_NAME != NULL ) pt->name = tmpl->TASK_NAME;
+      pt->idle = (strcmp(pt->name, MQX_IDLE_TASK_NAME) == 0);
+      if ( pt->idle ) rep->idle_load += pt->load;
+    }
+    if ( _task_get_priority(pt->tid, &prio) == MQX_OK ) pt->prio = prio;
+    td = (TD_STRUCT_PTR)_task_get_td(pt->tid);
+    if ( td != NULL )
+    {
+      pt->stack_size = (uchar_ptr)td->STACK_BASE - (uchar_ptr)td->STACK_LIMIT;
+      pt->stack_used = Load_stack_used((_mqx_uint_ptr)td->STACK_LIMIT, (_mqx_uint_ptr)td->STACK_BASE);
+    }
+  }
+}
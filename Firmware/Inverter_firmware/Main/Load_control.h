@@ -0,0 +1,49 @@
+#ifndef __LOAD_CONTROL
+  #define __LOAD_CONTROL
+
+// Загрузка процессора задачами и прерываниями, запас стеков задач.
+// Канал PIT2 с периодом LOAD_PERIOD_US прерывает процессор и относит отсчет к прерванной задаче,
+// или к прерываниям если он вложен в другое прерывание. Отсчеты накапливаются в LOAD_SLOTS интервалах
+// по LOAD_SLOT_SMPLS отсчетов, отчет суммирует все интервалы - скользящее окно около 1 с обновляемое каждые 0.25 с.
+// Период не кратен периоду PWM и тику MQX, чтобы выборки не привязывались к фазе периодических прерываний.
+// Время в критических секциях с запрещенными прерываниями относится к задаче которая их запретила.
+// Также не видны прерывания с приоритетом не ниже LOAD_ISR_PRIO, численно <= (тик MQX SysTick, ожидание синхронного
+// пуска в прерывании PIT0): их время относится к прерванной задаче, а не к прерываниям.
+// Наибольшее использование стеков задач и стека прерываний определяется по заполнению стеков MQX (MQX_MONITOR_STACK).
+// Смена задачи между выборками передается в канал трассировки TRACE_CH_TASK, загрузка за интервал - в TRACE_CH_COUNTER.
+
+#define LOAD_PERIOD_US    241     // Период выборки, около 4150 выборок в секунду
+#define LOAD_SLOT_SMPLS   1037    // Отсчетов в интервале окна, около 0.25 с
+#define LOAD_SLOTS        4
+#define LOAD_MAX_TASKS    12      // Задачи сверх этого количества учитываются вместе в other
+
+#define LOAD_PIT_INT      INT_PIT2
+
+typedef struct
+{
+  _task_id    tid;
+  const char *name;
+  INT32U      tmpl_idx;    // Номер шаблона задачи (*_IDX из App.h)
+  INT32U      prio;
+  INT32U      load;        // Доля времени в окне, 0.1 %
+  INT32U      stack_size;  // Размер стека, байт
+  INT32U      stack_used;  // Наибольшее использование стека, байт. 0 - задача уже удалена. Равно stack_size - стек был переполнен
+  INT32U      idle;        // 1 - задача простоя MQX
+} T_load_task;
+
+typedef struct
+{
+  INT32U      window_ms;      // Длина окна
+  INT32U      isr_load;       // Прерывания, 0.1 %
+  INT32U      idle_load;      // Задача простоя, 0.1 %
+  INT32U      other_load;     // Задачи не поместившиеся в таблицу, 0.1 %
+  INT32U      isr_stack_size;
+  INT32U      isr_stack_used;
+  INT32U      n;              // Количество задач в task
+  T_load_task task[LOAD_MAX_TASKS];
+} T_load_report;
+
+void Load_init(void);
+void Load_get_report(T_load_report *rep);
+
+#endif
@@ -1,4 +1,5 @@
 #include "App.h"
+#include <stddef.h>
 
 void LCD_task(uint_32 initial_data);
 static void Measure_task(uint_32 initial_data);
@@ -11,7 +12,7 @@ const TASK_TEMPLATE_STRUCT  MQX_template_list[] =
   { MEAS_IDX,        Measure_task,             1500,   MEAS_ID_PRIO,      "Meas",      MQX_FLOATING_POINT_TASK,                                             0,     0 },
   { VT100_IDX,       VT100_task,               3000,   VT100_ID_PRIO,     "VT100",     MQX_FLOATING_POINT_TASK + MQX_TIME_SLICE_TASK,                       0,     2 },
   { LCD_IDX,         LCD_task,                 2000,   LCD_ID_PRIO,       "LCD",       MQX_FLOATING_POINT_TASK,                                             0,     0 },
-  { CAN_TX_IDX,      CAN_Tx_Task,              1500,   CAN_TX_ID_PRIO,    "CAN_TX",    0,                                                                   0,     0 },
+  { CAN_TX_IDX,      CAN_Tx_Task,              1500,   CAN_TX_ID_PRIO,    "CAN_TX",    MQX_FLOATING_POINT_TASK,                                             0,     0 },
   { CAN_RX_IDX,      CAN_Rx_Task,              1500,   CAN_RX_ID_PRIO,    "CAN_RX",    MQX_FLOATING_POINT_TASK,                                             0,     0 },
   { 0 }
 };
@@ -33,12 +34,36 @@ static float FLT_smpl_to_Phase_meas(float smpl);
 static float FLT_smpl_to_Temper(float smpl);
 static float FLT_pwm_to_voltage(float smpl);
 
-static T_meas_results  meas_results[MEAS_RES_ARR_SZ];
+// Результаты измерений.
+// Задача измерений вычисляет результаты в рабочей копии и по завершении окна копирует в свободный из двух буферов публикации,
+// после чего увеличивает номер версии. Действующий буфер meas_pub[meas_ver & 1].
+// Читатель копирует действующий буфер и повторяет чтение если за время копирования версия изменилась,
+// поэтому читатель с любым приоритетом не ждет задачу измерений и не может получить наполовину обновленные данные
+#define MEAS_EVT_NEW   BIT(0)  // Событие публикации новой версии результатов
+
+static T_meas_snapshot        meas_work;    // Рабочая копия задачи измерений
+static T_meas_snapshot        meas_pub[2];  // Буферы публикации
+static volatile unsigned int  meas_ver;     // Номер опубликованной версии
+static LWEVENT_STRUCT         meas_evt;     // Оповещение ожидающих новую версию
+static volatile unsigned int  meas_energy_reset_req; // Запрос сброса счетчиков энергии, выполняется задачей измерений
+
+// Счетчики энергии в неинициализируемой памяти. Сохраняются при программном сбросе и сбросе от сторожевого таймера,
+// при выключении питания теряются. Достоверность проверяется по признаку и контрольной сумме
+typedef struct
+{
+  unsigned int       signature;      // MEAS_ENERGY_SIGNATURE
+  unsigned long long motor_mj;       // Энергия в режиме двигателя (мДж)
+  unsigned long long regen_mj;       // Энергия рекуперации (мДж)
+  unsigned long long trip_motor_mj;  // Энергия в режиме двигателя за поездку (мДж)
+  unsigned long long trip_regen_mj;  // Энергия рекуперации за поездку (мДж)
+  unsigned int       trips;          // Количество поездок
+  unsigned int       chksum;         // Контрольная сумма предыдущих полей
+} T_energy_ret;
+
+static __no_init T_energy_ret energy_ret;
 static float           aver_curr_rms;
 static unsigned int    aver_curr_cnt;
 
-static MUTEX_STRUCT    meas_mutex;
-
 const T_vals_scaling vscal[MEAS_RES_ARR_SZ] =
 {
   { "ii_w  ", INT_smpl_to_current,    FLT_smpl_to_current    },
@@ -91,16 +116,6 @@ void Get_rms_log_arr(float **ptr)
 }
 */
 
-/*-------------------------------------------------------------------------------------------------------------
- 
--------------------------------------------------------------------------------------------------------------*/
-static void Create_meas_mutex(void)
-{
-  MUTEX_ATTR_STRUCT mutexattr;
-  _mutatr_init(&mutexattr);
-  _mutex_init(&meas_mutex, &mutexattr);
-}
-
 /*-------------------------------------------------------------------------------------------------------------
 
 -------------------------------------------------------------------------------------------------------------*/
@@ -113,9 +128,14 @@ void Control_task(uint_32 initial_data)
   Led_control(LED2, 0);
   Led_control(LED3, 0);
 
+#if UART_MON_DMA
+  UART_init(); // Порт монитора назначается стандартным вводом/выводом до создания задачи VT100
+#endif
+  Trace_init();
+  Load_init();
   MC_create_event();
-  Create_meas_mutex();
-  TempCtrl_init_drivers();
+  _lwevent_create(&meas_evt, 0); // До запуска ADC и задач которые могут ждать результаты измерений
+  TempCtrl_init();
 
   CAN_init(CAN0_BASE_PTR, CAN_SPEED);
 
@@ -151,7 +171,7 @@ void Control_task(uint_32 initial_data)
   {
     _mqx_uint events;
 
-    if  ( MC_get_events(&events, 2, VFO_FALL | PWM_OE_RISE | MOTOR_STOP | MOTOR_START_DOWN | MOTOR_START_UP) == MQX_OK )
+    if  ( MC_get_events(&events, 2, VFO_FALL | PWM_OE_RISE | MOTOR_STOP | MOTOR_START_DOWN | MOTOR_START_UP | MOTOR_SYNC_START) == MQX_OK )
     {
       if ( events & VFO_FALL )
       {
@@ -187,6 +207,10 @@ void Control_task(uint_32 initial_data)
       {
         MC_start_motor_moving(MOVING_UP, mc_pcbl->up_move_freq, mc_pcbl->up_acceler_time);
       }
+      else if ( events & MOTOR_SYNC_START )
+      {
+        MC_sync_start_arm();
+      }
     }
     else
     {
@@ -328,102 +352,238 @@ static float FLT_pwm_to_voltage(float smpl)
 
 
 /*-------------------------------------------------------------------------------------------------------------
- 
+  Пересчет гармонических составляющих фазных токов завершенного окна
+  Амплитуда гармоники 2*|X|/N, действующее значение sqrt(2)*|X|/N, опорный сигнал в формате Q15
 -------------------------------------------------------------------------------------------------------------*/
+static void Meas_calc_harm(T_meas_window *w, T_meas_harm *h)
+{
+  unsigned int n;
+  unsigned int k;
+  float        re;
+  float        im;
+  float        aver;
+  float        dev;
+
+  if ( (w->info.sync == 0) || (w->info.cycles == 0) )
+  {
+    h->valid = 0;
+    return;
+  }
 
-void Lock_meas_mutex(void)
+  for (n = 0; n < MEAS_HARM_PH_NUM; n++)
+  {
+    for (k = 0; k < MEAS_HARM_NUM; k++)
+    {
+      re = (float)w->harm_re[n][k];
+      im = (float)w->harm_im[n][k];
+      h->rms[n][k] = vscal[n].flt_converter(sqrt(2.0 * (re * re + im * im)) / ((float)w->info.smpl_cnt * 32768.0));
+    }
+  }
+
+  // Небаланс по NEMA: максимальное отклонение основной гармоники фазы от среднего, отнесенное к среднему
+  aver = (h->rms[0][0] + h->rms[1][0] + h->rms[2][0]) / 3;
+  h->imbalance = 0;
+  if ( aver > 0 )
+  {
+    for (n = 0; n < MEAS_HARM_PH_NUM; n++)
+    {
+      dev = fabs(h->rms[n][0] - aver) * 100.0 / aver;
+      if ( dev > h->imbalance ) h->imbalance = dev;
+    }
+  }
+
+  h->freq  = (float)w->info.cycles * PWM_FREQ / (float)w->info.smpl_cnt;
+  h->valid = 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Контрольная сумма счетчиков энергии
+-------------------------------------------------------------------------------------------------------------*/
+static unsigned int Meas_energy_chksum(T_energy_ret *e)
 {
-  _mutex_lock(&meas_mutex);
-} 
- 
+  unsigned int *p = (unsigned int *)e;
+  unsigned int  n;
+  unsigned int  sum = 0;
+
+  for (n = 0; n < offsetof(T_energy_ret, chksum) / sizeof(unsigned int); n++)
+  {
+    sum = (sum << 1) + (sum >> 31) + p[n];
+  }
+  return ~sum;
+}
+
 /*-------------------------------------------------------------------------------------------------------------
- 
+  Проверка счетчиков энергии после сброса. Недостоверные счетчики обнуляются
 -------------------------------------------------------------------------------------------------------------*/
+static void Meas_energy_clear(void)
+{
+  memset(&energy_ret, 0, sizeof(energy_ret));
+  energy_ret.signature = MEAS_ENERGY_SIGNATURE;
+  energy_ret.chksum    = Meas_energy_chksum(&energy_ret);
+}
 
-void Unlock_meas_mutex(void)
+/*-------------------------------------------------------------------------------------------------------------
+  Проверка счетчиков энергии после сброса. Недостоверные счетчики обнуляются
+-------------------------------------------------------------------------------------------------------------*/
+static void Meas_energy_restore(void)
 {
-  _mutex_unlock(&meas_mutex);
-} 
- 
+  if ( (energy_ret.signature != MEAS_ENERGY_SIGNATURE) || (energy_ret.chksum != Meas_energy_chksum(&energy_ret)) )
+  {
+    Meas_energy_clear();
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Опубликовать рабочую копию результатов как новую версию и оповестить ожидающих
+  Вызывается только задачей измерений
+-------------------------------------------------------------------------------------------------------------*/
+static void Meas_publish(void)
+{
+  meas_pub[(meas_ver + 1) & 1] = meas_work;
+  __DMB(); // Данные буфера должны быть записаны раньше номера версии
+  meas_ver++;
+
+  // Импульс события освобождает всех ожидающих. Без переключения задач между установкой и сбросом,
+  // иначе ожидающая задача с более высоким приоритетом снова застанет событие установленным
+  _task_stop_preemption();
+  _lwevent_set(&meas_evt, MEAS_EVT_NEW);
+  _lwevent_clear(&meas_evt, MEAS_EVT_NEW);
+  _task_start_preemption();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Копирование части опубликованных результатов со смещением offs и длиной sz
+  Возвращает номер версии к которой относится копия
+-------------------------------------------------------------------------------------------------------------*/
+static unsigned int Meas_read(void *dst, unsigned int offs, unsigned int sz)
+{
+  unsigned int v;
+
+  do
+  {
+    v = meas_ver;
+    __DMB();
+    memcpy(dst, (char *)&meas_pub[v & 1] + offs, sz);
+    __DMB();
+    // Пока версия не изменилась, задача измерений пишет в другой буфер
+  }
+  while ( v != meas_ver );
+  return v;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Пересчет мощности завершенного окна и накопление энергии
+  Поездкой считается непрерывная последовательность окон с включенным PWM
+-------------------------------------------------------------------------------------------------------------*/
+static void Meas_calc_power(T_meas_window *w, T_meas_power *pw)
+{
+  float              p;
+  float              q;
+  unsigned long long e;
+
+  if ( w->pwr_cnt == 0 )
+  {
+    pw->valid = 0;
+    pw->p     = 0;
+    pw->q     = 0;
+    pw->s     = 0;
+    pw->pf    = 0;
+  }
+  else
+  {
+    // Средние за окно суммы переводим в вольты через v_bus, затем в амперы через ток
+    p = (float)w->pwr_p / (float)w->pwr_cnt;
+    q = (float)w->pwr_q / (float)w->pwr_cnt;
+    p = vscal[0].flt_converter(vscal[3].flt_converter(p) / PWM_MODULO) * MEAS_PWR_SIGN;
+    // Асинхронный двигатель потребляет реактивную мощность в обоих направлениях вращения,
+    // знак суммы по линейным напряжениям зависит только от порядка чередования фаз
+    q = fabs(vscal[0].flt_converter(vscal[3].flt_converter(q) / PWM_MODULO)) / sqrt(3.0);
+
+    if ( pw->valid == 0 )
+    {
+      // Начало новой поездки
+      energy_ret.trip_motor_mj = 0;
+      energy_ret.trip_regen_mj = 0;
+      energy_ret.trips++;
+    }
+
+    e = (unsigned long long)(fabs(p) * 1000.0 * (float)w->pwr_cnt / PWM_FREQ);
+    if ( p >= 0 )
+    {
+      energy_ret.motor_mj      += e;
+      energy_ret.trip_motor_mj += e;
+    }
+    else
+    {
+      energy_ret.regen_mj      += e;
+      energy_ret.trip_regen_mj += e;
+    }
+    energy_ret.chksum = Meas_energy_chksum(&energy_ret);
+
+    pw->valid = 1;
+    pw->p     = p;
+    pw->q     = q;
+    pw->s     = sqrt(p * p + q * q);
+    pw->pf    = pw->s > 0 ? p / pw->s : 0;
+  }
+
+  pw->kwh_motor      = (float)energy_ret.motor_mj      / 3.6e9;
+  pw->kwh_regen      = (float)energy_ret.regen_mj      / 3.6e9;
+  pw->trip_kwh_motor = (float)energy_ret.trip_motor_mj / 3.6e9;
+  pw->trip_kwh_regen = (float)energy_ret.trip_regen_mj / 3.6e9;
+  pw->trips          = energy_ret.trips;
+}
+
 /*-------------------------------------------------------------------------------------------------------------
   Задача выпоняющая измерения
+  Статистика накапливается в процессе сбора отсчетов ADC, здесь только пересчет результатов завершенного окна
 -------------------------------------------------------------------------------------------------------------*/
 static void Measure_task(uint_32 initial_data)
 {
-  signed short   *arr[MEAS_RES_ARR_SZ];
   unsigned int   n;
-  unsigned int   i;
-  unsigned int   sindx; // Стартовый индекс буфера
-  T_meas_stat    stat;
+  T_meas_window  win;
 
 
   aver_curr_rms = 0;
   aver_curr_cnt = 0;
+  Meas_energy_restore();
   for (;;)
   {
     
     _mqx_uint events;
 
-    Lock_meas_mutex();
-    if  ( MC_get_events(&events, 2, SMPL_ARR1_FULL + SMPL_ARR2_FULL) == MQX_OK )
+    if  ( MC_get_events(&events, 0, MEAS_WIN_READY) == MQX_OK )
     {
-      // Обработать массив отсчетов
+      ADC_get_meas_window(&win);
+      if ( win.info.smpl_cnt == 0 ) continue;
 
-      // Получим указатели на массивы отсчетов
-      ADC_get_smpl_arr(arr);
-      sindx = 0;
-      if ( events == SMPL_ARR2_FULL)
-      {
-        sindx = TST_SMPLS_ARR_SZ/2;
-      }
-      // Для каждого массива находим: минимум, максимум, среднее, среднеквадратическое
-      // Выполнение этого блока длиться 4.8  мс
       for (n = 0; n < MEAS_RES_ARR_SZ; n++)
       {
-        stat.maxv  = arr[n][sindx];
-        stat.minv  = arr[n][sindx];
-        stat.averv = 0;
-        stat.rmsv  = 0;
-        for (i = 0; i < (TST_SMPLS_ARR_SZ/2); i++)
-        {
-          if ( arr[n][i+sindx] > stat.maxv ) stat.maxv = arr[n][i+sindx];
-          if ( arr[n][i+sindx] < stat.minv ) stat.minv = arr[n][i+sindx];
-          stat.averv += arr[n][i+sindx];
-          stat.rmsv  += arr[n][i+sindx] * arr[n][i+sindx];
-        }
-        stat.averv = stat.averv / (TST_SMPLS_ARR_SZ/2);
-        stat.rmsv  = stat.rmsv / (TST_SMPLS_ARR_SZ/2);
-
-        meas_results[n].fmax = vscal[n].int_converter(stat.maxv);
-        meas_results[n].fmin = vscal[n].int_converter(stat.minv);
-        meas_results[n].favr = vscal[n].int_converter(stat.averv);
-        meas_results[n].frms = vscal[n].flt_converter(sqrt(stat.rmsv)); // sqrt выполняеться 756 тактов(6.3 мкс) включая перевод из double во float
+        if ( win.stat[n].cnt == 0 ) continue; // Медленный канал не попал в окно, оставляем прежний результат
+        meas_work.res[n].fmax = vscal[n].int_converter(win.stat[n].maxv);
+        meas_work.res[n].fmin = vscal[n].int_converter(win.stat[n].minv);
+        meas_work.res[n].favr = vscal[n].int_converter(win.stat[n].averv / (int)win.stat[n].cnt);
+        meas_work.res[n].frms = vscal[n].flt_converter(sqrt(win.stat[n].rmsv / win.stat[n].cnt)); // sqrt выполняеться 756 тактов(6.3 мкс) включая перевод из double во float
 
       }
-/*
-      if ( rms_log_pos != MEAS_RES_LOG_SZ )
+      meas_work.info = win.info;
+      Meas_calc_harm(&win, &meas_work.harm);
+      if ( meas_energy_reset_req )
       {
-        for (n = 0; n < MEAS_RES_ARR_SZ; n++)
-        {
-          meas_rms_log[n][rms_log_pos] = meas_results[n].frms;
-        }
-        rms_log_pos++;
+        meas_energy_reset_req = 0;
+        Meas_energy_clear();
       }
-      ADC_reset_smpl_arr_pos();
-*/ 
+      Meas_calc_power(&win, &meas_work.power);
+      Meas_publish();
+
       {
-        float  val = (meas_results[0].frms + meas_results[1].frms + meas_results[2].frms)/3;
+        float  val = (meas_work.res[0].frms + meas_work.res[1].frms + meas_work.res[2].frms)/3;
 
         _int_disable();
          aver_curr_rms += val;
          aver_curr_cnt++; 
         _int_enable();
       }
-
-      MC_set_events(MEAS_RES_READY);  
-      
-
-      Unlock_meas_mutex();
     }
   }
 }
@@ -450,16 +610,79 @@ void  Reset_aver_curr(void)
   aver_curr_cnt = 0;
   _int_enable();
 }
+/*-------------------------------------------------------------------------------------------------------------
+  Получить согласованную копию всех результатов измерений. Возвращает номер версии
+-------------------------------------------------------------------------------------------------------------*/
+unsigned int Get_meas_snapshot(T_meas_snapshot *snap)
+{
+  return Meas_read(snap, 0, sizeof(T_meas_snapshot));
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Номер последней опубликованной версии результатов измерений
+-------------------------------------------------------------------------------------------------------------*/
+unsigned int Meas_get_version(void)
+{
+  return meas_ver;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Ожидание версии результатов отличной от *ver не более ticks тиков (0 - без ограничения)
+  При успехе в *ver записывается номер новой версии.
+  Если публикация произошла между проверкой версии и началом ожидания, то новая версия будет обнаружена
+  по истечении ticks или при следующей публикации
+-------------------------------------------------------------------------------------------------------------*/
+_mqx_uint Meas_wait_next(unsigned int *ver, _mqx_uint ticks)
+{
+  if ( meas_ver == *ver )
+  {
+    _lwevent_wait_ticks(&meas_evt, MEAS_EVT_NEW, FALSE, ticks);
+    if ( meas_ver == *ver ) return MQX_ERROR;
+  }
+  *ver = meas_ver;
+  return MQX_OK;
+}
+
 /*-------------------------------------------------------------------------------------------------------------
 
 -------------------------------------------------------------------------------------------------------------*/
 void Get_copy_meas_results(T_meas_results *mres)
 {
-  _task_stop_preemption();
-  memcpy(mres, meas_results, sizeof(meas_results));
-  _task_start_preemption();
+  Meas_read(mres, offsetof(T_meas_snapshot, res), sizeof(meas_work.res));
 }
 
+/*-------------------------------------------------------------------------------------------------------------
+  Получить параметры окна по которому вычислены последние результаты измерений
+-------------------------------------------------------------------------------------------------------------*/
+void Get_meas_win_info(T_meas_win_info *wi)
+{
+  Meas_read(wi, offsetof(T_meas_snapshot, info), sizeof(T_meas_win_info));
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить копию результатов гармонического анализа фазных токов
+-------------------------------------------------------------------------------------------------------------*/
+void Get_copy_meas_harm(T_meas_harm *harm)
+{
+  Meas_read(harm, offsetof(T_meas_snapshot, harm), sizeof(T_meas_harm));
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить копию результатов измерения мощности и счетчиков энергии
+-------------------------------------------------------------------------------------------------------------*/
+void Get_copy_meas_power(T_meas_power *pwr)
+{
+  Meas_read(pwr, offsetof(T_meas_snapshot, power), sizeof(T_meas_power));
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Сброс счетчиков энергии
+  Выполняется задачей измерений при обработке следующего окна
+-------------------------------------------------------------------------------------------------------------*/
+void Meas_reset_energy(void)
+{
+  meas_energy_reset_req = 1;
+}
 
 /*-----------------------------------------------------------------------------------------------------
 
@@ -470,7 +693,7 @@ void Get_copy_meas_results(T_meas_results *mres)
 #define STR_SZ 64
 void LCD_task(uint_32 initial_data)
 {
-  T_meas_results     mres[8];
+  T_meas_results     mres[MEAS_RES_ARR_SZ];
   float              temp;
   char               str[STR_SZ + 1];
   T_MC_CBL          *mc_pcbl;
@@ -484,7 +707,7 @@ void LCD_task(uint_32 initial_data)
     Get_copy_meas_results(mres);
 
     terr = 0;
-    if (TempCtrl_read_IGBT_temperature(&temp)!=MQX_OK)
+    if (TempCtrl_get_IGBT_temperature(&temp)!=MQX_OK)
     {
       terr = 1;
     }
@@ -538,6 +761,7 @@ void LCD_task(uint_32 initial_data)
       snprintf(str, STR_SZ, "*****ERROR******");
       LCD_print_str(str, 0, 1);
     }
+    LCD_refresh();
 
     _time_delay(500);
   }
@@ -23,6 +23,8 @@ static void  Do_CAN_log_view(INT8U keycode);
 //static void  Do_ADC_test(INT8U keycode);
 static void  Do_ADC_read_smpls(INT8U keycode);
 static void  Do_Meas_values_view(INT8U keycode);
+static void  Do_UART_load_test(INT8U keycode);
+static void  Do_Task_load_view(INT8U keycode);
 
 extern const T_VT100_Menu MENU_MAIN;
 extern const T_VT100_Menu MENU_PARAMETERS;
@@ -57,6 +59,8 @@ const T_VT100_Menu_item MENU_MAIN_ITEMS[] =
 //  { '6', Do_ADC_test,                0 },
 //  { '7', Do_ADC_read_smpls,          0 },
   { '8', Do_Meas_values_view,        0 },
+  { '9', Do_UART_load_test,          0 },
+  { '0', Do_Task_load_view,          0 },
   { 'R', 0,                          0 },
   { 'M', 0,                         (void *)&MENU_MAIN }
 };
@@ -72,7 +76,9 @@ const T_VT100_Menu MENU_MAIN =
 //  "\033[5C <5> - Special menu\r\n"
 //  "\033[5C <6> - ADC test\r\n"
 //  "\033[5C <7> - Read ADC samples\r\n"
-  "\033[5C <8> - Measured values view\r\n",
+  "\033[5C <8> - Measured values view\r\n"
+  "\033[5C <9> - Monitor port load test\r\n"
+  "\033[5C <0> - Tasks CPU load and stacks\r\n",
   MENU_MAIN_ITEMS,
   sizeof(MENU_MAIN_ITEMS) / sizeof(MENU_MAIN_ITEMS[0])
 };
@@ -456,11 +462,7 @@ exit_:
 -------------------------------------------------------------------------------------------------------------*/
 INT32S  Mon_send_buf(INT8U *buf, INT32U len)
 {
-  int i;
-  for (i = 0; i < len; i++)
-  {
-    printf("%c", buf[i]);
-  }
+  write(stdout, buf, len);
   return MQX_OK;
 }
 
@@ -498,7 +500,7 @@ static void  Do_motor_test(INT8U keycode)
 {
   INT8U              b;
   T_MC_CBL           cbl;
-  float              temp;
+  T_temper_info      ti;
   unsigned long long cnt;
   char               str[64];
   T_meas_results     mres[MEAS_RES_ARR_SZ];
@@ -534,17 +536,23 @@ static void  Do_motor_test(INT8U keycode)
     printf(VT100_CLR_LINE"Rotation dir        = %d\r\n", cbl.direction);
     printf(VT100_CLR_LINE"skew_cnt = %06d, step = %016llX, ll_freq = %016llX\r\n", cbl.skew_cnt, cbl.ll_step, cbl.ll_mot_freq);
     printf(VT100_CLR_LINE"PWM scale= %0.3f\r\n", cbl.pwm_scale);
+    printf(VT100_CLR_LINE"Last stop #%d: %d->%d Hz, time=%d ms (plan %d ms), decel=%0.1f Hz/s, gov.time=%d ms, Vbus max=%0.1f V\r\n",
+           cbl.stop_rep.cnt, cbl.stop_rep.start_freq, cbl.stop_rep.end_freq, cbl.stop_rep.time_ms, cbl.stop_rep.plan_time_ms,
+           cbl.stop_rep.decel, cbl.stop_rep.gov_time_ms, cbl.stop_rep.vbus_max);
 
-    if ( TempCtrl_read_IGBT_temperature(&temp) == MQX_OK )
+    TempCtrl_get_IGBT_info(&ti);
+    if ( ti.valid )
     {
-      snprintf(str, 63, "%0.3lf", temp);
+      snprintf(str, 63, "%0.3lf", ti.temp);
       if ( strlen(str) > 6 ) FixStrerr(strlen(str));
-      printf(VT100_CLR_LINE"IGBT temperature = %s\r\n", str);
+      printf(VT100_CLR_LINE"IGBT temperature = %s, age = %d ms\r\n", str, ti.age_ms);
     }
     else
     {
       printf(VT100_CLR_LINE"IGBT temperature reading error!\r\n");
     }
+    printf(VT100_CLR_LINE"IGBT sensor reads = %d, nacks = %d, arb.lost = %d, bus busy = %d, timeouts = %d\r\n",
+           ti.reads, ti.nacks, ti.arb_lost, ti.busy, ti.timeouts);
 
     if ( cbl.motor_drv_fail )
     {
@@ -1028,9 +1036,12 @@ static void  Do_CAN_log_view(INT8U keycode)
   INT8U          b;
   T_can_rx       rx;
   INT32U         i;
+  INT32U         prev  = 0;
+  INT32U         first = 1;
+  INT32S         dt;
 
-  printf("CAN log.\n\r");
-  printf("Press 'R' to exit. \n\r");
+  printf("CAN log. Time of frame start (ms) and interval from previous frame (us).\n\r");
+  printf("Press 'S' to show statistics, 'R' to exit. \n\r");
 
   do
   {
@@ -1041,7 +1052,12 @@ static void  Do_CAN_log_view(INT8U keycode)
       while (CAN_pop_log_rec(&rx) == MQX_OK)
       {
 
-        printf("%02X %08X %01X %01X %01X - ",  rx.code, rx.canid, rx.ext, rx.rtr, rx.len);
+        // Разность по модулю 2^32 со знаком, чтобы переход отметки через 0 давал верный интервал
+        dt = first ? 0 : (INT32S)(rx.time - prev) * (1000000 / CAN_SPEED);
+        printf("%12.3f %+9d  ", (double)rx.time * 1000.0 / CAN_SPEED, dt);
+        prev  = rx.time;
+        first = 0;
+        printf("%02X %08X %01X %01X %01X %01X - ",  rx.code, rx.canid, rx.ext, rx.rtr, rx.len, rx.hit);
         for (i = 0; i < rx.len; i++)
         {
           printf("%02X ", rx.data[i]);
@@ -1060,6 +1076,57 @@ static void  Do_CAN_log_view(INT8U keycode)
       case 'R':
       case 'r':
         return;
+
+      case 'S':
+      case 's':
+        {
+          T_can_rx_stat    st;
+          T_can_estop_stat es;
+          T_can_tx_stat    ts;
+          T_can_bulk_stat  bs;
+          T_can_err_stat   er;
+          T_can_err_hist   eh[20];
+          T_can_sync_stat  ys;
+          T_MC_sync_stat   ms;
+          INT32U           hn;
+          CAN_get_rx_stat(&st);
+          CAN_get_estop_stat(&es);
+          CAN_get_tx_stat(&ts);
+          CAN_get_bulk_stat(&bs);
+          CAN_get_err_stat(&er);
+          hn = CAN_get_err_hist(eh, 20);
+          CAN_get_sync_stat(&ys);
+          MC_get_sync_stat(&ms);
+          printf("Rx frames = %d, interrupts = %d, max frames per interrupt = %d, FIFO warnings = %d, FIFO overflows = %d, queue overflows = %d, log drops = %d\r\n",
+                 st.frames, st.batches, st.max_batch, st.warnings, st.overflows, st.q_overflows, st.log_drops);
+          printf("Emergency stops = %d. ISR entry to PWM off: last = %0.2f us, max = %0.2f us. Frame start to PWM off: last = %d us, max = %d us\r\n",
+                 es.cnt,
+                 (float)es.last_cycles * 1000000.0 / BSP_SYSTEM_CLOCK, (float)es.max_cycles * 1000000.0 / BSP_SYSTEM_CLOCK,
+                 es.last_bits * (1000000 / CAN_SPEED), es.max_bits * (1000000 / CAN_SPEED));
+          printf("Tx answers: queued = %d, dropped = %d, max queue = %d. Telemetry every %d ms: queued = %d, dropped = %d, max queue = %d\r\n",
+                 ts.queued[CAN_TX_PRIO_ANS], ts.drops[CAN_TX_PRIO_ANS], ts.max_q[CAN_TX_PRIO_ANS], CAN_get_telem_period() * 10,
+                 ts.queued[CAN_TX_PRIO_TELEM], ts.drops[CAN_TX_PRIO_TELEM], ts.max_q[CAN_TX_PRIO_TELEM]);
+          printf("Bulk transfers = %d, completed = %d, aborted = %d, windows = %d, blocks = %d, retransmitted blocks = %d, ack timeouts = %d\r\n",
+                 bs.sessions, bs.completed, bs.aborted, bs.windows, bs.blocks, bs.retx_blocks, bs.timeouts);
+          printf("Bus state = %s, TEC = %d (max %d), REC = %d (max %d). Error passive %d ms, bus off %d ms\r\n",
+                 er.fltconf == CAN_FLT_ACTIVE ? "active" : (er.fltconf == CAN_FLT_PASSIVE ? "passive" : "bus off"),
+                 er.tec, er.tec_max, er.rec, er.rec_max, er.passive_ms, er.bus_off_ms);
+          printf("Bus off = %d, recoveries = %d, next hold = %d ms. Errors: bit0 = %d, bit1 = %d, ack = %d, crc = %d, form = %d, stuff = %d, Tx warn = %d, Rx warn = %d\r\n",
+                 er.bus_offs, er.recoveries, er.hold_ms,
+                 er.bit0_errs, er.bit1_errs, er.ack_errs, er.crc_errs, er.form_errs, er.stuff_errs, er.tx_warns, er.rx_warns);
+          printf("Sync frames = %d, last seq = %d, period = %d us, frame start to capture: last = %d us, max = %d us\r\n",
+                 ys.cnt, ys.seq, ys.period / SYNC_START_CYC_PER_US, ys.last_bits * (1000000 / CAN_SPEED), ys.max_bits * (1000000 / CAN_SPEED));
+          printf("Sync starts = %d, started = %d, missed = %d, cancelled = %d. PWM on late: last = %0.2f us, max = %0.2f us\r\n",
+                 ms.requests, ms.started, ms.missed, ms.cancelled,
+                 (float)ms.last_late / SYNC_START_CYC_PER_US, (float)ms.max_late / SYNC_START_CYC_PER_US);
+          printf("TEC/REC per second, newest first:");
+          for (i = 0; i < hn; i++)
+          {
+            printf(" %d/%d%s", eh[i].tec, eh[i].rec, eh[i].fltconf == CAN_FLT_BUS_OFF ? "B" : (eh[i].fltconf == CAN_FLT_PASSIVE ? "P" : ""));
+          }
+          printf("\r\n");
+        }
+        break;
       }
     }
   }
@@ -1334,14 +1401,80 @@ static void  Do_ADC_read_smpls(INT8U keycode)
   while (1);
 }
 */
+/*-------------------------------------------------------------------------------------------------------------
+  Двоичный поток выборок сигналов в порт монитора. Формат кадров описан в Stream_control.h
+  Запрашивает маску сигналов (hex) и количество периодов PWM между выборками, поток прекращается по 'R'
+-------------------------------------------------------------------------------------------------------------*/
+static void  Do_Meas_stream(void)
+{
+  INT8U          b;
+  char           str[32];
+  unsigned int   mask = STREAM_MASK_DEF;
+  unsigned int   div  = STREAM_DIV_DEF;
+  INT32U         len;
+  T_stream_stat  st;
+#if !UART_MON_DMA
+  static INT8U   buf[8 * (STREAM_FRAME_MAX + 2)];
+#endif
+
+  printf("Signals mask (hex), PWM periods per sample [%X,%d]>", mask, div);
+  if ( Get_string(str, 31) != MQX_OK ) return;
+  sscanf(str, "%x,%u", &mask, &div);
+  div = Stream_start(mask, div);
+  if ( div == 0 )
+  {
+    printf("\r\nEmpty signals mask\r\n");
+    return;
+  }
+  printf("\r\nStreaming mask %X at %d samples/s. Press 'R' to stop\r\n", mask & (BIT(STREAM_SIG_NUM) - 1), PWM_FREQ / div);
+
+  for (;;)
+  {
+#if UART_MON_DMA
+    // Кадры кодируются прямо в кольцо передачи драйвера
+    {
+      INT8U  *p;
+      INT32U  n;
+
+      UART_tx_lock();
+      n   = UART_tx_reserve(&p, STREAM_FRAME_MAX + 2);
+      len = (n != 0) ? Stream_encode(p, n) : 0;
+      UART_tx_commit(len);
+      UART_tx_unlock();
+    }
+#else
+    len = Stream_encode(buf, sizeof(buf));
+    if ( len != 0 ) write(stdout, buf, len);
+#endif
+    if ( len == 0 ) _time_delay_ticks(1);
+    if ( Mon_wait_byte(&b, 0) == MQX_OK )
+    {
+      if ( (b=='R') || (b=='r') ) break;
+    }
+  }
+  Stream_stop();
+  Stream_get_stat(&st);
+  printf("\r\nStream stopped. Samples = %d, dropped = %d, frames = %d, bytes = %d\r\n", st.samples, st.drops, st.frames, st.bytes);
+}
+
 /*-----------------------------------------------------------------------------------------------------
  
 -----------------------------------------------------------------------------------------------------*/
 static void  Do_Meas_values_view(INT8U keycode)
 {
   INT8U          b;
-  T_meas_results     mres[MEAS_RES_ARR_SZ]; 
+  T_meas_snapshot    ms;
+  unsigned int       ver;
+  unsigned int       n;
+  const char        *ph_name[MEAS_HARM_PH_NUM] = { "ii_w", "ii_v", "ii_u" };
 
+  printf("Measurement values view. '0'-start output, '1'-harmonics, '2'-power, 'B'-binary stream, '+'/'-' change cycles per window, 'R'-exit\r\n");
+  printf("Cycles per window = %d\r\n", ADC_get_meas_win_cycles());
+  {
+    float        ow, ov, ou;
+    unsigned int cal = ADC_get_curr_offs(&ow, &ov, &ou);
+    printf("Current sensor offsets(w,v,u) = %0.2f, %0.2f, %0.2f smpl, calibrations = %d\r\n", ow, ov, ou, cal);
+  }
 
   // Ожидаем стартового символа кроме 'R'
   do
@@ -1354,17 +1487,26 @@ static void  Do_Meas_values_view(INT8U keycode)
       case 'r':
         return;
 
+      case '+':
+        ADC_set_meas_win_cycles(ADC_get_meas_win_cycles() + 1);
+        printf("Cycles per window = %d\r\n", ADC_get_meas_win_cycles());
+        break;
+
+      case '-':
+        ADC_set_meas_win_cycles(ADC_get_meas_win_cycles() - 1);
+        printf("Cycles per window = %d\r\n", ADC_get_meas_win_cycles());
+        break;
+
       case '0':
         {
-          _mqx_uint events;
-          MC_get_events(&events, 2, MEAS_RES_READY);
+          ver = Meas_get_version();
           for (;;)
           {
-            if (MC_get_events(&events, 2, MEAS_RES_READY) == MQX_OK )
+            if ( Meas_wait_next(&ver, 2) == MQX_OK )
             {
               float aver = Get_aver_curr();
-              Get_copy_meas_results(mres);
-              printf("%0.1f, %0.1f\r\n", (mres[0].frms + mres[1].frms + mres[2].frms)/3, aver);
+              Get_meas_snapshot(&ms);
+              printf("%0.1f, %0.1f, %d, %d, %d, %d, %d, %d\r\n", (ms.res[0].frms + ms.res[1].frms + ms.res[2].frms)/3, aver, ms.info.smpl_cnt, ms.info.cycles, ms.info.sync, ms.info.bad_smpls[0], ms.info.bad_smpls[1], ms.info.bad_smpls[2]);
             }
             if (Mon_wait_byte(&b, 0) == MQX_OK) 
             {
@@ -1376,6 +1518,90 @@ static void  Do_Meas_values_view(INT8U keycode)
           }
         }
         break;
+
+      case 'B':
+      case 'b':
+        Do_Meas_stream();
+        return;
+
+      case '1':
+        {
+          ver = 0;
+          VT100_clr_screen();
+          for (;;)
+          {
+            if ( Meas_wait_next(&ver, 2) == MQX_OK )
+            {
+              Get_meas_snapshot(&ms);
+              VT100_set_cursor_pos(1, 0);
+              printf(VT100_CLR_LINE"Phase current harmonics. Window: %d smpls, %d cycles. Press 'R' to exit\r\n", ms.info.smpl_cnt, ms.info.cycles);
+              printf(DASH_LINE"\r\n");
+              if ( ms.harm.valid )
+              {
+                printf(VT100_CLR_LINE"f = %0.2f Hz\r\n", ms.harm.freq);
+                for (n = 0; n < MEAS_HARM_PH_NUM; n++)
+                {
+                  printf(VT100_CLR_LINE"%s I1 = %6.2f A  H3 = %5.1f%%  H5 = %5.1f%%  H7 = %5.1f%%\r\n", ph_name[n], ms.harm.rms[n][0],
+                         ms.harm.rms[n][0] > 0 ? ms.harm.rms[n][1] * 100.0 / ms.harm.rms[n][0] : 0.0,
+                         ms.harm.rms[n][0] > 0 ? ms.harm.rms[n][2] * 100.0 / ms.harm.rms[n][0] : 0.0,
+                         ms.harm.rms[n][0] > 0 ? ms.harm.rms[n][3] * 100.0 / ms.harm.rms[n][0] : 0.0);
+                }
+                printf(VT100_CLR_LINE"Imbalance = %0.1f%%\r\n", ms.harm.imbalance);
+              }
+              else
+              {
+                printf(VT100_CLR_LINE"Generator is stopped. No data.\r\n");
+                for (n = 0; n < MEAS_HARM_PH_NUM + 1; n++) printf(VT100_CLR_LINE"\r\n");
+              }
+            }
+            if (Mon_wait_byte(&b, 0) == MQX_OK) 
+            {
+              if ( (b=='R') || (b=='r') )
+              {
+                return;
+              }
+            }
+          }
+        }
+        break;
+
+      case '2':
+        {
+          ver = 0;
+          VT100_clr_screen();
+          for (;;)
+          {
+            if ( Meas_wait_next(&ver, 2) == MQX_OK )
+            {
+              Get_meas_snapshot(&ms);
+              VT100_set_cursor_pos(1, 0);
+              printf(VT100_CLR_LINE"Inverter output power. Press 'Z' to reset energy counters, 'R' to exit\r\n");
+              printf(DASH_LINE"\r\n");
+              if ( ms.power.valid )
+              {
+                printf(VT100_CLR_LINE"P = %8.1f W   Q = %8.1f var   S = %8.1f VA   PF = %5.3f\r\n", ms.power.p, ms.power.q, ms.power.s, ms.power.pf);
+              }
+              else
+              {
+                printf(VT100_CLR_LINE"PWM is stopped.\r\n");
+              }
+              printf(VT100_CLR_LINE"Total: motoring = %0.3f kWh  regeneration = %0.3f kWh\r\n", ms.power.kwh_motor, ms.power.kwh_regen);
+              printf(VT100_CLR_LINE"Trip %d: motoring = %0.1f Wh  regeneration = %0.1f Wh\r\n", ms.power.trips, ms.power.trip_kwh_motor * 1000.0, ms.power.trip_kwh_regen * 1000.0);
+            }
+            if (Mon_wait_byte(&b, 0) == MQX_OK) 
+            {
+              if ( (b=='R') || (b=='r') )
+              {
+                return;
+              }
+              if ( (b=='Z') || (b=='z') )
+              {
+                Meas_reset_energy();
+              }
+            }
+          }
+        }
+        break;
       }
     }
   }
@@ -1383,3 +1609,103 @@ static void  Do_Meas_values_view(INT8U keycode)
 
 
 }
+
+/*-------------------------------------------------------------------------------------------------------------
+  Загрузка процессора выводом в порт монитора.
+  Загрузка оценивается по скорости счета цикла задачи простоя MQX: сначала 1 с без вывода, затем 1 с непрерывного
+  вывода строк через printf. При опросном драйвере задача монитора ждет передачи каждого символа и задача простоя
+  не получает управления, при драйвере с DMA время процессора тратится только на форматирование и копирование в кольцо
+-------------------------------------------------------------------------------------------------------------*/
+static void  Do_UART_load_test(INT8U keycode)
+{
+  IDLE_LOOP_STRUCT  l0, l1;
+  INT32U            ref;
+  INT32U            idle;
+  INT32U            t0;
+  INT32U            bytes = 0;
+  INT32U            n = 0;
+  INT8U             b;
+
+  printf("Monitor port load test. Baud rate = %d, driver = %s\r\n", UART_MON_BAUD, UART_MON_DMA ? "DMA" : "polled");
+  _time_delay(100);
+
+  // Скорость счета задачи простоя без вывода
+  _mqx_get_idle_loop_count(&l0);
+  _time_delay(1000);
+  _mqx_get_idle_loop_count(&l1);
+  ref = l1.IDLE_LOOP1 - l0.IDLE_LOOP1;
+
+  // Непрерывный вывод в течении 1 с
+  _mqx_get_idle_loop_count(&l0);
+  t0 = DWT_CYCCNT;
+  while ( (DWT_CYCCNT - t0) < BSP_SYSTEM_CLOCK )
+  {
+    bytes += printf("%08d ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789\r\n", n++);
+  }
+  _mqx_get_idle_loop_count(&l1);
+  idle = l1.IDLE_LOOP1 - l0.IDLE_LOOP1;
+  fflush(stdout);
+
+  printf("\r\nWritten %d bytes in 1 s (line rate %d bytes/s)\r\n", bytes, UART_MON_BAUD / 10);
+  printf("Idle loops: reference = %d, during output = %d\r\n", ref, idle);
+  printf("CPU load by output = %0.1f%%\r\n", ref ? 100.0 * (1.0 - (float)idle / (float)ref) : 0.0);
+#if UART_MON_DMA
+  {
+    T_uart_stat st;
+    UART_get_stat(&st);
+    printf("Driver: tx = %d bytes, segments = %d, waits = %d, max used = %d of %d, rx = %d, overruns = %d, errors = %d\r\n",
+           st.tx_bytes, st.tx_segs, st.tx_waits, st.tx_max_used, UART_TX_BUF_SZ, st.rx_bytes, st.rx_overruns, st.rx_errors);
+  }
+#endif
+  printf("Press any key to exit\r\n");
+  Mon_wait_byte(&b, 0xFFFF);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Загрузка процессора задачами и прерываниями за скользящее окно и наибольшее использование стеков.
+  Обновляется каждые 0.5 с
+-------------------------------------------------------------------------------------------------------------*/
+static void  Do_Task_load_view(INT8U keycode)
+{
+  T_load_report   rep;
+  T_load_task    *pt;
+  INT32U          i;
+  INT8U           b;
+
+  printf("Tasks CPU load and stack usage. Press 'R' to exit.\r\n");
+
+  do
+  {
+    Load_get_report(&rep);
+
+    VT100_set_cursor_pos(3, 0);
+    printf(DASH_LINE"\r\n");
+    printf(VT100_CLR_LINE"Window = %d ms, ISR = %3d.%d %%, idle = %3d.%d %%, other tasks = %d.%d %%\r\n",
+           rep.window_ms, rep.isr_load / 10, rep.isr_load % 10, rep.idle_load / 10, rep.idle_load % 10,
+           rep.other_load / 10, rep.other_load % 10);
+    printf(VT100_CLR_LINE"Interrupt stack used %d of %d bytes\r\n", rep.isr_stack_used, rep.isr_stack_size);
+    printf(DASH_LINE"\r\n");
+    printf(VT100_CLR_LINE"Task              ID        Idx Prio   Load    Stack used/size  Free\r\n");
+    for (i = 0; i < rep.n; i++)
+    {
+      pt = &rep.task[i];
+      printf(VT100_CLR_LINE"%-16.16s  %08X  %3d %4d  %3d.%d %%  %5d/%-5d %3d %%%s\r\n",
+             pt->name, pt->tid, pt->tmpl_idx, pt->prio, pt->load / 10, pt->load % 10,
+             pt->stack_used, pt->stack_size,
+             pt->stack_size ? (pt->stack_size - pt->stack_used) * 100 / pt->stack_size : 0,
+             ((pt->stack_size != 0) && (pt->stack_used >= pt->stack_size)) ? " OVERFLOW?" : "");
+    }
+    printf(DASH_LINE"\r\n");
+
+    if ( Mon_wait_byte(&b, 500) == MQX_OK )
+    {
+      switch (b)
+      {
+      case 'R':
+      case 'r':
+        return;
+      }
+    }
+  }
+  while (1);
+}
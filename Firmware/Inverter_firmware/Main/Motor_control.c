@@ -4,18 +4,27 @@
 #include "App.h"
 #include <math.h>
 
-extern signed short   smpls[11][TST_SMPLS_ARR_SZ];
-extern unsigned int   arr_pos;
-
 
 static T_MC_CBL            mc_cbl;
 volatile static uint32_t   dummy;
 static LWEVENT_STRUCT      evt_grp;
 static pointer             mc_is_taskr_queue;
+static T_3ph_pwm           pwm_loaded; // Значения компараторов которые будут действовать в ближайшей нижней точке счетчика PWM
+static unsigned int        pwm_loaded_cycle; // Номер периода и фаза отсчета генератора по которому рассчитаны pwm_loaded
+static unsigned int        pwm_loaded_phase;
+
+// Синхронный старт. Назначается задачей приема CAN, PWM готовит Control_task, включает прерывание PIT
+static volatile INT32U     mc_sync_state;
+static INT32U              mc_sync_t;     // Момент старта в тактах ядра DWT_CYCCNT
+static INT8U               mc_sync_dir;
+static INT32U              mc_sync_freq;
+static INT32U              mc_sync_time;
+static T_MC_sync_stat      mc_sync_stat;
 
 Frac32 sinv, cosv;
 
 static void ETM0_isr(pointer user_isr_ptr);
+static void MC_sync_start_isr(pointer user_isr_ptr);
 
 
 /*-------------------------------------------------------------------------------------------------------------
@@ -117,11 +126,21 @@ void MC_init_PWM(void)
   mc_cbl.down_acceler_time    = 10;
   mc_cbl.down_deceler_time    = 10;
 
+  mc_cbl.gov_k                = VBUS_GOV_K_ONE;
+
 
   _int_install_isr(INT_FTM0, ETM0_isr, &mc_cbl);
   // Разрешить прерывание только после установки вектора! Иначе можем уйти в непрерывный вызов ISR по дефолтному вектору
   _bsp_int_init(INT_FTM0, ETM0_ISR_PRIO, 0, TRUE);
 
+  // Канал PIT синхронного старта. Таймер тактируется от системной шины и запускается только при назначении старта
+  SIM_SCGC6 |= BIT(23); // Разрешаем тактирование PIT
+  PIT_MCR    = 0;       // MDIS = 0. Модуль включен
+  PIT_TCTRL0 = 0;
+  PIT_TFLG0  = BIT(0);
+  _int_install_isr(INT_PIT0, MC_sync_start_isr, NULL);
+  _bsp_int_init(INT_PIT0, SYNC_START_ISR_PRIO, 0, TRUE);
+
   // Разрешаем тактирование ETM0
   SIM_SCGC6 |= BIT(24);
   dummy =  FTM0_SC;
@@ -315,9 +334,9 @@ void MC_init_PWM(void)
 
 
 /*-------------------------------------------------------------------------------------------------------------
-  Старт работы PWM
+  Расчет начального состояния PWM. Выходы остаются выключенными
 -------------------------------------------------------------------------------------------------------------*/
-void PWM_start(int dir, unsigned int freq)
+static void PWM_prepare(int dir, unsigned int freq)
 {
   T_3ph_pwm pwm_3ph;
 
@@ -342,8 +361,16 @@ void PWM_start(int dir, unsigned int freq)
   FTM0_C3V = pwm_3ph.pwm_b;
   FTM0_C4V = pwm_3ph.pwm_c;
   FTM0_C5V = pwm_3ph.pwm_c;
+  pwm_loaded       = pwm_3ph;
+  pwm_loaded_cycle = Gen_get_smpl_cycle();
+  pwm_loaded_phase = Gen_get_smpl_phase();
+}
 
-  _int_disable();
+/*-------------------------------------------------------------------------------------------------------------
+  Включение выходов PWM с начала периода. Вызывается при запрещенных прерываниях
+-------------------------------------------------------------------------------------------------------------*/
+static void PWM_enable(void)
+{
   FTM0_SYNCONF |= LSHIFT(1,  8); // Выставляем флаг для немедленного обновления регистров по флагу синхронизации
   FTM0_SYNC    |= BIT(7);        // Запускаем синхронизацию
   FTM0_CNT      = 0;             // Запись в регистр счетчка любого значения приводит к записи значения из CNTIN и установке начального состояния выходов
@@ -351,6 +378,16 @@ void PWM_start(int dir, unsigned int freq)
   FTM0_SWOCTRL  = 0x0000;        // Запись в регистр слова 0x0000 позволяет выходам работать в нормальном режиме PWM
   FTM0_SC      &= ~BIT(7);       // Сбросим TOF
   FTM0_SC      |= BIT(6);        // Разрешаем прерывания от PWM
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Старт работы PWM
+-------------------------------------------------------------------------------------------------------------*/
+void PWM_start(int dir, unsigned int freq)
+{
+  PWM_prepare(dir, freq);
+  _int_disable();
+  PWM_enable();
   _int_enable();
 }
 
@@ -417,8 +454,8 @@ void MC_create_event(void)
 -------------------------------------------------------------------------------------------------------------*/
 void MC_start_motor_moving(INT8U dir,  INT32U target_freq, INT32U time)
 {
-  // Не обрабатывать команд на пуск пока разорвана цепь безопасности
-  if (( PWM_state() == 0 ) && (Pin_PWM_OE_state()!=0))
+  // Не обрабатывать команд на пуск пока разорвана цепь безопасности или назначен синхронный старт
+  if (( PWM_state() == 0 ) && (Pin_PWM_OE_state()!=0) && (mc_sync_state == MC_SYNC_IDLE))
   {
     PWM_start(dir, START_FREQ);
     MC_init_speed_change(MOT_START_ACTION, target_freq, time);
@@ -431,6 +468,7 @@ void MC_start_motor_moving(INT8U dir,  INT32U target_freq, INT32U time)
 -------------------------------------------------------------------------------------------------------------*/
 void MC_stop_motor_moving(INT32U time)
 {
+  MC_sync_start_cancel();
   if ( PWM_state() != 0 )
   {
     MC_init_speed_change(MOT_STOP_ACTION, 0, time);
@@ -442,13 +480,23 @@ void MC_stop_motor_moving(INT32U time)
 -------------------------------------------------------------------------------------------------------------*/
 void MC_emergency_stop_motor(void)
 {
-  PWM_stop();
+  // Назначенный старт отменяется вместе с остановкой PWM, чтобы прерывание PIT0 не включило PWM после остановки
   _int_disable();
+  if ( mc_sync_state != MC_SYNC_IDLE )
+  {
+    PIT_TCTRL0    = 0;
+    PIT_TFLG0     = BIT(0);
+    mc_sync_state = MC_SYNC_IDLE;
+    mc_sync_stat.cancelled++;
+  }
+  PWM_stop();
   mc_cbl.mot_freq    = 0;
   mc_cbl.ll_mot_freq = 0;
   mc_cbl.skew_cnt    = 0;
   mc_cbl.ll_step     = 0;
   mc_cbl.action      = MOT_IDLE;
+  mc_cbl.gov_k       = VBUS_GOV_K_ONE;
+  mc_cbl.gov_acc     = 0;
   _int_enable();
   Reset_aver_curr(); 
 }
@@ -492,7 +540,15 @@ void MC_init_speed_change(unsigned int action,  unsigned int target_freq, unsign
   else if ( action == MOT_STOP_ACTION )
   {
     cbl.action = MOT_STOP_ACTION;
+    // Начинаем сбор данных для отчета об остановке
+    cbl.stop_periods    = 0;
+    cbl.gov_periods     = 0;
+    cbl.stop_vbus_max   = 0;
+    cbl.stop_start_freq = cbl.mot_freq;
+    cbl.stop_plan_ms    = target_time * 100;
   }
+  cbl.gov_k   = VBUS_GOV_K_ONE;
+  cbl.gov_acc = 0;
 
   current_freq = cbl.mot_freq;
   if ( target_freq != current_freq  )
@@ -582,12 +638,57 @@ void MC_init_speed_change(unsigned int action,  unsigned int target_freq, unsign
 }
 
 
+/*-------------------------------------------------------------------------------------------------------------
+  Регулятор напряжения шины при торможении
+  Возвращает коэффициент масштабирования шага снижения частоты в диапазоне от 0 до VBUS_GOV_K_ONE
+  Между VBUS_GOV_START_V и VBUS_GOV_HOLD_V коэффициент линейно убывает, поэтому частота снижается настолько быстро,
+  насколько шина успевает рассеивать энергию рекуперации
+-------------------------------------------------------------------------------------------------------------*/
+static unsigned int MC_vbus_governor(void)
+{
+  int v_bus;
+
+  v_bus = ADC_get_v_bus();
+  if ( v_bus > mc_cbl.stop_vbus_max ) mc_cbl.stop_vbus_max = v_bus;
+
+  if ( v_bus <= VBUS_VOLTS_TO_SMPL(VBUS_GOV_START_V) ) return VBUS_GOV_K_ONE;
+  if ( v_bus >= VBUS_VOLTS_TO_SMPL(VBUS_GOV_HOLD_V) ) return 0;
+
+  return (VBUS_VOLTS_TO_SMPL(VBUS_GOV_HOLD_V) - v_bus) * VBUS_GOV_K_ONE / (VBUS_VOLTS_TO_SMPL(VBUS_GOV_HOLD_V) - VBUS_VOLTS_TO_SMPL(VBUS_GOV_START_V));
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Фиксация отчета о завершенной остановке двигателя
+  Вызывается в момент отключения PWM по окончании торможения
+-------------------------------------------------------------------------------------------------------------*/
+static void MC_fix_stop_report(void)
+{
+  T_MC_stop_report *rep = &mc_cbl.stop_rep;
+
+  rep->cnt++;
+  rep->start_freq   = mc_cbl.stop_start_freq;
+  rep->end_freq     = mc_cbl.mot_freq;
+  rep->plan_time_ms = mc_cbl.stop_plan_ms;
+  rep->time_ms      = (unsigned long long)mc_cbl.stop_periods * 1000 / PWM_FREQ;
+  rep->gov_time_ms  = (unsigned long long)mc_cbl.gov_periods * 1000 / PWM_FREQ;
+  if ( mc_cbl.stop_periods != 0 )
+  {
+    rep->decel = ((float)rep->start_freq - (float)rep->end_freq) * PWM_FREQ / (float)mc_cbl.stop_periods;
+  }
+  else
+  {
+    rep->decel = 0;
+  }
+  rep->vbus_max = (float)mc_cbl.stop_vbus_max * VBUS_VOLT_PER_SMPL;
+}
+
 /*-------------------------------------------------------------------------------------------------------------
   Процедура обслуживания прерывания PWM
   Процедура активизирует задачу Motor_ISR_task поскольку в самой процедуре ISR нельзя использовать вычисления с плавающей точкой
 -------------------------------------------------------------------------------------------------------------*/
 static void ETM0_isr(pointer user_isr_ptr)
 {
+  TRACE_ISR_ENTER(TRACE_ISR_ETM0);
   Led_control(LED3, 1);
 
   if ( FTM0_SC & BIT(7) )
@@ -599,6 +700,7 @@ static void ETM0_isr(pointer user_isr_ptr)
   _taskq_resume(mc_is_taskr_queue, FALSE);
 
   Led_control(LED3, 0);
+  TRACE_ISR_LEAVE(TRACE_ISR_ETM0);
 }
 
 /*-------------------------------------------------------------------------------------------------------------
@@ -620,6 +722,10 @@ void      Motor_ISR_task(uint_32 initial_data)
 
     Led_control(LED3, 1);
 
+    // Компараторы записанные в прошлом периоде загружены в верхней точке и действуют в ближайшей нижней точке,
+    // по ним выбираем моменты выборок ADC для этой нижней точки и отмечаем ими кадр ADC
+    ADC_set_sampling(&pwm_loaded, pwm_loaded_cycle, pwm_loaded_phase);
+
     MC_calculate_PWM(&pwm_3ph);
     FTM0_C0V = pwm_3ph.pwm_a;
     FTM0_C1V = pwm_3ph.pwm_a;
@@ -628,21 +734,36 @@ void      Motor_ISR_task(uint_32 initial_data)
     FTM0_C4V = pwm_3ph.pwm_c;
     FTM0_C5V = pwm_3ph.pwm_c;
     FTM0_SYNC |= BIT(7);   //
-
-    if ( arr_pos < TST_SMPLS_ARR_SZ )
-    {
-      smpls[8][arr_pos] = pwm_3ph.pwm_a;
-      smpls[9][arr_pos] = pwm_3ph.pwm_b;
-      smpls[10][arr_pos] = pwm_3ph.pwm_c;
-    }
+    pwm_loaded       = pwm_3ph;
+    pwm_loaded_cycle = Gen_get_smpl_cycle();
+    pwm_loaded_phase = Gen_get_smpl_phase();
+    TRACE_CTRL(pwm_3ph.pwm_a);
 
     // Изменение скорости вращения задается счетчиком и шагом
     if ( mc_cbl.skew_cnt != 0 )
     {
-      mc_cbl.ll_mot_freq = mc_cbl.ll_mot_freq + mc_cbl.ll_step;       // Добавляем шаг
+      if ( mc_cbl.action == MOT_STOP_ACTION )
+      {
+        mc_cbl.stop_periods++;
+        // При снижении частоты ограничиваем рост напряжения шины от рекуперации
+        if ( mc_cbl.ll_step < 0 )
+        {
+          mc_cbl.gov_k = MC_vbus_governor();
+          if ( mc_cbl.gov_k < VBUS_GOV_K_ONE ) mc_cbl.gov_periods++;
+        }
+      }
+
+      // Шаг уменьшается в gov_k/VBUS_GOV_K_ONE раз, а счетчик этапа убывает во столько же раз медленнее,
+      // поэтому общее изменение частоты сохраняется, а время торможения растягивается
+      mc_cbl.ll_mot_freq = mc_cbl.ll_mot_freq + (mc_cbl.ll_step * (signed long long)mc_cbl.gov_k) / VBUS_GOV_K_ONE; // Добавляем шаг
       mc_cbl.mot_freq = (mc_cbl.ll_mot_freq + 0x80000000ll) >> 32;    // Приводим к 32-х битному целому c округлением
       Gen_update_freq(mc_cbl.mot_freq);
-      mc_cbl.skew_cnt--;
+      mc_cbl.gov_acc += mc_cbl.gov_k;
+      if ( mc_cbl.gov_acc >= VBUS_GOV_K_ONE )
+      {
+        mc_cbl.gov_acc -= VBUS_GOV_K_ONE;
+        mc_cbl.skew_cnt--;
+      }
       if ( mc_cbl.skew_cnt == 0 )
       {
         // Фиксируем переход от ускорения к  равномерному движению.
@@ -659,6 +780,7 @@ void      Motor_ISR_task(uint_32 initial_data)
         }
         if (  mc_cbl.action == MOT_STOP_ACTION ) // Если это было не торможение, то это равномерное движение
         {
+          MC_fix_stop_report();
           MC_emergency_stop_motor();
         }
         mc_cbl.action = MOT_UNIFORM_MOTION;
@@ -676,6 +798,7 @@ void      Motor_ISR_task(uint_32 initial_data)
     // Останавливаем движение если скрость снизилась до минимальной
     if ( mc_cbl.mot_freq <= MIN_FREQ )
     {
+      if ( mc_cbl.action == MOT_STOP_ACTION ) MC_fix_stop_report();
       MC_emergency_stop_motor();
       
     }
@@ -687,3 +810,123 @@ T_MC_CBL* MC_get_pcbl(void)
 {
   return &mc_cbl;
 }
+
+/*-------------------------------------------------------------------------------------------------------------
+  Назначить старт в момент t_sync + delay_us
+  t_sync - момент приема кадра синхронизации в тактах ядра DWT_CYCCNT
+  remain_us - время оставшееся до старта на момент вызова
+  Подготовка PWM выполняется задачей Control_task по событию MOTOR_SYNC_START
+-------------------------------------------------------------------------------------------------------------*/
+int MC_sync_start_request(INT8U dir, INT32U target_freq, INT32U time, INT32U t_sync, INT32U delay_us, INT32S *remain_us)
+{
+  INT32U t_start = t_sync + delay_us * SYNC_START_CYC_PER_US;
+  INT32S remain;
+  int    res = SYNC_START_OK;
+
+  _int_disable();
+  remain = (INT32S)(t_start - DWT_CYCCNT);
+  if ( (dir != MOVING_UP) && (dir != MOVING_DOWN) )                  res = SYNC_START_ERR_PARAM;
+  else if ( mc_sync_state != MC_SYNC_IDLE )                          res = SYNC_START_ERR_BUSY;
+  else if ( (PWM_state() != 0) || (Pin_PWM_OE_state() == 0) )        res = SYNC_START_ERR_STATE;
+  else if ( remain < SYNC_START_MIN_LEAD_US * SYNC_START_CYC_PER_US ) res = SYNC_START_ERR_LATE;
+  else
+  {
+    mc_sync_t     = t_start;
+    mc_sync_dir   = dir;
+    mc_sync_freq  = target_freq;
+    mc_sync_time  = time;
+    mc_sync_state = MC_SYNC_REQUESTED;
+    mc_sync_stat.requests++;
+  }
+  _int_enable();
+
+  *remain_us = remain / (INT32S)SYNC_START_CYC_PER_US;
+  if ( res == SYNC_START_OK ) MC_set_events(MOTOR_SYNC_START);
+  return res;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Подготовка PWM и запуск таймера PIT для назначенного старта. Вызывается из Control_task
+-------------------------------------------------------------------------------------------------------------*/
+void MC_sync_start_arm(void)
+{
+  INT32S remain;
+
+  if ( mc_sync_state != MC_SYNC_REQUESTED ) return;
+
+  PWM_prepare(mc_sync_dir, START_FREQ);
+  MC_init_speed_change(MOT_START_ACTION, mc_sync_freq, mc_sync_time);
+
+  _int_disable();
+  if ( mc_sync_state != MC_SYNC_REQUESTED )
+  {
+    mc_cbl.action = MOT_IDLE; // Старт отменен во время подготовки
+  }
+  else
+  {
+    remain = (INT32S)(mc_sync_t - DWT_CYCCNT) - SYNC_START_SPIN_US * SYNC_START_CYC_PER_US;
+    if ( remain > 0 )
+    {
+      PIT_LDVAL0    = remain / (BSP_SYSTEM_CLOCK / BSP_BUS_CLOCK); // PIT считает такты шины
+      PIT_TFLG0     = BIT(0);
+      PIT_TCTRL0    = BIT(1) + BIT(0); // TIE, TEN
+      mc_sync_state = MC_SYNC_ARMED;
+    }
+    else
+    {
+      mc_cbl.action = MOT_IDLE;
+      mc_sync_state = MC_SYNC_IDLE;
+      mc_sync_stat.missed++;
+    }
+  }
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отменить назначенный старт
+-------------------------------------------------------------------------------------------------------------*/
+void MC_sync_start_cancel(void)
+{
+  _int_disable();
+  if ( mc_sync_state != MC_SYNC_IDLE )
+  {
+    PIT_TCTRL0 = 0;
+    PIT_TFLG0  = BIT(0);
+    if ( mc_sync_state == MC_SYNC_ARMED ) mc_cbl.action = MOT_IDLE; // PWM еще не включен
+    mc_sync_state = MC_SYNC_IDLE;
+    mc_sync_stat.cancelled++;
+  }
+  _int_enable();
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Прерывание PIT за SYNC_START_SPIN_US до старта. Остаток выдерживается по счетчику тактов ядра
+-------------------------------------------------------------------------------------------------------------*/
+static void MC_sync_start_isr(pointer user_isr_ptr)
+{
+  INT32U late;
+
+  PIT_TCTRL0 = 0;
+  PIT_TFLG0  = BIT(0);
+  if ( mc_sync_state != MC_SYNC_ARMED ) return;
+
+  while ( (INT32S)(DWT_CYCCNT - mc_sync_t) < 0 )
+  {}
+  late = DWT_CYCCNT - mc_sync_t;
+  PWM_enable();
+
+  mc_sync_state = MC_SYNC_IDLE;
+  mc_sync_stat.started++;
+  mc_sync_stat.last_late = late;
+  if ( late > mc_sync_stat.max_late ) mc_sync_stat.max_late = late;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+
+-------------------------------------------------------------------------------------------------------------*/
+void MC_get_sync_stat(T_MC_sync_stat *st)
+{
+  _int_disable();
+  *st = mc_sync_stat;
+  _int_enable();
+}
@@ -8,9 +8,8 @@
 #define  MOTOR_START_DOWN  BIT(4) // Старт  двигателя влево
 #define  MOTOR_START_UP    BIT(5) // Старт  двигателя вправо
 #define  MOTOR_STOP        BIT(6) // Остановка двигателя
-#define  SMPL_ARR1_FULL    BIT(7) // Заполнен массив 1 отсчетов
-#define  SMPL_ARR2_FULL    BIT(8) // Заполнен массив 2 отсчетов
-#define  MEAS_RES_READY    BIT(9) // Готовность результатов статистических измерений сигналов
+#define  MEAS_WIN_READY    BIT(7) // Завершено окно накопления статистики измерений
+#define  MOTOR_SYNC_START  BIT(8) // Назначен старт двигателя в заданный момент общей шкалы времени
 
 
 #define  MAX_MOT_FREQ       50
@@ -37,7 +36,57 @@
 #define  MIN_FREQ           4   // Частота при снижении до которой происходит полная остановка двигателя
 #define  START_FREQ         5   // Частота с которой стартует вращение двигателя
 
+// Регулятор напряжения шины при торможении.
+// При превышении VBUS_GOV_START_V шаг снижения частоты уменьшается пропорционально приближению к VBUS_GOV_HOLD_V,
+// при достижении VBUS_GOV_HOLD_V снижение частоты приостанавливается и время торможения растягивается
+#define  VBUS_GOV_START_V   360.0 // Напряжение шины (В) с которого начинает работать регулятор
+#define  VBUS_GOV_HOLD_V    385.0 // Напряжение шины (В) при котором снижение частоты полностью приостанавливается
+#define  VBUS_GOV_K_ONE     256   // Коэффициент регулятора равный 1.0 (торможение с заданным шагом)
 
+// Старт в заданный момент общей шкалы времени группы инверторов (команда SYNC_START по CAN).
+// Момент задается в тактах ядра DWT_CYCCNT. Задача Control_task заранее рассчитывает PWM, канал PIT
+// вызывает прерывание за SYNC_START_SPIN_US до старта, остаток выдерживается по счетчику тактов и PWM включается
+#define  SYNC_START_MIN_LEAD_US 2000  // Минимальный запас времени до старта на подготовку PWM
+#define  SYNC_START_SPIN_US     20    // Опережение срабатывания PIT перекрывающее задержку входа в прерывание
+#define  SYNC_START_CYC_PER_US  (BSP_SYSTEM_CLOCK / 1000000)
+
+#define  MC_SYNC_IDLE           0   // Старт не назначен
+#define  MC_SYNC_REQUESTED      1   // Старт назначен, ожидается подготовка в Control_task
+#define  MC_SYNC_ARMED          2   // PWM подготовлен, запущен таймер PIT
+
+// Коды результата назначения старта. Передаются в ответе на SYNC_START
+#define  SYNC_START_OK          0
+#define  SYNC_START_ERR_SYNC    1   // Нет кадра синхронизации с заданным номером
+#define  SYNC_START_ERR_LATE    2   // Момент старта уже прошел или до него меньше SYNC_START_MIN_LEAD_US
+#define  SYNC_START_ERR_STATE   3   // Двигатель вращается или разорвана цепь безопасности
+#define  SYNC_START_ERR_BUSY    4   // Уже назначен другой старт
+#define  SYNC_START_ERR_PARAM   5   // Неверное направление
+
+
+
+typedef struct
+{
+  unsigned int       cnt;            // Количество зафиксированных остановок
+  unsigned int       start_freq;     // Частота в начале торможения (Гц)
+  unsigned int       end_freq;       // Частота при которой выполнено отключение (Гц)
+  unsigned int       plan_time_ms;   // Заданное время торможения (мс)
+  unsigned int       time_ms;        // Фактическое время торможения (мс)
+  unsigned int       gov_time_ms;    // Время в течении которого регулятор напряжения шины замедлял торможение (мс)
+  float              decel;          // Фактическое замедление (Гц/с)
+  float              vbus_max;       // Максимальное напряжение шины во время торможения (В)
+}
+T_MC_stop_report;
+
+typedef struct
+{
+  unsigned int       requests;       // Количество назначенных стартов
+  unsigned int       started;        // Количество выполненных стартов
+  unsigned int       missed;         // Подготовка PWM завершилась позже момента старта
+  unsigned int       cancelled;      // Старт отменен командой остановки
+  unsigned int       last_late;      // Запаздывание включения PWM относительно назначенного момента (тактов ядра)
+  unsigned int       max_late;
+}
+T_MC_sync_stat;
 
 typedef struct PWM_CBL
 {
@@ -65,6 +114,15 @@ typedef struct PWM_CBL
   float              pwm_scale;
   float              pwm_scale_delta;
   unsigned int       pwm_scale_cnt;
+
+  unsigned int       gov_k;          // Текущий коэффициент регулятора напряжения шины. VBUS_GOV_K_ONE - регулятор не вмешивается
+  unsigned int       gov_acc;        // Накопитель коэффициента регулятора для уменьшения skew_cnt
+  unsigned int       stop_start_freq;// Частота в начале текущего торможения
+  unsigned int       stop_plan_ms;   // Заданное время текущего торможения (мс)
+  unsigned int       stop_periods;   // Количество периодов PWM прошедших от начала торможения
+  unsigned int       gov_periods;    // Количество периодов PWM в которых работал регулятор
+  int                stop_vbus_max;  // Максимальный отсчет напряжения шины во время торможения
+  T_MC_stop_report   stop_rep;       // Отчет о последней остановке
 }
 T_MC_CBL, _PTR_ T_MC_CBL_ptr;
 
@@ -97,4 +155,9 @@ T_MC_CBL *MC_get_pcbl(void);
 
 void      MC_init_speed_change(unsigned int action,  unsigned int target_freq, unsigned int target_time);
 
+int       MC_sync_start_request(INT8U dir, INT32U target_freq, INT32U time, INT32U t_sync, INT32U delay_us, INT32S *remain_us);
+void      MC_sync_start_arm(void);
+void      MC_sync_start_cancel(void);
+void      MC_get_sync_stat(T_MC_sync_stat *st);
+
 #endif
@@ -78,22 +78,6 @@ void LCD_RST(int state)
   else PTD_BASE_PTR->PSOR = LSHIFT(1, 11);
 }
 
-/*-------------------------------------------------------------------------------------------------------------
-  Serial clock
--------------------------------------------------------------------------------------------------------------*/
-void LCD_SCL(int state)
-{
-  if ( state == 0 ) PTD_BASE_PTR->PCOR = LSHIFT(1, 12);
-  else PTD_BASE_PTR->PSOR = LSHIFT(1, 12);
-}
-/*-------------------------------------------------------------------------------------------------------------
-  Input data
--------------------------------------------------------------------------------------------------------------*/
-void LCD_SI(int state)
-{
-  if ( state == 0 ) PTD_BASE_PTR->PCOR = LSHIFT(1, 13);
-  else PTD_BASE_PTR->PSOR = LSHIFT(1, 13);
-}
 /*-------------------------------------------------------------------------------------------------------------
   Register Select Signal. RS=0: instruction; RS=1: data
 -------------------------------------------------------------------------------------------------------------*/
@@ -102,14 +86,6 @@ void LCD_RS(int state)
   if ( state == 0 ) PTD_BASE_PTR->PCOR = LSHIFT(1, 14);
   else PTD_BASE_PTR->PSOR = LSHIFT(1, 14);
 }
-/*-------------------------------------------------------------------------------------------------------------
-  Active LOW Chip Select signal
--------------------------------------------------------------------------------------------------------------*/
-void LCD_SCB(int state)
-{
-  if ( state == 0 ) PTD_BASE_PTR->PCOR = LSHIFT(1, 15);
-  else PTD_BASE_PTR->PSOR = LSHIFT(1, 15);
-}
 
 
 
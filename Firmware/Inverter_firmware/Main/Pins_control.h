@@ -16,8 +16,5 @@ void Pin_VFO_int_install(void);
 int  Pin_PWM_OE_state(void);
 
 void LCD_RST(int state);
-void LCD_SCL(int state);
-void LCD_SI(int state);
 void LCD_RS(int state);
-void LCD_SCB(int state);
 #endif
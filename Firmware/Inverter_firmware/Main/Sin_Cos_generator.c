@@ -266,6 +266,9 @@ static const long int cos_tbl[2048] =
 
 static unsigned int phase;
 static unsigned int dphase;
+static unsigned int cycles;      // Счетчик переполнений аккумулятора фазы, т.е. пройденных периодов генератора
+static unsigned int smpl_cycle;  // Номер периода к которому относится последний выданный отсчет
+static unsigned int smpl_phase;  // Фаза последнего выданного отсчета
 
 
 /*-------------------------------------------------------------------------------------------------------------
@@ -282,6 +285,7 @@ static unsigned int Gen_get_dphase(unsigned int freq)
 void Gen_start(unsigned int freq)
 {
   phase = 0;
+  cycles++; // Старт с нулевой фазы всегда начинает новый период
   dphase = Gen_get_dphase(freq);
 }
 
@@ -302,8 +306,39 @@ void Get_generator_sample(Frac32 *psin, Frac32 *pcos)
   indx = phase >> (32 - 11);
   *psin = sin_tbl[indx]; // Сдвигаем так чтобы осталось 11 бит соответственно размеру таблицы
   *pcos = cos_tbl[indx]; // Сдвигаем так чтобы осталось 11 бит соответственно размеру таблицы
+  smpl_cycle = cycles;
+  smpl_phase = phase;
   phase += dphase;
-  
+  if ( phase < dphase ) cycles++; // Аккумулятор фазы переполнился, следующий отсчет начинает новый период
 }
 
+/*-------------------------------------------------------------------------------------------------------------
+  Получить номер периода генератора к которому относится последний отсчет выданный Get_generator_sample
+  Смена номера между соседними отсчетами означает переход фазы через 0
+-------------------------------------------------------------------------------------------------------------*/
+unsigned int Gen_get_smpl_cycle(void)
+{
+  return smpl_cycle;
+}
+
+
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить фазу последнего отсчета выданного Get_generator_sample. Полный период соответствует PH_MAX
+-------------------------------------------------------------------------------------------------------------*/
+unsigned int Gen_get_smpl_phase(void)
+{
+  return smpl_phase;
+}
 
+/*-------------------------------------------------------------------------------------------------------------
+  Получить значения sin и cos произвольной фазы в формате Q15
+  Используется для опорных сигналов гармонического анализа, поэтому точности 16 бит достаточно
+-------------------------------------------------------------------------------------------------------------*/
+void Gen_get_sin_cos_q15(unsigned int ph, int *psin, int *pcos)
+{
+  unsigned int indx;
+  indx = ph >> (32 - 11);
+  *psin = sin_tbl[indx] >> 16;
+  *pcos = cos_tbl[indx] >> 16;
+}
@@ -6,5 +6,8 @@
 void Gen_start(unsigned int freq);
 void Gen_update_freq(unsigned int freq);
 void Get_generator_sample(Frac32 *psin, Frac32 *pcos);
+unsigned int Gen_get_smpl_cycle(void);
+unsigned int Gen_get_smpl_phase(void);
+void Gen_get_sin_cos_q15(unsigned int ph, int *psin, int *pcos);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include "App.h"
+
+
+// Очередь выборок. Кольцо с одним писателем (Stream_sample в прерывании ADC) и одним читателем (Stream_encode) без блокировок.
+// Индексы только увеличиваются, позиция в массиве - младшие биты индекса
+static T_stream_smpl    stream_q[STREAM_Q_SZ];
+static volatile INT32U  stream_head;   // Изменяет только писатель
+static volatile INT32U  stream_tail;   // Изменяет только читатель
+
+static volatile INT32U  stream_mask;   // Маска передаваемых сигналов. 0 - поток остановлен
+static INT32U           stream_div;    // Количество периодов PWM между выборками
+static INT32U           stream_n;      // Количество сигналов в маске
+static INT32U           stream_cnt;    // Счетчик периодов PWM до следующей выборки
+static INT16U           stream_seq;    // Номер следующей выборки
+
+static T_stream_stat    stream_stat;
+
+// CRC-16/CCITT-FALSE (полином 0x1021) по тетрадам
+static const INT16U crc16_nibble_tbl[16] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/*-------------------------------------------------------------------------------------------------------------
+  Количество установленных бит в маске сигналов
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U Stream_mask_bits(INT32U mask)
+{
+  INT32U n = 0;
+
+  mask &= BIT(STREAM_SIG_NUM) - 1;
+  while (mask)
+  {
+    n += mask & 1;
+    mask >>= 1;
+  }
+  return n;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Вычисление CRC-16/CCITT-FALSE с начальным значением 0xFFFF
+-------------------------------------------------------------------------------------------------------------*/
+static INT16U Stream_crc16(INT8U *buf, INT32U len)
+{
+  INT16U crc = 0xFFFF;
+
+  while (len--)
+  {
+    crc = (crc << 4) ^ crc16_nibble_tbl[(crc >> 12) ^ (*buf >> 4)];
+    crc = (crc << 4) ^ crc16_nibble_tbl[(crc >> 12) ^ (*buf & 0x0F)];
+    buf++;
+  }
+  return crc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Кодирование COBS с завершающим нулевым байтом
+  Длина src не должна превышать 253 байт, тогда размер результата равен len + 2
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U Stream_cobs(INT8U *src, INT32U len, INT8U *dst)
+{
+  INT32U code_pos = 0;
+  INT32U o        = 1;
+  INT8U  code     = 1;
+
+  while (len--)
+  {
+    if ( *src == 0 )
+    {
+      dst[code_pos] = code;
+      code_pos      = o++;
+      code          = 1;
+    }
+    else
+    {
+      dst[o++] = *src;
+      code++;
+    }
+    src++;
+  }
+  dst[code_pos] = code;
+  dst[o++]      = 0;
+  return o;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Выборка сигналов. Вызывается из прерывания ADC в каждом периоде PWM
+  res - результаты обработки кадра ADC, pwm - компараторы действовавшие в момент выборки
+-------------------------------------------------------------------------------------------------------------*/
+void Stream_sample(const T_ADC_res *res, const T_3ph_pwm *pwm)
+{
+  INT32U         mask = stream_mask;
+  INT32U         head;
+  INT32U         i;
+  INT32U         n;
+  INT16S         sig[STREAM_SIG_NUM];
+  T_stream_smpl *ps;
+
+  if ( mask == 0 ) return;
+  if ( ++stream_cnt < stream_div ) return;
+  stream_cnt = 0;
+  stream_stat.samples++;
+
+  head = stream_head;
+  if ( (head - stream_tail) >= STREAM_Q_SZ )
+  {
+    // Выборка теряется, но номер увеличивается чтобы потеря была видна на приемной стороне
+    stream_seq++;
+    stream_stat.drops++;
+    return;
+  }
+
+  sig[STREAM_SIG_II_W]   = res->ii_w;
+  sig[STREAM_SIG_II_V]   = res->ii_v;
+  sig[STREAM_SIG_II_U]   = res->ii_u;
+  sig[STREAM_SIG_V_BUS]  = res->v_bus;
+  sig[STREAM_SIG_V_U]    = res->smpl_v_u;
+  sig[STREAM_SIG_PWM_A]  = pwm->pwm_a;
+  sig[STREAM_SIG_PWM_B]  = pwm->pwm_b;
+  sig[STREAM_SIG_PWM_C]  = pwm->pwm_c;
+  sig[STREAM_SIG_FREQ]   = (INT16S)(MC_get_pcbl()->ll_mot_freq >> 24);
+  sig[STREAM_SIG_TEMPER] = res->smpl_temper;
+
+  ps      = &stream_q[head & (STREAM_Q_SZ - 1)];
+  ps->seq = stream_seq++;
+  n       = 0;
+  for (i = 0; i < STREAM_SIG_NUM; i++)
+  {
+    if ( mask & BIT(i) ) ps->v[n++] = sig[i];
+  }
+  __DMB(); // Запись должна быть завершена раньше публикации индекса
+  stream_head = head + 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Минимальное количество периодов PWM между выборками при котором поток с заданной маской
+  не превышает пропускную способность порта монитора (10 бит на байт, 2 байта накладных расходов COBS)
+-------------------------------------------------------------------------------------------------------------*/
+INT32U Stream_min_div(INT32U mask)
+{
+  INT32U bits = 10 * (STREAM_FRAME_MAX - 2 * (STREAM_SIG_NUM - Stream_mask_bits(mask)) + 2);
+
+  return (PWM_FREQ * bits + STREAM_BAUD - 1) / STREAM_BAUD;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Запуск потока. Делитель ограничивается снизу пропускной способностью порта
+  Возвращает установленный делитель или 0 если маска пуста
+-------------------------------------------------------------------------------------------------------------*/
+INT32U Stream_start(INT32U mask, INT32U div)
+{
+  INT32U min_div;
+
+  mask &= BIT(STREAM_SIG_NUM) - 1;
+  if ( mask == 0 ) return 0;
+
+  min_div = Stream_min_div(mask);
+  if ( div < min_div ) div = min_div;
+  if ( div > 0xFFFF  ) div = 0xFFFF;
+
+  _int_disable();
+  stream_mask = 0;
+  stream_div  = div;
+  stream_n    = Stream_mask_bits(mask);
+  stream_cnt  = 0;
+  stream_seq  = 0;
+  stream_head = 0;
+  stream_tail = 0;
+  memset(&stream_stat, 0, sizeof(stream_stat));
+  stream_mask = mask;
+  _int_enable();
+  return div;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Остановка потока. Вызывается из задачи читателя очереди
+  Не переданные выборки отбрасываются: после сброса маски Stream_encode не смог бы заполнить их заголовок
+-------------------------------------------------------------------------------------------------------------*/
+void Stream_stop(void)
+{
+  stream_mask = 0;
+  __DMB(); // После сброса маски прерывание ADC не добавляет выборок
+  stream_tail = stream_head;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Извлечь из очереди накопленные выборки и упаковать их в кодированные кадры
+  Кадры помещаются в buf целиком пока хватает места. Возвращает количество записанных байт
+-------------------------------------------------------------------------------------------------------------*/
+INT32U Stream_encode(INT8U *buf, INT32U size)
+{
+  INT8U          frame[STREAM_FRAME_MAX];
+  INT32U         tail = stream_tail;
+  INT32U         mask = stream_mask;
+  INT32U         len  = 0;
+  INT32U         flen;
+  INT32U         i;
+  INT16U         crc;
+  T_stream_smpl *ps;
+
+  while ( (tail != stream_head) && ((size - len) >= (STREAM_FRAME_MAX + 2)) )
+  {
+    __DMB(); // Запись читается после индекса
+    ps       = &stream_q[tail & (STREAM_Q_SZ - 1)];
+    frame[0] = ps->seq & 0xFF;
+    frame[1] = ps->seq >> 8;
+    frame[2] = mask & 0xFF;
+    frame[3] = mask >> 8;
+    frame[4] = stream_div & 0xFF;
+    frame[5] = stream_div >> 8;
+    flen     = 6;
+    for (i = 0; i < stream_n; i++)
+    {
+      frame[flen++] = (INT16U)ps->v[i] & 0xFF;
+      frame[flen++] = (INT16U)ps->v[i] >> 8;
+    }
+    __DMB(); // Запись должна быть прочитана раньше освобождения места
+    stream_tail = ++tail;
+
+    crc           = Stream_crc16(frame, flen);
+    frame[flen++] = crc & 0xFF;
+    frame[flen++] = crc >> 8;
+    len += Stream_cobs(frame, flen, buf + len);
+    stream_stat.frames++;
+  }
+  stream_stat.bytes += len;
+  return len;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить статистику потока
+-------------------------------------------------------------------------------------------------------------*/
+void Stream_get_stat(T_stream_stat *st)
+{
+  *st = stream_stat;
+}
@@ -0,0 +1,55 @@
+#ifndef __STREAM_CONTROL
+  #define __STREAM_CONTROL
+
+// Двоичный поток телеметрии через порт монитора.
+// Выборки сигналов делаются в прерывании ADC раз в заданное количество периодов PWM и через очередь
+// передаются задаче монитора, которая упаковывает их в кадры и отправляет в UART.
+//
+// Кадр до кодирования (все поля младшим байтом вперед):
+//   INT16U seq   - номер выборки. Увеличивается и для выборок потерянных при переполнении очереди
+//   INT16U mask  - маска передаваемых сигналов STREAM_SIG_*
+//   INT16U div   - количество периодов PWM между выборками
+//   INT16S v[n]  - значения сигналов из маски в порядке возрастания номеров
+//   INT16U crc   - CRC-16/CCITT-FALSE (полином 0x1021, начальное значение 0xFFFF) всех предыдущих байт
+// Кадр кодируется COBS и завершается байтом 0x00
+
+#define STREAM_SIG_II_W     0   // Ток фазы w (отсчеты ADC за вычетом смещения нуля)
+#define STREAM_SIG_II_V     1   // Ток фазы v
+#define STREAM_SIG_II_U     2   // Ток фазы u
+#define STREAM_SIG_V_BUS    3   // Напряжение шины (отсчеты ADC, бегущее среднее)
+#define STREAM_SIG_V_U      4   // Фазное напряжение u (отсчеты ADC, обновляется с частотой 500 Гц)
+#define STREAM_SIG_PWM_A    5   // Компаратор PWM фазы A действовавший в момент выборки
+#define STREAM_SIG_PWM_B    6
+#define STREAM_SIG_PWM_C    7
+#define STREAM_SIG_FREQ     8   // Частота генератора (1/256 Гц)
+#define STREAM_SIG_TEMPER   9   // Температура кристалла (отсчеты ADC, обновляется с частотой 500 Гц)
+#define STREAM_SIG_NUM      10
+
+#define STREAM_MASK_DEF     0x0129  // ii_w, v_bus, pwm_a, freq
+#define STREAM_DIV_DEF      16      // 1000 выборок в секунду
+#define STREAM_Q_SZ         256     // Размер очереди выборок. Степень двойки
+#define STREAM_FRAME_MAX    (6 + 2 * STREAM_SIG_NUM + 2) // Наибольший размер кадра до кодирования
+#define STREAM_BAUD         UART_MON_BAUD               // Скорость порта монитора
+
+typedef struct
+{
+  INT16U seq;
+  INT16S v[STREAM_SIG_NUM]; // Значения сигналов из маски подряд
+} T_stream_smpl;
+
+typedef struct
+{
+  INT32U samples;   // Сделано выборок
+  INT32U drops;     // Выборок потеряно из-за переполнения очереди
+  INT32U frames;    // Отправлено кадров
+  INT32U bytes;     // Отправлено байт после кодирования
+} T_stream_stat;
+
+void    Stream_sample(const T_ADC_res *res, const T_3ph_pwm *pwm);
+INT32U  Stream_min_div(INT32U mask);
+INT32U  Stream_start(INT32U mask, INT32U div);
+void    Stream_stop(void);
+INT32U  Stream_encode(INT8U *buf, INT32U size);
+void    Stream_get_stat(T_stream_stat *st);
+
+#endif
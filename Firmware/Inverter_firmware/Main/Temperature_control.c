@@ -3,98 +3,220 @@
 #include <fio.h>
 #include "App.h"
 
-#define I2C_DEVICE_POLLED    "i2c0:"
-#define I2C_DEVICE_INTERRUPT "ii2c0:"
-#define I2C_MAX31725_ADDRESS  (0x90>>1)
-#define I2C_SPEED            400000 
+// Шаги обмена с датчиком: запись указателя регистра температуры, повторный старт и чтение 2-х байт
+#define TEMP_ST_IDLE     0
+#define TEMP_ST_ADDR_W   1  // Передан адрес для записи
+#define TEMP_ST_PTR      2  // Передан номер регистра
+#define TEMP_ST_ADDR_R   3  // Передан адрес для чтения
+#define TEMP_ST_RX0      4  // Принимается старший байт
+#define TEMP_ST_RX1      5  // Принимается младший байт
 
-static  MQX_FILE_PTR   i2c0_fd;
+static volatile INT32U  temp_state;
+static INT8U            temp_msb;
+static INT32U           temp_period_ms = TEMP_PERIOD_MS;
 
+// Кэш. Изменяется только в прерывании I2C0
+static INT16S           temp_raw;      // Значение регистра температуры MAX31725, 1/256 град. C
+static INT32U           temp_have;     // Было хотя бы одно успешное чтение
+static MQX_TICK_STRUCT  temp_ts;
+static T_temper_info    temp_stat;
 
-/*-----------------------------------------------------------------------------------------------------
 
+/*-----------------------------------------------------------------------------------------------------
+  Прервать обмен. Снятие MST формирует STOP
 -----------------------------------------------------------------------------------------------------*/
-_mqx_int TempCtrl_init_drivers(void)
+static void TempCtrl_i2c_abort(void)
 {
-  _mqx_int param;
-
-  i2c0_fd = fopen(I2C_DEVICE_POLLED, NULL);
-  if ( i2c0_fd == NULL )
-  {
-    return MQX_ERROR;
-  }
-  param = I2C_SPEED;
-  if ( ioctl(i2c0_fd, IO_IOCTL_I2C_SET_BAUD, &param)!= I2C_OK )
-  {
-    fclose(i2c0_fd);
-    return MQX_ERROR;
-  }
-  if (ioctl(i2c0_fd, IO_IOCTL_I2C_SET_MASTER_MODE, NULL)!= I2C_OK )
-  {
-    fclose(i2c0_fd);
-    return MQX_ERROR;
-  }
-  return MQX_OK;
+  I2C0_C1    = BIT(7) + BIT(6);  // IICEN, IICIE
+  temp_state = TEMP_ST_IDLE;
 }
 
-
 /*-----------------------------------------------------------------------------------------------------
-
+  Прерывание I2C0. Каждое прерывание - завершение передачи или приема одного байта
 -----------------------------------------------------------------------------------------------------*/
-_mqx_int TempCtrl_read_IGBT_temperature(float *temp_ptr)
+static void TempCtrl_i2c_isr(pointer user_isr_ptr)
 {
-  _mqx_int  param;
-  _mqx_int  result;
-  uchar     buf[4];
-  _mqx_int  n;
-  float     f;
-
-  param = I2C_MAX31725_ADDRESS;
-  if ( ioctl(i2c0_fd, IO_IOCTL_I2C_SET_DESTINATION_ADDRESS, &param)!= I2C_OK )
+  INT8U s = I2C0_S;
+
+  I2C0_S = BIT(1);  // IICIF
+  if ( s & BIT(4) )
   {
-    return MQX_ERROR;
+    // ARBL. Потерян арбитраж
+    I2C0_S = BIT(4);
+    temp_stat.arb_lost++;
+    TempCtrl_i2c_abort();
+    return;
   }
-  fwrite(buf, 1, 0, i2c0_fd);
-  if ( ioctl(i2c0_fd, IO_IOCTL_FLUSH_OUTPUT, &param) == I2C_OK )
+
+  switch (temp_state)
   {
-    if ( param )
+  case TEMP_ST_ADDR_W:
+  case TEMP_ST_PTR:
+  case TEMP_ST_ADDR_R:
+    if ( s & BIT(0) )
     {
-      ioctl(i2c0_fd, IO_IOCTL_I2C_STOP, NULL);
-      return MQX_ERROR;
+      // RXAK. Нет подтверждения от датчика
+      temp_stat.nacks++;
+      TempCtrl_i2c_abort();
+      return;
     }
+    if ( temp_state == TEMP_ST_ADDR_W )
+    {
+      I2C0_D     = 0;                            // Регистр температуры
+      temp_state = TEMP_ST_PTR;
+    }
+    else if ( temp_state == TEMP_ST_PTR )
+    {
+      I2C0_C1   |= BIT(2);                       // RSTA. Повторный старт
+      I2C0_D     = (TEMP_MAX31725_ADDR << 1) | 1;
+      temp_state = TEMP_ST_ADDR_R;
+    }
+    else
+    {
+      I2C0_C1   &= ~(BIT(4) + BIT(3));           // TX = 0 - прием, TXAK = 0 - подтверждать первый байт
+      temp_state = TEMP_ST_RX0;
+      (void)I2C0_D;                              // Чтение запускает прием
+    }
+    break;
+
+  case TEMP_ST_RX0:
+    I2C0_C1   |= BIT(3);                         // TXAK. Последний байт не подтверждается
+    temp_state = TEMP_ST_RX1;
+    temp_msb   = I2C0_D;
+    break;
+
+  case TEMP_ST_RX1:
+    I2C0_C1   &= ~(BIT(5) + BIT(3));             // MST = 0 - STOP
+    temp_state = TEMP_ST_IDLE;
+    temp_raw   = (INT16S)((temp_msb << 8) | I2C0_D);
+    _time_get_ticks(&temp_ts);
+    temp_have  = 1;
+    temp_stat.reads++;
+    break;
+
+  default:
+    TempCtrl_i2c_abort();
+    break;
   }
-  else
-  {
-    return MQX_ERROR;
-  }
-  buf[0] = 0;
-  result = fwrite(buf, 1, 1, i2c0_fd);
-  if ( 1 != result )
+}
+
+/*-----------------------------------------------------------------------------------------------------
+  Прерывание PIT1. Запуск чтения температуры
+-----------------------------------------------------------------------------------------------------*/
+static void TempCtrl_pit_isr(pointer user_isr_ptr)
+{
+  PIT_TFLG1 = BIT(0);
+
+  if ( temp_state != TEMP_ST_IDLE )
   {
-    return MQX_ERROR;
+    // Обмен завис. Модуль перезапускается чтобы освободить шину
+    temp_stat.timeouts++;
+    I2C0_C1    = 0;
+    temp_state = TEMP_ST_IDLE;
+    I2C0_C1    = BIT(7) + BIT(6);  // IICEN, IICIE
+    return;
   }
-  if (ioctl(i2c0_fd, IO_IOCTL_I2C_REPEATED_START, NULL)!= I2C_OK  )
+  if ( I2C0_S & BIT(5) )
   {
-    return MQX_ERROR;
+    // BUSY. Шину занимает другой ведущий или не отпущена после сбоя
+    temp_stat.busy++;
+    return;
   }
 
-  n = 2; // Читаем 2-а байта
-  param = n;
-  if (ioctl(i2c0_fd, IO_IOCTL_I2C_SET_RX_REQUEST, &param)!= I2C_OK)
-  {
-    return MQX_ERROR;
-  }
+  temp_state = TEMP_ST_ADDR_W;
+  I2C0_C1    = 0
+               + LSHIFT(1, 7)  // IICEN.
+               + LSHIFT(1, 6)  // IICIE.
+               + LSHIFT(1, 5)  // MST. Переход в режим ведущего формирует START
+               + LSHIFT(1, 4)  // TX.
+  ;
+  I2C0_D     = TEMP_MAX31725_ADDR << 1;
+}
 
-  result = fread(buf, 1, n, i2c0_fd);
-  if ( result != n )
-  {
-    return MQX_ERROR;
-  }
+/*-----------------------------------------------------------------------------------------------------
+  Инициализация I2C0 и запуск периодического чтения температуры
+-----------------------------------------------------------------------------------------------------*/
+_mqx_int TempCtrl_init(void)
+{
+  // Тактирование I2C0. Драйвер I2C BSP отключен (BSPCFG_ENABLE_I2C0 = 0), выводы PTD8, PTD9 (ALT2, открытый сток,
+  // фильтр) настраивает только таблица gen_pins_conf в init_gpio.c
+  SIM_SCGC4 |= BIT(6);
+  SIM_SCGC6 |= BIT(23); // Тактирование PIT
+
+  I2C0_C1    = 0;
+  I2C0_F     = 0
+               + LSHIFT(0, 6)             // MULT. Множитель 1
+               + LSHIFT(TEMP_I2C_ICR, 0)  // ICR.
+  ;
+  I2C0_S     = BIT(4) + BIT(1); // Сбросить ARBL и IICIF
+  temp_state = TEMP_ST_IDLE;
+  I2C0_C1    = BIT(7) + BIT(6); // IICEN, IICIE
+
+  _int_install_isr(TEMP_I2C_INT, TempCtrl_i2c_isr, NULL);
+  _bsp_int_init(TEMP_I2C_INT, TEMP_ISR_PRIO, 0, TRUE);
+
+  PIT_MCR    = 0;       // MDIS = 0. Модуль включен
+  PIT_TCTRL1 = 0;
+  PIT_TFLG1  = BIT(0);
+  _int_install_isr(TEMP_PIT_INT, TempCtrl_pit_isr, NULL);
+  _bsp_int_init(TEMP_PIT_INT, TEMP_ISR_PRIO, 0, TRUE);
+
+  TempCtrl_set_period(temp_period_ms);
+  return MQX_OK;
+}
+
+/*-----------------------------------------------------------------------------------------------------
+  Установить период чтения температуры
+-----------------------------------------------------------------------------------------------------*/
+void TempCtrl_set_period(INT32U period_ms)
+{
+  if ( period_ms < TEMP_PERIOD_MIN_MS ) period_ms = TEMP_PERIOD_MIN_MS;
+  if ( period_ms > TEMP_PERIOD_MAX_MS ) period_ms = TEMP_PERIOD_MAX_MS;
+  temp_period_ms = period_ms;
+
+  PIT_TCTRL1 = 0;
+  PIT_LDVAL1 = period_ms * (BSP_BUS_CLOCK / 1000) - 1; // PIT считает такты шины
+  PIT_TFLG1  = BIT(0);
+  PIT_TCTRL1 = BIT(1) + BIT(0); // TIE, TEN
+}
 
-  ioctl(i2c0_fd, IO_IOCTL_I2C_STOP, NULL);
+/*-----------------------------------------------------------------------------------------------------
+  Получить температуру IGBT и состояние чтения из кэша
+-----------------------------------------------------------------------------------------------------*/
+void TempCtrl_get_IGBT_info(T_temper_info *ti)
+{
+  MQX_TICK_STRUCT now;
+  boolean         overflow;
+  INT16S          raw;
+  INT32U          have;
+  _mqx_int        age;
 
+  _int_disable();
+  *ti  = temp_stat;
+  raw  = temp_raw;
+  have = temp_have;
+  ti->ts = temp_ts;
+  _int_enable();
+
+  _time_get_ticks(&now);
+  age = _time_diff_milliseconds(&now, &ti->ts, &overflow);
+  if ( overflow || (age < 0) ) age = MAX_INT_32;
+
+  ti->temp      = (float)raw / 256.0f;
+  ti->age_ms    = have ? age : MAX_UINT_32;
+  ti->period_ms = temp_period_ms;
+  ti->valid     = have && (ti->age_ms <= TEMP_AGE_PERIODS * temp_period_ms);
+}
+
+/*-----------------------------------------------------------------------------------------------------
+  Получить температуру IGBT из кэша. Возвращает MQX_ERROR если значение недостоверно
+-----------------------------------------------------------------------------------------------------*/
+_mqx_int TempCtrl_get_IGBT_temperature(float *temp_ptr)
+{
+  T_temper_info ti;
 
-  f =  (float)buf[0] + (float)buf[1]/256.0;
-  *temp_ptr = f;
+  TempCtrl_get_IGBT_info(&ti);
+  if ( ti.valid == 0 ) return MQX_ERROR;
+  *temp_ptr = ti.temp;
   return MQX_OK;
 }
@@ -1,7 +1,39 @@
 #ifndef __TEMPERATURE_CONTROL
   #define __TEMPERATURE_CONTROL
 
-_mqx_int TempCtrl_init_drivers(void);
-_mqx_int TempCtrl_read_IGBT_temperature(float *temp_ptr);
+// Температура IGBT с датчика MAX31725 на I2C0.
+// Чтение запускает канал PIT1 с периодом TEMP_PERIOD_MS, обмен по I2C ведет прерывание I2C0 без участия задач.
+// Последнее прочитанное значение хранится вместе с моментом чтения. Вентилятор, индикатор и монитор берут его
+// из кэша и не обращаются к шине. Значение считается достоверным если прочитано не раньше TEMP_AGE_PERIODS периодов назад.
+// Незавершенный к следующему запуску обмен прерывается со сбросом модуля I2C.
+
+#define TEMP_PERIOD_MS        250      // Период чтения температуры по умолчанию
+#define TEMP_PERIOD_MIN_MS    10
+#define TEMP_PERIOD_MAX_MS    10000
+#define TEMP_AGE_PERIODS      4        // Срок достоверности в периодах чтения
+
+#define TEMP_I2C_INT          INT_I2C0
+#define TEMP_PIT_INT          INT_PIT1
+#define TEMP_MAX31725_ADDR    (0x90>>1)
+#define TEMP_I2C_ICR          0x1D     // Делитель SCL 160: 60 МГц / 160 = 375 кГц
+
+typedef struct
+{
+  float           temp;      // Температура, град. C
+  INT32U          valid;     // 1 - значение прочитано не позже срока достоверности
+  INT32U          age_ms;    // Время прошедшее с момента чтения
+  MQX_TICK_STRUCT ts;        // Момент последнего успешного чтения
+  INT32U          period_ms; // Период чтения
+  INT32U          reads;     // Успешных чтений
+  INT32U          nacks;     // Датчик не ответил
+  INT32U          arb_lost;  // Потерян арбитраж
+  INT32U          busy;      // Шина была занята к моменту запуска
+  INT32U          timeouts;  // Обмен не завершился за период чтения
+} T_temper_info;
+
+_mqx_int TempCtrl_init(void);
+void     TempCtrl_set_period(INT32U period_ms);
+_mqx_int TempCtrl_get_IGBT_temperature(float *temp_ptr);
+void     TempCtrl_get_IGBT_info(T_temper_info *ti);
 
 #endif
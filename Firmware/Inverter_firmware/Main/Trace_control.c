@@ -0,0 +1,33 @@
+#include <mqx.h>
+#include <bsp.h>
+#include "App.h"
+
+volatile INT32U trace_drops;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Настройка ITM и TPIU на вывод через SWO без отладчика
+  Отладчик подключенный позже может перенастроить их по своему
+-------------------------------------------------------------------------------------------------------------*/
+void Trace_init(void)
+{
+  DEMCR     |= BIT(24);    // TRCENA. Разрешение блоков DWT, ITM и TPIU
+  SIM_SOPT2 |= BIT(12);    // TRACECLKSEL. Тактирование трассировки от частоты ядра
+
+  TPIU_SPPR  = 2;          // TXMODE. Асинхронный вывод SWO в коде NRZ
+  TPIU_ACPR  = BSP_SYSTEM_CLOCK / TRACE_SWO_BAUD - 1;
+  TPIU_FFCR  = BIT(8);     // TrigIn. Форматер выключен, в SWO идет только поток ITM
+
+  // Пакеты синхронизации ITM по разряду 26 счетчика тактов, раз в 0.56 с
+  DWT_CTRL   = (DWT_CTRL & ~LSHIFT(3, 10)) | LSHIFT(2, 10) | BIT(0); // SYNCTAP, CYCCNTENA
+
+  ITM_LAR    = 0xC5ACCE55; // Разблокировка регистров ITM
+  ITM_TCR    = 0
+               + LSHIFT(1, 16)                  // TraceBusID.
+               + LSHIFT(TRACE_TS_PRESCALE, 8)   // TSPrescale. Метки времени в единицах TRACE_TS_DIV тактов
+               + LSHIFT(1, 2)                   // SYNCENA. Пакеты синхронизации
+               + LSHIFT(1, 1)                   // TSENA. Локальные метки времени
+               + LSHIFT(1, 0)                   // ITMENA.
+  ;
+  ITM_TPR    = 0;          // Все порты доступны и из непривилегированного режима
+  ITM_TER    = TRACE_PORTS_DEF;
+}
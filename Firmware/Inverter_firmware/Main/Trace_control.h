@@ -0,0 +1,63 @@
+#ifndef __TRACE_CONTROL
+  #define __TRACE_CONTROL
+
+// Трассировка событий через каналы ITM и вывод SWO (PTA2, режим SWD).
+// Событие - запись 1, 2 или 4 байт в порт стимулов ITM, занимает несколько тактов и не ждет передачи.
+// Если FIFO ITM занято, событие пропускается и учитывается в trace_drops.
+// После каждого события ITM добавляет локальную метку времени в единицах TRACE_TS_DIV тактов ядра.
+// Поток декодирует Linux_tools/swo_decode.c.
+//
+// Каналы (порты стимулов):
+//   TRACE_CH_ISR     1 байт - вход в прерывание TRACE_ISR_*, с битом TRACE_ISR_EXIT - выход из него
+//   TRACE_CH_TASK    1 байт - смена выполняемой задачи по выборкам загрузки процессора (Load_control.c):
+//                    номер шаблона *_IDX из App.h или TRACE_TASK_*
+//   TRACE_CH_CTRL    2 байта - компаратор PWM фазы A рассчитанный задачей Motor_ISR_task в очередном периоде
+//   TRACE_CH_COUNTER 4 байта - счетчик: номер TRACE_CNT_* в старшем байте, значение в младших 24 битах
+
+#define TRACE_CH_ISR        1
+#define TRACE_CH_TASK       2
+#define TRACE_CH_CTRL       3
+#define TRACE_CH_COUNTER    4
+
+// Включенные по умолчанию каналы. Канал TRACE_CH_CTRL добавляет 16000 событий в секунду,
+// его включают отладчиком (ITM_TER) или здесь когда это нужно
+#define TRACE_PORTS_DEF     (BIT(TRACE_CH_ISR) + BIT(TRACE_CH_TASK) + BIT(TRACE_CH_COUNTER))
+
+#define TRACE_SWO_BAUD      4000000   // Скорость SWO в режиме NRZ (UART)
+#define TRACE_TS_DIV        64        // Делитель тактов ядра для меток времени ITM
+#define TRACE_TS_PRESCALE   3         // Код делителя 64 в ITM_TCR
+
+#define TRACE_ISR_ETM0      1
+#define TRACE_ISR_ADC_DMA   2
+#define TRACE_ISR_CAN       3
+#define TRACE_ISR_EXIT      0x80
+
+#define TRACE_TASK_OTHER    0xFD      // Задача не поместившаяся в таблицу Load_control
+#define TRACE_TASK_MQX      0xFE      // Системная задача MQX
+#define TRACE_TASK_IDLE     0xFF      // Задача простоя MQX
+
+#define TRACE_CNT_DROPS     1         // Пропущено событий трассировки
+#define TRACE_CNT_ISR_LOAD  2         // Загрузка прерываниями за интервал окна Load_control, 0.1 %
+#define TRACE_CNT_IDLE_LOAD 3         // Время задачи простоя за интервал окна, 0.1 %
+
+extern volatile INT32U trace_drops;
+
+// Запись в порт ch значения типа type если порт включен. Проверка занятости FIFO по чтению порта
+#define TRACE_PUT(ch, type, v) \
+  do { \
+    if ( ITM_TER & BIT(ch) ) \
+    { \
+      if ( ITM_STIM_READ(ch) & BIT(0) ) *(volatile type *)&ITM_STIM_WRITE(ch) = (type)(v); \
+      else trace_drops++; \
+    } \
+  } while (0)
+
+#define TRACE_ISR_ENTER(id)        TRACE_PUT(TRACE_CH_ISR, INT8U, (id))
+#define TRACE_ISR_LEAVE(id)        TRACE_PUT(TRACE_CH_ISR, INT8U, (id) | TRACE_ISR_EXIT)
+#define TRACE_TASK(id)             TRACE_PUT(TRACE_CH_TASK, INT8U, (id))
+#define TRACE_CTRL(v)              TRACE_PUT(TRACE_CH_CTRL, INT16U, (v))
+#define TRACE_COUNTER(id, v)       TRACE_PUT(TRACE_CH_COUNTER, INT32U, ((INT32U)(id) << 24) | ((v) & 0xFFFFFF))
+
+void Trace_init(void);
+
+#endif
@@ -0,0 +1,407 @@
+#include "App.h"
+
+#if UART_MON_DMA
+
+// Кольцо передачи. Пишет задача захватившая uart_tx_sem, читает DMA.
+// Данные расположены в [tail, head), а если запись перешла на начало кольца (head < tail) - в [tail, wrap) и [0, head).
+// Переход на начало выполняется раньше конца кольца если в конце не хватает места для непрерывного участка UART_tx_reserve
+static INT8U            uart_tx_buf[UART_TX_BUF_SZ];
+static volatile INT32U  uart_tx_head;  // Изменяет только задача
+static volatile INT32U  uart_tx_tail;  // Изменяется в прерывании DMA или при запрещенных прерываниях
+static volatile INT32U  uart_tx_wrap;  // Конец данных перед переходом записи на начало кольца
+static INT32U           uart_tx_seg;   // Длина участка переданного DMA для передачи. 0 - канал свободен
+
+static INT8U            uart_rx_buf[UART_RX_BUF_SZ];
+static INT32U           uart_rx_tail;  // Позиция чтения. Позиция записи определяется по адресу назначения канала DMA
+
+static LWEVENT_STRUCT   uart_event;
+static LWSEM_STRUCT     uart_tx_sem;   // Разделение записи в кольцо передачи между задачами
+static T_uart_stat      uart_stat;
+static MQX_FILE_PTR     uart_fd;
+
+
+/*-------------------------------------------------------------------------------------------------------------
+  Запуск передачи очередного непрерывного участка кольца
+  Вызывается из прерывания DMA или при запрещенных прерываниях
+-------------------------------------------------------------------------------------------------------------*/
+static void UART_tx_start(void)
+{
+  INT32U head = uart_tx_head;
+  INT32U tail = uart_tx_tail;
+  INT32U len;
+
+  if ( uart_tx_seg != 0 ) return;
+
+  // Участок до точки перехода передан, продолжаем с начала кольца
+  if ( (head < tail) && (tail >= uart_tx_wrap) )
+  {
+    tail         = 0;
+    uart_tx_tail = 0;
+  }
+  if ( head == tail ) return;
+
+  len = (head > tail) ? (head - tail) : (uart_tx_wrap - tail);
+
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].SADDR         = (uint32_t)&uart_tx_buf[tail];
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].CITER_ELINKNO = len;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].BITER_ELINKNO = len;
+  uart_tx_seg = len;
+  uart_stat.tx_segs++;
+  DMA_SERQ = UART_DMA_TX_CH; // Запросы запрещаются аппаратно по завершении главного цикла (DREQ)
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Прерывание DMA по завершении передачи участка кольца
+-------------------------------------------------------------------------------------------------------------*/
+static void UART_DMA_tx_isr(pointer user_isr_ptr)
+{
+  DMA_CINT = UART_DMA_TX_CH;
+
+  uart_tx_tail      += uart_tx_seg;
+  uart_stat.tx_bytes += uart_tx_seg;
+  uart_tx_seg        = 0;
+  UART_tx_start();
+  _lwevent_set(&uart_event, UART_TX_DONE);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Прерывание по ошибкам приемника
+  Флаги сбрасываются чтением S1 и затем D, поэтому байт на выходе FIFO теряется
+-------------------------------------------------------------------------------------------------------------*/
+static void UART_err_isr(pointer user_isr_ptr)
+{
+  INT8U s1 = UART0_S1;
+
+  if ( s1 & BIT(3) ) uart_stat.rx_overruns++;         // OR
+  if ( s1 & (BIT(2) | BIT(1)) ) uart_stat.rx_errors++; // NF, FE
+  if ( s1 & (BIT(3) | BIT(2) | BIT(1) | BIT(0)) )
+  {
+    (void)UART0_D;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Позиция записи DMA в кольце приема
+-------------------------------------------------------------------------------------------------------------*/
+static INT32U UART_rx_head(void)
+{
+  return ((INT32U)DMA_BASE_PTR->TCD[UART_DMA_RX_CH].DADDR - (INT32U)uart_rx_buf) & (UART_RX_BUF_SZ - 1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Захват и освобождение кольца передачи задачей
+-------------------------------------------------------------------------------------------------------------*/
+void UART_tx_lock(void)
+{
+  _lwsem_wait(&uart_tx_sem);
+}
+
+void UART_tx_unlock(void)
+{
+  _lwsem_post(&uart_tx_sem);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить непрерывный участок свободного места в кольце передачи не короче min байт
+  Возвращает длину участка или 0 если столько места нет. Данные записываются по *p и передаются вызовом UART_tx_commit
+  Вызывать только между UART_tx_lock и UART_tx_unlock
+-------------------------------------------------------------------------------------------------------------*/
+INT32U UART_tx_reserve(INT8U **p, INT32U min)
+{
+  INT32U head = uart_tx_head;
+  INT32U tail = uart_tx_tail;
+  INT32U free;
+
+  if ( head >= tail )
+  {
+    // Позиция записи не должна догнать позицию чтения, иначе заполненное кольцо не отличить от пустого
+    free = UART_TX_BUF_SZ - head - (tail == 0 ? 1 : 0);
+    if ( (free < min) && (tail > min) )
+    {
+      // В конце кольца места мало, а в начале достаточно. Запись переходит на начало кольца
+      uart_tx_wrap = head;
+      __DMB(); // Точка перехода должна быть видна прерыванию раньше новой позиции записи
+      uart_tx_head = 0;
+      head         = 0;
+      free         = tail - 1;
+    }
+  }
+  else
+  {
+    free = tail - head - 1;
+  }
+
+  if ( free < min ) return 0;
+  *p = &uart_tx_buf[head];
+  return free;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Передать len байт записанных в участок полученный от UART_tx_reserve
+-------------------------------------------------------------------------------------------------------------*/
+void UART_tx_commit(INT32U len)
+{
+  INT32U head;
+  INT32U used;
+
+  if ( len == 0 ) return;
+
+  head = uart_tx_head + len;
+  if ( head >= UART_TX_BUF_SZ )
+  {
+    uart_tx_wrap = UART_TX_BUF_SZ;
+    head         = 0;
+  }
+  __DMB(); // Данные должны быть записаны раньше публикации позиции
+  uart_tx_head = head;
+
+  _int_disable();
+  UART_tx_start();
+  _int_enable();
+
+  used = UART_tx_used();
+  if ( used > uart_stat.tx_max_used ) uart_stat.tx_max_used = used;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Количество байт в кольце передачи ожидающих отправки
+-------------------------------------------------------------------------------------------------------------*/
+INT32U UART_tx_used(void)
+{
+  INT32U head = uart_tx_head;
+  INT32U tail = uart_tx_tail;
+
+  if ( head >= tail ) return head - tail;
+  return uart_tx_wrap - tail + head;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Функции устройства MQX
+-------------------------------------------------------------------------------------------------------------*/
+static _mqx_int UART_open(MQX_FILE_PTR fd, char_ptr open_name, char_ptr flags)
+{
+  return MQX_OK;
+}
+
+static _mqx_int UART_close(MQX_FILE_PTR fd)
+{
+  return MQX_OK;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Чтение. Ожидает хотя бы одного принятого байта и возвращает не более len уже принятых байт
+-------------------------------------------------------------------------------------------------------------*/
+static _mqx_int UART_read(MQX_FILE_PTR fd, char_ptr buf, _mqx_int len)
+{
+  INT32U   head;
+  _mqx_int n = 0;
+
+  while ( (head = UART_rx_head()) == uart_rx_tail )
+  {
+    _time_delay_ticks(1);
+  }
+  while ( (n < len) && (uart_rx_tail != head) )
+  {
+    buf[n++]     = uart_rx_buf[uart_rx_tail];
+    uart_rx_tail = (uart_rx_tail + 1) & (UART_RX_BUF_SZ - 1);
+  }
+  uart_stat.rx_bytes += n;
+  return n;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Запись. Копирует данные в кольцо передачи, при нехватке места ждет завершения передачи участков
+-------------------------------------------------------------------------------------------------------------*/
+static _mqx_int UART_write(MQX_FILE_PTR fd, char_ptr buf, _mqx_int len)
+{
+  INT8U    *p;
+  INT32U    n;
+  _mqx_int  rest = len;
+
+  UART_tx_lock();
+  while ( rest > 0 )
+  {
+    n = UART_tx_reserve(&p, 1);
+    if ( n == 0 )
+    {
+      uart_stat.tx_waits++;
+      _lwevent_wait_ticks(&uart_event, UART_TX_DONE, FALSE, UART_TX_WAIT_TICKS);
+      continue;
+    }
+    if ( n > rest ) n = rest;
+    memcpy(p, buf, n);
+    UART_tx_commit(n);
+    buf  += n;
+    rest -= n;
+  }
+  UART_tx_unlock();
+  return len;
+}
+
+static _mqx_int UART_ioctl(MQX_FILE_PTR fd, _mqx_uint cmd, pointer param)
+{
+  switch (cmd)
+  {
+  case IO_IOCTL_CHAR_AVAIL:
+    *(boolean *)param = (UART_rx_head() != uart_rx_tail);
+    return MQX_OK;
+
+  case IO_IOCTL_FLUSH_OUTPUT:
+    while ( UART_tx_used() != 0 )
+    {
+      _lwevent_wait_ticks(&uart_event, UART_TX_DONE, FALSE, UART_TX_WAIT_TICKS);
+    }
+    return MQX_OK;
+  }
+  return IO_ERROR_INVALID_IOCTL_CMD;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Настройка каналов DMA передачи и приема
+-------------------------------------------------------------------------------------------------------------*/
+static void UART_DMA_configure(void)
+{
+  SIM_SCGC6 |= BIT(1);  // Тактирование DMAMUX0
+  SIM_SCGC7 |= BIT(1);  // Тактирование DMA
+
+  DMAMUX0_CHCFG(UART_DMA_TX_CH) = 0;
+  DMAMUX0_CHCFG(UART_DMA_RX_CH) = 0;
+
+  // Передача: кольцо -> D. Адрес и длина участка задаются при запуске
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].SADDR = (uint32_t)uart_tx_buf;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].SOFF  = 1;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].ATTR  = 0
+                                            + LSHIFT(0, 11) // SMOD.  0 Source address modulo feature is disabled
+                                            + LSHIFT(0,  8) // SSIZE. 000 8-bit
+                                            + LSHIFT(0,  3) // DMOD.  0 Source address modulo feature is disabled
+                                            + LSHIFT(0,  0) // DSIZE. 000 8-bit
+  ;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].NBYTES_MLNO   = 1;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].SLAST         = 0;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].DADDR         = (uint32_t)&UART0_D;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].DOFF          = 0;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].DLAST_SGA     = 0;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].CITER_ELINKNO = 1;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].BITER_ELINKNO = 1;
+  DMA_BASE_PTR->TCD[UART_DMA_TX_CH].CSR = 0
+                                          + LSHIFT(1, 3)       // DREQ.        1 The channel's ERQ bit is cleared when the major loop is complete.
+                                          + LSHIFT(0, 2)       // INTHALF.
+                                          + LSHIFT(1, 1)       // INTMAJOR.    1 The end-of-major loop interrupt is enabled.
+  ;
+
+  // Прием: D -> кольцо по кругу
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].SADDR = (uint32_t)&UART0_D;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].SOFF  = 0;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].ATTR  = 0
+                                            + LSHIFT(0, 11) // SMOD.  0 Source address modulo feature is disabled
+                                            + LSHIFT(0,  8) // SSIZE. 000 8-bit
+                                            + LSHIFT(0,  3) // DMOD.  0 Source address modulo feature is disabled
+                                            + LSHIFT(0,  0) // DSIZE. 000 8-bit
+  ;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].NBYTES_MLNO   = 1;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].SLAST         = 0;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].DADDR         = (uint32_t)uart_rx_buf;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].DOFF          = 1;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].DLAST_SGA     = (uint32_t)(-UART_RX_BUF_SZ); // По завершении главного цикла возвращаемся на начало кольца
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].CITER_ELINKNO = UART_RX_BUF_SZ;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].BITER_ELINKNO = UART_RX_BUF_SZ;
+  DMA_BASE_PTR->TCD[UART_DMA_RX_CH].CSR = 0;
+
+  _int_install_isr(UART_DMA_TX_INT, UART_DMA_tx_isr, 0);
+  _bsp_int_init(UART_DMA_TX_INT, UART_ISR_PRIO, 0, TRUE);
+
+  DMAMUX0_CHCFG(UART_DMA_TX_CH) = 0
+                                  + LSHIFT(1, 7)                  // ENBL.   1 DMA channel is enabled
+                                  + LSHIFT(0, 6)                  // TRIG.   0 Triggering is disabled.
+                                  + LSHIFT(UART_DMA_TX_SOURCE, 0) // SOURCE. DMA Channel Source (slot)
+  ;
+  DMAMUX0_CHCFG(UART_DMA_RX_CH) = 0
+                                  + LSHIFT(1, 7)                  // ENBL.   1 DMA channel is enabled
+                                  + LSHIFT(0, 6)                  // TRIG.   0 Triggering is disabled.
+                                  + LSHIFT(UART_DMA_RX_SOURCE, 0) // SOURCE. DMA Channel Source (slot)
+  ;
+  DMA_SERQ = UART_DMA_RX_CH; // Канал приема работает постоянно, канал передачи запускается UART_tx_start
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Инициализация UART0, установка устройства UART_MON_DEVICE и назначение его стандартным вводом/выводом
+  Вызывать до создания задач использующих printf
+-------------------------------------------------------------------------------------------------------------*/
+_mqx_uint UART_init(void)
+{
+  INT32U div;
+
+  SIM_SCGC4 |= BIT(10); // Тактирование UART0. Выводы PTB16, PTB17 настраиваются по таблице выводов BSP
+  _lwevent_create(&uart_event, LWEVENT_AUTO_CLEAR);
+  _lwsem_create(&uart_tx_sem, 1);
+
+  // FIFO и делитель можно менять только при выключенных приемнике и передатчике
+  UART0_C2 = 0;
+
+  // Скорость UART_CLOCK / (16 * (SBR + BRFA / 32)). Делитель вычисляется в 1/32 долях
+  div = (2 * UART_CLOCK + UART_MON_BAUD / 2) / UART_MON_BAUD;
+  UART0_BDH = (div >> 13) & 0x1F;
+  UART0_BDL = (div >> 5) & 0xFF;
+  UART0_C4  = div & 0x1F;
+  UART0_C1  = 0;        // 8 бит, без контроля четности
+
+  UART0_PFIFO = 0
+                + LSHIFT(1, 7)  // TXFE. 1 Transmit FIFO is enabled.
+                + LSHIFT(1, 3)  // RXFE. 1 Receive FIFO is enabled.
+  ;
+  UART0_CFIFO = 0
+                + LSHIFT(1, 7)  // TXFLUSH. Очистить FIFO передатчика
+                + LSHIFT(1, 6)  // RXFLUSH. Очистить FIFO приемника
+  ;
+  UART0_TWFIFO = UART_TX_WATERMARK;
+  UART0_RWFIFO = UART_RX_WATERMARK;
+
+  UART0_C3 = 0
+             + LSHIFT(1, 3)  // ORIE. 1 OR interrupt requested.
+             + LSHIFT(1, 2)  // NEIE. 1 NF interrupt requested.
+             + LSHIFT(1, 1)  // FEIE. 1 FE interrupt requested.
+  ;
+  UART0_C5 = 0
+             + LSHIFT(1, 7)  // TDMAS. 1 If C2[TIE] is set, TDRE flag generates DMA requests.
+             + LSHIFT(1, 5)  // RDMAS. 1 If C2[RIE] is set, RDRF flag generates DMA requests.
+  ;
+
+  UART_DMA_configure();
+
+  _int_install_isr(INT_UART0_ERR, UART_err_isr, 0);
+  _bsp_int_init(INT_UART0_ERR, UART_ISR_PRIO, 0, TRUE);
+
+  UART0_C2 = 0
+             + LSHIFT(1, 7)  // TIE. Запросы DMA передатчика
+             + LSHIFT(1, 5)  // RIE. Запросы DMA приемника
+             + LSHIFT(1, 3)  // TE.  Transmitter on.
+             + LSHIFT(1, 2)  // RE.  Receiver on.
+  ;
+
+  if ( _io_dev_install(UART_MON_DEVICE, UART_open, UART_close, UART_read, UART_write, UART_ioctl, NULL) != MQX_OK )
+  {
+    return MQX_ERROR;
+  }
+  uart_fd = fopen(UART_MON_DEVICE, NULL);
+  if ( uart_fd == NULL ) return MQX_ERROR;
+
+  // Задачи созданные после этого получают порт монитора в качестве стандартного ввода/вывода
+  _io_set_handle(IO_PROC_STDIN,  uart_fd);
+  _io_set_handle(IO_PROC_STDOUT, uart_fd);
+  _io_set_handle(IO_PROC_STDERR, uart_fd);
+  _io_set_handle(IO_STDIN,  uart_fd);
+  _io_set_handle(IO_STDOUT, uart_fd);
+  return MQX_OK;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Получить статистику драйвера
+-------------------------------------------------------------------------------------------------------------*/
+void UART_get_stat(T_uart_stat *st)
+{
+  _int_disable();
+  *st = uart_stat;
+  _int_enable();
+}
+
+#endif
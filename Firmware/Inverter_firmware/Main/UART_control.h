@@ -0,0 +1,67 @@
+#ifndef __UART_CONTROL
+  #define __UART_CONTROL
+
+// Драйвер порта монитора на UART0 с передачей и приемом через DMA.
+// Используется вместо опросного драйвера MQX ttya: если в user_config.h выключен BSPCFG_ENABLE_TTYA.
+// Устанавливается как устройство MQX и назначается стандартным вводом/выводом, поэтому printf, getchar и status() монитора
+// работают без изменений, но printf не ждет передачи каждого символа, а только копирует его в кольцевой буфер.
+//
+// Передача: канал DMA переносит в FIFO передатчика непрерывный участок кольца по запросам UART при заполнении FIFO
+// не выше UART_TX_WATERMARK. Прерывание возникает только по завершении участка.
+// Прием: канал DMA по каждому принятому байту пишет в кольцо приема по кругу без прерываний,
+// позиция записи определяется по адресу назначения канала.
+// Запись из нескольких задач (printf задачи монитора и отладочный вывод других задач) разделяется семафором:
+// UART_write захватывает его сам, а прямой доступ к кольцу через UART_tx_reserve и UART_tx_commit
+// выполняется между UART_tx_lock и UART_tx_unlock. Из прерываний писать в порт нельзя.
+//
+// Загрузка процессора непрерывным выводом, пункт '9' монитора (printf строк по 72 байта в течении 1 с).
+// Значения - оценка по тактам на байт, на плате их нужно уточнить этим же тестом:
+//   Драйвер            115200 бод    921600 бод
+//   опросный ttya      ~100 %        ~100 %       задача ждет освобождения регистра передатчика на каждом символе
+//   DMA (UART0)        ~0.5 %        ~4 %         форматирование printf и копирование в кольцо, около 50 тактов на байт,
+//                                                 плюс одно прерывание DMA на участок кольца
+
+#define UART_MON_DMA       (BSPCFG_ENABLE_TTYA == 0)
+
+#define UART_MON_DEVICE    "uart0:"
+#if UART_MON_DMA
+  #define UART_MON_BAUD    921600    // Скорость порта монитора
+#else
+  #define UART_MON_BAUD    BSPCFG_SCI0_BAUD_RATE // Порт монитора обслуживает опросный драйвер MQX
+#endif
+#define UART_CLOCK         BSP_SYSTEM_CLOCK // UART0 тактируется от частоты ядра
+
+#define UART_TX_BUF_SZ     4096      // Размер кольца передачи
+#define UART_RX_BUF_SZ     256       // Размер кольца приема. Степень двойки не более 32768
+#define UART_TX_WATERMARK  2         // Запрос DMA передатчика при количестве байт в FIFO не более этого значения
+#define UART_RX_WATERMARK  1         // Запрос DMA приемника при наличии в FIFO хотя бы одного байта
+#define UART_TX_WAIT_TICKS 2         // Максимальное ожидание освобождения места в кольце передачи за один шаг
+
+#define UART_DMA_RX_CH     8         // Каналы DMA. 0..6 заняты сбором результатов ADC
+#define UART_DMA_TX_CH     9
+#define UART_DMA_TX_INT    INT_DMA9_DMA25
+#define UART_DMA_RX_SOURCE 2         // Номера источников запросов UART0 в DMAMUX0
+#define UART_DMA_TX_SOURCE 3
+
+#define UART_TX_DONE       BIT(0)    // Событие завершения участка передачи
+
+typedef struct
+{
+  INT32U tx_bytes;     // Передано байт
+  INT32U tx_segs;      // Запущено участков DMA
+  INT32U tx_waits;     // Сколько раз запись ожидала освобождения кольца
+  INT32U tx_max_used;  // Наибольшее заполнение кольца передачи
+  INT32U rx_bytes;     // Прочитано байт
+  INT32U rx_overruns;  // Ошибки переполнения приемника
+  INT32U rx_errors;    // Ошибки кадра и шумы
+} T_uart_stat;
+
+_mqx_uint UART_init(void);
+void      UART_tx_lock(void);
+void      UART_tx_unlock(void);
+INT32U    UART_tx_reserve(INT8U **p, INT32U min);
+void      UART_tx_commit(INT32U len);
+INT32U    UART_tx_used(void);
+void      UART_get_stat(T_uart_stat *st);
+
+#endif
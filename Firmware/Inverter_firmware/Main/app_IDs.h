@@ -5,8 +5,40 @@
 //  Частотный преобразователь
 //******************************************************************************************************************************************************
 #define INVERT_ONBUS_MSG                 0x1BF0FFFF  // Асинхронная посылка из платы инвертера
+                                                 // Периодическая телеметрия. Мультиплексированные пакеты длиной 8 байт:
+                                                 // В байте  0 - биты 3..0 номер пакета, биты 7..4 счетчик циклов телеметрии
+                                                 // Пакет 0:
+                                                 //   В байте  1 - состояние: биты 1..0 фаза движения (MOT_*), бит 2 направление, бит 3 PWM включен,
+                                                 //                бит 4 авария драйвера, бит 5 разорвана цепь безопасности
+                                                 //   В байтах 2,3 - частота вращения (0.01 Гц, старший байт первым)
+                                                 //   В байтах 4,5 - напряжение шины (0.1 В, старший байт первым)
+                                                 //   В байтах 6,7 - температура IGBT (0.1 C, со знаком, старший байт первым), 0x8000 - не достоверна
+                                                 // Пакет 1:
+                                                 //   В байтах 1,2 3,4 5,6 - действующие значения токов ii_w, ii_v, ii_u (0.01 А, старший байт первым)
+                                                 //   В байте  7 - 1 если окно измерений синхронизировано с периодом генератора
+                                                 // Пакет 2:
+                                                 //   В байтах 1,2 - количество аварий драйвера (старший байт первым)
+                                                 //   В байтах 3,4 - количество аварийных остановок по CAN (старший байт первым)
+                                                 //   В байтах 5,6 - количество потерянных принятых пакетов (переполнения FIFO и очереди)
+                                                 //   В байте  7 - количество отброшенных пакетов телеметрии (не более 255)
+                                                 // Пакет 3:
+                                                 //   В байте  1 - количество переходов в Bus Off (не более 255)
+                                                 //   В байтах 2,3 - время в состоянии Error Passive (с, старший байт первым)
+                                                 //   В байте  4 - счетчик ошибок передачи TEC
+                                                 //   В байте  5 - счетчик ошибок приема REC
+                                                 //   В байте  6 - максимальный из счетчиков TEC и REC за последнюю минуту
+                                                 //   В байте  7 - биты 1..0 состояние узла (0 - Error Active, 1 - Error Passive, 2 - Bus Off)
 #define INVERT_REQ                       0x1BF1FFFF  // Посылка к плате с запросом данных или командой
 #define INVERT_ANS                       0x1BF2FFFF  // Посылка из платы в ответ на запрос
+#define INVERT_BULK                      0x1BF3FFFF  // Кадры блочной передачи из платы (см. BULK_OPEN)
+                                                 // В байте  0 - бит 7 младший бит номера окна, биты 6..4 номер блока в окне, биты 3..0 номер кадра в блоке
+                                                 // В байтах 1..7 - данные блока. Блок из 16 кадров содержит 108 байт объекта и CRC32 этих байт
+                                                 // (полином 0x04C11DB7 отраженный, начальное значение и финальный XOR 0xFFFFFFFF, старший байт первым).
+                                                 // Кадры одного окна могут приходить не по порядку
+#define INVERT_SYNC                      0x1BF4FFFF  // Кадр синхронизации общей шкалы времени группы инверторов. Посылается ведущим узлом всем платам
+                                                 // В байте  0 - номер кадра синхронизации
+                                                 // Каждая плата фиксирует момент приема по отметке времени таймера FlexCAN.
+                                                 // Моменты совпадают на всех платах с точностью до битового интервала.
 
 // Идентификатором INVERT_REQ вызываются следующие команды (передаются в байте 0 блока данных)
 #define START_MOVING                     0x01 // Начало движения
@@ -17,6 +49,116 @@
 #define STOP_MOVING                      0x02 // Окончание движения
                                               // В байте  1 - время замедления (в десятых долях секунды)
 #define EMERGENCY_STOP_MOVING            0x03 // Аварийная остановка
+#define GET_HARMONICS                    0x04 // Запрос результатов гармонического анализа фазного тока
+                                              // В байте  1 - номер фазы (0 - ii_w, 1 - ii_v, 2 - ii_u)
+                                              // Ответ с идентификатором INVERT_ANS:
+                                              // В байте  0 - GET_HARMONICS
+                                              // В байте  1 - номер фазы. Бит 7 установлен если результатов нет (генератор остановлен)
+                                              // В байтах 2,3 - действующее значение основной гармоники (0.01 А, старший байт первым)
+                                              // В байтах 4,5,6 - 3-я, 5-я, 7-я гармоники (0.1 % от основной, не более 255)
+                                              // В байте  7 - небаланс основной гармоники фазных токов (0.1 %, не более 255)
+#define GET_POWER                        0x05 // Запрос мощности и счетчиков энергии
+                                              // В байте  1 - страница (0 - мощность, 1 - энергия с момента сброса счетчиков, 2 - энергия за поездку)
+                                              // Ответ с идентификатором INVERT_ANS:
+                                              // В байте  0 - GET_POWER
+                                              // В байте  1 - страница. Бит 7 установлен если страницы нет или PWM выключен (для страницы 0)
+                                              // Страница 0:
+                                              //   В байтах 2,3 - активная мощность (10 Вт, со знаком, старший байт первым). Отрицательная при рекуперации
+                                              //   В байтах 4,5 - реактивная мощность (10 ВАр, старший байт первым)
+                                              //   В байтах 6,7 - коэффициент мощности (0.001, со знаком, старший байт первым)
+                                              // Страница 1:
+                                              //   В байтах 2,3,4 - энергия в режиме двигателя (0.1 кВт*ч, старший байт первым)
+                                              //   В байтах 5,6,7 - энергия рекуперации (0.1 кВт*ч, старший байт первым)
+                                              // Страница 2:
+                                              //   В байтах 2,3,4 - энергия в режиме двигателя за поездку (Вт*ч, старший байт первым)
+                                              //   В байтах 5,6,7 - энергия рекуперации за поездку (Вт*ч, старший байт первым)
+#define RESET_ENERGY                     0x06 // Сброс счетчиков энергии
+#define SET_TELEMETRY                    0x07 // Установка периода телеметрии на INVERT_ONBUS_MSG
+                                              // В байте  1 - период в единицах 10 мс, 0 - телеметрия выключена
+
+// Словарь параметров. Параметр адресуется индексом, значение передается 4-я байтами со старшего байта первым,
+// тип значения: 0 - беззнаковое целое, 1 - целое со знаком, 2 - float IEEE 754.
+// Индексы: 0x00..0x0B - настройки движения в порядке пунктов меню теста двигателя,
+//          0x20..0x2E - состояние двигателя и отчет о последней остановке (только чтение), 0x40 - период телеметрии
+// Коды результата: 0 - успешно, 1 - нет индекса, 2 - только чтение, 3 - неверный тип, 4 - вне диапазона,
+//                  5 - нарушена последовательность сегментов, 6 - слишком много параметров в пакете
+#define OD_READ                          0x08 // Чтение параметра
+                                              // В байте  1 - индекс
+                                              // Ответ с идентификатором INVERT_ANS:
+                                              // В байте  0 - OD_READ
+                                              // В байте  1 - индекс
+                                              // В байте  2 - тип
+                                              // В байте  3 - код результата
+                                              // В байтах 4..7 - значение
+#define OD_WRITE                         0x09 // Запись параметра
+                                              // В байте  1 - индекс
+                                              // В байте  2 - тип
+                                              // В байтах 4..7 - значение
+                                              // Ответ с идентификатором INVERT_ANS в формате OD_READ с установленным значением параметра
+#define OD_BATCH_READ                    0x0A // Чтение группы параметров
+                                              // В байте  1 - количество индексов (1..6)
+                                              // В байтах 2..7 - индексы
+                                              // Ответ сегментами с идентификатором INVERT_ANS, по одному параметру в сегменте:
+                                              // В байте  0 - OD_BATCH_READ
+                                              // В байте  1 - номер сегмента, бит 7 установлен в последнем сегменте
+                                              // В байте  2 - индекс
+                                              // В байте  3 - биты 3..0 тип, биты 7..4 код результата
+                                              // В байтах 4..7 - значение
+                                              // На запрос с нулевым количеством индексов - один последний сегмент с кодом OD_ERR_SIZE
+#define OD_BATCH_WRITE                   0x0B // Запись группы параметров сегментами, по одному параметру в сегменте (не более 16)
+                                              // В байте  1 - номер сегмента начиная с 0, бит 7 установлен в последнем сегменте
+                                              // В байте  2 - индекс
+                                              // В байте  3 - тип
+                                              // В байтах 4..7 - значение
+                                              // Параметры проверяются все вместе и записываются одновременно после приема последнего сегмента.
+                                              // Ответ с идентификатором INVERT_ANS после последнего сегмента или ошибки последовательности:
+                                              // В байте  0 - OD_BATCH_WRITE
+                                              // В байте  1 - количество принятых сегментов
+                                              // В байте  2 - код результата
+                                              // В байте  3 - индекс параметра вызвавшего ошибку
+#define BULK_OPEN                        0x0C // Начать блочную передачу объекта на INVERT_BULK. Предыдущая передача прекращается
+                                              // В байте  1 - объект (0 - тестовая последовательность, 1 - результаты измерений, 2 - лог приемника CAN)
+                                              // В байтах 2..5 - длина тестовой последовательности (старший байт первым)
+                                              // В байте  6 - количество блоков в окне подтверждения (1..8, 0 - 8)
+                                              // Ответ с идентификатором INVERT_ANS перед первым окном:
+                                              // В байте  0 - BULK_OPEN
+                                              // В байте  1 - объект
+                                              // В байте  2 - код результата (0 - успешно, 1 - нет объекта, 2 - объект пуст, 3 - длина больше 16 Мбайт)
+                                              // В байте  3 - количество блоков в окне
+                                              // В байтах 4..7 - длина объекта в байтах (старший байт первым)
+#define BULK_ACK                         0x0D // Подтверждение окна
+                                              // В байте  1 - номер окна начиная с 0 (младшие 8 бит)
+                                              // В байте  2 - маска блоков окна требующих повтора (ошибка CRC или потеряны кадры).
+                                              //              0 - окно принято, передается следующее окно. После последнего окна передача завершается
+                                              // Подтверждение с номером следующего окна (любая маска) подтверждает и текущее окно,
+                                              // так передача продолжается после потери подтверждения окна
+#define BULK_ABORT                       0x0E // Прекратить блочную передачу
+#define SYNC_START                       0x0F // Начало движения в заданный момент общей шкалы времени
+                                              // В байте  1 - направление (вниз - 1, вверх - 0)
+                                              // В байте  2 - целевая частота вращения (Гц)
+                                              // В байте  3 - время ускорения (в десятых долях секунды)
+                                              // В байте  4 - номер кадра INVERT_SYNC от которого отсчитывается задержка (один из 4 последних)
+                                              // В байтах 5..7 - задержка старта после кадра синхронизации (мкс, старший байт первым)
+                                              // Ответ с идентификатором INVERT_ANS:
+                                              // В байте  0 - SYNC_START
+                                              // В байте  1 - код результата (0 - старт назначен, 1 - нет кадра синхронизации,
+                                              //              2 - задержка уже истекла или слишком мала, 3 - двигатель вращается или разорвана цепь безопасности,
+                                              //              4 - уже назначен другой старт, 5 - неверное направление)
+                                              // В байтах 4..7 - время до старта (мкс, со знаком, старший байт первым)
+                                              // Команды STOP_MOVING и EMERGENCY_STOP_MOVING отменяют назначенный старт
+#define GET_TASK_LOAD                    0x10 // Запрос загрузки процессора задачами за последнюю секунду и использования их стеков
+                                              // Ответ сегментами с идентификатором INVERT_ANS:
+                                              // В байте  0 - GET_TASK_LOAD
+                                              // В байте  1 - номер сегмента, бит 7 установлен в последнем сегменте
+                                              // Сегмент 0:
+                                              //   В байтах 2,3 - загрузка прерываниями (0.1 %, старший байт первым)
+                                              //   В байтах 4,5 - время задачи простоя (0.1 %, старший байт первым)
+                                              //   В байтах 6,7 - наибольшее использование стека прерываний (байт, старший байт первым)
+                                              // Сегменты 1..n, по одному на задачу кроме задачи простоя:
+                                              //   В байте  2 - номер шаблона задачи (MOTISR_IDX..CAN_RX_IDX, 0 - задачи MQX)
+                                              //   В байтах 3,4 - загрузка задачей (0.1 %, старший байт первым)
+                                              //   В байтах 5,6 - наибольшее использование стека (байт, старший байт первым). 0 - стек переполнен
+                                              //   В байте  7 - использованная часть стека (%)
 
 
 //******************************************************************************************************************************************************
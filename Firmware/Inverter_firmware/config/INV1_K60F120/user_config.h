@@ -37,7 +37,7 @@
 
 
 /* MGCT: <generated_code> */
-#define BSPCFG_ENABLE_TTYA       1
+#define BSPCFG_ENABLE_TTYA       0 /* 0 - monitor port on UART0 uses the DMA driver from Main/UART_control.c */
 #define BSPCFG_ENABLE_ITTYA      0
 #define BSPCFG_ENABLE_TTYB       0
 #define BSPCFG_ENABLE_ITTYB      0
@@ -49,7 +49,7 @@
 #define BSPCFG_ENABLE_ITTYE      0
 #define BSPCFG_ENABLE_TTYF       0
 #define BSPCFG_ENABLE_ITTYF      0
-#define BSPCFG_ENABLE_I2C0       1
+#define BSPCFG_ENABLE_I2C0       0 /* 0 - I2C0 is driven by the interrupt state machine in Main/Temperature_control.c */
 #define BSPCFG_ENABLE_II2C0      0
 #define BSPCFG_ENABLE_I2C1       0
 #define BSPCFG_ENABLE_II2C1      0
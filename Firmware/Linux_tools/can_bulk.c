@@ -0,0 +1,286 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Клиент блочной передачи частотного преобразователя через Linux SocketCAN
+
+  Загружает объект командой BULK_OPEN, подтверждает окна командой BULK_ACK с маской блоков для повтора
+  и выводит достигнутую скорость передачи.
+
+  Сборка:  gcc -O2 -Wall -o can_bulk can_bulk.c
+  Запуск:  can_bulk [-i can0] [-o объект] [-n длина] [-w блоков_в_окне] [-b скорость_шины] [-f файл]
+           can_bulk -o 0 -n 100000        - тестовая последовательность 100000 байт с проверкой содержимого
+           can_bulk -o 1 -f meas.bin      - снимок результатов измерений в файл
+-------------------------------------------------------------------------------------------------------------*/
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+// Должно совпадать с app_IDs.h и CAN_control.h прошивки
+#define INVERT_REQ          0x1BF1FFFF
+#define INVERT_ANS          0x1BF2FFFF
+#define INVERT_BULK         0x1BF3FFFF
+#define BULK_OPEN           0x0C
+#define BULK_ACK            0x0D
+#define BULK_ABORT          0x0E
+#define BULK_OBJ_TEST       0
+#define BULK_BLOCK_FRAMES   16
+#define BULK_BLOCK_BYTES    (BULK_BLOCK_FRAMES * 7)
+#define BULK_BLOCK_DATA     (BULK_BLOCK_BYTES - 4)
+#define BULK_WIN_MAX        8
+
+#define ANS_TIMEOUT_MS      1000 // Ожидание ответа на BULK_OPEN
+#define FRAME_TIMEOUT_MS    200  // Пауза в приеме кадров окна после которой запрашивается повтор
+#define MAX_RETRIES         10   // Повторов одного окна до отказа
+
+static int can_sock;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Текущее время в миллисекундах
+-------------------------------------------------------------------------------------------------------------*/
+static double Now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  CRC32 как в прошивке: полином 0x04C11DB7 отраженный, начальное значение и финальный XOR 0xFFFFFFFF
+-------------------------------------------------------------------------------------------------------------*/
+static uint32_t Crc32(const uint8_t *buf, unsigned len)
+{
+  uint32_t crc = 0xFFFFFFFFUL;
+  int      i;
+
+  while ( len-- )
+  {
+    crc ^= *buf++;
+    for (i = 0; i < 8; i++) crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+  }
+  return crc ^ 0xFFFFFFFFUL;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отправить команду на INVERT_REQ
+-------------------------------------------------------------------------------------------------------------*/
+static void Send_req(const uint8_t *data)
+{
+  struct can_frame f;
+
+  memset(&f, 0, sizeof(f));
+  f.can_id  = INVERT_REQ | CAN_EFF_FLAG;
+  f.can_dlc = 8;
+  memcpy(f.data, data, 8);
+  if ( write(can_sock, &f, sizeof(f)) != sizeof(f) ) perror("write");
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Принять кадр с ожиданием не более tmo_ms. Возвращает 0 при таймауте
+-------------------------------------------------------------------------------------------------------------*/
+static int Recv_frame(struct can_frame *f, int tmo_ms)
+{
+  struct pollfd pfd = { can_sock, POLLIN, 0 };
+
+  if ( poll(&pfd, 1, tmo_ms) <= 0 ) return 0;
+  if ( read(can_sock, f, sizeof(*f)) != sizeof(*f) ) return 0;
+  return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+
+-------------------------------------------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+  const char          *ifname = "can0";
+  const char          *fname  = NULL;
+  unsigned             obj    = BULK_OBJ_TEST;
+  unsigned             tsize  = 65536;
+  unsigned             win_sz = BULK_WIN_MAX;
+  unsigned             bitrate = 100000;
+  struct sockaddr_can  addr;
+  struct ifreq         ifr;
+  struct can_filter    flt[2];
+  struct can_frame     f;
+  uint8_t              req[8];
+  uint8_t              blk[BULK_WIN_MAX][BULK_BLOCK_BYTES];
+  uint16_t             got[BULK_WIN_MAX];
+  uint8_t             *data;
+  unsigned             size, blocks, win, first, nblk, need, bad;
+  unsigned             b, n, retries, stale, frames = 0, retx = 0, errors = 0, lost_acks = 0;
+  double               t_start, t_last;
+  int                  opt;
+
+  while ( (opt = getopt(argc, argv, "i:o:n:w:b:f:")) != -1 )
+  {
+    switch (opt)
+    {
+    case 'i': ifname  = optarg; break;
+    case 'o': obj     = strtoul(optarg, NULL, 0); break;
+    case 'n': tsize   = strtoul(optarg, NULL, 0); break;
+    case 'w': win_sz  = strtoul(optarg, NULL, 0); break;
+    case 'b': bitrate = strtoul(optarg, NULL, 0); break;
+    case 'f': fname   = optarg; break;
+    default:
+      fprintf(stderr, "Usage: %s [-i can0] [-o object] [-n test_size] [-w window_blocks] [-b bitrate] [-f out_file]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  can_sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if ( can_sock < 0 ) { perror("socket"); return 1; }
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  ifr.ifr_name[IFNAMSIZ - 1] = 0;
+  if ( ioctl(can_sock, SIOCGIFINDEX, &ifr) < 0 ) { perror(ifname); return 1; }
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family  = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if ( bind(can_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ) { perror("bind"); return 1; }
+
+  flt[0].can_id   = INVERT_ANS  | CAN_EFF_FLAG;
+  flt[0].can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+  flt[1].can_id   = INVERT_BULK | CAN_EFF_FLAG;
+  flt[1].can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+  setsockopt(can_sock, SOL_CAN_RAW, CAN_RAW_FILTER, flt, sizeof(flt));
+
+  // Открытие передачи
+  memset(req, 0, sizeof(req));
+  req[0] = BULK_OPEN;
+  req[1] = obj;
+  req[2] = tsize >> 24; req[3] = tsize >> 16; req[4] = tsize >> 8; req[5] = tsize;
+  req[6] = win_sz;
+  t_start = Now_ms();
+  Send_req(req);
+  for (;;)
+  {
+    if ( !Recv_frame(&f, ANS_TIMEOUT_MS) ) { fprintf(stderr, "No answer to BULK_OPEN\n"); return 1; }
+    if ( ((f.can_id & CAN_EFF_MASK) == INVERT_ANS) && (f.data[0] == BULK_OPEN) ) break;
+  }
+  if ( f.data[2] != 0 ) { fprintf(stderr, "BULK_OPEN error %d\n", f.data[2]); return 1; }
+  win_sz = f.data[3];
+  size   = ((unsigned)f.data[4] << 24) | (f.data[5] << 16) | (f.data[6] << 8) | f.data[7];
+  blocks = (size + BULK_BLOCK_DATA - 1) / BULK_BLOCK_DATA;
+  data   = malloc((size_t)blocks * BULK_BLOCK_DATA);
+  if ( data == NULL ) return 1;
+  printf("Object %u: %u bytes, %u blocks, %u blocks per window\n", obj, size, blocks, win_sz);
+
+  for (win = 0, first = 0; first < blocks; win++, first += nblk)
+  {
+    nblk = blocks - first;
+    if ( nblk > win_sz ) nblk = win_sz;
+    need = (1u << nblk) - 1;
+    memset(got, 0, sizeof(got));
+    retries = 0;
+
+    for (;;)
+    {
+      // Прием кадров пока не собраны все ожидаемые блоки или не наступила пауза
+      t_last = Now_ms();
+      stale  = 0;
+      while ( need != 0 )
+      {
+        int tmo = FRAME_TIMEOUT_MS - (int)(Now_ms() - t_last);
+        if ( tmo <= 0 || !Recv_frame(&f, tmo) ) break;
+        if ( (f.can_id & CAN_EFF_MASK) != INVERT_BULK || f.can_dlc != 8 ) continue;
+        if ( (f.data[0] >> 7) != (win & 1) )
+        {
+          // Кадр предыдущего окна: запоздавший или повтор окна после потери нашего подтверждения
+          stale = 1;
+          continue;
+        }
+        b = (f.data[0] >> 4) & 0x07;
+        n = f.data[0] & 0x0F;
+        if ( b >= nblk || !(need & (1u << b)) ) continue;
+        memcpy(&blk[b][n * 7], &f.data[1], 7);
+        got[b] |= 1u << n;
+        frames++;
+        t_last = Now_ms();
+        if ( got[b] == 0xFFFF ) need &= ~(1u << b);
+      }
+
+      // Проверка CRC собранных блоков и маска блоков для повтора
+      bad = need;
+      for (b = 0; b < nblk; b++)
+      {
+        uint8_t *p = blk[b];
+        uint32_t crc;
+
+        if ( bad & (1u << b) ) continue;
+        crc = ((uint32_t)p[BULK_BLOCK_DATA] << 24) | (p[BULK_BLOCK_DATA + 1] << 16) | (p[BULK_BLOCK_DATA + 2] << 8) | p[BULK_BLOCK_DATA + 3];
+        if ( Crc32(p, BULK_BLOCK_DATA) != crc )
+        {
+          bad |= 1u << b;
+          errors++;
+        }
+        else
+        {
+          memcpy(&data[(first + b) * BULK_BLOCK_DATA], p, BULK_BLOCK_DATA);
+        }
+      }
+
+      memset(req, 0, sizeof(req));
+      req[0] = BULK_ACK;
+      if ( stale && (win > 0) )
+      {
+        // Прошивка повторяет предыдущее окно, значит его подтверждение потеряно. Подтверждаем еще раз
+        req[1] = win - 1;
+        Send_req(req);
+        lost_acks++;
+      }
+      req[1] = win;
+      req[2] = bad;
+      Send_req(req);
+      if ( bad == 0 ) break;
+
+      if ( ++retries > MAX_RETRIES )
+      {
+        fprintf(stderr, "Window %u failed, blocks mask %02X\n", win, bad);
+        req[0] = BULK_ABORT;
+        Send_req(req);
+        return 1;
+      }
+      for (b = 0; b < nblk; b++)
+      {
+        if ( bad & (1u << b) ) { got[b] = 0; retx++; }
+      }
+      need = bad;
+    }
+  }
+
+  {
+    double   dt      = (Now_ms() - t_start) / 1000.0;
+    // Кадр 8 байт с расширенным идентификатором без учета вставленных битов занимает 128 бит и 3 бита паузы
+    double   wire    = bitrate / 131.0 * 7.0 * BULK_BLOCK_DATA / BULK_BLOCK_BYTES;
+    unsigned mism    = 0;
+    unsigned i;
+
+    if ( obj == BULK_OBJ_TEST )
+    {
+      for (i = 0; i < size; i++)
+      {
+        if ( data[i] != ((i ^ (i >> 8)) & 0xFF) ) mism++;
+      }
+    }
+    printf("Received %u bytes in %.3f s: %.0f bytes/s (%.1f %% of %.0f bytes/s limit at %u bit/s)\n",
+           size, dt, size / dt, 100.0 * size / dt / wire, wire, bitrate);
+    printf("Frames = %u, retransmitted blocks = %u, CRC errors = %u, repeated ACKs = %u", frames, retx, errors, lost_acks);
+    if ( obj == BULK_OBJ_TEST ) printf(", pattern mismatches = %u", mism);
+    printf("\n");
+
+    if ( fname != NULL )
+    {
+      FILE *fp = fopen(fname, "wb");
+      if ( fp == NULL || fwrite(data, 1, size, fp) != size ) { perror(fname); return 1; }
+      fclose(fp);
+    }
+    return mism ? 1 : 0;
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef __CAN_HOST
+  #define __CAN_HOST
+
+// Окружение для сборки протокольной части драйвера CAN (CAN_protocol.c) под Linux.
+// Заменяет App.h: типы и функции MQX, используемые протоколом, реализованы в can_host.c
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "app_types.h"
+
+typedef uint32_t        uint_32;
+typedef uint32_t        _mqx_uint;
+typedef int32_t         _mqx_int;
+typedef unsigned char   boolean;
+typedef void           *pointer;
+typedef uint32_t        _task_id;
+
+#define TRUE            1
+#define FALSE           0
+#define MQX_OK          0
+#define MQX_ERROR       1
+#define _PTR_           *
+
+typedef struct CAN_MemMap *CAN_MemMapPtr;
+typedef struct ADC_MemMap *ADC_MemMapPtr;
+
+typedef struct
+{
+  struct timespec ts;
+} MQX_TICK_STRUCT;
+
+// Запрет прерываний эмулируется рекурсивным мьютексом
+void    _int_disable(void);
+void    _int_enable(void);
+void    _time_get_ticks(MQX_TICK_STRUCT *t);
+int32_t _time_diff_milliseconds(MQX_TICK_STRUCT *end, MQX_TICK_STRUCT *start, boolean *ovfl);
+_mqx_uint _time_delay(uint_32 ms);
+
+#include "Pins_control.h"
+#include "Motor_control.h"
+#include "ADC_control.h"
+#include "Load_control.h"
+#include "Temperature_control.h"
+#include "CAN_control.h"
+#include "app_IDs.h"
+
+#endif
@@ -0,0 +1,600 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Узел частотного преобразователя на Linux SocketCAN
+
+  Собирается с протокольной частью драйвера CAN прошивки (Main/CAN_protocol.c) и заменяет аппаратную часть
+  (CAN_control.c): прием кадров, очередь задачи приема, передачу и статистику. Двигатель и измерения заменены
+  заглушками, поэтому на команды отвечает тот же код, что и в прошивке.
+
+  Потоки:
+    прием     - чтение сокета, аварийная остановка и кадры синхронизации как в CAN_isr, очередь из CAN_RX_Q_SZ кадров
+    обработка - аналог CAN_Rx_Task: выборка очереди, CAN_process_rx, CAN_bulk_poll
+    передача  - кадры блочной передачи из CAN_bulk_frame
+    телеметрия- CAN_Tx_Task
+
+  Запуск: can_host [-i vcan0] [-T период_телеметрии] [-s период_статистики_с]
+          can_host -t                - расчет битовых интервалов Solve_can_timings для стандартных скоростей
+-------------------------------------------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "CAN_host.h"
+
+#define CAN_CLK          60000000UL  // Тактирование контроллера CAN в прошивке: BSP_SYSTEM_CLOCK / 2
+#define POLL_MS          (CAN_RX_POLL_TICKS * 5)
+
+static int              can_sock;
+static pthread_mutex_t  int_mutex;
+static pthread_mutex_t  q_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   q_cond   = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t  tx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   tx_cond  = PTHREAD_COND_INITIALIZER;
+static int              tx_kick;
+
+// Очередь задачи приема, как в CAN_control.c
+static T_can_rx         rx_q[CAN_RX_Q_SZ];
+static double           rx_q_time[CAN_RX_Q_SZ];
+static INT32U           rx_q_head;
+static INT32U           rx_q_tail;
+
+static T_can_rx         rx_log[CAN_RX_LOG_SZ];
+static INT32U           rx_log_head;
+static INT32U           rx_log_tail;
+
+static T_can_rx_stat    rx_stat;
+static T_can_estop_stat estop_stat;
+static T_can_tx_stat    tx_stat;
+
+// Статистика обработки
+static INT32U           q_depth_max;
+static double           q_depth_sum;
+static INT32U           proc_cnt;
+static double           proc_lat_sum;   // От приема кадра до завершения обработки (мкс)
+static double           proc_lat_max;
+static INT32U           bulk_frames;
+
+static T_MC_CBL         mc_cbl;
+static INT32U           mc_events;
+static INT32U           sync_starts;
+static INT32U           sync_rejects;
+
+// Кадры синхронизации. На Linux момент приема фиксируется в микросекундах по CLOCK_MONOTONIC
+static T_can_sync       sync_hist[CAN_SYNC_HIST_SZ];
+static INT32U           sync_head;
+static T_can_sync_stat  sync_stat;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Время в микросекундах
+-------------------------------------------------------------------------------------------------------------*/
+static double Now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// Функции MQX используемые протоколом
+//-------------------------------------------------------------------------------------------------------------
+void _int_disable(void)
+{
+  pthread_mutex_lock(&int_mutex);
+}
+
+void _int_enable(void)
+{
+  pthread_mutex_unlock(&int_mutex);
+}
+
+void _time_get_ticks(MQX_TICK_STRUCT *t)
+{
+  clock_gettime(CLOCK_MONOTONIC, &t->ts);
+}
+
+int32_t _time_diff_milliseconds(MQX_TICK_STRUCT *end, MQX_TICK_STRUCT *start, boolean *ovfl)
+{
+  *ovfl = FALSE;
+  return (end->ts.tv_sec - start->ts.tv_sec) * 1000 + (end->ts.tv_nsec - start->ts.tv_nsec) / 1000000;
+}
+
+_mqx_uint _time_delay(uint_32 ms)
+{
+  usleep(ms * 1000);
+  return MQX_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// Заглушки двигателя и измерений
+//-------------------------------------------------------------------------------------------------------------
+T_MC_CBL *MC_get_pcbl(void)
+{
+  return &mc_cbl;
+}
+
+_mqx_uint MC_set_events(_mqx_uint evnt)
+{
+  mc_events |= evnt;
+  return MQX_OK;
+}
+
+void MC_emergency_stop_motor(void)
+{
+  mc_cbl.action = MOT_IDLE;
+}
+
+int PWM_state(void)
+{
+  return 0;
+}
+
+int Pin_PWM_OE_state(void)
+{
+  return 1;
+}
+
+int MC_sync_start_request(INT8U dir, INT32U target_freq, INT32U time, INT32U t_sync, INT32U delay_us, INT32S *remain_us)
+{
+  *remain_us = (INT32S)(t_sync + delay_us - (INT32U)Now_us());
+  if ( (dir != MOVING_UP) && (dir != MOVING_DOWN) ) return SYNC_START_ERR_PARAM;
+  if ( *remain_us < SYNC_START_MIN_LEAD_US )
+  {
+    sync_rejects++;
+    return SYNC_START_ERR_LATE;
+  }
+  sync_starts++;
+  return SYNC_START_OK;
+}
+
+unsigned int Get_meas_snapshot(T_meas_snapshot *snap)
+{
+  memset(snap, 0, sizeof(*snap));
+  return 0;
+}
+
+void Get_copy_meas_harm(T_meas_harm *harm)
+{
+  memset(harm, 0, sizeof(*harm));
+}
+
+void Get_copy_meas_power(T_meas_power *pwr)
+{
+  memset(pwr, 0, sizeof(*pwr));
+}
+
+void Meas_reset_energy(void)
+{
+}
+
+void Load_get_report(T_load_report *rep)
+{
+  memset(rep, 0, sizeof(*rep));
+}
+
+_mqx_int TempCtrl_get_IGBT_temperature(float *temp_ptr)
+{
+  *temp_ptr = 0;
+  return MQX_ERROR; // Датчика нет, в телеметрии признак недостоверной температуры
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// Аппаратная часть драйвера CAN
+//-------------------------------------------------------------------------------------------------------------
+
+/*-------------------------------------------------------------------------------------------------------------
+  Передача кадра в сокет. При заполнении очереди передачи ядра ждем освобождения
+-------------------------------------------------------------------------------------------------------------*/
+static int Sock_write(INT32U id, INT8U *data, INT8U len, INT8U ext)
+{
+  struct can_frame f;
+  struct pollfd    pfd = { 0, POLLOUT, 0 };
+
+  memset(&f, 0, sizeof(f));
+  f.can_id  = ext ? (id | CAN_EFF_FLAG) : id;
+  f.can_dlc = len;
+  memcpy(f.data, data, len);
+  pfd.fd = can_sock;
+  while ( write(can_sock, &f, sizeof(f)) != sizeof(f) )
+  {
+    if ( errno != ENOBUFS ) return MQX_ERROR;
+    poll(&pfd, 1, 10);
+  }
+  return MQX_OK;
+}
+
+_mqx_uint CAN_send(INT32U prio, INT32U id, INT8U *data, INT8U len, INT8U ext)
+{
+  if ( prio >= CAN_TX_PRIO_NUM ) return MQX_ERROR;
+  _int_disable();
+  tx_stat.queued[prio]++;
+  _int_enable();
+  if ( Sock_write(id, data, len, ext) != MQX_OK )
+  {
+    _int_disable();
+    tx_stat.drops[prio]++;
+    _int_enable();
+    return MQX_ERROR;
+  }
+  return MQX_OK;
+}
+
+void CAN_tx_kick(void)
+{
+  pthread_mutex_lock(&tx_mutex);
+  tx_kick = 1;
+  pthread_cond_signal(&tx_cond);
+  pthread_mutex_unlock(&tx_mutex);
+}
+
+INT32U CAN_copy_log(T_can_rx *dst, INT32U max)
+{
+  INT32U i;
+  INT32U n = 0;
+
+  _int_disable();
+  for (i = rx_log_tail; (i != rx_log_head) && (n < max); i = (i + 1) % CAN_RX_LOG_SZ)
+  {
+    dst[n++] = rx_log[i];
+  }
+  _int_enable();
+  return n;
+}
+
+void CAN_get_rx_stat(T_can_rx_stat *st)
+{
+  pthread_mutex_lock(&q_mutex);
+  *st = rx_stat;
+  pthread_mutex_unlock(&q_mutex);
+}
+
+void CAN_get_estop_stat(T_can_estop_stat *st)
+{
+  _int_disable();
+  *st = estop_stat;
+  _int_enable();
+}
+
+void CAN_get_tx_stat(T_can_tx_stat *st)
+{
+  _int_disable();
+  *st = tx_stat;
+  _int_enable();
+}
+
+_mqx_uint CAN_get_sync(INT8U seq, INT32U *t)
+{
+  _mqx_uint res = MQX_ERROR;
+  INT32U    now = (INT32U)Now_us();
+  INT32U    i;
+
+  _int_disable();
+  for (i = 0; i < CAN_SYNC_HIST_SZ; i++)
+  {
+    if ( sync_hist[i].valid && (sync_hist[i].seq == seq) && ((now - sync_hist[i].t) < CAN_SYNC_MAX_AGE_MS * 1000) )
+    {
+      *t  = sync_hist[i].t;
+      res = MQX_OK;
+      break;
+    }
+  }
+  _int_enable();
+  return res;
+}
+
+void CAN_get_sync_stat(T_can_sync_stat *st)
+{
+  _int_disable();
+  *st = sync_stat;
+  _int_enable();
+}
+
+void CAN_get_err_stat(T_can_err_stat *st)
+{
+  memset(st, 0, sizeof(*st));
+}
+
+INT32U CAN_get_err_hist(T_can_err_hist *h, INT32U n)
+{
+  return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Поток приема. Аналог CAN_isr
+-------------------------------------------------------------------------------------------------------------*/
+static void *Rx_thread(void *arg)
+{
+  struct can_frame f;
+  T_can_rx         rx;
+  INT32U           next;
+
+  while ( read(can_sock, &f, sizeof(f)) == sizeof(f) )
+  {
+    memset(&rx, 0, sizeof(rx));
+    rx.canid = f.can_id & CAN_EFF_MASK;
+    rx.ext   = (f.can_id & CAN_EFF_FLAG) ? 1 : 0;
+    rx.rtr   = (f.can_id & CAN_RTR_FLAG) ? 1 : 0;
+    rx.len   = f.can_dlc;
+    memcpy(rx.data, f.data, f.can_dlc);
+    rx.time  = (INT32U)(Now_us() * (CAN_SPEED / 1e6)); // В битовых интервалах, как таймер FlexCAN
+
+    // Лог как в CAN_isr: при заполнении новые кадры отбрасываются
+    _int_disable();
+    if ( (rx_log_head + 1) % CAN_RX_LOG_SZ == rx_log_tail )
+    {
+      rx_stat.log_drops++;
+    }
+    else
+    {
+      rx_log[rx_log_head] = rx;
+      rx_log_head = (rx_log_head + 1) % CAN_RX_LOG_SZ;
+    }
+    _int_enable();
+
+    if ( (rx.canid == INVERT_REQ) && (rx.len > 0) && (rx.data[0] == EMERGENCY_STOP_MOVING) )
+    {
+      _int_disable();
+      MC_emergency_stop_motor();
+      estop_stat.cnt++;
+      _int_enable();
+    }
+    else if ( (rx.canid == INVERT_SYNC) && (rx.len > 0) )
+    {
+      _int_disable();
+      sync_hist[sync_head].t     = (INT32U)Now_us();
+      sync_hist[sync_head].seq   = rx.data[0];
+      sync_hist[sync_head].valid = 1;
+      sync_head = (sync_head + 1) % CAN_SYNC_HIST_SZ;
+      sync_stat.cnt++;
+      sync_stat.seq = rx.data[0];
+      _int_enable();
+    }
+
+    pthread_mutex_lock(&q_mutex);
+    rx_stat.frames++;
+    next = (rx_q_head + 1) % CAN_RX_Q_SZ;
+    if ( next == rx_q_tail )
+    {
+      rx_stat.q_overflows++;
+    }
+    else
+    {
+      rx_q[rx_q_head]      = rx;
+      rx_q_time[rx_q_head] = Now_us();
+      rx_q_head            = next;
+    }
+    pthread_cond_signal(&q_cond);
+    pthread_mutex_unlock(&q_mutex);
+  }
+  perror("read");
+  exit(1);
+  return NULL;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Поток обработки. Аналог CAN_Rx_Task
+-------------------------------------------------------------------------------------------------------------*/
+static void *Proc_thread(void *arg)
+{
+  struct timespec ts;
+  T_can_rx        rx;
+  double          t_rx;
+  double          lat;
+  INT32U          depth;
+
+  while (1)
+  {
+    CAN_bulk_poll();
+
+    pthread_mutex_lock(&q_mutex);
+    if ( rx_q_head == rx_q_tail )
+    {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += POLL_MS * 1000000L;
+      if ( ts.tv_nsec >= 1000000000L ) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+      pthread_cond_timedwait(&q_cond, &q_mutex, &ts);
+    }
+    while ( rx_q_head != rx_q_tail )
+    {
+      depth = (rx_q_head + CAN_RX_Q_SZ - rx_q_tail) % CAN_RX_Q_SZ;
+      if ( depth > q_depth_max ) q_depth_max = depth;
+      q_depth_sum += depth;
+      rx   = rx_q[rx_q_tail];
+      t_rx = rx_q_time[rx_q_tail];
+      rx_q_tail = (rx_q_tail + 1) % CAN_RX_Q_SZ;
+      pthread_mutex_unlock(&q_mutex);
+
+      CAN_process_rx(&rx);
+
+      lat = Now_us() - t_rx;
+      pthread_mutex_lock(&q_mutex);
+      proc_cnt++;
+      proc_lat_sum += lat;
+      if ( lat > proc_lat_max ) proc_lat_max = lat;
+    }
+    pthread_mutex_unlock(&q_mutex);
+  }
+  return NULL;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Поток передачи кадров блочной передачи. Аналог загрузки майлбоксов в CAN_tx_dispatch
+-------------------------------------------------------------------------------------------------------------*/
+static void *Tx_thread(void *arg)
+{
+  T_can_tx tx;
+  int      r;
+
+  while (1)
+  {
+    pthread_mutex_lock(&tx_mutex);
+    while ( tx_kick == 0 ) pthread_cond_wait(&tx_cond, &tx_mutex);
+    tx_kick = 0;
+    pthread_mutex_unlock(&tx_mutex);
+
+    do
+    {
+      _int_disable();
+      r = CAN_bulk_frame(&tx);
+      _int_enable();
+      if ( r )
+      {
+        Sock_write(tx.canid, tx.data, tx.len, tx.ext);
+        bulk_frames++;
+      }
+    }
+    while ( r );
+  }
+  return NULL;
+}
+
+static void *Telem_thread(void *arg)
+{
+  CAN_Tx_Task(0);
+  return NULL;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Вывод статистики
+-------------------------------------------------------------------------------------------------------------*/
+static void Print_stat(void)
+{
+  T_can_bulk_stat bs;
+
+  CAN_get_bulk_stat(&bs);
+  pthread_mutex_lock(&q_mutex);
+  printf("Rx frames = %u, queue overflows = %u, processed = %u, queue depth max = %u, avr = %.2f, "
+         "rx->done latency avr = %.1f us, max = %.1f us\n",
+         rx_stat.frames, rx_stat.q_overflows, proc_cnt, q_depth_max, proc_cnt ? q_depth_sum / proc_cnt : 0.0,
+         proc_cnt ? proc_lat_sum / proc_cnt : 0.0, proc_lat_max);
+  pthread_mutex_unlock(&q_mutex);
+  printf("Tx answers = %u (failed %u), telemetry = %u, bulk frames = %u, bulk transfers = %u/%u, emergency stops = %u\n",
+         tx_stat.queued[CAN_TX_PRIO_ANS], tx_stat.drops[CAN_TX_PRIO_ANS], tx_stat.queued[CAN_TX_PRIO_TELEM],
+         bulk_frames, bs.completed, bs.sessions, estop_stat.cnt);
+  printf("Sync frames = %u, sync starts = %u, rejected as late = %u\n", sync_stat.cnt, sync_starts, sync_rejects);
+  fflush(stdout);
+}
+
+static void On_signal(int sig)
+{
+  Print_stat();
+  _exit(0);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Проверка Solve_can_timings для стандартных скоростей
+-------------------------------------------------------------------------------------------------------------*/
+static int Print_timings(void)
+{
+  static const INT32U rates[] = { 10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000 };
+  T_can_ctrl ctrl;
+  unsigned   k;
+  int        err = 0;
+
+  for (k = 0; k < sizeof(rates) / sizeof(rates[0]); k++)
+  {
+    if ( Solve_can_timings(CAN_CLK, rates[k], &ctrl) != MQX_OK )
+    {
+      printf("%7u bit/s: no solution\n", rates[k]);
+      err = 1;
+      continue;
+    }
+    {
+      INT32U tq  = 1 + (ctrl.propseg + 1) + (ctrl.pseg1 + 1) + (ctrl.pseg2 + 1);
+      double act = (double)CAN_CLK / (ctrl.presdiv + 1) / tq;
+
+      printf("%7u bit/s: presdiv=%u propseg=%u pseg1=%u pseg2=%u rjw=%u, %u tq, actual %.1f bit/s (%+.3f %%), sample point %.1f %%\n",
+             rates[k], ctrl.presdiv + 1, ctrl.propseg + 1, ctrl.pseg1 + 1, ctrl.pseg2 + 1, ctrl.rjw + 1, tq,
+             act, (act - rates[k]) * 100.0 / rates[k], 100.0 * (tq - ctrl.pseg2 - 1) / tq);
+    }
+  }
+  return err;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+
+-------------------------------------------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+  const char          *ifname = "vcan0";
+  int                  telem  = -1;
+  int                  stat_s = 0;
+  struct sockaddr_can  addr;
+  struct ifreq         ifr;
+  struct can_filter    flt[2];
+  pthread_mutexattr_t  ma;
+  pthread_t            th;
+  int                  opt;
+
+  while ( (opt = getopt(argc, argv, "i:T:s:t")) != -1 )
+  {
+    switch (opt)
+    {
+    case 'i': ifname = optarg; break;
+    case 'T': telem  = atoi(optarg); break;
+    case 's': stat_s = atoi(optarg); break;
+    case 't': return Print_timings();
+    default:
+      fprintf(stderr, "Usage: %s [-i vcan0] [-T telemetry_period_10ms] [-s stat_period_s] | -t\n", argv[0]);
+      return 1;
+    }
+  }
+
+  pthread_mutexattr_init(&ma);
+  pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&int_mutex, &ma);
+
+  mc_cbl.up_accel_pwm_scale   = mc_cbl.up_pwm_scale   = mc_cbl.up_decel_pwm_scale   = 0.5;
+  mc_cbl.down_accel_pwm_scale = mc_cbl.down_pwm_scale = mc_cbl.down_decel_pwm_scale = 0.5;
+  mc_cbl.up_move_freq   = mc_cbl.down_move_freq = MAX_MOT_FREQ;
+  mc_cbl.gov_k          = VBUS_GOV_K_ONE;
+  if ( telem >= 0 ) CAN_set_telem_period(telem);
+
+  can_sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if ( can_sock < 0 ) { perror("socket"); return 1; }
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  ifr.ifr_name[IFNAMSIZ - 1] = 0;
+  if ( ioctl(can_sock, SIOCGIFINDEX, &ifr) < 0 ) { perror(ifname); return 1; }
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family  = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if ( bind(can_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ) { perror("bind"); return 1; }
+
+  // Как фильтры 0 и 1 Rx FIFO: команды инвертору и кадры синхронизации
+  flt[0].can_id   = INVERT_REQ | CAN_EFF_FLAG;
+  flt[0].can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+  flt[1].can_id   = INVERT_SYNC | CAN_EFF_FLAG;
+  flt[1].can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+  setsockopt(can_sock, SOL_CAN_RAW, CAN_RAW_FILTER, flt, sizeof(flt));
+
+  signal(SIGINT,  On_signal);
+  signal(SIGTERM, On_signal);
+
+  pthread_create(&th, NULL, Proc_thread,  NULL);
+  pthread_create(&th, NULL, Tx_thread,    NULL);
+  pthread_create(&th, NULL, Telem_thread, NULL);
+  pthread_create(&th, NULL, Rx_thread,    NULL);
+
+  printf("Inverter CAN node on %s\n", ifname);
+  fflush(stdout);
+  while (1)
+  {
+    if ( stat_s > 0 )
+    {
+      sleep(stat_s);
+      Print_stat();
+    }
+    else
+    {
+      pause();
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,259 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Генератор нагрузки на команды частотного преобразователя через Linux SocketCAN
+
+  Посылает запросы на INVERT_REQ, не более заданного количества без ответа, и сопоставляет с ними ответы INVERT_ANS.
+  Выводит пропускную способность обработки команд и распределение задержки ответа.
+  Используются только запросы с одним ответом:
+    od    - OD_READ индексов 0x00..0x0B
+    power - GET_POWER страниц 0..2
+    harm  - GET_HARMONICS фаз 0..2
+    mix   - чередование всех трех
+
+  Запуск: can_load [-i vcan0] [-n запросов] [-r запросов_в_сек] [-w без_ответа] [-c od|power|harm|mix]
+          can_load -n 100000 -w 1     - задержка одиночного запроса
+          can_load -n 100000 -w 32    - предельная пропускная способность
+-------------------------------------------------------------------------------------------------------------*/
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "app_IDs.h"
+
+#define W_MAX          256  // Наибольшее количество запросов без ответа
+#define DRAIN_MS       1000 // Ожидание ответов после последнего запроса
+
+typedef struct
+{
+  uint8_t  cmd;
+  uint8_t  arg;
+  double   t;
+}
+T_pending;
+
+static int        sock;
+static T_pending  pend[W_MAX];
+static int        pend_n;
+static double    *lat;
+static long       answered;
+static long       unmatched;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Время в микросекундах
+-------------------------------------------------------------------------------------------------------------*/
+static double Now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int Cmp_dbl(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Сформировать запрос номер n выбранного вида
+-------------------------------------------------------------------------------------------------------------*/
+static void Make_req(long n, int kind, uint8_t *cmd, uint8_t *arg)
+{
+  if ( kind == 3 ) kind = n % 3;
+  switch (kind)
+  {
+  case 0:
+    *cmd = OD_READ;
+    *arg = (n / 3) % 12;
+    break;
+  case 1:
+    *cmd = GET_POWER;
+    *arg = (n / 3) % 3;
+    break;
+  default:
+    *cmd = GET_HARMONICS;
+    *arg = (n / 3) % 3;
+    break;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отправка кадра. При заполнении очереди передачи ядра ждем ее освобождения
+-------------------------------------------------------------------------------------------------------------*/
+static int Send_req(uint8_t cmd, uint8_t arg)
+{
+  struct can_frame f;
+  struct pollfd    pfd = { sock, POLLOUT, 0 };
+
+  memset(&f, 0, sizeof(f));
+  f.can_id  = INVERT_REQ | CAN_EFF_FLAG;
+  f.can_dlc = 8;
+  f.data[0] = cmd;
+  f.data[1] = arg;
+  while ( write(sock, &f, sizeof(f)) != sizeof(f) )
+  {
+    if ( errno != ENOBUFS ) { perror("write"); return -1; }
+    poll(&pfd, 1, 10);
+  }
+  return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Прием ответов в течении timeout_ms. Ответ сопоставляется с самым старым запросом той же команды и аргумента
+-------------------------------------------------------------------------------------------------------------*/
+static void Recv_ans(int timeout_ms)
+{
+  struct can_frame f;
+  struct pollfd    pfd = { sock, POLLIN, 0 };
+  double           t;
+  int              k;
+
+  while ( poll(&pfd, 1, timeout_ms) > 0 )
+  {
+    if ( read(sock, &f, sizeof(f)) != sizeof(f) ) break;
+    timeout_ms = 0;
+    if ( (f.can_id & CAN_EFF_MASK) != INVERT_ANS ) continue;
+    t = Now_us();
+    for (k = 0; k < pend_n; k++)
+    {
+      if ( (pend[k].cmd == f.data[0]) && (pend[k].arg == (f.data[1] & 0x7F)) ) break;
+    }
+    if ( k == pend_n )
+    {
+      unmatched++;
+      continue;
+    }
+    lat[answered++] = t - pend[k].t;
+    memmove(&pend[k], &pend[k + 1], (pend_n - k - 1) * sizeof(T_pending));
+    pend_n--;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+
+-------------------------------------------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+  const char          *ifname = "vcan0";
+  static const char   *kinds[] = { "od", "power", "harm", "mix" };
+  long                 num    = 10000;
+  double               rate   = 0;
+  int                  win    = 16;
+  int                  kind   = 3;
+  int                  max_w  = 0;
+  struct sockaddr_can  addr;
+  struct ifreq         ifr;
+  struct can_filter    flt;
+  double               t0;
+  double               t_end;
+  double               t_next;
+  double               now;
+  long                 sent   = 0;
+  uint8_t              cmd;
+  uint8_t              arg;
+  int                  opt;
+  int                  k;
+
+  while ( (opt = getopt(argc, argv, "i:n:r:w:c:")) != -1 )
+  {
+    switch (opt)
+    {
+    case 'i': ifname = optarg; break;
+    case 'n': num    = atol(optarg); break;
+    case 'r': rate   = atof(optarg); break;
+    case 'w': win    = atoi(optarg); break;
+    case 'c':
+      for (kind = 0; kind < 4; kind++) if ( strcmp(optarg, kinds[kind]) == 0 ) break;
+      if ( kind < 4 ) break;
+      /* FALLTHROUGH */
+    default:
+      fprintf(stderr, "Usage: %s [-i vcan0] [-n count] [-r req_per_s] [-w in_flight] [-c od|power|harm|mix]\n", argv[0]);
+      return 1;
+    }
+  }
+  if ( (num <= 0) || (win < 1) || (win > W_MAX) )
+  {
+    fprintf(stderr, "Count must be positive, in flight 1..%d\n", W_MAX);
+    return 1;
+  }
+  lat = malloc(num * sizeof(double));
+  if ( lat == NULL ) { perror("malloc"); return 1; }
+
+  sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if ( sock < 0 ) { perror("socket"); return 1; }
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  ifr.ifr_name[IFNAMSIZ - 1] = 0;
+  if ( ioctl(sock, SIOCGIFINDEX, &ifr) < 0 ) { perror(ifname); return 1; }
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family  = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if ( bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ) { perror("bind"); return 1; }
+  flt.can_id   = INVERT_ANS | CAN_EFF_FLAG;
+  flt.can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+  setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, &flt, sizeof(flt));
+
+  t0     = Now_us();
+  t_next = t0;
+  while ( sent < num )
+  {
+    now = Now_us();
+    if ( (pend_n < win) && ((rate <= 0) || (now >= t_next)) )
+    {
+      Make_req(sent, kind, &cmd, &arg);
+      if ( Send_req(cmd, arg) < 0 ) return 1;
+      pend[pend_n].cmd = cmd;
+      pend[pend_n].arg = arg;
+      pend[pend_n].t   = Now_us();
+      pend_n++;
+      if ( pend_n > max_w ) max_w = pend_n;
+      sent++;
+      if ( rate > 0 ) t_next += 1e6 / rate;
+      Recv_ans(0);
+      continue;
+    }
+    if ( pend_n >= win )
+    {
+      // Окно заполнено. Если ответы не приходят, считаем самый старый запрос потерянным
+      Recv_ans(DRAIN_MS);
+      if ( pend_n >= win )
+      {
+        memmove(&pend[0], &pend[1], (pend_n - 1) * sizeof(T_pending));
+        pend_n--;
+      }
+    }
+    else
+    {
+      k = (int)((t_next - now) / 1000);
+      Recv_ans(k > 0 ? k : 0);
+    }
+  }
+  while ( pend_n > 0 )
+  {
+    k = pend_n;
+    Recv_ans(DRAIN_MS);
+    if ( pend_n == k ) break;
+  }
+  t_end = Now_us();
+
+  printf("Requests %s: sent %ld, answered %ld, lost %ld, unmatched answers %ld, max in flight %d\n",
+         kinds[kind], sent, answered, sent - answered, unmatched, max_w);
+  printf("Time %.3f s, %.0f answers/s\n", (t_end - t0) / 1e6, answered * 1e6 / (t_end - t0));
+  if ( answered > 0 )
+  {
+    qsort(lat, answered, sizeof(double), Cmp_dbl);
+    printf("Latency us: min %.0f, p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, max %.0f\n",
+           lat[0], lat[answered * 50 / 100], lat[answered * 90 / 100], lat[answered * 99 / 100],
+           lat[answered * 999 / 1000], lat[answered - 1]);
+  }
+  return answered == sent ? 0 : 2;
+}
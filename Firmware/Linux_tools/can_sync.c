@@ -0,0 +1,137 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Синхронный старт группы частотных преобразователей через Linux SocketCAN
+
+  Посылает кадр синхронизации INVERT_SYNC, затем команду SYNC_START с задержкой старта относительно этого кадра
+  и выводит ответы плат. Все платы фиксируют момент приема кадра синхронизации по отметке времени FlexCAN
+  и включают PWM в один и тот же момент общей шкалы времени.
+
+  Сборка:  gcc -O2 -Wall -o can_sync can_sync.c
+  Запуск:  can_sync [-i can0] [-d направление] [-f частота_Гц] [-a ускорение_0.1с] [-t задержка_мс] [-s номер]
+           can_sync -d 0 -f 50 -a 10 -t 50   - старт вверх через 50 мс после кадра синхронизации
+-------------------------------------------------------------------------------------------------------------*/
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+// Должно совпадать с app_IDs.h и Motor_control.h прошивки
+#define INVERT_REQ          0x1BF1FFFF
+#define INVERT_ANS          0x1BF2FFFF
+#define INVERT_SYNC         0x1BF4FFFF
+#define SYNC_START          0x0F
+
+#define ANS_TIMEOUT_MS      200  // Ожидание ответов после команды
+
+static const char *res_str[] = { "armed", "no sync frame", "too late", "motor running or safety chain open", "busy", "bad direction" };
+
+static int can_sock;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отправить кадр
+-------------------------------------------------------------------------------------------------------------*/
+static int Send_frame(uint32_t id, const uint8_t *data, int len)
+{
+  struct can_frame f;
+
+  memset(&f, 0, sizeof(f));
+  f.can_id  = id | CAN_EFF_FLAG;
+  f.can_dlc = len;
+  memcpy(f.data, data, len);
+  if ( write(can_sock, &f, sizeof(f)) != sizeof(f) )
+  {
+    perror("write");
+    return -1;
+  }
+  return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+
+-------------------------------------------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+  const char          *ifname = "can0";
+  unsigned             dir    = 0;
+  unsigned             freq   = 50;
+  unsigned             accel  = 10;
+  unsigned             delay  = 50;
+  unsigned             seq    = (unsigned)time(NULL) & 0xFF;
+  struct sockaddr_can  addr;
+  struct ifreq         ifr;
+  struct can_filter    flt;
+  struct can_frame     f;
+  struct pollfd        pfd;
+  uint8_t              d[8];
+  uint32_t             us;
+  int32_t              remain;
+  int                  opt;
+  int                  n = 0;
+
+  while ( (opt = getopt(argc, argv, "i:d:f:a:t:s:")) != -1 )
+  {
+    switch (opt)
+    {
+    case 'i': ifname = optarg; break;
+    case 'd': dir    = strtoul(optarg, NULL, 0); break;
+    case 'f': freq   = strtoul(optarg, NULL, 0); break;
+    case 'a': accel  = strtoul(optarg, NULL, 0); break;
+    case 't': delay  = strtoul(optarg, NULL, 0); break;
+    case 's': seq    = strtoul(optarg, NULL, 0) & 0xFF; break;
+    default:
+      fprintf(stderr, "Usage: %s [-i can0] [-d dir] [-f freq_hz] [-a accel_0.1s] [-t delay_ms] [-s sync_seq]\n", argv[0]);
+      return 1;
+    }
+  }
+  us = delay * 1000;
+  if ( us > 0xFFFFFF )
+  {
+    fprintf(stderr, "Delay must be below %u ms\n", 0xFFFFFF / 1000);
+    return 1;
+  }
+
+  can_sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if ( can_sock < 0 ) { perror("socket"); return 1; }
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  ifr.ifr_name[IFNAMSIZ - 1] = 0;
+  if ( ioctl(can_sock, SIOCGIFINDEX, &ifr) < 0 ) { perror(ifname); return 1; }
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family  = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if ( bind(can_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ) { perror("bind"); return 1; }
+  flt.can_id   = INVERT_ANS | CAN_EFF_FLAG;
+  flt.can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+  setsockopt(can_sock, SOL_CAN_RAW, CAN_RAW_FILTER, &flt, sizeof(flt));
+
+  d[0] = seq;
+  if ( Send_frame(INVERT_SYNC, d, 1) < 0 ) return 1;
+
+  d[0] = SYNC_START;
+  d[1] = dir;
+  d[2] = freq;
+  d[3] = accel;
+  d[4] = seq;
+  d[5] = us >> 16;
+  d[6] = us >> 8;
+  d[7] = us;
+  if ( Send_frame(INVERT_REQ, d, 8) < 0 ) return 1;
+
+  pfd.fd     = can_sock;
+  pfd.events = POLLIN;
+  while ( poll(&pfd, 1, ANS_TIMEOUT_MS) > 0 )
+  {
+    if ( read(can_sock, &f, sizeof(f)) != sizeof(f) ) break;
+    if ( (f.can_dlc < 8) || (f.data[0] != SYNC_START) ) continue;
+    remain = (int32_t)(((uint32_t)f.data[4] << 24) | ((uint32_t)f.data[5] << 16) | ((uint32_t)f.data[6] << 8) | f.data[7]);
+    printf("Answer %d: %s, start in %d us\n", ++n, f.data[1] < 6 ? res_str[f.data[1]] : "unknown", remain);
+  }
+  if ( n == 0 ) printf("No answers\n");
+  return n == 0;
+}
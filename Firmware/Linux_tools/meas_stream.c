@@ -0,0 +1,291 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Прием двоичного потока выборок сигналов частотного преобразователя через порт монитора
+
+  Включает поток из меню монитора (пункт '8', затем 'B'), декодирует кадры COBS, проверяет CRC-16
+  и записывает выборки в CSV. Токи, напряжение шины и частота переводятся в физические единицы,
+  остальные сигналы записываются в отсчетах. По Ctrl+C поток останавливается командой 'R'.
+
+  Сборка:  gcc -O2 -Wall -o meas_stream meas_stream.c
+  Запуск:  meas_stream [-d /dev/ttyUSB0] [-b 921600] [-m маска_hex] [-p периодов_PWM] [-o файл.csv] [-r файл.bin]
+           meas_stream -m 7 -p 4 -o curr.csv      - три фазных тока с частотой 4000 выборок/с
+           meas_stream -m 129 -o vbus.csv          - ii_w, v_bus и частота генератора, 1000 выборок/с
+-------------------------------------------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Должно совпадать с Stream_control.h и Motor_control.h прошивки
+#define STREAM_SIG_NUM      10
+#define STREAM_FRAME_MAX    (6 + 2 * STREAM_SIG_NUM + 2)
+#define PWM_FREQ            16000
+
+#define CURR_AMP_PER_SMPL   (3.3 / (4096.0 * 0.04 * 0.6875))
+#define VBUS_VOLT_PER_SMPL  (3.3 * (2200.0 + 300000.0) * 0.964 / (2200.0 * 4096.0))
+
+#define RX_BUF_SZ           4096
+
+typedef struct
+{
+  const char *name;
+  double      k;      // Множитель перевода отсчетов в единицы измерения
+} T_sig_desc;
+
+static const T_sig_desc sig_desc[STREAM_SIG_NUM] =
+{
+  { "ii_w_A",   CURR_AMP_PER_SMPL },
+  { "ii_v_A",   CURR_AMP_PER_SMPL },
+  { "ii_u_A",   CURR_AMP_PER_SMPL },
+  { "v_bus_V",  VBUS_VOLT_PER_SMPL },
+  { "v_u",      1.0 },
+  { "pwm_a",    1.0 },
+  { "pwm_b",    1.0 },
+  { "pwm_c",    1.0 },
+  { "freq_Hz",  1.0 / 256.0 },
+  { "temper",   1.0 },
+};
+
+static volatile sig_atomic_t stop_req;
+
+/*-------------------------------------------------------------------------------------------------------------
+  CRC-16/CCITT-FALSE, как в Stream_crc16 прошивки
+-------------------------------------------------------------------------------------------------------------*/
+static uint16_t Crc16(const uint8_t *buf, unsigned len)
+{
+  uint16_t crc = 0xFFFF;
+  unsigned i;
+
+  while ( len-- )
+  {
+    crc ^= (uint16_t)(*buf++) << 8;
+    for (i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  }
+  return crc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Декодирование COBS кадра без завершающего нуля. Возвращает длину или -1 при ошибке
+-------------------------------------------------------------------------------------------------------------*/
+static int Cobs_decode(const uint8_t *src, unsigned len, uint8_t *dst, unsigned max)
+{
+  unsigned i = 0;
+  unsigned o = 0;
+  unsigned code;
+  unsigned k;
+
+  while ( i < len )
+  {
+    code = src[i++];
+    if ( (code == 0) || (i + code - 1 > len) ) return -1;
+    for (k = 1; k < code; k++)
+    {
+      if ( o >= max ) return -1;
+      dst[o++] = src[i++];
+    }
+    if ( (code < 0xFF) && (i < len) )
+    {
+      if ( o >= max ) return -1;
+      dst[o++] = 0;
+    }
+  }
+  return o;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Открытие последовательного порта в двоичном режиме
+-------------------------------------------------------------------------------------------------------------*/
+static int Open_port(const char *dev, unsigned baud)
+{
+  struct termios tio;
+  speed_t        spd;
+  int            fd;
+
+  switch (baud)
+  {
+  case 115200: spd = B115200; break;
+  case 230400: spd = B230400; break;
+  case 460800: spd = B460800; break;
+  case 921600: spd = B921600; break;
+  default:
+    fprintf(stderr, "Unsupported baud rate %u\n", baud);
+    return -1;
+  }
+
+  fd = open(dev, O_RDWR | O_NOCTTY);
+  if ( fd < 0 ) { perror(dev); return -1; }
+  if ( tcgetattr(fd, &tio) < 0 ) { perror("tcgetattr"); close(fd); return -1; }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, spd);
+  cfsetospeed(&tio, spd);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN]  = 0;
+  tio.c_cc[VTIME] = 0;
+  if ( tcsetattr(fd, TCSANOW, &tio) < 0 ) { perror("tcsetattr"); close(fd); return -1; }
+  tcflush(fd, TCIOFLUSH);
+  return fd;
+}
+
+static void Send_str(int fd, const char *s)
+{
+  if ( write(fd, s, strlen(s)) < 0 ) perror("write");
+  tcdrain(fd);
+}
+
+static void On_sigint(int sig)
+{
+  (void)sig;
+  stop_req = 1;
+}
+
+int main(int argc, char **argv)
+{
+  const char    *dev   = "/dev/ttyUSB0";
+  const char    *oname = NULL;
+  const char    *rname = NULL;
+  unsigned       baud  = 921600;
+  unsigned       mask  = 0x0129;
+  unsigned       div   = 16;
+  FILE          *out   = stdout;
+  FILE          *raw   = NULL;
+  uint8_t        rx[RX_BUF_SZ];
+  uint8_t        enc[2 * STREAM_FRAME_MAX];
+  uint8_t        frame[STREAM_FRAME_MAX];
+  unsigned       enc_len = 0;
+  int            synced  = 0;
+  int            have_seq = 0;
+  uint16_t       last_seq = 0;
+  uint64_t       seq_ext  = 0;
+  unsigned long  frames = 0, crc_errs = 0, fmt_errs = 0, lost = 0;
+  unsigned       fmask, fdiv, n, i, k;
+  uint16_t       seq;
+  int16_t        v;
+  struct pollfd  pfd;
+  char           cmd[32];
+  int            fd, opt, len, flen;
+
+  while ( (opt = getopt(argc, argv, "d:b:m:p:o:r:")) != -1 )
+  {
+    switch (opt)
+    {
+    case 'd': dev   = optarg; break;
+    case 'b': baud  = strtoul(optarg, NULL, 0); break;
+    case 'm': mask  = strtoul(optarg, NULL, 16); break;
+    case 'p': div   = strtoul(optarg, NULL, 0); break;
+    case 'o': oname = optarg; break;
+    case 'r': rname = optarg; break;
+    default:
+      fprintf(stderr, "Usage: %s [-d /dev/ttyUSB0] [-b baud] [-m mask_hex] [-p pwm_periods] [-o out.csv] [-r raw.bin]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  fd = Open_port(dev, baud);
+  if ( fd < 0 ) return 1;
+  if ( oname != NULL )
+  {
+    out = fopen(oname, "w");
+    if ( out == NULL ) { perror(oname); return 1; }
+  }
+  if ( rname != NULL )
+  {
+    raw = fopen(rname, "wb");
+    if ( raw == NULL ) { perror(rname); return 1; }
+  }
+  signal(SIGINT,  On_sigint);
+  signal(SIGTERM, On_sigint);
+
+  // Выход в главное меню, вход в просмотр измерений и запуск потока
+  Send_str(fd, "RR");
+  usleep(100000);
+  tcflush(fd, TCIFLUSH);
+  snprintf(cmd, sizeof(cmd), "8B%X,%u\r", mask, div);
+  Send_str(fd, cmd);
+
+  fprintf(out, "time_s,seq");
+  for (i = 0; i < STREAM_SIG_NUM; i++)
+  {
+    if ( mask & (1u << i) ) fprintf(out, ",%s", sig_desc[i].name);
+  }
+  fprintf(out, "\n");
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while ( !stop_req )
+  {
+    if ( poll(&pfd, 1, 200) <= 0 ) continue;
+    len = read(fd, rx, sizeof(rx));
+    if ( len < 0 )
+    {
+      if ( errno == EINTR ) continue;
+      perror("read");
+      break;
+    }
+    if ( raw != NULL ) fwrite(rx, 1, len, raw);
+
+    for (k = 0; k < (unsigned)len; k++)
+    {
+      if ( rx[k] != 0 )
+      {
+        if ( enc_len < sizeof(enc) ) enc[enc_len] = rx[k];
+        enc_len++;
+        continue;
+      }
+
+      // Байт 0x00 - граница кадра. Все до первой границы (эхо меню) отбрасывается
+      if ( !synced || (enc_len == 0) )
+      {
+        synced  = 1;
+        enc_len = 0;
+        continue;
+      }
+      flen    = (enc_len <= sizeof(enc)) ? Cobs_decode(enc, enc_len, frame, sizeof(frame)) : -1;
+      enc_len = 0;
+      if ( flen < 8 ) { fmt_errs++; continue; }
+      if ( Crc16(frame, flen - 2) != (frame[flen - 2] | (frame[flen - 1] << 8)) ) { crc_errs++; continue; }
+
+      seq   = frame[0] | (frame[1] << 8);
+      fmask = frame[2] | (frame[3] << 8);
+      fdiv  = frame[4] | (frame[5] << 8);
+      for (n = 0, i = 0; i < STREAM_SIG_NUM; i++) n += (fmask >> i) & 1;
+      if ( (fdiv == 0) || ((unsigned)flen != 8 + 2 * n) ) { fmt_errs++; continue; }
+
+      // Пропуски номеров - выборки потерянные в прошивке или кадры отброшенные здесь
+      if ( have_seq )
+      {
+        lost    += (uint16_t)(seq - last_seq - 1);
+        seq_ext += (uint16_t)(seq - last_seq);
+      }
+      else
+      {
+        seq_ext = seq;
+      }
+      have_seq = 1;
+      last_seq = seq;
+      frames++;
+
+      fprintf(out, "%.6f,%llu", (double)seq_ext * fdiv / PWM_FREQ, (unsigned long long)seq_ext);
+      for (n = 0, i = 0; i < STREAM_SIG_NUM; i++)
+      {
+        if ( !(fmask & (1u << i)) ) continue;
+        v = (int16_t)(frame[6 + 2 * n] | (frame[7 + 2 * n] << 8));
+        n++;
+        if ( sig_desc[i].k == 1.0 ) fprintf(out, ",%d", v);
+        else                        fprintf(out, ",%.4f", v * sig_desc[i].k);
+      }
+      fprintf(out, "\n");
+    }
+  }
+
+  Send_str(fd, "R");
+  close(fd);
+  if ( out != stdout ) fclose(out);
+  if ( raw != NULL ) fclose(raw);
+  fprintf(stderr, "Frames = %lu, lost samples = %lu, CRC errors = %lu, format errors = %lu\n", frames, lost, crc_errs, fmt_errs);
+  return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef __OFFS_HOST
+  #define __OFFS_HOST
+
+// Окружение для сборки калибровки смещений датчиков тока (ADC_offs.c) под Linux.
+// Заменяет App.h: из прошивки нужны только типы и константы ADC_control.h
+
+#include <stdint.h>
+#include "app_types.h"
+
+typedef uint32_t        uint_32;
+typedef uint32_t        _mqx_uint;
+typedef struct ADC_MemMap *ADC_MemMapPtr;
+
+#define _PTR_           *
+
+#include "Pins_control.h"
+#include "Motor_control.h"
+#include "ADC_control.h"
+
+#endif
@@ -0,0 +1,263 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Проверка калибровки смещений датчиков тока прошивки (Main/ADC_offs.c) на синтетических отсчетах
+
+  Отсчеты трех фаз с известными смещениями, шумом и синусоидой тока подаются в ADC_curr_offs_update
+  с частотой кадров ADC 16 кГц, как в прошивке:
+    1. Простой после включения: калибровка должна найти смещения
+    2. Пуск на 5, 10, 20 и 50 Гц: смещения не меняются, ошибка действующего значения в каждом периоде
+       после старта и ошибка амплитуды и фазы основной гармоники в установившемся режиме малы
+    3. Остановка с затуханием тока и сдвигом смещений: повторная калибровка находит новые смещения
+    4. Медленный дрейф в простое: смещения следуют за ним, без дрейфа сходятся к истинным
+  Для сравнения выводится результат прежнего фильтра постоянной составляющей (ФВЧ с постоянной 2^12 отсчетов).
+  При нарушении любого допуска возвращает 1.
+
+  Сборка и запуск: make check
+-------------------------------------------------------------------------------------------------------------*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "offs_host.h"
+
+#define FS            16000.0  // Частота кадров ADC, Гц
+#define AMP           400.0    // Амплитуда тока, отсчеты ADC
+#define NOISE         3.0      // СКО шума, отсчеты ADC
+#define RUN_S         2        // Длительность работы, с. Установившийся режим - последняя секунда
+#define STOP_TAU_S    0.005    // Постоянная затухания тока после остановки PWM
+
+#define TOL_OFFS      0.3      // Допуск калибровки смещения, отсчеты
+#define TOL_DRIFT     0.6      // Допуск слежения за дрейфом, отсчеты
+#define TOL_IDLE      0.1      // Допуск смещения после долгого простоя без дрейфа, отсчеты
+#define TOL_RMS_PCT   0.1      // Допуск ошибки действующего значения в периоде, %
+#define TOL_AMP_PCT   0.05     // Допуск ошибки амплитуды основной гармоники, %
+#define TOL_PH_DEG    0.05     // Допуск ошибки фазы основной гармоники, градусы
+
+static T_ADC_res      res;
+static double         offs[3] = { 2071.3, 2030.7, 2055.0 }; // Истинные смещения фаз w, v, u
+static unsigned int   rnd     = 12345;
+static int            fails;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Шум с нормальным распределением (сумма 12 равномерных) и детерминированной последовательностью
+-------------------------------------------------------------------------------------------------------------*/
+static double Noise(void)
+{
+  double s = 0;
+  int    i;
+
+  for (i = 0; i < 12; i++)
+  {
+    rnd = rnd * 1103515245u + 12345u;
+    s  += (rnd >> 8) / 16777216.0;
+  }
+  return (s - 6.0) * NOISE;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Отсчет ADC: смещение + ток + шум с округлением и ограничением 12 битами
+-------------------------------------------------------------------------------------------------------------*/
+static unsigned short Smpl(double offset, double i)
+{
+  double v = floor(offset + i + Noise() + 0.5);
+
+  if ( v < 0 ) v = 0;
+  if ( v > 4095 ) v = 4095;
+  return (unsigned short)v;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Один кадр ADC с токами i[3]. Возвращает токи после вычитания смещений как в ADC_process_frame
+-------------------------------------------------------------------------------------------------------------*/
+static void Frame(const double *i, int running, int *ii)
+{
+  res.smpl_ii_w = Smpl(offs[0], i[0]);
+  res.smpl_ii_v = Smpl(offs[1], i[1]);
+  res.smpl_ii_u = Smpl(offs[2], i[2]);
+  ADC_curr_offs_update(&res, running);
+  ii[0] = res.smpl_ii_w - ((res.ii_w_offs + (1 << (ADC_OFFS_Q - 1))) >> ADC_OFFS_Q);
+  ii[1] = res.smpl_ii_v - ((res.ii_v_offs + (1 << (ADC_OFFS_Q - 1))) >> ADC_OFFS_Q);
+  ii[2] = res.smpl_ii_u - ((res.ii_u_offs + (1 << (ADC_OFFS_Q - 1))) >> ADC_OFFS_Q);
+}
+
+static void Idle(unsigned int frames)
+{
+  static const double zero[3] = { 0, 0, 0 };
+  int                 ii[3];
+
+  while ( frames-- ) Frame(zero, 0, ii);
+}
+
+static void Check(int ok, const char *what)
+{
+  if ( !ok )
+  {
+    printf("FAIL: %s\n", what);
+    fails++;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Сравнение смещений найденных калибровкой с истинными
+-------------------------------------------------------------------------------------------------------------*/
+static void Check_offs(const char *stage, double tol)
+{
+  double f[3];
+  int    n;
+  char   s[80];
+
+  f[0] = res.ii_w_offs / 65536.0;
+  f[1] = res.ii_v_offs / 65536.0;
+  f[2] = res.ii_u_offs / 65536.0;
+  printf("%-22s", stage);
+  for (n = 0; n < 3; n++)
+  {
+    printf("  %8.3f (%+.3f)", f[n], f[n] - offs[n]);
+    snprintf(s, sizeof(s), "%s: offset %d error %.3f", stage, n, f[n] - offs[n]);
+    Check(fabs(f[n] - offs[n]) <= tol, s);
+  }
+  printf("\n");
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Пуск на частоте freq на RUN_S секунд, затем остановка с затуханием тока.
+  Параллельно с калибровкой ток фазы w проходит через прежний ФВЧ с тем же смещением на момент старта
+-------------------------------------------------------------------------------------------------------------*/
+static void Run(double freq)
+{
+  int          frames = (int)(RUN_S * FS);
+  int          per    = (int)(FS / freq + 0.5);
+  int          offs0[3];
+  int          ii[3];
+  int          iir_offs;
+  int          iir;
+  int          k, n, c;
+  double       i[3];
+  double       ph;
+  double       sq_cal = 0, sq_iir = 0;
+  double       re_cal = 0, im_cal = 0, re_iir = 0, im_iir = 0;
+  double       a_cal, a_iir, p_cal, p_iir;
+  double       rms0 = sqrt(AMP * AMP / 2);
+  double       e_cal, e_iir;
+  char         s[80];
+
+  offs0[0] = res.ii_w_offs;
+  offs0[1] = res.ii_v_offs;
+  offs0[2] = res.ii_u_offs;
+  iir_offs = (int)floor(offs[0] * 4096 + 0.5);
+
+  printf("%4.0f Hz, RMS error in cycles after start, %%:\n", freq);
+  printf("  cal:");
+  for (k = 0, c = 0; k < frames; k++)
+  {
+    ph   = 2 * M_PI * freq * k / FS;
+    i[0] = AMP * sin(ph);
+    i[1] = AMP * sin(ph - 2 * M_PI / 3);
+    i[2] = AMP * sin(ph + 2 * M_PI / 3);
+    Frame(i, 1, ii);
+
+    // Прежний фильтр постоянной составляющей
+    iir       = res.smpl_ii_w - (iir_offs >> 12);
+    iir_offs += iir;
+
+    sq_cal += (double)ii[0] * ii[0];
+    sq_iir += (double)iir * iir;
+    if ( (k + 1) % per == 0 )
+    {
+      // Действующее значение за период, первые 5 периодов
+      e_cal = (sqrt(sq_cal / per) / rms0 - 1) * 100;
+      e_iir = (sqrt(sq_iir / per) / rms0 - 1) * 100;
+      if ( c < 5 )
+      {
+        printf(" %+.3f (IIR %+.3f)", e_cal, e_iir);
+        snprintf(s, sizeof(s), "%.0f Hz: cycle %d RMS error %.3f %%", freq, c, e_cal);
+        Check(fabs(e_cal) <= TOL_RMS_PCT, s);
+      }
+      c++;
+      sq_cal = 0;
+      sq_iir = 0;
+    }
+    if ( k >= frames - (int)FS )
+    {
+      // Основная гармоника за последнюю секунду
+      re_cal += ii[0] * cos(ph);
+      im_cal += ii[0] * sin(ph);
+      re_iir += iir * cos(ph);
+      im_iir += iir * sin(ph);
+    }
+  }
+  printf("\n");
+
+  a_cal = 2 * sqrt(re_cal * re_cal + im_cal * im_cal) / FS;
+  a_iir = 2 * sqrt(re_iir * re_iir + im_iir * im_iir) / FS;
+  p_cal = atan2(re_cal, im_cal) * 180 / M_PI;
+  p_iir = atan2(re_iir, im_iir) * 180 / M_PI;
+  printf("  steady state: cal %+.3f %% / %+.3f deg, IIR %+.3f %% / %+.3f deg\n",
+         (a_cal / AMP - 1) * 100, p_cal, (a_iir / AMP - 1) * 100, p_iir);
+  snprintf(s, sizeof(s), "%.0f Hz: amplitude error %.3f %%", freq, (a_cal / AMP - 1) * 100);
+  Check(fabs(a_cal / AMP - 1) * 100 <= TOL_AMP_PCT, s);
+  snprintf(s, sizeof(s), "%.0f Hz: phase error %.3f deg", freq, p_cal);
+  Check(fabs(p_cal) <= TOL_PH_DEG, s);
+
+  snprintf(s, sizeof(s), "%.0f Hz: offsets changed while running", freq);
+  Check((res.ii_w_offs == offs0[0]) && (res.ii_v_offs == offs0[1]) && (res.ii_u_offs == offs0[2]), s);
+
+  // Остановка PWM: ток затухает, смещения не должны его захватить
+  for (n = 0; n < ADC_OFFS_SETTLE_FRAMES; n++)
+  {
+    double d = exp(-n / (STOP_TAU_S * FS));
+
+    i[0] *= d;
+    i[1] *= d;
+    i[2] *= d;
+    Frame(i, 0, ii);
+  }
+}
+
+int main(void)
+{
+  static const double freqs[] = { 5, 10, 20, 50 }; // Целое число кадров в периоде
+  unsigned int        cal;
+  unsigned int        n;
+  int                 k;
+
+  ADC_curr_offs_reset(&res);
+
+  // Калибровка после включения
+  Idle(ADC_OFFS_SETTLE_FRAMES + (1u << ADC_OFFS_CAL_SHIFT));
+  Check(res.cal_done == 1, "no calibration after power-up");
+  Check_offs("Power-up calibration", TOL_OFFS);
+
+  for (n = 0; n < sizeof(freqs) / sizeof(freqs[0]); n++)
+  {
+    cal = res.cal_done;
+    Run(freqs[n]);
+
+    // Смещения изменились за время работы (нагрев), повторная калибровка в простое
+    offs[0] += 4.0;
+    offs[1] -= 2.5;
+    offs[2] += 1.2;
+    Idle((1u << ADC_OFFS_CAL_SHIFT) + 1);
+    Check(res.cal_done == cal + 1, "no calibration after stop");
+    Check_offs("Calibration after stop", TOL_OFFS);
+  }
+
+  // Дрейф 2 отсчета за 20 с простоя, отставание слежения около 0.4 отсчета
+  for (k = 0; k < 20 * (int)FS; k++)
+  {
+    offs[0] += 2.0 / (20 * FS);
+    offs[1] -= 2.0 / (20 * FS);
+    Idle(1);
+  }
+  Check_offs("Drift tracking", TOL_DRIFT);
+
+  // Без дрейфа смещения должны сойтись к истинным, а не к ближайшей половине отсчета
+  Idle(20 * (int)FS);
+  Check_offs("Idle without drift", TOL_IDLE);
+
+  if ( fails )
+  {
+    printf("offs_test: %d FAILED\n", fails);
+    return 1;
+  }
+  printf("offs_test: OK\n");
+  return 0;
+}
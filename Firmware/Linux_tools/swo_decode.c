@@ -0,0 +1,504 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Декодер потока ITM принятого с вывода SWO частотного преобразователя
+
+  Поток формирует модуль Trace_control прошивки: TPIU в режиме NRZ, форматер выключен,
+  локальные метки времени в единицах 64 тактов ядра. Декодер разбирает пакеты ITM, назначает событиям
+  время по меткам, записывает временную диаграмму событий в CSV и выводит статистику:
+  длительность прерываний, доли времени и переключения задач, период и разброс расчета PWM, счетчики.
+
+  Поток читается из файла записанного ранее (любым USB-UART адаптером или отладчиком, -f, по умолчанию stdin)
+  или непосредственно из последовательного порта (-d). При приеме из порта сырые байты можно сохранить (-r)
+  для повторного разбора. Прием завершается по Ctrl+C.
+
+  Сборка:  gcc -O2 -Wall -o swo_decode swo_decode.c
+  Запуск:  swo_decode [-f файл.bin] [-d /dev/ttyUSB0] [-b 4000000] [-r файл.bin] [-t файл.csv] [-c частота_ядра] [-a]
+           swo_decode -d /dev/ttyUSB1 -r swo.bin      - прием из порта, статистика по Ctrl+C
+           swo_decode -f swo.bin -t timeline.csv      - разбор записи с временной диаграммой
+-------------------------------------------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Должно совпадать с Trace_control.h, App.h и Motor_control.h прошивки
+#define TRACE_CH_ISR        1
+#define TRACE_CH_TASK       2
+#define TRACE_CH_CTRL       3
+#define TRACE_CH_COUNTER    4
+
+#define TRACE_TS_DIV        64
+#define TRACE_ISR_EXIT      0x80
+#define TRACE_TASK_OTHER    0xFD
+#define TRACE_TASK_MQX      0xFE
+#define TRACE_TASK_IDLE     0xFF
+
+#define CORE_CLOCK          120000000
+#define PWM_FREQ            16000
+
+#define ISR_IDS             4
+#define TASK_IDS            256
+#define CNT_IDS             4
+#define PORTS               32
+#define PEND_MAX            64      // Событий между двумя метками времени
+#define RX_BUF_SZ           4096
+
+static const char *isr_names[ISR_IDS]  = { "?", "ETM0", "ADC_DMA", "CAN" };
+static const char *task_names[8]       = { "?", "MotIsr", "Ctrl", "Meas", "VT100", "LCD", "CAN_TX", "CAN_RX" };
+static const char *cnt_names[CNT_IDS]  = { "?", "trace_drops", "isr_load_0.1%", "idle_load_0.1%" };
+
+typedef struct
+{
+  unsigned port;
+  unsigned size;
+  uint32_t v;
+} T_event;
+
+typedef struct
+{
+  unsigned long n;
+  uint64_t      sum;
+  uint64_t      min;
+  uint64_t      max;
+} T_dur;
+
+// Состояние разбора пакетов
+static unsigned      zeros;          // Подряд идущие нулевые байты, начало пакета синхронизации
+static int           synced;
+static unsigned      hdr;            // Заголовок текущего пакета
+static unsigned      need;           // Ожидаемые байты данных пакета программного источника
+static unsigned      got;
+static uint32_t      val;
+static int           cont;           // 1 - пакет продолжается пока в байтах установлен бит 7
+static unsigned      cont_n;
+static unsigned      cont_max;
+static int           cont_ts;        // Продолжение - локальная метка времени
+
+static uint64_t      ts;             // Текущее время в тиках меток
+static T_event       pend[PEND_MAX];
+static unsigned      pend_n;
+
+// Статистика
+static unsigned long n_sync, n_ovf, n_unknown, n_hw, n_ts, n_events, n_pend_ovf;
+static unsigned long port_events[PORTS];
+
+static int           isr_active[ISR_IDS];
+static uint64_t      isr_start[ISR_IDS];
+static T_dur         isr_dur[ISR_IDS];
+static unsigned long isr_unpaired;
+
+static int           task_cur = -1;
+static uint64_t      task_since;
+static uint64_t      task_time[TASK_IDS];
+static unsigned long task_switch[TASK_IDS];
+
+static int           ctrl_have;
+static uint64_t      ctrl_last;
+static T_dur         ctrl_per;
+static unsigned      ctrl_v;
+
+static int           cnt_have[CNT_IDS];
+static uint32_t      cnt_val[CNT_IDS];
+
+static FILE         *tl;             // Временная диаграмма
+static double        us_per_tick;
+static volatile sig_atomic_t stop_req;
+
+/*-------------------------------------------------------------------------------------------------------------
+  Накопление длительности
+-------------------------------------------------------------------------------------------------------------*/
+static void Dur_add(T_dur *d, uint64_t v)
+{
+  if ( (d->n == 0) || (v < d->min) ) d->min = v;
+  if ( (d->n == 0) || (v > d->max) ) d->max = v;
+  d->sum += v;
+  d->n++;
+}
+
+static const char* Task_name(unsigned id, char *buf)
+{
+  if ( id == TRACE_TASK_IDLE  ) return "idle";
+  if ( id == TRACE_TASK_MQX   ) return "mqx";
+  if ( id == TRACE_TASK_OTHER ) return "other";
+  if ( id < 8 ) return task_names[id];
+  sprintf(buf, "task%u", id);
+  return buf;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Обработка события с назначенным временем
+-------------------------------------------------------------------------------------------------------------*/
+static void Event_process(const T_event *e, uint64_t t)
+{
+  char     buf[16];
+  unsigned id;
+
+  n_events++;
+  port_events[e->port]++;
+
+  switch (e->port)
+  {
+  case TRACE_CH_ISR:
+    id = e->v & ~TRACE_ISR_EXIT;
+    if ( tl != NULL ) fprintf(tl, "%.3f,ISR,%s,%s\n", t * us_per_tick, id < ISR_IDS ? isr_names[id] : "?", (e->v & TRACE_ISR_EXIT) ? "leave" : "enter");
+    if ( id >= ISR_IDS ) break;
+    if ( !(e->v & TRACE_ISR_EXIT) )
+    {
+      if ( isr_active[id] ) isr_unpaired++;
+      isr_active[id] = 1;
+      isr_start[id]  = t;
+    }
+    else if ( isr_active[id] )
+    {
+      Dur_add(&isr_dur[id], t - isr_start[id]);
+      isr_active[id] = 0;
+    }
+    else
+    {
+      isr_unpaired++;
+    }
+    break;
+
+  case TRACE_CH_TASK:
+    id = e->v & 0xFF;
+    if ( tl != NULL ) fprintf(tl, "%.3f,TASK,%s,\n", t * us_per_tick, Task_name(id, buf));
+    if ( task_cur >= 0 ) task_time[task_cur] += t - task_since;
+    task_cur   = id;
+    task_since = t;
+    task_switch[id]++;
+    break;
+
+  case TRACE_CH_CTRL:
+    if ( tl != NULL ) fprintf(tl, "%.3f,CTRL,pwm_a,%u\n", t * us_per_tick, e->v & 0xFFFF);
+    if ( ctrl_have ) Dur_add(&ctrl_per, t - ctrl_last);
+    ctrl_have = 1;
+    ctrl_last = t;
+    ctrl_v    = e->v & 0xFFFF;
+    break;
+
+  case TRACE_CH_COUNTER:
+    id = e->v >> 24;
+    if ( tl != NULL ) fprintf(tl, "%.3f,CNT,%s,%u\n", t * us_per_tick, id < CNT_IDS ? cnt_names[id] : "?", e->v & 0xFFFFFF);
+    if ( id >= CNT_IDS ) break;
+    cnt_have[id] = 1;
+    cnt_val[id]  = e->v & 0xFFFFFF;
+    break;
+
+  default:
+    if ( tl != NULL ) fprintf(tl, "%.3f,PORT%u,,%u\n", t * us_per_tick, e->port, e->v);
+    break;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Метка времени. Время ожидающих событий - время метки
+-------------------------------------------------------------------------------------------------------------*/
+static void Ts_apply(uint32_t delta)
+{
+  unsigned i;
+
+  n_ts++;
+  ts += delta;
+  for (i = 0; i < pend_n; i++) Event_process(&pend[i], ts);
+  pend_n = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Потеря данных. Незавершенные интервалы не учитываются
+-------------------------------------------------------------------------------------------------------------*/
+static void Trace_gap(void)
+{
+  memset(isr_active, 0, sizeof(isr_active));
+  ctrl_have = 0;
+}
+
+static void Event_put(unsigned port, unsigned size, uint32_t v)
+{
+  if ( pend_n >= PEND_MAX )
+  {
+    // Метки времени выключены или потеряны. События получают время последней метки
+    n_pend_ovf++;
+    Ts_apply(0);
+  }
+  pend[pend_n].port = port;
+  pend[pend_n].size = size;
+  pend[pend_n].v    = v;
+  pend_n++;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Разбор очередного байта потока ITM
+-------------------------------------------------------------------------------------------------------------*/
+static void Itm_byte(uint8_t b)
+{
+  // Пакет синхронизации: не менее 47 нулевых бит и бит 1, в байтах - 5 нулей и 0x80
+  if ( (need == 0) && !cont )
+  {
+    if ( b == 0 )
+    {
+      zeros++;
+      return;
+    }
+    if ( zeros > 0 )
+    {
+      if ( (b == 0x80) && (zeros >= 5) )
+      {
+        n_sync++;
+        if ( !synced ) Trace_gap();
+        synced = 1;
+        zeros  = 0;
+        return;
+      }
+      zeros = 0;
+      if ( synced ) n_unknown++;
+    }
+  }
+  if ( !synced ) return;
+
+  if ( need > 0 )
+  {
+    // Данные пакета источника, младший байт первым
+    val |= (uint32_t)b << (8 * got);
+    if ( ++got < need ) return;
+    need = 0;
+    if ( hdr & 0x04 ) n_hw++;
+    else Event_put(hdr >> 3, got, val);
+    return;
+  }
+
+  if ( cont )
+  {
+    if ( cont_ts ) val |= (uint32_t)(b & 0x7F) << (7 * cont_n);
+    cont_n++;
+    if ( (b & 0x80) && (cont_n < cont_max) ) return;
+    cont = 0;
+    if ( b & 0x80 )
+    {
+      // Слишком длинный пакет. Поток рассинхронизирован до следующего пакета синхронизации
+      n_unknown++;
+      synced = 0;
+      Trace_gap();
+      return;
+    }
+    if ( cont_ts ) Ts_apply(val);
+    return;
+  }
+
+  hdr = b;
+  val = 0;
+  got = 0;
+  if ( b == 0x70 )
+  {
+    // Переполнение FIFO ITM
+    n_ovf++;
+    Trace_gap();
+  }
+  else if ( (b & 0x03) != 0 )
+  {
+    // Пакет источника: размер 1, 2 или 4 байта, бит 2 - аппаратный источник, номер порта в битах 7..3
+    need = (b & 0x03) == 3 ? 4 : (b & 0x03);
+  }
+  else if ( ((b & 0x8F) == 0) && (b != 0) )
+  {
+    // Короткая локальная метка времени 1..6
+    Ts_apply((b >> 4) & 0x07);
+  }
+  else if ( (b & 0xCF) == 0xC0 )
+  {
+    // Длинная локальная метка времени, до 4 байт продолжения
+    cont = 1; cont_n = 0; cont_max = 4; cont_ts = 1;
+  }
+  else if ( ((b == 0x94) || (b == 0xB4)) || ((b & 0x0B) == 0x08) )
+  {
+    // Глобальная метка времени или пакет расширения. Пропускается
+    if ( b & 0x80 )
+    {
+      cont = 1; cont_n = 0; cont_max = 6; cont_ts = 0;
+    }
+  }
+  else
+  {
+    n_unknown++;
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Вывод статистики
+-------------------------------------------------------------------------------------------------------------*/
+static void Print_stat(void)
+{
+  uint64_t total = 0;
+  char     buf[16];
+  unsigned i;
+
+  if ( task_cur >= 0 )
+  {
+    task_time[task_cur] += ts - task_since;
+    task_since = ts;
+  }
+
+  printf("Duration %.3f s, events %lu, timestamps %lu, syncs %lu, overflows %lu, unknown %lu, hw packets %lu, no timestamp %lu\n",
+         ts * us_per_tick / 1e6, n_events, n_ts, n_sync, n_ovf, n_unknown, n_hw, n_pend_ovf);
+  for (i = 0; i < PORTS; i++)
+  {
+    if ( port_events[i] ) printf("  port %2u: %lu\n", i, port_events[i]);
+  }
+
+  printf("\nISR          count      min_us     avg_us     max_us\n");
+  for (i = 1; i < ISR_IDS; i++)
+  {
+    if ( isr_dur[i].n == 0 ) continue;
+    printf("%-10s %8lu %10.2f %10.2f %10.2f\n", isr_names[i], isr_dur[i].n, isr_dur[i].min * us_per_tick,
+           (double)isr_dur[i].sum / isr_dur[i].n * us_per_tick, isr_dur[i].max * us_per_tick);
+  }
+  if ( isr_unpaired ) printf("Unpaired enter/leave: %lu\n", isr_unpaired);
+
+  for (i = 0; i < TASK_IDS; i++) total += task_time[i];
+  if ( total > 0 )
+  {
+    printf("\nTask         time_%%   switches\n");
+    for (i = 0; i < TASK_IDS; i++)
+    {
+      if ( task_switch[i] == 0 ) continue;
+      printf("%-10s %8.1f %10lu\n", Task_name(i, buf), 100.0 * task_time[i] / total, task_switch[i]);
+    }
+  }
+
+  if ( ctrl_per.n > 0 )
+  {
+    printf("\nPWM calculation period: n = %lu, min = %.2f us, avg = %.2f us, max = %.2f us (nominal %.2f us), last pwm_a = %u\n",
+           ctrl_per.n, ctrl_per.min * us_per_tick, (double)ctrl_per.sum / ctrl_per.n * us_per_tick,
+           ctrl_per.max * us_per_tick, 1e6 / PWM_FREQ, ctrl_v);
+  }
+
+  for (i = 1; i < CNT_IDS; i++)
+  {
+    if ( cnt_have[i] ) printf("%s = %u\n", cnt_names[i], cnt_val[i]);
+  }
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Открытие последовательного порта в двоичном режиме
+-------------------------------------------------------------------------------------------------------------*/
+static int Open_port(const char *dev, unsigned baud)
+{
+  struct termios tio;
+  speed_t        spd;
+  int            fd;
+
+  switch (baud)
+  {
+  case 921600:  spd = B921600;  break;
+  case 2000000: spd = B2000000; break;
+  case 3000000: spd = B3000000; break;
+  case 4000000: spd = B4000000; break;
+  default:
+    fprintf(stderr, "Unsupported baud rate %u\n", baud);
+    return -1;
+  }
+
+  fd = open(dev, O_RDONLY | O_NOCTTY);
+  if ( fd < 0 ) { perror(dev); return -1; }
+  if ( tcgetattr(fd, &tio) < 0 ) { perror("tcgetattr"); close(fd); return -1; }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, spd);
+  cfsetospeed(&tio, spd);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN]  = 0;
+  tio.c_cc[VTIME] = 0;
+  if ( tcsetattr(fd, TCSANOW, &tio) < 0 ) { perror("tcsetattr"); close(fd); return -1; }
+  tcflush(fd, TCIFLUSH);
+  return fd;
+}
+
+static void On_sigint(int sig)
+{
+  (void)sig;
+  stop_req = 1;
+}
+
+int main(int argc, char **argv)
+{
+  const char    *fname = NULL;
+  const char    *dev   = NULL;
+  const char    *rname = NULL;
+  const char    *tname = NULL;
+  unsigned       baud  = 4000000;
+  double         core  = CORE_CLOCK;
+  FILE          *raw   = NULL;
+  uint8_t        rx[RX_BUF_SZ];
+  struct pollfd  pfd;
+  int            fd = 0;
+  int            opt, len, k;
+
+  while ( (opt = getopt(argc, argv, "f:d:b:r:t:c:a")) != -1 )
+  {
+    switch (opt)
+    {
+    case 'f': fname = optarg; break;
+    case 'd': dev   = optarg; break;
+    case 'b': baud  = strtoul(optarg, NULL, 0); break;
+    case 'r': rname = optarg; break;
+    case 't': tname = optarg; break;
+    case 'c': core  = strtod(optarg, NULL); break;
+    case 'a': synced = 1; break;   // Не ждать пакета синхронизации - запись начата с начала потока
+    default:
+      fprintf(stderr, "Usage: %s [-f in.bin] [-d /dev/ttyUSB0] [-b baud] [-r raw.bin] [-t timeline.csv] [-c core_hz] [-a]\n", argv[0]);
+      return 1;
+    }
+  }
+  us_per_tick = TRACE_TS_DIV * 1e6 / core;
+
+  if ( dev != NULL )
+  {
+    fd = Open_port(dev, baud);
+    if ( fd < 0 ) return 1;
+  }
+  else if ( fname != NULL )
+  {
+    fd = open(fname, O_RDONLY);
+    if ( fd < 0 ) { perror(fname); return 1; }
+  }
+  if ( rname != NULL )
+  {
+    raw = fopen(rname, "wb");
+    if ( raw == NULL ) { perror(rname); return 1; }
+  }
+  if ( tname != NULL )
+  {
+    tl = fopen(tname, "w");
+    if ( tl == NULL ) { perror(tname); return 1; }
+    fprintf(tl, "time_us,channel,name,value\n");
+  }
+  signal(SIGINT,  On_sigint);
+  signal(SIGTERM, On_sigint);
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while ( !stop_req )
+  {
+    if ( (dev != NULL) && (poll(&pfd, 1, 200) <= 0) ) continue;
+    len = read(fd, rx, sizeof(rx));
+    if ( len < 0 )
+    {
+      if ( errno == EINTR ) continue;
+      perror("read");
+      break;
+    }
+    if ( (len == 0) && (dev == NULL) ) break;
+    if ( raw != NULL ) fwrite(rx, 1, len, raw);
+    for (k = 0; k < len; k++) Itm_byte(rx[k]);
+  }
+  if ( pend_n > 0 ) Ts_apply(0);
+
+  if ( fd != 0 ) close(fd);
+  if ( raw != NULL ) fclose(raw);
+  if ( tl != NULL ) fclose(tl);
+  Print_stat();
+  return 0;
+}
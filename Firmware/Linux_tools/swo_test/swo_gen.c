@@ -0,0 +1,162 @@
+/*-------------------------------------------------------------------------------------------------------------
+  Генератор тестового потока ITM для проверки декодера swo_decode
+
+  Формирует поток таким, каким его выдает модуль Trace_control прошивки за 64 периода PWM:
+  вход и выход прерываний ETM0, ADC_DMA и CAN, смену задач, значения PWM и счетчики, с короткими и длинными
+  локальными метками времени. Добавлены мусор до первого пакета синхронизации, глобальная метка времени,
+  пакет расширения, пакет аппаратного источника и переполнение FIFO, которые декодер должен пропустить или учесть.
+  Поток детерминирован, результат разбора сравнивается с эталоном (см. Makefile).
+
+  Сборка:  gcc -O2 -Wall -o swo_gen swo_gen.c
+  Запуск:  swo_gen > capture.bin
+-------------------------------------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+
+// Должно совпадать с Trace_control.h прошивки
+#define TRACE_CH_ISR        1
+#define TRACE_CH_TASK       2
+#define TRACE_CH_CTRL       3
+#define TRACE_CH_COUNTER    4
+
+#define TRACE_ISR_ETM0      1
+#define TRACE_ISR_ADC_DMA   2
+#define TRACE_ISR_CAN       3
+#define TRACE_ISR_EXIT      0x80
+#define TRACE_TASK_IDLE     0xFF
+
+#define MOTISR_IDX          1
+#define CAN_RX_IDX          7
+
+#define PERIODS             64
+
+static void Put(unsigned b)
+{
+  putchar(b & 0xFF);
+}
+
+static void Sync(void)
+{
+  int i;
+
+  for (i = 0; i < 5; i++) Put(0x00);
+  Put(0x80);
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Пакет программного источника: port - номер порта, size - 1, 2 или 4 байта, младший байт первым
+-------------------------------------------------------------------------------------------------------------*/
+static void Sw(unsigned port, unsigned size, uint32_t v)
+{
+  unsigned i;
+
+  Put((port << 3) | (size == 4 ? 3 : size));
+  for (i = 0; i < size; i++) Put(v >> (8 * i));
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Локальная метка времени: короткая для 1..6, иначе длинная с байтами продолжения
+-------------------------------------------------------------------------------------------------------------*/
+static void Ts(uint32_t d)
+{
+  if ( (d >= 1) && (d <= 6) )
+  {
+    Put(d << 4);
+    return;
+  }
+  Put(0xC0);
+  while ( d >= 0x80 )
+  {
+    Put((d & 0x7F) | 0x80);
+    d >>= 7;
+  }
+  Put(d);
+}
+
+// Как и ITM, метка времени выдается после пакетов к которым относится и содержит приращение от предыдущей метки.
+// События одного тика идут подряд перед одной меткой
+static uint32_t ts_last;
+static uint32_t ev_t;
+static int      ev_pend;
+
+static void Ts_flush(void)
+{
+  if ( !ev_pend ) return;
+  Ts(ev_t - ts_last);
+  ts_last = ev_t;
+  ev_pend = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------
+  Событие в момент t (тики меток времени от начала потока)
+-------------------------------------------------------------------------------------------------------------*/
+static void Ev(uint32_t t, unsigned port, unsigned size, uint32_t v)
+{
+  if ( ev_pend && (t != ev_t) ) Ts_flush();
+  Sw(port, size, v);
+  ev_t    = t;
+  ev_pend = 1;
+}
+
+int main(void)
+{
+  unsigned n;
+  unsigned dur;
+  uint32_t t;
+
+  // Хвост предыдущих пакетов до синхронизации должен быть пропущен
+  Put(0x55);
+  Put(0x13);
+  Put(0x00);
+  Put(0x00);
+  Sync();
+
+  for (n = 0; n < PERIODS; n++)
+  {
+    // Период PWM 62.5 мкс - 117.19 тиков по 64 такта ядра
+    t   = 10 + n * 117 + n * 3 / 16;
+
+    // Прерывание PWM длительностью 4..7 тиков пробуждает задачу расчета PWM
+    dur = 4 + (n & 3);
+    Ev(t,            TRACE_CH_ISR,  1, TRACE_ISR_ETM0);
+    Ev(t + dur,      TRACE_CH_ISR,  1, TRACE_ISR_ETM0 | TRACE_ISR_EXIT);
+    Ev(t + dur,      TRACE_CH_TASK, 1, MOTISR_IDX);
+    Ev(t + dur + 20, TRACE_CH_CTRL, 2, 1500 + 10 * n);
+    Ev(t + dur + 35, TRACE_CH_TASK, 1, TRACE_TASK_IDLE);
+
+    if ( (n & 15) == 15 )
+    {
+      // Прерывание DMA ADC раз в 16 периодов
+      Ev(t + 70, TRACE_CH_ISR, 1, TRACE_ISR_ADC_DMA);
+      Ev(t + 95, TRACE_CH_ISR, 1, TRACE_ISR_ADC_DMA | TRACE_ISR_EXIT);
+    }
+    if ( n == 20 )
+    {
+      // Прием кадра CAN и задача приема
+      Ev(t + 60, TRACE_CH_ISR,  1, TRACE_ISR_CAN);
+      Ev(t + 66, TRACE_CH_ISR,  1, TRACE_ISR_CAN | TRACE_ISR_EXIT);
+      Ev(t + 66, TRACE_CH_TASK, 1, CAN_RX_IDX);
+      Ev(t + 76, TRACE_CH_TASK, 1, TRACE_TASK_IDLE);
+    }
+    if ( n == 31 )
+    {
+      // Счетчики интервала окна загрузки, затем глобальная метка времени и пакет расширения
+      Ev(t + 100, TRACE_CH_COUNTER, 4, (2u << 24) | 57);
+      Ev(t + 100, TRACE_CH_COUNTER, 4, (3u << 24) | 912);
+      Ev(t + 100, TRACE_CH_COUNTER, 4, (1u << 24) | 0);
+      Ts_flush();
+      Put(0x94); Put(0x81); Put(0x02);
+      Put(0x08);
+    }
+    if ( n == 40 )
+    {
+      // Пакет аппаратного источника (счетчик событий DWT) и переполнение FIFO ITM
+      Ts_flush();
+      Put(0x05); Put(0x01);
+      Put(0x70);
+    }
+  }
+  Ts_flush();
+  Sync();
+  return 0;
+}